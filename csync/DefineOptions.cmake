@@ -3,3 +3,4 @@ if ( NOT WIN32 )
 endif()
 option(UNIT_TESTING "Build with unit tests" OFF)
 option(MEM_NULL_TESTS "Enable NULL memory testing" OFF)
+option(STRIP_TRACE_LOG "Do not compile the trace log statements of csync" OFF)
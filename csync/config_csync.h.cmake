@@ -12,6 +12,7 @@
 
 #cmakedefine WITH_LOG4C 1
 #cmakedefine WITH_ICONV 1
+#cmakedefine STRIP_TRACE_LOG 1
 
 #cmakedefine HAVE_ARGP_H 1
 #cmakedefine HAVE_ICONV_H 1
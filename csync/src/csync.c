@@ -234,10 +234,11 @@ int csync_update(CSYNC *ctx) {
   }
 
   csync_gettime(&finish);
+  ctx->local.update_time = c_secdiff(finish, start);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for local replica took %.2f seconds walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+            ctx->local.update_time, c_rbtree_size(ctx->local.tree));
   csync_memstat_check();
 
   /* update detection for remote replica */
@@ -253,11 +254,12 @@ int csync_update(CSYNC *ctx) {
   }
 
   csync_gettime(&finish);
+  ctx->remote.update_time = c_secdiff(finish, start);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for remote replica took %.2f seconds "
             "walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+            ctx->remote.update_time, c_rbtree_size(ctx->remote.tree));
   csync_memstat_check();
 
   ctx->status |= CSYNC_STATUS_UPDATE;
@@ -284,10 +286,11 @@ int csync_reconcile(CSYNC *ctx) {
   rc = csync_reconcile_updates(ctx);
 
   csync_gettime(&finish);
+  ctx->local.reconcile_time = c_secdiff(finish, start);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Reconciliation for local replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+      ctx->local.reconcile_time, c_rbtree_size(ctx->local.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -305,10 +308,11 @@ int csync_reconcile(CSYNC *ctx) {
   rc = csync_reconcile_updates(ctx);
 
   csync_gettime(&finish);
+  ctx->remote.reconcile_time = c_secdiff(finish, start);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Reconciliation for remote replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+      ctx->remote.reconcile_time, c_rbtree_size(ctx->remote.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -570,6 +574,7 @@ int csync_commit(CSYNC *ctx) {
 
   _csync_clean_ctx(ctx);
 
+  ctx->local.read_from_db = 0;
   ctx->remote.read_from_db = 0;
   ctx->read_from_db_disabled = 0;
 
@@ -190,6 +190,19 @@ typedef void (*csync_update_callback) (bool local,
                                     const char *dirUrl,
                                     void *userdata);
 
+/*
+ * Hooks to list the remote directories with something else than the owncloud module.
+ * opendir returns NULL and sets errno on error. readdir returns NULL at the end of the
+ * directory, or an entry without a name (and sets errno) if the listing failed.
+ */
+struct csync_vio_file_stat_s;
+typedef void *(*csync_vio_opendir_hook) (const char *url,
+                                         void *userdata);
+typedef struct csync_vio_file_stat_s *(*csync_vio_readdir_hook) (void *dhandle,
+                                                                  void *userdata);
+typedef void (*csync_vio_closedir_hook) (void *dhandle,
+                                         void *userdata);
+
 /**
  * @brief Allocate a csync context.
  *
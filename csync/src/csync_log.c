@@ -79,19 +79,36 @@ static void csync_log_stderr(int verbosity,
 
     fprintf(stderr, "  %s\n", buffer);
 }
-static void csync_log_function(int verbosity,
-                               const char *function,
-                               const char *buffer)
+void csync_log(int verbosity,
+               const char *function,
+               const char *format, ...)
 {
-    csync_log_callback log_fn = csync_get_log_callback();
+    char buffer[1024];
+    csync_log_callback log_fn;
+    va_list va;
+    int len = 0;
+
+    if (verbosity > csync_get_log_level()) {
+        return;
+    }
+
+    log_fn = csync_get_log_callback();
     if (log_fn) {
-        char buf[1024];
+        /* the callback gets "function: message", formatted in one go */
+        len = snprintf(buffer, sizeof(buffer), "%s: ", function);
+        if (len < 0 || len >= (int) sizeof(buffer)) {
+            len = 0;
+        }
+    }
 
-        snprintf(buf, sizeof(buf), "%s: %s", function, buffer);
+    va_start(va, format);
+    vsnprintf(buffer + len, sizeof(buffer) - len, format, va);
+    va_end(va);
 
+    if (log_fn) {
         log_fn(verbosity,
                function,
-               buf,
+               buffer,
                csync_get_log_userdata());
         return;
     }
@@ -99,22 +116,6 @@ static void csync_log_function(int verbosity,
     csync_log_stderr(verbosity, function, buffer);
 }
 
-
-void csync_log(int verbosity,
-               const char *function,
-               const char *format, ...)
-{
-    char buffer[1024];
-    va_list va;
-
-    if (verbosity <= csync_get_log_level()) {
-        va_start(va, format);
-        vsnprintf(buffer, sizeof(buffer), format, va);
-        va_end(va);
-        csync_log_function(verbosity, function, buffer);
-    }
-}
-
 int csync_set_log_level(int level) {
   if (level < 0) {
     return -1;
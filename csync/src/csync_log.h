@@ -60,8 +60,45 @@ enum csync_log_priority_e {
     CSYNC_LOG_PRIORITY_UNKNOWN,
 };
 
+#include "c_private.h"
+
+/*
+ * The statements above this priority are not compiled in. Configure with
+ * -DSTRIP_TRACE_LOG=ON to strip the trace logs of the release builds.
+ */
+#ifndef CSYNC_LOG_MAX_PRIORITY
+#ifdef STRIP_TRACE_LOG
+#define CSYNC_LOG_MAX_PRIORITY CSYNC_LOG_PRIORITY_DEBUG
+#else
+#define CSYNC_LOG_MAX_PRIORITY CSYNC_LOG_PRIORITY_NOTSET
+#endif
+#endif
+
+/* Set by csync_set_log_level(), read by the macros below */
+extern CSYNC_THREAD int csync_log_level;
+
+#ifdef __GNUC__
+#define CSYNC_LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define CSYNC_LOG_UNLIKELY(x) (x)
+#endif
+
+/*
+ * Whether a statement of this priority is logged. The level is checked before
+ * the arguments are evaluated, a disabled statement only costs this branch.
+ */
+#define CSYNC_LOG_ENABLED(priority) \
+  ((priority) <= CSYNC_LOG_MAX_PRIORITY && CSYNC_LOG_UNLIKELY((priority) <= csync_log_level))
+
+#define CSYNC_LOG_FUNCTION(priority, function, ...) \
+  do { \
+    if (CSYNC_LOG_ENABLED(priority)) { \
+      csync_log(priority, function, __VA_ARGS__); \
+    } \
+  } while (0)
+
 #define CSYNC_LOG(priority, ...) \
-  csync_log(priority, __FUNCTION__, __VA_ARGS__)
+  CSYNC_LOG_FUNCTION(priority, __FUNCTION__, __VA_ARGS__)
 
 void csync_log(int verbosity,
                const char *function,
@@ -35,6 +35,10 @@
 #define FNM_PATHNAME    (1 << 0) /* No wildcard can ever match `/'.  */
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 int csync_fnmatch(__const char *__pattern, __const char *__name, int __flags);
 
 /**
@@ -49,4 +53,8 @@ CSYNC_STATUS csync_errno_to_status(int error, CSYNC_STATUS default_status);
 
 char *csync_normalize_etag(const char *);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _CSYNC_MISC_H */
@@ -530,8 +530,7 @@ static struct listdir_context *fetch_resource_list(csync_owncloud_ctx_t *ctx, co
 
     curi = _cleanPath( uri );
 
-    /* The old legacy one-level PROPFIND cache. Also gets filled
-       by the recursive cache if 'infinity' did not suceed. */
+    /* The old legacy one-level PROPFIND cache. */
     if (ctx->propfind_cache) {
         if (c_streq(curi, ctx->propfind_cache->target)) {
             DEBUG_WEBDAV("fetch_resource_list Using simple PROPFIND cache %s", curi);
@@ -667,7 +666,7 @@ csync_vio_handle_t *owncloud_opendir(CSYNC *ctx, const char *uri) {
     }
     if (ctx->owncloud_context->propfind_recursive_cache) {
         // Try to fetch from recursive cache (if we have one)
-        fetchCtx = get_listdir_context_from_recursive_cache(ctx->owncloud_context, curi);
+        fetchCtx = take_listdir_context_from_recursive_cache(ctx->owncloud_context, curi);
     }
     SAFE_FREE(curi);
     ctx->owncloud_context->is_first_propfind = false;
@@ -710,6 +709,14 @@ csync_vio_file_stat_t *owncloud_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle)
         return NULL;
     }
 
+    if (fetchCtx->entries) {
+        /* From the recursive PROPFIND, already converted: the caller takes it */
+        if (fetchCtx->entries_read < fetchCtx->entries_count) {
+            return fetchCtx->entries[fetchCtx->entries_read++];
+        }
+        return NULL;
+    }
+
     while( fetchCtx->currResource ) {
         resource* currResource = fetchCtx->currResource;
         char *escaped_path = NULL;
@@ -806,7 +813,11 @@ int owncloud_set_property(CSYNC* ctx, const char *key, void *data) {
         return 0;
     }
     if( c_streq(key, "get_dav_session")) {
-        /* Give the ne_session to the caller */
+        /* Give the ne_session to the caller. Connect first in case owncloud_opendir
+         * was not used for the discovery */
+        if (dav_connect(ctx->owncloud_context, ctx->remote.uri) < 0) {
+            DEBUG_WEBDAV("connection failed");
+        }
         *(ne_session**)data = ctx->owncloud_context->dav_session.ctx;
         return 0;
     }
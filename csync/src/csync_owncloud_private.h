@@ -65,7 +65,7 @@
 #include "csync_owncloud.h"
 
 
-#define DEBUG_WEBDAV(...) csync_log( 9, "oc_module", __VA_ARGS__);
+#define DEBUG_WEBDAV(...) CSYNC_LOG_FUNCTION(CSYNC_LOG_PRIORITY_TRACE, "oc_module", __VA_ARGS__)
 
 typedef int (*csync_owncloud_redirect_callback_t)(CSYNC* ctx, const char* uri);
 
@@ -99,6 +99,7 @@ struct csync_owncloud_ctx_s {
     bool is_first_propfind;
     struct listdir_context *propfind_cache;
     c_rbtree_t *propfind_recursive_cache;
+    int propfind_recursive_root_level; /* number of '/' in the path of the listed folder */
     int propfind_recursive_cache_depth;
     int propfind_recursive_cache_file_count;
     int propfind_recursive_cache_folder_count;
@@ -162,19 +163,27 @@ struct listdir_context {
     char            *target;        /* Request-URI of the PROPFIND */
     unsigned int     result_count;   /* number of elements stored in list */
     int ref; /* reference count, only destroy when it reaches 0 */
+
+    /* Instead of the list: the entries taken from the recursive PROPFIND cache,
+       already converted. readdir hands them over to the caller. */
+    csync_vio_file_stat_t **entries;
+    unsigned int entries_count;
+    unsigned int entries_read;
 };
 
 
-/* Values are propfind_recursive_element: */
+/* Values are propfind_recursive_element: the entries of one folder, converted
+ * as soon as the recursive PROPFIND reply gives them */
 struct propfind_recursive_element {
-    struct resource *self;
-    struct resource *children;
-    struct propfind_recursive_element *parent;
+    char *uri; /* escaped path of the folder */
+    csync_vio_file_stat_t **entries;
+    unsigned int count;
+    unsigned int allocated;
 };
 typedef struct propfind_recursive_element propfind_recursive_element_t;
 
 void clear_propfind_recursive_cache(csync_owncloud_ctx_t *ctx);
-struct listdir_context *get_listdir_context_from_recursive_cache(csync_owncloud_ctx_t *ctx, const char *curi);
+struct listdir_context *take_listdir_context_from_recursive_cache(csync_owncloud_ctx_t *ctx, const char *curi);
 void fill_recursive_propfind_cache(csync_owncloud_ctx_t *ctx, const char *uri, const char *curi);
 struct listdir_context *get_listdir_context_from_cache(csync_owncloud_ctx_t *ctx, const char *curi);
 void fetch_resource_list_recursive(csync_owncloud_ctx_t *ctx, const char *uri, const char *curi);
@@ -24,8 +24,12 @@
 
 static void _tree_destructor(void *data) {
     propfind_recursive_element_t *element = data;
-    resource_free(element->self);
-    resource_free(element->children);
+    unsigned int i;
+    for (i = 0; i < element->count; i++) {
+        csync_vio_file_stat_destroy(element->entries[i]);
+    }
+    SAFE_FREE(element->entries);
+    SAFE_FREE(element->uri);
     SAFE_FREE(element);
 }
 
@@ -38,156 +42,152 @@ void clear_propfind_recursive_cache(csync_owncloud_ctx_t *ctx)
     }
 }
 
-struct listdir_context *get_listdir_context_from_recursive_cache(csync_owncloud_ctx_t *ctx, const char *curi)
+/* The entries are moved to the returned context: each folder can only be taken once */
+struct listdir_context *take_listdir_context_from_recursive_cache(csync_owncloud_ctx_t *ctx, const char *curi)
 {
+    c_rbnode_t *node = NULL;
     propfind_recursive_element_t *element = NULL;
     struct listdir_context *fetchCtx = NULL;
-    struct resource *iterator, *r;
 
     if (!ctx->propfind_recursive_cache) {
-        DEBUG_WEBDAV("get_listdir_context_from_recursive_cache No cache");
+        DEBUG_WEBDAV("take_listdir_context_from_recursive_cache No cache");
         return NULL;
     }
 
-    element = c_rbtree_node_data(c_rbtree_find(ctx->propfind_recursive_cache, curi));
+    node = c_rbtree_find(ctx->propfind_recursive_cache, curi);
+    element = c_rbtree_node_data(node);
     if (!element) {
-        DEBUG_WEBDAV("get_listdir_context_from_recursive_cache No element %s in cache found", curi);
+        DEBUG_WEBDAV("take_listdir_context_from_recursive_cache No element %s in cache found", curi);
         return NULL;
     }
+    c_rbtree_node_delete(node);
+
     if( ctx->csync_ctx->callbacks.update_callback ) {
         ctx->csync_ctx->callbacks.update_callback(false, curi, ctx->csync_ctx->callbacks.update_callback_userdata);
     }
 
-    /* Out of the element, create a listdir_context.. if we could be sure that it is immutable, we could ref instead.. need to investigate */
     fetchCtx = c_malloc( sizeof( struct listdir_context ));
     ZERO_STRUCTP(fetchCtx);
-    fetchCtx->list = NULL;
     fetchCtx->target = c_strdup(curi);
-    fetchCtx->currResource = NULL;
     fetchCtx->ref = 1;
+    fetchCtx->entries = element->entries;
+    fetchCtx->entries_count = element->count;
+    fetchCtx->result_count = element->count;
 
-    iterator = element->children;
-    r = NULL;
-    while (iterator) {
-        r = resource_dup(iterator);
-        r->next = fetchCtx->list;
-        fetchCtx->list = r;
-        iterator = iterator->next;
-        fetchCtx->result_count++;
-        /* DEBUG_WEBDAV("get_listdir_context_from_cache Returning cache for %s element %s", fetchCtx->target, fetchCtx->list->uri); */
-    }
-
-    r = resource_dup(element->self);
-    r->next = fetchCtx->list;
-    fetchCtx->result_count++;
-    fetchCtx->list = r;
-    fetchCtx->currResource = fetchCtx->list;
-    DEBUG_WEBDAV("get_listdir_context_from_cache Returning cache for %s (%d elements)", fetchCtx->target, fetchCtx->result_count);
+    SAFE_FREE(element->uri);
+    SAFE_FREE(element);
+    DEBUG_WEBDAV("take_listdir_context_from_recursive_cache Returning cache for %s (%d elements)", fetchCtx->target, fetchCtx->result_count);
     return fetchCtx;
 }
 
 static int _key_cmp(const void *key, const void *b) {
     const char *elementAUri = (char*)key;
     const propfind_recursive_element_t *elementB = b;
-    return ne_path_compare(elementAUri, elementB->self->uri);
+    return ne_path_compare(elementAUri, elementB->uri);
 }
 static int _data_cmp(const void *a, const void *b) {
     const propfind_recursive_element_t *elementA = a;
     const propfind_recursive_element_t *elementB = b;
-    return ne_path_compare(elementA->self->uri, elementB->self->uri);
+    return ne_path_compare(elementA->uri, elementB->uri);
 }
+
+/* Number of '/' in the path, not counting a trailing one */
+static int _path_level(const char *path) {
+    int level = 0;
+    const char *p;
+    for (p = path; *p; p++) {
+        if (*p == '/' && p[1] != '\0') {
+            level++;
+        }
+    }
+    return level;
+}
+
+static propfind_recursive_element_t *_find_or_add_element(csync_owncloud_ctx_t *ctx, const char *uri)
+{
+    propfind_recursive_element_t *element =
+            c_rbtree_node_data(c_rbtree_find(ctx->propfind_recursive_cache, uri));
+    if (!element) {
+        element = c_malloc(sizeof(propfind_recursive_element_t));
+        ZERO_STRUCTP(element);
+        element->uri = c_strdup(uri);
+        c_rbtree_insert(ctx->propfind_recursive_cache, element);
+    }
+    return element;
+}
+
+/* Called by neon for each response while the reply is parsed. The entry is converted for
+ * readdir right away, so the listing is only kept once in memory. */
 static void propfind_results_recursive_callback(void *userdata,
                     const ne_uri *uri,
                     const ne_prop_result_set *set)
 {
-    struct resource *newres = 0;
-
-    const ne_status *status = NULL;
-    char *path = ne_path_unescape( uri->path );
-    char *parentPath;
-    propfind_recursive_element_t *element = NULL;
-    propfind_recursive_element_t *pElement = NULL;
+    struct resource res;
+    csync_vio_file_stat_t *lfs = NULL;
+    char *parentPath = NULL;
+    propfind_recursive_element_t *parentElement = NULL;
     int depth = 0;
     csync_owncloud_ctx_t *ctx = (csync_owncloud_ctx_t*) userdata;
 
-
-    (void) status;
-
     if (!ctx->propfind_recursive_cache) {
         c_rbtree_create(&ctx->propfind_recursive_cache, _key_cmp, _data_cmp);
     }
 
-    /* Fill the resource structure with the data about the file */
-    newres = c_malloc(sizeof(struct resource));
+    ZERO_STRUCT(res);
+    res.uri = ne_path_unescape( uri->path );
+    res.name = c_basename( res.uri );
+    fill_webdav_properties_into_resource(&res, set);
 
-    newres->uri =  path; /* no need to strdup because ne_path_unescape already allocates */
-    newres->name = c_basename( path );
-    fill_webdav_properties_into_resource(newres, set);
+    if (res.type == resr_collection) {
+        /* Also when it is empty: it is listed from the cache */
+        if (!c_rbtree_find(ctx->propfind_recursive_cache, uri->path)) {
+            DEBUG_WEBDAV("propfind_results_recursive %s is a folder", res.uri);
+            _find_or_add_element(ctx, uri->path);
 
-    if( newres->type == resr_collection) {
-        ctx->propfind_recursive_cache_folder_count++;
-    } else {
-        ctx->propfind_recursive_cache_file_count++;
-    }
-
-    /* Create new item in rb tree */
-    if (newres->type == resr_collection) {
-        DEBUG_WEBDAV("propfind_results_recursive %s is a folder", newres->uri);
-        /* Check if in rb tree */
-        element = c_rbtree_node_data(c_rbtree_find(ctx->propfind_recursive_cache,uri->path));
-        /* If not, create a new item and insert it */
-        if (!element) {
-            element = c_malloc(sizeof(propfind_recursive_element_t));
-            element->self = resource_dup(newres);
-            element->self->next = 0;
-            element->children = NULL;
-            element->parent = NULL;
-            c_rbtree_insert(ctx->propfind_recursive_cache, element);
-            /* DEBUG_WEBDAV("results_recursive Added collection %s", newres->uri); */
-
-            // We do this here and in get_listdir_context_from_recursive_cache because
+            // We do this here and in take_listdir_context_from_recursive_cache because
             // a recursive PROPFIND might take some time but we still want to
-            // be informed. Later when get_listdir_context_from_recursive_cache is
+            // be informed. Later when take_listdir_context_from_recursive_cache is
             // called the DB queries might be the problem causing slowness, so do it again there then.
             if( ctx->csync_ctx->callbacks.update_callback ) {
-		ctx->csync_ctx->callbacks.update_callback(false, path, ctx->csync_ctx->callbacks.update_callback_userdata);
-	    }
+                ctx->csync_ctx->callbacks.update_callback(false, res.uri, ctx->csync_ctx->callbacks.update_callback_userdata);
+            }
         }
     }
 
-    /* Check for parent in tree. If exists: Insert it into the children elements there */
-    parentPath = ne_path_parent(uri->path);
-    if (parentPath) {
-        propfind_recursive_element_t *parentElement = NULL;
-
-        parentElement = c_rbtree_node_data(c_rbtree_find(ctx->propfind_recursive_cache,parentPath));
-        free(parentPath);
-
-        if (parentElement) {
-            newres->next = parentElement->children;
-            parentElement->children = newres;
+    depth = _path_level(uri->path) - ctx->propfind_recursive_root_level;
+    if (depth > 0) {
+        if (res.type == resr_collection) {
+            ctx->propfind_recursive_cache_folder_count++;
+        } else {
+            ctx->propfind_recursive_cache_file_count++;
+        }
+        if (depth > ctx->propfind_recursive_cache_depth) {
+            DEBUG_WEBDAV("propfind_results_recursive %s new maximum tree depth %d", res.uri, depth);
+            ctx->propfind_recursive_cache_depth = depth;
+        }
 
-            /* If the current result is a collection we also need to set its parent */
-            if (element)
-                element->parent = parentElement;
+        /* Add it to its folder, even if the reply did not give the folder yet */
+        parentPath = ne_path_parent(uri->path);
+        if (parentPath) {
+            parentElement = _find_or_add_element(ctx, parentPath);
+            SAFE_FREE(parentPath);
 
-            pElement = element;
-            while (pElement) {
-                depth++;
-                pElement = pElement->parent;
-            }
-            if (depth > ctx->propfind_recursive_cache_depth) {
-                DEBUG_WEBDAV("propfind_results_recursive %s new maximum tree depth %d", newres->uri, depth);
-                ctx->propfind_recursive_cache_depth = depth;
+            if (parentElement->count == parentElement->allocated) {
+                parentElement->allocated = parentElement->allocated ? 2 * parentElement->allocated : 8;
+                parentElement->entries = c_realloc(parentElement->entries,
+                        parentElement->allocated * sizeof(csync_vio_file_stat_t *));
             }
-
-            /* DEBUG_WEBDAV("results_recursive Added child %s to collection %s", newres->uri, element->self->uri); */
-            return;
+            lfs = csync_vio_file_stat_new();
+            resourceToFileStat(lfs, &res);
+            parentElement->entries[parentElement->count++] = lfs;
         }
     }
 
-    resource_free(newres);
-    newres = NULL;
+    SAFE_FREE(res.uri);
+    SAFE_FREE(res.name);
+    SAFE_FREE(res.md5);
+    SAFE_FREE(res.directDownloadUrl);
+    SAFE_FREE(res.directDownloadCookies);
 }
 
 void fetch_resource_list_recursive(csync_owncloud_ctx_t *ctx, const char *uri, const char *curi)
@@ -200,6 +200,10 @@ void fetch_resource_list_recursive(csync_owncloud_ctx_t *ctx, const char *uri, c
     int depth = NE_DEPTH_INFINITE;
 
     DEBUG_WEBDAV("fetch_resource_list_recursive Starting recursive propfind %s %s", uri, curi);
+    ctx->propfind_recursive_root_level = _path_level(curi);
+    ctx->propfind_recursive_cache_depth = 0;
+    ctx->propfind_recursive_cache_file_count = 0;
+    ctx->propfind_recursive_cache_folder_count = 0;
     if( ctx->csync_ctx->callbacks.update_callback ) {
 	ctx->csync_ctx->callbacks.update_callback(false, curi, ctx->csync_ctx->callbacks.update_callback_userdata);
     }
@@ -264,16 +268,28 @@ void fetch_resource_list_recursive(csync_owncloud_ctx_t *ctx, const char *uri, c
     return;
 }
 
-/* Called by owncloud_opendir()->fetch_resource_list() to fill the cache */
+/* Called by owncloud_opendir() to fill the cache */
 void fill_recursive_propfind_cache(csync_owncloud_ctx_t *ctx, const char *uri, const char *curi) {
     fetch_resource_list_recursive(ctx, uri, curi);
 
-    if (ctx->propfind_recursive_cache_depth <= 2) {
+    if (ctx->propfind_recursive_cache_depth < 2) {
+        /* The sub folders would look empty: only keep the listed one */
+        c_rbnode_t *node = NULL;
+        propfind_recursive_element_t *element = NULL;
+
         DEBUG_WEBDAV("fill_recursive_propfind_cache %s Server maybe did not give us an 'infinity' depth result", curi);
-        /* transform the cache to the normal cache in propfind_cache */
-        ctx->propfind_cache = get_listdir_context_from_recursive_cache(ctx, curi);
-        /* clear the cache, it is bogus since the server returned only results for Depth 1 */
+        if (ctx->propfind_recursive_cache) {
+            node = c_rbtree_find(ctx->propfind_recursive_cache, curi);
+            element = c_rbtree_node_data(node);
+        }
+        if (element) {
+            c_rbtree_node_delete(node);
+        }
         clear_propfind_recursive_cache(ctx);
+        if (element) {
+            c_rbtree_create(&ctx->propfind_recursive_cache, _key_cmp, _data_cmp);
+            c_rbtree_insert(ctx->propfind_recursive_cache, element);
+        }
     } else {
         DEBUG_WEBDAV("fill_recursive_propfind_cache %s We received %d elements deep for 'infinity' depth (%d folders, %d files)",
                      curi,
@@ -429,6 +429,7 @@ void resource_free(struct resource* o) {
 void free_fetchCtx( struct listdir_context *ctx )
 {
     struct resource *newres, *res;
+    unsigned int i;
     if( ! ctx ) return;
     newres = ctx->list;
     res = newres;
@@ -438,6 +439,12 @@ void free_fetchCtx( struct listdir_context *ctx )
 
     SAFE_FREE(ctx->target);
 
+    /* The ones readdir did not hand over */
+    for (i = ctx->entries_read; i < ctx->entries_count; i++) {
+        csync_vio_file_stat_destroy(ctx->entries[i]);
+    }
+    SAFE_FREE(ctx->entries);
+
     while( res ) {
         SAFE_FREE(res->uri);
         SAFE_FREE(res->name);
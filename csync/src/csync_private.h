@@ -89,6 +89,12 @@ struct csync_s {
       void *userdata;
       csync_update_callback update_callback;
       void *update_callback_userdata;
+
+      /* If set, used instead of the owncloud module to list the remote directories */
+      csync_vio_opendir_hook remote_opendir_hook;
+      csync_vio_readdir_hook remote_readdir_hook;
+      csync_vio_closedir_hook remote_closedir_hook;
+      void *vio_userdata;
   } callbacks;
   c_strlist_t *excludes;
 
@@ -107,6 +113,10 @@ struct csync_s {
     c_rbtree_t *tree;
     c_list_t *list;
     enum csync_replica_e type;
+    int  read_from_db;
+    /* seconds spent in the last update detection and reconciliation */
+    double update_time;
+    double reconcile_time;
   } local;
 
   struct {
@@ -115,6 +125,8 @@ struct csync_s {
     c_list_t *list;
     enum csync_replica_e type;
     int  read_from_db;
+    double update_time;
+    double reconcile_time;
   } remote;
 
 #if defined(HAVE_ICONV) && defined(WITH_ICONV)
@@ -148,6 +160,11 @@ struct csync_s {
   /* hooks for checking the white list */
   void *checkBlackListData;
   int (*checkBlackListHook)(void*, const char*);
+
+  /* hook telling that nothing changed locally below a directory, so its content
+     can be restored from the database instead of being walked */
+  void *skipLocalDiscoveryData;
+  int (*skipLocalDiscoveryHook)(void*, const char*);
 };
 
 
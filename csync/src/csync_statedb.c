@@ -321,6 +321,10 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
                         (char*) sqlite3_column_text(stmt, 11),
                         REMOTE_PERM_BUF_SIZE);
             }
+            /* only selected by name, "SELECT *" has other columns there */
+            if(column_count > 12 && c_streq(sqlite3_column_name(stmt, 12), "filesize")) {
+                (*st)->size = sqlite3_column_int64(stmt, 12);
+            }
         }
     } else {
         if( rc != SQLITE_DONE ) {
@@ -467,7 +471,7 @@ char *csync_statedb_get_etag( CSYNC *ctx, uint64_t jHash ) {
     return ret;
 }
 
-#define BELOW_PATH_QUERY "SELECT phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm FROM metadata WHERE pathlen>? AND path LIKE(?)"
+#define BELOW_PATH_QUERY "SELECT phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize FROM metadata WHERE pathlen>? AND path LIKE(?)"
 
 int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     int rc;
@@ -513,7 +517,7 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
         rc = _csync_file_stat_from_metadata_table( &st, stmt);
         if( st ) {
             /* store into result list. */
-            if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
+            if (c_rbtree_insert(ctx->current == LOCAL_REPLICA ? ctx->local.tree : ctx->remote.tree, (void *) st) < 0) {
                 SAFE_FREE(st);
                 ctx->status_code = CSYNC_STATUS_TREE_ERROR;
                 break;
@@ -533,6 +537,51 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     return 0;
 }
 
+#define COUNT_BELOW_PATH_QUERY "SELECT COUNT(*), SUM(type == ?) FROM metadata WHERE pathlen>? AND path LIKE(?)"
+
+int csync_statedb_count_below_path( CSYNC *ctx, const char *path, int *dirs ) {
+    int rc;
+    sqlite3_stmt *stmt = NULL;
+    char *likepath;
+    int asp;
+    int cnt = -1;
+
+    if( !ctx || !path || !ctx->statedb.db ) {
+        return -1;
+    }
+
+    rc = sqlite3_prepare_v2(ctx->statedb.db, COUNT_BELOW_PATH_QUERY, -1, &stmt, NULL);
+    if( rc != SQLITE_OK || stmt == NULL ) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for count below path query.");
+      return -1;
+    }
+
+    asp = asprintf( &likepath, "%s/%%%%", path);
+    if (asp < 0) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "asprintf failed!");
+        sqlite3_finalize(stmt);
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt, 1, CSYNC_FTW_TYPE_DIR);
+    sqlite3_bind_int(stmt, 2, strlen(path));
+    sqlite3_bind_text(stmt, 3, likepath, -1, SQLITE_STATIC);
+
+    rc = sqlite3_step(stmt);
+    if( rc == SQLITE_ROW ) {
+        cnt = sqlite3_column_int(stmt, 0);
+        if (dirs) {
+            *dirs = sqlite3_column_int(stmt, 1);
+        }
+    } else {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not count the entries below %s: %d!", path, rc);
+    }
+    sqlite3_finalize(stmt);
+    SAFE_FREE(likepath);
+
+    return cnt;
+}
+
 /* query the statedb, caller must free the memory */
 c_strlist_t *csync_statedb_query(sqlite3 *db,
                                  const char *statement) {
@@ -87,6 +87,17 @@ char *csync_statedb_get_etag(CSYNC *ctx, uint64_t jHash);
  */
 int csync_statedb_get_below_path(CSYNC *ctx, const char *path);
 
+/**
+ * @brief Count the records below a path, without reading them.
+ *
+ * @param ctx      The csync context.
+ * @param path     The parent directory.
+ * @param dirs     Receives the number of directories among them.
+ *
+ * @return  The number of records, less than 0 on error.
+ */
+int csync_statedb_count_below_path(CSYNC *ctx, const char *path, int *dirs);
+
 /**
  * @brief A generic statedb query.
  *
@@ -228,6 +228,17 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
     tmp = csync_statedb_get_stat_by_hash(ctx, h);
 
     if(tmp && tmp->phash == h ) { /* there is an entry in the database */
+        if (type == CSYNC_FTW_TYPE_DIR && tmp->type == CSYNC_FTW_TYPE_DIR
+                && ctx->current == LOCAL_REPLICA && ctx->skipLocalDiscoveryHook
+                && !ctx->read_from_db_disabled
+                && ctx->skipLocalDiscoveryHook(ctx->skipLocalDiscoveryData, path)) {
+            /* Nothing changed locally in there, restore the whole subtree from the
+             * database instead of walking it. */
+            CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Reading local tree from database: %s", path);
+            ctx->local.read_from_db = true;
+            st->instruction = CSYNC_INSTRUCTION_NONE;
+            goto out;
+        }
         /* we have an update! */
         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Database entry found, compare: %" PRId64 " <-> %" PRId64 ", etag: %s <-> %s, inode: %" PRId64 " <-> %" PRId64,
                   ((int64_t) fs->mtime), ((int64_t) tmp->modtime), fs->etag, tmp->etag, (uint64_t) fs->inode, (uint64_t) tmp->inode);
@@ -475,13 +486,14 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
 static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
 {
     const char *path = NULL;
+    const char *replica_uri = ctx->current == LOCAL_REPLICA ? ctx->local.uri : ctx->remote.uri;
 
-    if( strlen(uri) < strlen(ctx->remote.uri)+1) {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "name does not contain remote uri!");
+    if( strlen(uri) < strlen(replica_uri)+1) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "name does not contain replica uri!");
         return false;
     }
 
-    path = uri + strlen(ctx->remote.uri)+1;
+    path = uri + strlen(replica_uri)+1;
 
     if( csync_statedb_get_below_path(ctx, path) < 0 ) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "StateDB could not be read!");
@@ -491,6 +503,40 @@ static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
     return true;
 }
 
+bool csync_update_remote_dir_needs_listing(CSYNC *ctx, const char *path, const char *etag,
+                                           const char *file_id, const char *remotePerm) {
+  csync_file_stat_t *tmp = NULL;
+  bool from_db = false;
+
+  /* Same tests as in _csync_detect_update */
+  if (csync_excluded(ctx, path, CSYNC_FTW_TYPE_DIR) != CSYNC_NOT_EXCLUDED) {
+    return false;
+  }
+  if (ctx->checkBlackListHook && ctx->checkBlackListHook(ctx->checkBlackListData, path)) {
+    return false;
+  }
+  if (csync_get_statedb_exists(ctx) && !ctx->read_from_db_disabled && etag) {
+    tmp = csync_statedb_get_stat_by_hash(ctx, c_jhash64((uint8_t *) path, strlen(path), 0));
+    from_db = tmp && c_streq(etag, tmp->etag) && c_streq(file_id, tmp->file_id)
+        && c_streq(remotePerm, tmp->remotePerm);
+    csync_file_stat_free(tmp);
+  }
+  return !from_db;
+}
+
+bool csync_update_remote_dir_replaced(CSYNC *ctx, const char *path, const char *file_id) {
+  csync_file_stat_t *tmp = NULL;
+  bool replaced = false;
+
+  if (!csync_get_statedb_exists(ctx) || ctx->read_from_db_disabled || !file_id || !file_id[0]) {
+    return false;
+  }
+  tmp = csync_statedb_get_stat_by_hash(ctx, c_jhash64((uint8_t *) path, strlen(path), 0));
+  replaced = tmp && tmp->file_id[0] && !c_streq(file_id, tmp->file_id);
+  csync_file_stat_free(tmp);
+  return replaced;
+}
+
 /* File tree walker */
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth) {
@@ -504,7 +550,8 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   int rc = 0;
   int res = 0;
 
-  bool do_read_from_db = (ctx->current == REMOTE_REPLICA && ctx->remote.read_from_db);
+  int *ctx_read_from_db = ctx->current == LOCAL_REPLICA ? &ctx->local.read_from_db : &ctx->remote.read_from_db;
+  bool do_read_from_db = *ctx_read_from_db;
 
   if (uri[0] == '\0') {
     errno = ENOENT;
@@ -512,10 +559,10 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     goto error;
   }
 
-  read_from_db = ctx->remote.read_from_db;
+  read_from_db = *ctx_read_from_db;
 
-  // if the etag of this dir is still the same, its content is restored from the
-  // database.
+  // if the etag of this dir is still the same, or nothing changed locally in it,
+  // its content is restored from the database.
   if( do_read_from_db ) {
       if( ! fill_tree_from_db(ctx, uri) ) {
         errno = ENOENT;
@@ -550,7 +597,10 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
 
     d_name = dirent->name;
     if (d_name == NULL) {
-      ctx->status_code = CSYNC_STATUS_READDIR_ERROR;
+      /* The listing failed half way, errno tells why */
+      ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_READDIR_ERROR);
+      csync_vio_file_stat_destroy(dirent);
+      dirent = NULL;
       goto error;
     }
 
@@ -706,7 +756,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     }
 
     ctx->current_fs = previous_fs;
-    ctx->remote.read_from_db = read_from_db;
+    *ctx_read_from_db = read_from_db;
     SAFE_FREE(filename);
     csync_vio_file_stat_destroy(dirent);
     dirent = NULL;
@@ -720,7 +770,7 @@ done:
   SAFE_FREE(filename);
   return rc;
 error:
-  ctx->remote.read_from_db = read_from_db;
+  *ctx_read_from_db = read_from_db;
   if (dh != NULL) {
     csync_vio_closedir(ctx, dh);
   }
@@ -25,6 +25,10 @@
 #include "csync.h"
 #include "vio/csync_vio_file_stat.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @file csync_update.h
  *
@@ -95,6 +99,44 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth);
 
+/**
+ * @brief Tell if csync_ftw() will have to list a remote directory.
+ *
+ * A directory is not listed if it is excluded, or if its etag, file id and permissions are
+ * the same as in the database: its content is then read from the database. This is used
+ * to list the remote directories in advance.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  path         The path of the directory, relative to the remote uri.
+ *
+ * @param  etag         The normalized etag, file id and permissions of the directory on
+ *                      the server.
+ *
+ * @return true if the directory will be listed.
+ */
+bool csync_update_remote_dir_needs_listing(CSYNC *ctx, const char *path, const char *etag,
+                                           const char *file_id, const char *remotePerm);
+
+/**
+ * @brief Tell if the server has another directory than the one in the database
+ * at \a path: its file id changed, as after a restore. Its content is then likely
+ * to have changed too.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  path         The path of the directory, relative to the remote uri.
+ *
+ * @param  file_id      The file id of the directory on the server.
+ *
+ * @return true if the database knows the directory with another file id.
+ */
+bool csync_update_remote_dir_replaced(CSYNC *ctx, const char *path, const char *file_id);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _CSYNC_UPDATE_H */
 
 /* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -45,6 +45,12 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
       if(ctx->remote.read_from_db) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Read from db flag is true, should not!" );
       }
+      if (ctx->callbacks.remote_opendir_hook) {
+          if( ctx->callbacks.update_callback ) {
+              ctx->callbacks.update_callback(ctx->replica, name, ctx->callbacks.update_callback_userdata);
+          }
+          return ctx->callbacks.remote_opendir_hook(name, ctx->callbacks.vio_userdata);
+      }
       return owncloud_opendir(ctx, name);
       break;
     case LOCAL_REPLICA:
@@ -73,6 +79,11 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
       if( ctx->remote.read_from_db ) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Remote ReadFromDb is true, should not!");
       }
+      if (ctx->callbacks.remote_closedir_hook) {
+          ctx->callbacks.remote_closedir_hook(dhandle, ctx->callbacks.vio_userdata);
+          rc = 0;
+          break;
+      }
       rc = owncloud_closedir(ctx, dhandle);
       break;
   case LOCAL_REPLICA:
@@ -91,6 +102,9 @@ csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle
       if( ctx->remote.read_from_db ) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Remote readfromdb is true, should not!");
       }
+      if (ctx->callbacks.remote_readdir_hook) {
+          return ctx->callbacks.remote_readdir_hook(dhandle, ctx->callbacks.vio_userdata);
+      }
       return owncloud_readdir(ctx, dhandle);
       break;
     case LOCAL_REPLICA:
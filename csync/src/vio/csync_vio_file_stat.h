@@ -37,6 +37,10 @@
 // currently specified at https://github.com/owncloud/core/issues/8322 are 9 to 10
 #define REMOTE_PERM_BUF_SIZE 15
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct csync_vio_file_stat_s csync_vio_file_stat_t;
 
 enum csync_vio_file_flags_e {
@@ -118,4 +122,8 @@ void csync_vio_file_stat_set_file_id( csync_vio_file_stat_t* dst, const char* sr
 
 void csync_vio_set_file_id(char* dst, const char *src );
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _CSYNC_VIO_METHOD_H */
@@ -0,0 +1,164 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2014 by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Measures the update detection of the local replica with the log level the
+ * client uses (everything, through a callback) and with logging disabled.
+ *
+ *   benchmark_csync_update [directories] [files per directory] [runs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "csync_private.h"
+#include "csync_update.h"
+#include "csync_statedb.h"
+#include "csync_log.h"
+#include "csync_time.h"
+
+#define BENCH_DIR "/tmp/benchmark_csync"
+#define BENCH_DB "/tmp/benchmark_csync_journal.db"
+
+static size_t logged_bytes;
+
+/* What the client does: the message is taken over, but not written */
+static void bench_log_callback(int verbosity,
+                               const char *function,
+                               const char *buffer,
+                               void *userdata)
+{
+    (void) verbosity;
+    (void) function;
+    (void) userdata;
+
+    logged_bytes += strlen(buffer);
+}
+
+static int create_tree(int dirs, int files)
+{
+    char path[256];
+    FILE *f;
+    int d, i;
+
+    if (system("rm -rf " BENCH_DIR " " BENCH_DB) != 0 || mkdir(BENCH_DIR, 0755) != 0) {
+        return -1;
+    }
+    for (d = 0; d < dirs; d++) {
+        snprintf(path, sizeof(path), BENCH_DIR "/dir%d", d);
+        if (mkdir(path, 0755) != 0) {
+            return -1;
+        }
+        for (i = 0; i < files; i++) {
+            snprintf(path, sizeof(path), BENCH_DIR "/dir%d/file%d.txt", d, i);
+            f = fopen(path, "w");
+            if (f == NULL) {
+                return -1;
+            }
+            fputs("benchmark", f);
+            fclose(f);
+        }
+    }
+    return 0;
+}
+
+/* Returns the seconds spent in the walk of the local replica, or -1 */
+static double run_update(int log_level)
+{
+    struct timespec start, finish;
+    CSYNC *csync;
+    int rc;
+
+    if (csync_create(&csync, BENCH_DIR, "owncloud://localhost/benchmark") < 0) {
+        return -1;
+    }
+    if (csync_init(csync) < 0 || csync_statedb_load(csync, BENCH_DB, &csync->statedb.db) < 0) {
+        csync_destroy(csync);
+        return -1;
+    }
+
+    csync_set_log_callback(bench_log_callback);
+    csync_set_log_level(log_level);
+
+    csync->current = LOCAL_REPLICA;
+    csync->replica = csync->local.type;
+
+    csync_gettime(&start);
+    rc = csync_ftw(csync, csync->local.uri, csync_walker, MAX_DEPTH);
+    csync_gettime(&finish);
+
+    csync_set_log_level(0);
+    csync_destroy(csync);
+
+    return rc < 0 ? -1 : c_secdiff(finish, start);
+}
+
+int main(int argc, char **argv)
+{
+    int dirs = argc > 1 ? atoi(argv[1]) : 100;
+    int files = argc > 2 ? atoi(argv[2]) : 100;
+    int runs = argc > 3 ? atoi(argv[3]) : 5;
+    double best_logged = -1;
+    double best_silent = -1;
+    double t;
+    int i;
+
+    if (create_tree(dirs, files) < 0) {
+        fprintf(stderr, "Could not create the tree in %s\n", BENCH_DIR);
+        return 1;
+    }
+
+    /* alternate the two, the best run of each counts */
+    for (i = 0; i < runs; i++) {
+        t = run_update(CSYNC_LOG_PRIORITY_NOTSET + 1);
+        if (t < 0) {
+            fprintf(stderr, "Update detection failed\n");
+            return 1;
+        }
+        if (best_logged < 0 || t < best_logged) {
+            best_logged = t;
+        }
+
+        t = run_update(CSYNC_LOG_PRIORITY_NOLOG);
+        if (t < 0) {
+            fprintf(stderr, "Update detection failed\n");
+            return 1;
+        }
+        if (best_silent < 0 || t < best_silent) {
+            best_silent = t;
+        }
+    }
+
+    printf("%d files in %d directories, best of %d runs\n", dirs * files, dirs, runs);
+    printf("  log level %d (the client's): %.4f s, %zu bytes logged per run\n",
+           CSYNC_LOG_PRIORITY_NOTSET + 1, best_logged, logged_bytes / runs);
+    printf("  logging disabled:          %.4f s\n", best_silent);
+#ifdef STRIP_TRACE_LOG
+    printf("  (built with STRIP_TRACE_LOG, the trace logs are compiled out)\n");
+#endif
+
+    if (system("rm -rf " BENCH_DIR " " BENCH_DB) != 0) {
+        return 1;
+    }
+    return 0;
+}
@@ -140,12 +140,44 @@ static void check_logging(void **state)
     assert_int_equal(rc, 0);
 }
 
+static int evaluated;
+
+static int count_evaluation(void)
+{
+    evaluated++;
+    return 42;
+}
+
+static void check_disabled_log_not_evaluated(void **state)
+{
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = csync_set_log_callback(check_log_callback);
+    assert_int_equal(rc, 0);
+
+    evaluated = 0;
+    csync_set_log_level(CSYNC_LOG_PRIORITY_ERROR);
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "value %d", count_evaluation());
+    assert_int_equal(evaluated, 0);
+
+    csync_set_log_level(CSYNC_LOG_PRIORITY_TRACE);
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "value %d", count_evaluation());
+#ifdef STRIP_TRACE_LOG
+    assert_int_equal(evaluated, 0);
+#else
+    assert_int_equal(evaluated, 1);
+#endif
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test(check_set_log_level),
         unit_test(check_set_auth_callback),
         unit_test_setup_teardown(check_logging, setup, teardown),
+        unit_test_setup_teardown(check_disabled_log_not_evaluated, setup, teardown),
     };
 
     return run_tests(tests);
@@ -29,6 +29,7 @@
 #include "simplesslerrorhandler.h"
 #include "syncengine.h"
 #include "syncjournaldb.h"
+#include "syncmetrics.h"
 #include "config.h"
 
 #include "cmd.h"
@@ -43,6 +44,7 @@ struct CmdOptions {
     bool silent;
     bool trustSSL;
     QString exclude;
+    QString metricsFile;
 };
 
 // we can't use csync_set_userdata because the SyncEngine sets it already.
@@ -81,6 +83,8 @@ void help()
     std::cout << "                         Proxy is http://server:port" << std::endl;
     std::cout << "  --trust                Trust the SSL certification." << std::endl;
     std::cout << "  --exclude [file]       exclude list file" << std::endl;
+    std::cout << "  --metrics [file]       write the sync metrics to that file" << std::endl;
+    std::cout << "                         in the Prometheus text format" << std::endl;
     std::cout << "" << std::endl;
     exit(1);
 
@@ -127,6 +131,8 @@ void parseOptions( const QStringList& app_args, CmdOptions *options )
             options->trustSSL = true;
         } else if( option == "--exclude" && !it.peekNext().startsWith("-") ) {
                 options->exclude = it.next();
+        } else if( option == "--metrics" && !it.peekNext().startsWith("-") ) {
+            options->metricsFile = it.next();
         } else {
             help();
         }
@@ -225,6 +231,12 @@ int main(int argc, char **argv) {
         csync_add_exclude_list(_csync_ctx, options.exclude.toLocal8Bit());
     }
 
+    MetricsExporter metricsExporter;
+    metricsExporter.setupFromEnvironment();
+    if (!options.metricsFile.isEmpty()) {
+        metricsExporter.setFile(options.metricsFile);
+    }
+
     Cmd cmd;
     SyncJournalDb db(options.source_dir);
     SyncEngine engine(_csync_ctx, options.source_dir, QUrl(options.target_url).path(), folder, &db);
@@ -236,6 +248,7 @@ int main(int argc, char **argv) {
 
     app.exec();
 
+    metricsExporter.writeFile();
     csync_destroy(_csync_ctx);
 
     ne_sock_exit();
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "activitylistmodel.h"
+#include "utility.h"
+
+#include <QLocale>
+
+namespace Mirall {
+
+ActivityListModel::ActivityListModel(QObject *parent)
+    : QAbstractTableModel(parent)
+    , _maxRows(2000)
+{
+    _flushTimer.setSingleShot(true);
+    _flushTimer.setInterval(100);
+    connect(&_flushTimer, SIGNAL(timeout()), SLOT(flush()));
+}
+
+void ActivityListModel::setMaxRows(int maxRows)
+{
+    _maxRows = qMax(maxRows, 1);
+    trim();
+}
+
+void ActivityListModel::addEntry(const Entry &entry)
+{
+    _pending.append(entry);
+    // the newer ones replace them anyway
+    while (_pending.size() > _maxRows) {
+        _pending.removeFirst();
+    }
+    if (!_flushTimer.isActive()) {
+        _flushTimer.start();
+    }
+}
+
+void ActivityListModel::flush()
+{
+    _flushTimer.stop();
+    if (_pending.isEmpty()) {
+        return;
+    }
+    beginInsertRows(QModelIndex(), 0, _pending.size() - 1);
+    foreach (const Entry &entry, _pending) {
+        _entries.prepend(entry);
+    }
+    _pending.clear();
+    endInsertRows();
+    trim();
+}
+
+void ActivityListModel::trim()
+{
+    if (_entries.size() > _maxRows) {
+        beginRemoveRows(QModelIndex(), _maxRows, _entries.size() - 1);
+        _entries.erase(_entries.begin() + _maxRows, _entries.end());
+        endRemoveRows();
+    }
+}
+
+void ActivityListModel::removeIgnoredEntries(const QString &folder)
+{
+    for (int i = _pending.size() - 1; i >= 0; --i) {
+        if (_pending.at(i).ignored && _pending.at(i).folder == folder) {
+            _pending.removeAt(i);
+        }
+    }
+
+    // remove the consecutive rows together, starting from the bottom
+    int row = _entries.size() - 1;
+    while (row >= 0) {
+        if (!_entries.at(row).ignored || _entries.at(row).folder != folder) {
+            --row;
+            continue;
+        }
+        int first = row;
+        while (first > 0 && _entries.at(first - 1).ignored && _entries.at(first - 1).folder == folder) {
+            --first;
+        }
+        beginRemoveRows(QModelIndex(), first, row);
+        _entries.erase(_entries.begin() + first, _entries.begin() + row + 1);
+        endRemoveRows();
+        row = first - 1;
+    }
+}
+
+ActivityListModel::Entry ActivityListModel::entry(int row) const
+{
+    return _entries.value(row);
+}
+
+int ActivityListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : _entries.size();
+}
+
+int ActivityListModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant ActivityListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= _entries.size()) {
+        return QVariant();
+    }
+    const Entry &entry = _entries.at(index.row());
+
+    if (role == Qt::DisplayRole) {
+        switch (index.column()) {
+        case TimeColumn:
+            return timeString(entry.timestamp);
+        case FileColumn:
+            return entry.file;
+        case FolderColumn:
+            return entry.folder;
+        case ActionColumn:
+            return entry.message;
+        case SizeColumn:
+            return entry.size >= 0 ? Utility::octetsToString(entry.size) : QString();
+        }
+    } else if (role == Qt::ToolTipRole) {
+        switch (index.column()) {
+        case TimeColumn:
+            return timeString(entry.timestamp, QLocale::LongFormat);
+        case FileColumn:
+            return entry.file;
+        case ActionColumn:
+            return entry.message;
+        }
+    } else if (role == Qt::DecorationRole && index.column() == TimeColumn) {
+        return entry.icon;
+    }
+    return QVariant();
+}
+
+QVariant ActivityListModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    // Adjust ProtocolWidget::copyToClipboard() when making changes here!
+    switch (section) {
+    case TimeColumn:
+        return tr("Time");
+    case FileColumn:
+        return tr("File");
+    case FolderColumn:
+        return tr("Folder");
+    case ActionColumn:
+        return tr("Action");
+    case SizeColumn:
+        return tr("Size");
+    }
+    return QVariant();
+}
+
+QString ActivityListModel::timeString(const QDateTime &dt, QLocale::FormatType format)
+{
+    QLocale loc = QLocale::system();
+    QString timeStr;
+    QDate today = QDate::currentDate();
+
+    if( format == QLocale::NarrowFormat ) {
+        if( dt.date().day() == today.day() ) {
+            timeStr = loc.toString(dt.time(), QLocale::NarrowFormat);
+        } else {
+            timeStr = loc.toString(dt, QLocale::NarrowFormat);
+        }
+    } else {
+        timeStr = loc.toString(dt, format);
+    }
+    return timeStr;
+}
+
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef ACTIVITYLISTMODEL_H
+#define ACTIVITYLISTMODEL_H
+
+#include <QAbstractTableModel>
+#include <QDateTime>
+#include <QList>
+#include <QLocale>
+#include <QTimer>
+#include <QVariant>
+
+namespace Mirall {
+
+/**
+ * @brief The completed items shown in the activity list, newest first
+ *
+ * Only the newest maxRows() entries are kept. The entries are inserted in
+ * batches, at most every 100 msec, and the texts are only formatted for the
+ * rows the view asks for.
+ */
+class ActivityListModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    enum Column { TimeColumn, FileColumn, FolderColumn, ActionColumn, SizeColumn, ColumnCount };
+
+    struct Entry {
+        Entry() : size(-1), ignored(false) {}
+        QDateTime timestamp;
+        QString file;
+        QString folder;
+        QString message;
+        qint64 size; // -1 when the size is not relevant for the action
+        QVariant icon;
+        bool ignored; // removed when the folder syncs again
+    };
+
+    explicit ActivityListModel(QObject *parent = 0);
+
+    int maxRows() const { return _maxRows; }
+    void setMaxRows(int maxRows);
+
+    void addEntry(const Entry &entry);
+    void removeIgnoredEntries(const QString &folder);
+
+    Entry entry(int row) const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const Q_DECL_OVERRIDE;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const Q_DECL_OVERRIDE;
+
+    static QString timeString(const QDateTime &dt, QLocale::FormatType format = QLocale::NarrowFormat);
+
+public slots:
+    /** Insert the entries added since the last flush now */
+    void flush();
+
+private:
+    void trim();
+
+    QList<Entry> _entries;
+    QList<Entry> _pending; // oldest first
+    QTimer _flushTimer;
+    int _maxRows;
+};
+
+}
+
+#endif // ACTIVITYLISTMODEL_H
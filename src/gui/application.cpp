@@ -28,6 +28,7 @@
 #include "mirallconfigfile.h"
 #include "socketapi.h"
 #include "sslerrordialog.h"
+#include "syncmetrics.h"
 #include "theme.h"
 #include "utility.h"
 #include "clientproxy.h"
@@ -105,6 +106,9 @@ Application::Application(int &argc, char **argv) :
     setupLogging();
     setupTranslations();
 
+    MetricsExporter *metricsExporter = new MetricsExporter(this);
+    metricsExporter->setupFromEnvironment();
+
     connect( this, SIGNAL(messageReceived(QString, QObject*)), SLOT(slotParseOptions(QString, QObject*)));
 
     Account *account = Account::restore();
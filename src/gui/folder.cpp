@@ -26,7 +26,7 @@
 #include "utility.h"
 #include "clientproxy.h"
 #include "syncengine.h"
-#include "syncrunfilelog.h"
+#include "syncrunprocessor.h"
 
 #include "creds/abstractcredentials.h"
 
@@ -34,6 +34,7 @@
 #include <QTimer>
 #include <QUrl>
 #include <QDir>
+#include <QFileInfo>
 
 #include <QMessageBox>
 #include <QPushButton>
@@ -59,6 +60,9 @@ Folder::Folder(const QString &alias, const QString &path, const QString& secondP
       , _csyncUnavail(false)
       , _wipeDb(false)
       , _proxyDirty(true)
+      , _localChangedRoot(true)
+      , _watcherReliable(false)
+      , _pollAfterSync(false)
       , _journal(path)
       , _csync_ctx(0)
 {
@@ -189,7 +193,7 @@ QString Folder::path() const
 
 bool Folder::isBusy() const
 {
-    return !_engine.isNull();
+    return !_engine.isNull() || !_runProcessor.isNull();
 }
 
 QString Folder::remotePath() const
@@ -267,7 +271,11 @@ void Folder::slotPollTimerTimeout()
     } else {
         // do the ordinary etag chech for the root folder.
         RequestEtagJob* job = new RequestEtagJob(AccountManager::instance()->account(), remotePath(), this);
+        // also get the etags of the top level entries to know which of them changed
+        job->setListChildren(true);
         // check if the etag is different
+        QObject::connect(job, SIGNAL(childEtagsRetrieved(QHash<QString,QByteArray>)),
+                         this, SLOT(slotChildEtagsRetrieved(QHash<QString,QByteArray>)));
         QObject::connect(job, SIGNAL(etagRetreived(QString)), this, SLOT(etagRetreived(QString)));
         QObject::connect(job, SIGNAL(networkError(QNetworkReply*)), this, SLOT(slotNetworkUnavailable()));
         job->start();
@@ -283,7 +291,108 @@ void Folder::etagRetreived(const QString& etag)
 
     if (_lastEtag != etag) {
         _lastEtag = etag;
+        const QStringList changed = changedRemoteChildren();
+        if (changed.isEmpty()) {
+            // Only the folder itself changed (e.g. a top level entry was removed),
+            // or we could not tell what changed
+            emit scheduleToSync(alias());
+        } else {
+            qDebug() << "* Remote changes in" << changed;
+            emit scheduleToSyncPaths(alias(), changed);
+        }
+    }
+    _remoteChildEtags.clear();
+}
+
+void Folder::slotRemoteChangeNotified()
+{
+    if (isBusy()) {
+        _pollAfterSync = true;
+        return;
+    }
+    slotPollTimerTimeout();
+}
+
+void Folder::setRemoteNotificationsActive(bool active)
+{
+    int polltime = MirallConfigFile().remotePollInterval();
+    _pollTimer.setInterval(active ? 10 * polltime : polltime);
+}
+
+void Folder::slotChildEtagsRetrieved(const QHash<QString, QByteArray> &etags)
+{
+    _remoteChildEtags = etags;
+}
+
+QStringList Folder::changedRemoteChildren()
+{
+    QStringList changed;
+    QHash<QString, QByteArray>::const_iterator it;
+    for (it = _remoteChildEtags.constBegin(); it != _remoteChildEtags.constEnd(); ++it) {
+        SyncJournalFileRecord record = _journal.getFileRecord(it.key());
+        if (!record.isValid() || record._etag != it.value()) {
+            changed.append(it.key());
+        }
+    }
+    return changed;
+}
+
+QString Folder::topLevelEntry(const QString &path) const
+{
+    const QString folderPath = QDir::cleanPath(this->path()) + QLatin1Char('/');
+    const QString changedPath = QDir::cleanPath(path) + QLatin1Char('/');
+    return changedPath.startsWith(folderPath)
+            ? changedPath.mid(folderPath.length()).section(QLatin1Char('/'), 0, 0) : QString();
+}
+
+void Folder::slotWatchedPathChanged(const QString &path)
+{
+    const QString topLevel = topLevelEntry(path);
+    if (topLevel.isEmpty()) {
+        // the root itself, or something we do not know about
+        _localChangedRoot = true;
+        return;
+    }
+    _localChangedPaths.insert(topLevel);
+}
+
+void Folder::slotWatchedPathsChanged(const QStringList &paths)
+{
+    const QString folderPath = QDir::cleanPath(this->path()) + QLatin1Char('/');
+    QStringList topLevelEntries;
+    foreach (const QString &path, paths) {
+        // Shown as pending until the sync: the tree also counts it in the parent directories
+        const QString cleanPath = QDir::cleanPath(path);
+        if (cleanPath.startsWith(folderPath)) {
+            _statusTree.setStatus(cleanPath.mid(folderPath.length()), SyncFileStatus::STATUS_EVAL);
+        }
+
+        // the directory in which something was created, removed or modified
+        const QString dir = QFileInfo(path).dir().path();
+        slotWatchedPathChanged(dir);
+        const QString topLevel = topLevelEntry(dir);
+        if (!topLevel.isEmpty() && !topLevelEntries.contains(topLevel)) {
+            topLevelEntries.append(topLevel);
+        }
+    }
+
+    if (_localChangedRoot || topLevelEntries.isEmpty()) {
         emit scheduleToSync(alias());
+    } else {
+        emit scheduleToSyncLocalPaths(alias(), topLevelEntries);
+    }
+}
+
+void Folder::slotWatcherLostChanges()
+{
+    _localChangedRoot = true;
+}
+
+void Folder::slotWatcherReliableChanged(bool reliable)
+{
+    _watcherReliable = reliable;
+    if (!reliable) {
+        _localChangedRoot = true;
     }
 }
 
@@ -296,92 +405,28 @@ void Folder::slotNetworkUnavailable()
     emit syncStateChange();
 }
 
-void Folder::bubbleUpSyncResult()
+void Folder::bubbleUpSyncResult(const SyncRunSummary &summary)
 {
-    // count new, removed and updated items
-    int newItems = 0;
-    int removedItems = 0;
-    int updatedItems = 0;
-    int ignoredItems = 0;
-    int renamedItems = 0;
-
-    SyncFileItem firstItemNew;
-    SyncFileItem firstItemDeleted;
-    SyncFileItem firstItemUpdated;
-    SyncFileItem firstItemRenamed;
     Logger *logger = Logger::instance();
 
-    SyncRunFileLog syncFileLog;
-
-    syncFileLog.start(path(), _engine ? _engine->stopWatch() : Utility::StopWatch() );
-
-    QElapsedTimer timer;
-    timer.start();
-
-    foreach (const SyncFileItem &item, _syncResult.syncFileItemVector() ) {
-        // Log the item
-        syncFileLog.logItem( item );
-
-        // and process the item to the gui
-        if( item._status == SyncFileItem::FatalError || item._status == SyncFileItem::NormalError ) {
-            slotSyncError( tr("%1: %2").arg(item._file, item._errorString) );
-            logger->postOptionalGuiLog(item._file, item._errorString);
-        } else {
-            // add new directories or remove gone away dirs to the watcher
-            if (item._isDirectory && item._instruction == CSYNC_INSTRUCTION_NEW ) {
-                FolderMan::instance()->addMonitorPath( alias(), path()+item._file );
-            }
-            if (item._isDirectory && item._instruction == CSYNC_INSTRUCTION_REMOVE ) {
-                FolderMan::instance()->removeMonitorPath( alias(), path()+item._file );
-            }
-
-            if (item._direction == SyncFileItem::Down) {
-                switch (item._instruction) {
-                case CSYNC_INSTRUCTION_NEW:
-                    newItems++;
-                    if (firstItemNew.isEmpty())
-                        firstItemNew = item;
-                    break;
-                case CSYNC_INSTRUCTION_REMOVE:
-                    removedItems++;
-                    if (firstItemDeleted.isEmpty())
-                        firstItemDeleted = item;
-                    break;
-                case CSYNC_INSTRUCTION_CONFLICT:
-                case CSYNC_INSTRUCTION_SYNC:
-                    updatedItems++;
-                    if (firstItemUpdated.isEmpty())
-                        firstItemUpdated = item;
-                    break;
-                case CSYNC_INSTRUCTION_ERROR:
-                    qDebug() << "Got Instruction ERROR. " << _syncResult.errorString();
-                    break;
-                case CSYNC_INSTRUCTION_RENAME:
-                    if (firstItemRenamed.isEmpty()) {
-                        firstItemRenamed = item;
-                    }
-                    renamedItems++;
-                    break;
-                default:
-                    // nothing.
-                    break;
-                }
-            } else if( item._direction == SyncFileItem::None ) { // ignored files counting.
-                if( item._instruction == CSYNC_INSTRUCTION_IGNORE ) {
-                    ignoredItems++;
-                }
-            }
-        }
+    for (int i = 0; i < summary.errors.size(); ++i) {
+        const QString &file = summary.errors.at(i).first;
+        const QString &errorString = summary.errors.at(i).second;
+        slotSyncError( tr("%1: %2").arg(file, errorString) );
+        logger->postOptionalGuiLog(file, errorString);
+    }
+    if (summary.errorCount > summary.errors.size()) {
+        slotSyncError( tr("%1 more errors, see the sync log in the folder.")
+                       .arg(summary.errorCount - summary.errors.size()) );
     }
-    syncFileLog.close();
 
-    qDebug() << "Processing result list and logging took " << timer.elapsed() << " Milliseconds.";
-    _syncResult.setWarnCount(ignoredItems);
+    _syncResult.setWarnCount(summary.ignoredItems);
 
-    createGuiLog( firstItemNew._file,     SyncFileStatus(SyncFileStatus::STATUS_NEW), newItems );
-    createGuiLog( firstItemDeleted._file, SyncFileStatus(SyncFileStatus::STATUS_REMOVE), removedItems );
-    createGuiLog( firstItemUpdated._file, SyncFileStatus(SyncFileStatus::STATUS_UPDATED), updatedItems );
+    createGuiLog( summary.firstItemNew._file,     SyncFileStatus(SyncFileStatus::STATUS_NEW), summary.newItems );
+    createGuiLog( summary.firstItemDeleted._file, SyncFileStatus(SyncFileStatus::STATUS_REMOVE), summary.removedItems );
+    createGuiLog( summary.firstItemUpdated._file, SyncFileStatus(SyncFileStatus::STATUS_UPDATED), summary.updatedItems );
 
+    const SyncFileItem &firstItemRenamed = summary.firstItemRenamed;
     if( !firstItemRenamed.isEmpty() ) {
         SyncFileStatus status(SyncFileStatus::STATUS_RENAME);
         // if the path changes it's rather a move
@@ -390,7 +435,7 @@ void Folder::bubbleUpSyncResult()
         if(renTarget != renSource) {
             status.set(SyncFileStatus::STATUS_MOVE);
         }
-        createGuiLog( firstItemRenamed._file, status, renamedItems, firstItemRenamed._renameTarget );
+        createGuiLog( firstItemRenamed._file, status, summary.renamedItems, firstItemRenamed._renameTarget );
     }
 
     qDebug() << "OO folder slotSyncFinished: result: " << int(_syncResult.status());
@@ -549,7 +594,6 @@ bool Folder::proxyDirty()
 
 void Folder::startSync(const QStringList &pathList)
 {
-    Q_UNUSED(pathList)
     if (!_csync_ctx) {
         // no _csync_ctx yet,  initialize it.
         init();
@@ -579,6 +623,28 @@ void Folder::startSync(const QStringList &pathList)
     emit syncStateChange();
 
 
+    // Walk everything locally unless only some top level entries changed on the server
+    // and the watcher, reliable since the last sync started, saw nothing changing outside of them
+    QStringList localDiscoveryPaths;
+    if (!pathList.isEmpty() && !_localChangedRoot) {
+        localDiscoveryPaths = pathList;
+        foreach (const QString &changedPath, _localChangedPaths) {
+            if (!localDiscoveryPaths.contains(changedPath)) {
+                localDiscoveryPaths.append(changedPath);
+            }
+        }
+    }
+    _localChangedPaths.clear();
+    // while some directories are not watched, the changes in them during this sync are missed
+    _localChangedRoot = !_watcherReliable;
+
+    // the entries that still need to be synced are discovered again
+    _statusTree.clear();
+
+    // the completed items are logged and counted as they come
+    _runProcessor.reset(new SyncRunProcessor(path()));
+    connect(_runProcessor.data(), SIGNAL(finished()), SLOT(slotSyncResultProcessed()));
+
     qDebug() << "*** Start syncing";
     setIgnoredFiles();
     _engine.reset(new SyncEngine( _csync_ctx, path(), remoteUrl().path(), _remotePath, &_journal));
@@ -604,6 +670,7 @@ void Folder::startSync(const QStringList &pathList)
 
     setDirtyNetworkLimits();
     _engine->setSelectiveSyncBlackList(selectiveSyncBlackList());
+    _engine->setLocalDiscoveryPaths(localDiscoveryPaths);
 
     QMetaObject::invokeMethod(_engine.data(), "startSync", Qt::QueuedConnection);
 
@@ -656,12 +723,24 @@ void Folder::slotSyncFinished()
 {
     qDebug() << "-> CSync Finished slot with error " << _csyncError << "warn count" << _syncResult.warnCount();
 
-    bubbleUpSyncResult();
-
     _engine.reset(0);
+    // the result is complete once the processor caught up with the log
+    _runProcessor->finish();
+}
+
+void Folder::slotSyncResultProcessed()
+{
+    bubbleUpSyncResult(_runProcessor->summary());
+    // this is called by a signal of the processor
+    _runProcessor.take()->deleteLater();
+
     // _watcher->setEventsEnabledDelayed(2000);
     _pollTimer.start();
     _timeSinceLastSync.restart();
+    if (_pollAfterSync) {
+        _pollAfterSync = false;
+        QTimer::singleShot(0, this, SLOT(slotPollTimerTimeout()));
+    }
 
 
     if (_csyncError) {
@@ -716,18 +795,49 @@ void Folder::slotTransmissionProgress(const Progress::Info &pi)
     ProgressDispatcher::instance()->setProgressInfo(alias(), pi);
 }
 
-// a job is completed: count the errors and forward to the ProgressDispatcher
+// a job is completed: log it, count the errors and forward to the ProgressDispatcher
 void Folder::slotJobCompleted(const SyncFileItem &item)
 {
+    if (_runProcessor) {
+        _runProcessor->addItem(item);
+    }
+
+    // add new directories or remove gone away dirs to the watcher
+    if (item._isDirectory && item._status != SyncFileItem::FatalError
+            && item._status != SyncFileItem::NormalError) {
+        if (item._instruction == CSYNC_INSTRUCTION_NEW) {
+            FolderMan::instance()->addMonitorPath( alias(), path()+item._file );
+        } else if (item._instruction == CSYNC_INSTRUCTION_REMOVE) {
+            FolderMan::instance()->removeMonitorPath( alias(), path()+item._file );
+        }
+    }
+
     if (Progress::isWarningKind(item._status)) {
         // Count all error conditions.
         _syncResult.setWarnCount(_syncResult.warnCount()+1);
+        _statusTree.setStatus(item.destination(), SyncFileStatus::STATUS_ERROR);
+    } else {
+        _statusTree.setStatus(item.destination(), SyncFileStatus::STATUS_SYNC);
     }
     emit ProgressDispatcher::instance()->jobCompleted(alias(), item);
 }
 
 void Folder::slotSyncItemDiscovered(const SyncFileItem & item)
 {
+    switch (item._instruction) {
+    case CSYNC_INSTRUCTION_NONE:
+    case CSYNC_INSTRUCTION_IGNORE:
+        break;
+    case CSYNC_INSTRUCTION_ERROR:
+        _statusTree.setStatus(item.destination(), SyncFileStatus::STATUS_ERROR);
+        break;
+    case CSYNC_INSTRUCTION_NEW:
+        _statusTree.setStatus(item.destination(), SyncFileStatus::STATUS_NEW);
+        break;
+    default:
+        _statusTree.setStatus(item.destination(), SyncFileStatus::STATUS_EVAL);
+        break;
+    }
     emit ProgressDispatcher::instance()->syncItemDiscovered(alias(), item);
 }
 
@@ -22,11 +22,13 @@
 #include "syncjournaldb.h"
 #include "clientproxy.h"
 #include "syncfilestatus.h"
+#include "syncstatustree.h"
 
 #include <csync.h>
 
 #include <QDir>
 #include <QHash>
+#include <QSet>
 #include <QObject>
 #include <QStringList>
 
@@ -40,6 +42,8 @@ class QThread;
 namespace Mirall {
 
 class SyncEngine;
+class SyncRunProcessor;
+struct SyncRunSummary;
 
 class FolderWatcher;
 
@@ -119,6 +123,9 @@ public:
 
      // Used by the Socket API
      SyncJournalDb *journalDb() { return &_journal; }
+
+     /** The entries that are not in sync, as seen by the last or the current sync run */
+     const SyncStatusTree &statusTree() const { return _statusTree; }
      CSYNC *csyncContext() { return _csync_ctx; }
 
      QStringList selectiveSyncBlackList() { return _selectiveSyncBlackList; }
@@ -131,6 +138,10 @@ signals:
     void syncStarted();
     void syncFinished(const SyncResult &result);
     void scheduleToSync( const QString& );
+    /** Only the given top level entries changed on the server, see startSync() */
+    void scheduleToSyncPaths( const QString &alias, const QStringList &pathList );
+    /** Only the given top level entries changed locally, see startSync() */
+    void scheduleToSyncLocalPaths( const QString &alias, const QStringList &pathList );
 
 public slots:
 
@@ -145,10 +156,36 @@ public slots:
      /**
       * Starts a sync operation
       *
-      * If the list of changed files is known, it is passed.
+      * If the list of changed files is known, it is passed. The local tree is then
+      * only walked in these paths and in the ones the file system watcher reported
+      * since the last sync, the rest is read from the journal.
       */
       void startSync(const QStringList &pathList = QStringList());
 
+      /** Called by the file system watcher with the directory in which something changed */
+      void slotWatchedPathChanged(const QString &path);
+
+      /**
+       * Called by the file system watcher with the files and directories that changed.
+       * Schedules a sync of the top level entries they are in.
+       */
+      void slotWatchedPathsChanged(const QStringList &paths);
+
+      /** The file system watcher lost changes: the whole local tree needs to be walked */
+      void slotWatcherLostChanges();
+
+      /** Until the file system watcher is reliable, the whole local tree is walked */
+      void slotWatcherReliableChanged(bool reliable);
+
+      /** The server notified a change, check the etags now instead of waiting for the poll timer */
+      void slotRemoteChangeNotified();
+
+      /**
+       * While the server notifies the changes, the poll timer only runs as a safety net
+       * and for the forced syncs, with a ten times longer interval.
+       */
+      void setRemoteNotificationsActive(bool active);
+
       void setProxyDirty(bool value);
       bool proxyDirty();
 
@@ -160,6 +197,7 @@ private slots:
     void slotSyncError(const QString& );
     void slotCsyncUnavailable();
     void slotSyncFinished();
+    void slotSyncResultProcessed();
 
     void slotFolderDiscovered(bool local, QString folderName);
     void slotTransmissionProgress(const Progress::Info& pi);
@@ -168,6 +206,7 @@ private slots:
 
     void slotPollTimerTimeout();
     void etagRetreived(const QString &);
+    void slotChildEtagsRetrieved(const QHash<QString, QByteArray> &etags);
     void slotNetworkUnavailable();
 
     void slotThreadTreeWalkResult(const SyncFileItemVector& );
@@ -179,10 +218,16 @@ private:
 
     void setIgnoredFiles();
 
-    void bubbleUpSyncResult();
+    void bubbleUpSyncResult(const SyncRunSummary &summary);
 
     void checkLocalPath();
 
+    // the top level entries whose etag differs from the one in the journal
+    QStringList changedRemoteChildren();
+
+    // the top level entry \a path is in, empty for the root or a path outside of the folder
+    QString topLevelEntry(const QString &path) const;
+
     void createGuiLog(const QString& filename, SyncFileStatus status, int count,
                        const QString& renameTarget = QString::null );
 
@@ -193,6 +238,7 @@ private:
     bool       _paused;
     SyncResult _syncResult;
     QScopedPointer<SyncEngine> _engine;
+    QScopedPointer<SyncRunProcessor> _runProcessor;
     QStringList  _errors;
     QStringList _selectiveSyncBlackList;
     bool         _csyncError;
@@ -201,9 +247,18 @@ private:
     bool         _proxyDirty;
     QTimer        _pollTimer;
     QString       _lastEtag;
+    QHash<QString, QByteArray> _remoteChildEtags; // of the last poll
+    // top level entries in which the watcher saw changes since the last sync started
+    QSet<QString> _localChangedPaths;
+    // set if the watcher reported a change in the root, lost changes or was not reliable
+    // since the last sync started, or before the first sync
+    bool          _localChangedRoot;
+    bool          _watcherReliable;
+    bool          _pollAfterSync; // a change was notified during the sync
     QElapsedTimer _timeSinceLastSync;
 
     SyncJournalDb _journal;
+    SyncStatusTree _statusTree;
 
     ClientProxy   _clientProxy;
 
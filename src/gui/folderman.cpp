@@ -38,6 +38,16 @@ namespace Mirall {
 
 FolderMan* FolderMan::_instance = 0;
 
+/* How many folders are synced at the same time at most */
+static int maximumParallelFolders()
+{
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_FOLDERS").toInt();
+    if (max <= 0) {
+        max = 3; //default
+    }
+    return max;
+}
+
 FolderMan::FolderMan(QObject *parent) :
     QObject(parent),
     _syncEnabled( true )
@@ -56,6 +66,10 @@ FolderMan::FolderMan(QObject *parent) :
 
     _socketApi = new SocketApi(this);
     _socketApi->slotReadExcludes();
+
+    _remoteChangeNotifier = new RemoteChangeNotifier(this);
+    connect(_remoteChangeNotifier, SIGNAL(remoteChanged()), SLOT(slotRemoteChanged()));
+    connect(_remoteChangeNotifier, SIGNAL(activeChanged(bool)), SLOT(slotRemoteNotificationsActive(bool)));
 }
 
 FolderMan *FolderMan::instance()
@@ -111,8 +125,10 @@ int FolderMan::unloadAllFolders()
         unloadFolder(i.key());
         cnt++;
     }
-    _currentSyncFolder.clear();
+    _currentSyncFolders.clear();
     _scheduleQueue.clear();
+    _scheduledSyncPaths.clear();
+    _scheduledLocalSyncs.clear();
 
     Q_ASSERT(_folderMap.count() == 0);
     return cnt;
@@ -131,10 +147,15 @@ void FolderMan::registerFolderMonitor( Folder *folder )
         fw->addIgnoreListFile( cfg.excludeFile(MirallConfigFile::SystemScope) );
         fw->addIgnoreListFile( cfg.excludeFile(MirallConfigFile::UserScope) );
 
-        // Connect the folderChanged signal, which comes with the changed path,
-        // to the signal mapper which maps to the folder alias. The changed path
-        // is lost this way, but we do not need it for the current implementation.
-        connect(fw, SIGNAL(folderChanged(QString)), _folderWatcherSignalMapper, SLOT(map()));
+        // The folder keeps track of where the changes are for its next sync, and
+        // schedules a sync of the top level entries in which they are.
+        connect(fw, SIGNAL(pathsChanged(QStringList)), folder, SLOT(slotWatchedPathsChanged(QStringList)));
+        connect(fw, SIGNAL(lostChanges()), folder, SLOT(slotWatcherLostChanges()));
+        connect(fw, SIGNAL(reliableChanged(bool)), folder, SLOT(slotWatcherReliableChanged(bool)));
+        folder->slotWatcherReliableChanged(fw->isReliable());
+        // Lost changes can be anywhere: connect them to the signal mapper which maps
+        // to the folder alias, to schedule a sync of the whole folder.
+        connect(fw, SIGNAL(lostChanges()), _folderWatcherSignalMapper, SLOT(map()));
         _folderWatcherSignalMapper->setMapping(fw, folder->alias());
         _folderWatchers.insert(folder->alias(), fw);
     }
@@ -227,9 +248,9 @@ bool FolderMan::ensureJournalGone(const QString &localPath)
 
 void FolderMan::terminateCurrentSync()
 {
-    if( !_currentSyncFolder.isEmpty() ) {
-        qDebug() << "Terminating syncing on folder " << _currentSyncFolder;
-        terminateSyncProcess( _currentSyncFolder );
+    foreach( const QString &alias, _currentSyncFolders.keys() ) {
+        qDebug() << "Terminating syncing on folder " << alias;
+        terminateSyncProcess( alias );
     }
 }
 
@@ -350,6 +371,9 @@ Folder* FolderMan::setupFolderFromConfigFile(const QString &file) {
 
     /* Use a signal mapper to connect the signals to the alias */
     connect(folder, SIGNAL(scheduleToSync(const QString&)), SLOT(slotScheduleSync(const QString&)));
+    connect(folder, SIGNAL(scheduleToSyncPaths(QString,QStringList)), SLOT(slotScheduleSyncPaths(QString,QStringList)));
+    connect(folder, SIGNAL(scheduleToSyncLocalPaths(QString,QStringList)), SLOT(slotScheduleLocalSyncPaths(QString,QStringList)));
+    folder->setRemoteNotificationsActive(_remoteChangeNotifier->isActive());
     connect(folder, SIGNAL(syncStateChange()), _folderChangeSignalMapper, SLOT(map()));
     connect(folder, SIGNAL(syncStarted()), SLOT(slotFolderSyncStarted()));
     connect(folder, SIGNAL(syncFinished(SyncResult)), SLOT(slotFolderSyncFinished(SyncResult)));
@@ -389,17 +413,15 @@ void FolderMan::slotSetFolderPaused( const QString& alias, bool paused )
 // csync still remains in a stable state, regardless of that.
 void FolderMan::terminateSyncProcess( const QString& alias )
 {
-    QString folderAlias = alias;
     if( alias.isEmpty() ) {
-        folderAlias = _currentSyncFolder;
+        terminateCurrentSync();
+        return;
     }
-    if( ! folderAlias.isEmpty() && _folderMap.contains(folderAlias) ) {
-        Folder *f = _folderMap[folderAlias];
+    if( _folderMap.contains(alias) ) {
+        Folder *f = _folderMap[alias];
         if( f ) {
             f->slotTerminateSync();
-            if(_currentSyncFolder == folderAlias ) {
-                _currentSyncFolder.clear();
-            }
+            _currentSyncFolders.remove(alias);
         }
     }
 }
@@ -437,7 +459,10 @@ void FolderMan::slotScheduleSync( const QString& alias )
 {
     if( alias.isEmpty() ) return;
 
-    if( _currentSyncFolder == alias ) {
+    // Whatever was scheduled before, the whole folder needs to be synced now
+    _scheduledSyncPaths.remove(alias);
+
+    if( _currentSyncFolders.contains(alias) ) {
         qDebug() << "folder " << alias << " is currently syncing. NOT scheduling.";
         return;
     }
@@ -462,6 +487,34 @@ void FolderMan::slotScheduleSync( const QString& alias )
     QTimer::singleShot(500, this, SLOT(slotScheduleFolderSync()));
 }
 
+void FolderMan::slotScheduleSyncPaths( const QString &alias, const QStringList &pathList )
+{
+    if( pathList.isEmpty() || (_scheduleQueue.contains(alias) && !_scheduledSyncPaths.contains(alias)) ) {
+        // Nothing known, or a sync of the whole folder is already scheduled
+        slotScheduleSync(alias);
+        return;
+    }
+
+    QStringList paths = _scheduledSyncPaths.value(alias);
+    foreach (const QString &path, pathList) {
+        if (!paths.contains(path)) {
+            paths.append(path);
+        }
+    }
+    slotScheduleSync(alias);
+    if( _scheduleQueue.contains(alias) ) {
+        _scheduledSyncPaths.insert(alias, paths);
+    }
+}
+
+void FolderMan::slotScheduleLocalSyncPaths( const QString &alias, const QStringList &pathList )
+{
+    slotScheduleSyncPaths(alias, pathList);
+    if( _scheduledSyncPaths.contains(alias) ) {
+        _scheduledLocalSyncs.insert(alias);
+    }
+}
+
 // only enable or disable foldermans will to schedule and do syncs.
 // this is not the same as Pause and Resume of folders.
 void FolderMan::setSyncEnabled( bool enabled )
@@ -471,36 +524,74 @@ void FolderMan::setSyncEnabled( bool enabled )
         QTimer::singleShot(200, this, SLOT(slotScheduleFolderSync()));
     }
     _syncEnabled = enabled;
+    if (enabled) {
+        // does nothing if it is already waiting, or if no endpoint is configured
+        _remoteChangeNotifier->start(AccountManager::instance()->account());
+    } else {
+        _remoteChangeNotifier->stop();
+    }
     // force a redraw in case the network connect status changed
     emit( folderSyncStateChange(QString::null) );
 }
 
+/*
+  * The syncs of the few top level entries in which the file system watcher saw
+  * changes are what the user is waiting for: they go first, and one of the slots
+  * is kept for them so that they never wait behind the syncs of big folders.
+  * The syncs of the entries that changed on the server are not prioritized.
+  */
+QString FolderMan::takeNextScheduledFolder()
+{
+    for( int i = 0; i < _scheduleQueue.count(); ++i ) {
+        const QString &alias = _scheduleQueue.at(i);
+        // a full sync may have been scheduled since
+        if( _scheduledLocalSyncs.contains(alias) && _scheduledSyncPaths.contains(alias) ) {
+            return _scheduleQueue.takeAt(i);
+        }
+    }
+
+    int otherSyncs = 0;
+    foreach( bool localSync, _currentSyncFolders.values() ) {
+        if( !localSync ) {
+            otherSyncs++;
+        }
+    }
+    const int maxOtherSyncs = qMax(1, maximumParallelFolders() - 1);
+    if( otherSyncs >= maxOtherSyncs || _scheduleQueue.isEmpty() ) {
+        return QString();
+    }
+    return _scheduleQueue.dequeue();
+}
+
 /*
   * slot to start folder syncs.
   * It is either called from the slot where folders enqueue themselves for
   * syncing or after a folder sync was finished.
+  * Up to maximumParallelFolders() folders are synced at the same time. Their
+  * propagations share the budget of parallel requests.
   */
 void FolderMan::slotScheduleFolderSync()
 {
-    if( !_currentSyncFolder.isEmpty() ) {
-        qDebug() << "Currently folder " << _currentSyncFolder << " is running, wait for finish!";
-        return;
-    }
-
     if( ! _syncEnabled ) {
         qDebug() << "FolderMan: Syncing is disabled, no scheduling.";
         return;
     }
 
-    qDebug() << "XX slotScheduleFolderSync: folderQueue size: " << _scheduleQueue.count();
-    if( ! _scheduleQueue.isEmpty() ) {
-        const QString alias = _scheduleQueue.dequeue();
+    qDebug() << "XX slotScheduleFolderSync: folderQueue size: " << _scheduleQueue.count()
+             << "running: " << _currentSyncFolders.keys();
+    while( _currentSyncFolders.count() < maximumParallelFolders() ) {
+        const QString alias = takeNextScheduledFolder();
+        if( alias.isEmpty() ) {
+            break;
+        }
         if( _folderMap.contains( alias ) ) {
             Folder *f = _folderMap[alias];
             if( f && !f->syncPaused() ) {
-                _currentSyncFolder = alias;
+                const QStringList paths = _scheduledSyncPaths.take(alias);
+                const bool localSync = _scheduledLocalSyncs.remove(alias) && !paths.isEmpty();
+                _currentSyncFolders.insert(alias, localSync);
 
-                f->startSync( QStringList() );
+                f->startSync( paths );
 
                 // reread the excludes of the socket api
                 // FIXME: the excludes need rework.
@@ -511,22 +602,43 @@ void FolderMan::slotScheduleFolderSync()
     }
 }
 
+void FolderMan::slotRemoteChanged()
+{
+    foreach (Folder *f, _folderMap.values()) {
+        if (f && !f->syncPaused()) {
+            f->slotRemoteChangeNotified();
+        }
+    }
+}
+
+void FolderMan::slotRemoteNotificationsActive(bool active)
+{
+    foreach (Folder *f, _folderMap.values()) {
+        if (f) {
+            f->setRemoteNotificationsActive(active);
+        }
+    }
+}
+
 void FolderMan::slotFolderSyncStarted( )
 {
-    qDebug() << ">===================================== sync started for " << _currentSyncFolder;
+    Folder *f = qobject_cast<Folder *>(sender());
+    qDebug() << ">===================================== sync started for " << (f ? f->alias() : QString());
 }
 
 /*
   * a folder indicates that its syncing is finished.
-  * Start the next sync after the system had some milliseconds to breath.
+  * Its slot is free: start the next sync.
   */
 void FolderMan::slotFolderSyncFinished( const SyncResult& )
 {
-    qDebug() << "<===================================== sync finished for " << _currentSyncFolder;
-
-    _currentSyncFolder.clear();
+    Folder *f = qobject_cast<Folder *>(sender());
+    if( f ) {
+        qDebug() << "<===================================== sync finished for " << f->alias();
+        _currentSyncFolders.remove(f->alias());
+    }
 
-    QTimer::singleShot(200, this, SLOT(slotScheduleFolderSync()));
+    QTimer::singleShot(0, this, SLOT(slotScheduleFolderSync()));
 }
 
 void FolderMan::addFolderDefinition(const QString& alias, const QString& sourceFolder,
@@ -570,6 +682,8 @@ void FolderMan::removeAllFolderDefinitions()
     }
     // clear the queue.
     _scheduleQueue.clear();
+    _scheduledSyncPaths.clear();
+    _scheduledLocalSyncs.clear();
 
 }
 
@@ -577,7 +691,7 @@ void FolderMan::slotRemoveFolder( const QString& alias )
 {
     if( alias.isEmpty() ) return;
 
-    if( _currentSyncFolder == alias ) {
+    if( _currentSyncFolders.contains(alias) ) {
         // terminate if the sync is currently underway.
         terminateSyncProcess( alias );
     }
@@ -590,6 +704,8 @@ void FolderMan::removeFolder( const QString& alias )
     Folder *f = 0;
 
     _scheduleQueue.removeAll(alias);
+    _scheduledSyncPaths.remove(alias);
+    _scheduledLocalSyncs.remove(alias);
 
     if( _folderMap.contains( alias )) {
         qDebug() << "Removing " << alias;
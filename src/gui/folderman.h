@@ -24,6 +24,7 @@
 #include "folder.h"
 #include "folderwatcher.h"
 #include "syncfileitem.h"
+#include "remotechangenotifier.h"
 
 class QSignalMapper;
 
@@ -115,7 +116,7 @@ public slots:
     int unloadAllFolders();
 
     // if enabled is set to false, no new folders will start to sync.
-    // the current one will finish.
+    // the current ones will finish.
     void setSyncEnabled( bool );
 
     void slotScheduleAllFolders();
@@ -125,16 +126,25 @@ public slots:
 
     // slot to add a folder to the syncing queue
     void slotScheduleSync( const QString & );
+    // same, but only the given paths need to be looked at, see Folder::startSync()
+    void slotScheduleSyncPaths( const QString &alias, const QStringList &pathList );
+    // same, for local changes: these syncs go first, see takeNextScheduledFolder()
+    void slotScheduleLocalSyncPaths( const QString &alias, const QStringList &pathList );
 
 private slots:
 
     // slot to take the next folder from queue and start syncing.
     void slotScheduleFolderSync();
 
+    void slotRemoteChanged();
+    void slotRemoteNotificationsActive(bool active);
+
 private:
     // finds all folder configuration files
     // and create the folders
     void terminateCurrentSync();
+    // the next folder of the queue that may start now, or an empty string
+    QString takeNextScheduledFolder();
     QString getBackupName( const QString& ) const;
     void registerFolderMonitor( Folder *folder );
 
@@ -147,11 +157,17 @@ private:
     QString        _folderConfigPath;
     QSignalMapper *_folderChangeSignalMapper;
     QSignalMapper *_folderWatcherSignalMapper;
-    QString        _currentSyncFolder;
+    // the folders that are syncing, and whether it is a sync of local changes
+    QHash<QString, bool> _currentSyncFolders;
     bool           _syncEnabled;
     QQueue<QString> _scheduleQueue;
+    // the paths for the queued folders that do not need a full sync
+    QHash<QString, QStringList> _scheduledSyncPaths;
+    // the queued folders whose paths were reported by the file system watcher
+    QSet<QString> _scheduledLocalSyncs;
     QMap<QString, FolderWatcher*> _folderWatchers;
     QPointer<SocketApi> _socketApi;
+    RemoteChangeNotifier *_remoteChangeNotifier;
 
     static FolderMan *_instance;
     explicit FolderMan(QObject *parent = 0);
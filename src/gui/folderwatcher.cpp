@@ -35,12 +35,63 @@
 
 namespace Mirall {
 
+static int defaultDebounceInterval()
+{
+    static int msec = qgetenv("OWNCLOUD_WATCHER_DEBOUNCE").toInt();
+    if (msec <= 0) {
+        msec = 1000; // default
+    }
+    return msec;
+}
+
+// Above that many changed paths in a window, a full scan is cheaper than the list
+static const int maxPendingPaths = 10000;
+
+void IgnoreMatcher::addPattern(QString pattern)
+{
+    if(pattern.endsWith('/')) {
+        // directory only pattern. But since only dirs are checked, we cut off the trailing slash.
+        pattern.remove(pattern.length()-1, 1); // remove the last char.
+    }
+    QRegExp regexp(pattern, Qt::CaseSensitive, QRegExp::Wildcard);
+    if (pattern.contains('/')) {
+        _pathPatterns.append(regexp);
+    } else {
+        _componentPatterns.append(regexp);
+    }
+}
+
+bool IgnoreMatcher::isIgnored(const QString& path) const
+{
+    foreach (const QRegExp &regexp, _pathPatterns) {
+        if (regexp.exactMatch(path)) {
+            qDebug() << "* Discarded by ignore pattern: " << path;
+            return true;
+        }
+    }
+    if (_componentPatterns.isEmpty()) {
+        return false;
+    }
+    foreach (const QString& comp, path.split('/')) {
+        foreach (const QRegExp &regexp, _componentPatterns) {
+            if (regexp.exactMatch(comp)) {
+                qDebug() << "* Discarded by component ignore pattern " << comp;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 FolderWatcher::FolderWatcher(const QString &root, QObject *parent)
-    : QObject(parent)
+    : QObject(parent), _polledDirectoryCount(0), _reliable(true)
 {
-    _d.reset(new FolderWatcherPrivate(this, root));
+    _flushTimer = new QTimer(this);
+    _flushTimer->setSingleShot(true);
+    _flushTimer->setInterval(defaultDebounceInterval());
+    connect(_flushTimer, SIGNAL(timeout()), SLOT(slotFlushPendingChanges()));
 
-    _timer.start();
+    _d.reset(new FolderWatcherPrivate(this, root));
 }
 
 FolderWatcher::~FolderWatcher()
@@ -58,6 +109,7 @@ void FolderWatcher::addIgnoreListFile( const QString& file )
         QString line = QString::fromLocal8Bit( infile.readLine() ).trimmed();
         if( !(line.startsWith( QLatin1Char('#') ) || line.isEmpty()) ) {
             _ignores.append(line);
+            _ignoreMatcher.addPattern(line);
         }
     }
 }
@@ -70,40 +122,40 @@ QStringList FolderWatcher::ignores() const
 bool FolderWatcher::pathIsIgnored( const QString& path )
 {
     if( path.isEmpty() ) return true;
+    if( _ignoreMatcher.isEmpty() ) return false;
 
     // Remember: here only directories are checked!
     // If that changes to files too at some day, remember to check
     // for the database name as well as the trailing slash rule for
     // dirs only. Best use csync_ignore than somehow.
-    foreach (QString pattern, _ignores) {
-        QRegExp regexp(pattern);
-        regexp.setPatternSyntax(QRegExp::Wildcard);
-
-        QFileInfo fInfo(path);
-        if( fInfo.isHidden() ) {
-            qDebug() << "* Discarded as is hidden!";
-            return true;
-        }
+    QFileInfo fInfo(path);
+    if( fInfo.isHidden() ) {
+        qDebug() << "* Discarded as is hidden!";
+        return true;
+    }
+    return _ignoreMatcher.isIgnored(path);
+}
 
-        if(pattern.endsWith('/')) {
-            // directory only pattern. But since only dirs here, we cut off the trailing dir.
-            pattern.remove(pattern.length()-1, 1); // remove the last char.
-        }
-        // if the pattern contains / it needs to match the entire path
-        if (pattern.contains('/') && regexp.exactMatch(path)) {
-            qDebug() << "* Discarded by ignore pattern: " << path;
-            return true;
-        }
+void FolderWatcher::setPolledDirectoryCount(int count)
+{
+    if (count != _polledDirectoryCount) {
+        qWarning() << "Could not watch" << count << "directories, they are polled";
+    }
+    _polledDirectoryCount = count;
+}
 
-        QStringList components = path.split('/');
-        foreach (const QString& comp, components) {
-            if(regexp.exactMatch(comp)) {
-                qDebug() << "* Discarded by component ignore pattern " << comp;
-                return true;
-            }
-        }
+void FolderWatcher::setReliable(bool reliable)
+{
+    if (reliable != _reliable) {
+        qDebug() << Q_FUNC_INFO << reliable;
+        _reliable = reliable;
+        emit reliableChanged(reliable);
     }
-    return false;
+}
+
+void FolderWatcher::setDebounceInterval(int msec)
+{
+    _flushTimer->setInterval(msec);
 }
 
 void FolderWatcher::changeDetected( const QString& path )
@@ -112,48 +164,82 @@ void FolderWatcher::changeDetected( const QString& path )
     changeDetected(paths);
 }
 
+// The backends that only know which directory changed
 void FolderWatcher::changeDetected( const QStringList& paths )
 {
-    // qDebug() << Q_FUNC_INFO << paths;
+    foreach (const QString &path, paths) {
+        QFileInfo fi(path);
+        if (fi.isDir()) {
+            recordChange(path, path, Modified | Directory);
+        } else {
+            recordChange(path, fi.dir().path(), Modified);
+        }
+    }
+}
 
-    // TODO: this shortcut doesn't look very reliable:
-    //   - why is the timeout only 1 second?
-    //   - what if there are more than one file being updated frequently?
-    //   - why do we skip the file alltogether instead of e.g. reducing the upload frequency?
+void FolderWatcher::changeDetected( const QString& path, int type )
+{
+    recordChange(path, QFileInfo(path).dir().path(), type);
+}
 
-    // Check if the same path was reported within the last second.
-    QSet<QString> pathsSet = paths.toSet();
-    if( pathsSet == _lastPaths && _timer.elapsed() < 1000 ) {
-        // the same path was reported within the last second. Skip.
+void FolderWatcher::recordChange( const QString& path, const QString& folder, int type )
+{
+    // The patterns are for directories: a file is only ignored with its directory
+    if( pathIsIgnored((type & Directory) ? path : folder) ) {
         return;
     }
-    _lastPaths = pathsSet;
-    _timer.restart();
-
-    QSet<QString> changedFolders;
 
-    // ------- handle ignores:
-    for (int i = 0; i < paths.size(); ++i) {
-        QString path = paths[i];
-        if( pathIsIgnored(path) ) {
-            continue;
-        }
+    _pendingPathes[path] |= type;
+    if (_pendingPathes.count() > maxPendingPaths) {
+        qDebug() << Q_FUNC_INFO << "too many changes to keep track of";
+        overflowDetected();
+        return;
+    }
+    if (!_flushTimer->isActive()) {
+        _flushTimer->start();
+    }
 
-        QFileInfo fi(path);
-        if (fi.isDir()) {
-            changedFolders.insert(path);
-        } else {
-            changedFolders.insert(fi.dir().path());
-        }
+    if (!_notifiedFolders.contains(folder)) {
+        _notifiedFolders.insert(folder);
+        qDebug() << "detected changes in folder:" << folder;
+        emit folderChanged(folder);
     }
-    if (changedFolders.isEmpty()) {
+}
+
+void FolderWatcher::overflowDetected()
+{
+    _flushTimer->stop();
+    _pendingPathes.clear();
+    _notifiedFolders.clear();
+    emit lostChanges();
+}
+
+void FolderWatcher::slotFlushPendingChanges()
+{
+    _notifiedFolders.clear();
+    if (_pendingPathes.isEmpty()) {
         return;
     }
 
-    qDebug() << "detected changes in folders:" << changedFolders;
-    foreach (const QString &path, changedFolders) {
-        emit folderChanged(path);
+    // Sorted, the paths below a directory come right after it
+    QStringList paths = _pendingPathes.keys();
+    qSort(paths);
+    QStringList changed;
+    QString wholeDir; // a directory created, removed or moved as a whole, ends with '/'
+    foreach (const QString &path, paths) {
+        if (!wholeDir.isEmpty() && path.startsWith(wholeDir)) {
+            continue;
+        }
+        changed.append(path);
+        const int type = _pendingPathes.value(path);
+        if ((type & Directory) && (type & (Created | Removed | Moved))) {
+            wholeDir = path + QLatin1Char('/');
+        }
     }
+    _pendingPathes.clear();
+
+    qDebug() << Q_FUNC_INFO << changed.count() << "paths changed";
+    emit pathsChanged(changed);
 }
 
 void FolderWatcher::addPath(const QString &path )
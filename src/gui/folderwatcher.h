@@ -22,6 +22,7 @@
 #include <QStringList>
 #include <QTime>
 #include <QHash>
+#include <QRegExp>
 #include <QScopedPointer>
 #include <QSet>
 
@@ -31,10 +32,29 @@ namespace Mirall {
 
 class FolderWatcherPrivate;
 
+/*
+ * The ignore patterns of a FolderWatcher, compiled once. A copy can be
+ * used in another thread.
+ */
+class IgnoreMatcher
+{
+public:
+    void addPattern(QString pattern);
+    bool isEmpty() const { return _pathPatterns.isEmpty() && _componentPatterns.isEmpty(); }
+
+    /* Whether \a path, or one of its components, matches a pattern */
+    bool isIgnored(const QString& path) const;
+
+private:
+    QList<QRegExp> _pathPatterns; // patterns with a '/' match the entire path
+    QList<QRegExp> _componentPatterns;
+};
+
 /*
  * Folder Watcher monitors a directory and its sub directories
  * for changes in the local file system. Changes are signalled
- * through the folderChanged() signal.
+ * through the folderChanged() signal, and collected over a short
+ * window to be signalled all at once through pathsChanged().
  *
  * Note that if new folders are created, this folderwatcher class
  * does not automatically adds them to the list of monitored
@@ -52,6 +72,21 @@ public:
     FolderWatcher(const QString &root, QObject *parent = 0L);
     virtual ~FolderWatcher();
 
+    /** What happened to a path, as far as the backend can tell */
+    enum ChangeType {
+        Modified = 1,  // content or attributes
+        Created = 2,
+        Removed = 4,
+        Moved = 8,     // moved away or moved in
+        Directory = 16 // the path is a directory
+    };
+
+    /**
+     * The changes are collected during \a msec after the first one before pathsChanged()
+     * is emitted. The default is OWNCLOUD_WATCHER_DEBOUNCE, or 1000 ms.
+     */
+    void setDebounceInterval(int msec);
+
     /**
       * Set a file name to load a file with ignore patterns.
       *
@@ -70,13 +105,40 @@ public:
     void addPath(const QString&);
     void removePath(const QString&);
 
-    /* Check if the path is ignored. */
+    /* Check if the directory is ignored, hidden directories are. Not meant for files. */
     bool pathIsIgnored( const QString& path );
 
+    const IgnoreMatcher &ignoreMatcher() const { return _ignoreMatcher; }
+
+    /**
+     * The number of directories that are polled because the system could not watch
+     * them (e.g. inotify's max_user_watches was reached)
+     */
+    int polledDirectoryCount() const { return _polledDirectoryCount; }
+
+    /**
+     * Whether all the changes below the root are reported as they happen. Not the case
+     * while the directories are still being registered, nor while some of them are polled.
+     */
+    bool isReliable() const { return _reliable; }
+
 signals:
-    /** Emitted when one of the paths is changed */
+    /** Emitted when one of the paths is changed, once per directory and debounce window */
     void folderChanged(const QString &path);
 
+    /**
+     * Emitted at the end of a debounce window with the files and directories that changed
+     * during it. Ignored directories and what they contain, and paths below a directory
+     * that was created, removed or moved as a whole, are not in the list.
+     */
+    void pathsChanged(const QStringList &paths);
+
+    /** Some changes were lost (the queue of the system overflowed): everything needs to be looked at */
+    void lostChanges();
+
+    /** Emitted when isReliable() changes */
+    void reliableChanged(bool reliable);
+
     /** Emitted if an error occurs */
     void error(const QString& error);
 
@@ -85,14 +147,33 @@ protected slots:
     void changeDetected( const QString& path);
     void changeDetected( const QStringList& paths);
 
+private slots:
+    void slotFlushPendingChanges();
+
 protected:
+    // called from the implementations with the path that changed and its ChangeType flags
+    void changeDetected( const QString& path, int type );
+    // called from the implementations when they lost events
+    void overflowDetected();
+    // called from the implementations when they fall back to polling for some directories
+    void setPolledDirectoryCount(int count);
+    // called from the implementations that can miss changes for a while
+    void setReliable(bool reliable);
+
+    // the paths changed during the current window, with their ChangeType flags
     QHash<QString, int> _pendingPathes;
 
 private:
+    void recordChange( const QString& path, const QString& folder, int type );
+
     QScopedPointer<FolderWatcherPrivate> _d;
     QStringList _ignores;
-    QTime _timer;
-    QSet<QString> _lastPaths;
+    IgnoreMatcher _ignoreMatcher;
+    int _polledDirectoryCount;
+    bool _reliable;
+    QTimer *_flushTimer;
+    // the directories for which folderChanged() was emitted in the current window
+    QSet<QString> _notifiedFolders;
 
     friend class FolderWatcherPrivate;
 };
@@ -14,23 +14,269 @@
 #include "config.h"
 
 #include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "folder.h"
 #include "folderwatcher_linux.h"
 
 #include <cerrno>
+#include <cstring>
 #include <QDebug>
 #include <QStringList>
 #include <QObject>
-#include <QVarLengthArray>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QVector>
 
 namespace Mirall {
 
+static const uint32_t watchMask = IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE |
+                                  IN_CREATE |IN_DELETE | IN_DELETE_SELF |
+                                  IN_MOVE_SELF |IN_UNMOUNT |IN_ONLYDIR |
+                                  IN_DONT_FOLLOW;
+
+/* How often the directories that could not be watched are polled */
+static int pollInterval()
+{
+    const int msec = qgetenv("OWNCLOUD_WATCHER_POLL_INTERVAL").toInt();
+    return msec > 0 ? msec : 30 * 1000; // default
+}
+
+/* Watches per folder beyond which the directories are polled, 0 for the system limit only */
+static int maxWatches()
+{
+    return qgetenv("OWNCLOUD_WATCHER_MAX_WATCHES").toInt();
+}
+
+/* Same as FolderWatcher::pathIsIgnored(), for the worker threads */
+static bool directoryIsIgnored(const IgnoreMatcher &ignores, const QString &path)
+{
+    if (ignores.isEmpty()) {
+        return false;
+    }
+    if (path.section(QLatin1Char('/'), -1).startsWith(QLatin1Char('.'))) {
+        return true; // hidden
+    }
+    return ignores.isIgnored(path);
+}
+
+class TreeVisitor
+{
+public:
+    virtual ~TreeVisitor() {}
+    /* Called for each directory, the root included. Returns whether to walk it. */
+    virtual bool enterDirectory(const QString &path) = 0;
+    /* Called for each entry of a walked directory, \a dirFd is the one of the directory */
+    virtual void visitEntry(int dirFd, const char *name, const QString &path) { Q_UNUSED(dirFd) Q_UNUSED(name) Q_UNUSED(path) }
+};
+
+static bool entryIsDirectory(int dirFd, const struct dirent *entry)
+{
+    if (entry->d_type != DT_UNKNOWN) {
+        return entry->d_type == DT_DIR;
+    }
+    struct stat st;
+    return fstatat(dirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Walk the tree below \a root without recursion. Each directory is opened relative to its
+ * parent, which stays open while it is walked: the path is never resolved again.
+ * Symbolic links are not followed.
+ */
+struct WalkFrame {
+    DIR *dir;
+    QString path;
+};
+
+static void walkTree(const QString &root, TreeVisitor *visitor, QAtomicInt &aborted)
+{
+    QVector<WalkFrame> stack;
+
+    if (!visitor->enterDirectory(root)) {
+        return;
+    }
+    int fd = open(QFile::encodeName(root).constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = fd < 0 ? 0 : fdopendir(fd);
+    if (!dir) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        qDebug() << Q_FUNC_INFO << "Could not open" << root << strerror(errno);
+        return;
+    }
+    WalkFrame rootFrame = { dir, root };
+    stack.append(rootFrame);
+
+    while (!stack.isEmpty() && !aborted.fetchAndAddRelaxed(0)) {
+        DIR *current = stack.last().dir;
+        const struct dirent *entry = readdir(current);
+        if (!entry) {
+            closedir(current);
+            stack.removeLast();
+            continue;
+        }
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        const int dirFd = dirfd(current);
+        const QString path = stack.last().path + QLatin1Char('/') + QFile::decodeName(entry->d_name);
+        visitor->visitEntry(dirFd, entry->d_name, path);
+        if (!entryIsDirectory(dirFd, entry) || !visitor->enterDirectory(path)) {
+            continue;
+        }
+        int childFd = openat(dirFd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        DIR *child = childFd < 0 ? 0 : fdopendir(childFd);
+        if (!child) {
+            if (childFd >= 0) {
+                close(childFd);
+            }
+            continue;
+        }
+        WalkFrame frame = { child, path };
+        stack.append(frame);
+    }
+
+    // aborted
+    foreach (const WalkFrame &frame, stack) {
+        closedir(frame.dir);
+    }
+}
+
+/*
+ * Adds the watches of a tree, the ones that exist are kept. Once the system refuses
+ * more watches, the directories that remain are the roots of the trees to poll.
+ */
+class InotifyRegistration : public QRunnable, public TreeVisitor
+{
+public:
+    InotifyRegistration(FolderWatcherPrivate *watcher, const QString &root, const IgnoreMatcher &ignores)
+        : _watcher(watcher), _root(root), _ignores(ignores), _exhausted(false), _added(0) {}
+
+    void run() Q_DECL_OVERRIDE {
+        QElapsedTimer timer;
+        timer.start();
+        walkTree(_root, this, _watcher->_aborted);
+        if (_watcher->_aborted.fetchAndAddRelaxed(0)) {
+            return;
+        }
+        qDebug() << "(+) Watcher:" << _root << ":" << _added << "directories registered in"
+                 << timer.elapsed() << "ms";
+        QMetaObject::invokeMethod(_watcher, "slotRegistrationFinished", Qt::QueuedConnection,
+                                  Q_ARG(QStringList, _unwatched));
+    }
+
+    bool enterDirectory(const QString &path) Q_DECL_OVERRIDE {
+        if (path != _root && directoryIsIgnored(_ignores, path)) {
+            return false;
+        }
+        if (_exhausted) {
+            _unwatched.append(path);
+            return false;
+        }
+        // Locked until the watch is in the hash, for the events that come right away
+        QMutexLocker locker(&_watcher->_watchesMutex);
+        if (_watcher->_watchedPaths.contains(path)) {
+            return true;
+        }
+        int wd = -1;
+        if (_watcher->_maxWatches > 0 && _watcher->_watches.count() >= _watcher->_maxWatches) {
+            errno = ENOSPC; // as if the system limit was reached
+        } else {
+            wd = inotify_add_watch(_watcher->_fd, QFile::encodeName(path).constData(), watchMask);
+        }
+        if (wd < 0) {
+            if (errno == ENOSPC) {
+                qWarning() << "Could not watch" << path << ": the inotify watch limit is reached";
+                _exhausted = true;
+                _unwatched.append(path);
+            }
+            return false;
+        }
+        _watcher->_watches.insert(wd, path);
+        _watcher->_watchedPaths.insert(path, wd);
+        _added++;
+        return true;
+    }
+
+private:
+    FolderWatcherPrivate *_watcher;
+    QString _root;
+    IgnoreMatcher _ignores;
+    bool _exhausted;
+    int _added;
+    QStringList _unwatched;
+};
+
+/*
+ * Takes a snapshot of the entries below the directories that are not watched. The
+ * watcher compares it with the previous one in its own thread.
+ */
+class PollScan : public QRunnable, public TreeVisitor
+{
+public:
+    typedef FolderWatcherPrivate::PollSnapshot PollSnapshot;
+
+    PollScan(FolderWatcherPrivate *watcher, const QStringList &roots, const IgnoreMatcher &ignores)
+        : _watcher(watcher), _roots(roots), _ignores(ignores), _directories(0) {}
+
+    void run() Q_DECL_OVERRIDE {
+        foreach (const QString &root, _roots) {
+            _currentRoot = root;
+            walkTree(root, this, _watcher->_aborted);
+        }
+        if (_watcher->_aborted.fetchAndAddRelaxed(0)) {
+            return;
+        }
+        QMetaObject::invokeMethod(_watcher, "slotPollFinished", Qt::QueuedConnection,
+                                  Q_ARG(PollSnapshot, _snapshot), Q_ARG(int, _directories));
+    }
+
+    bool enterDirectory(const QString &path) Q_DECL_OVERRIDE {
+        if (path != _currentRoot && directoryIsIgnored(_ignores, path)) {
+            return false;
+        }
+        _directories++;
+        return true;
+    }
+
+    void visitEntry(int dirFd, const char *name, const QString &path) Q_DECL_OVERRIDE {
+        struct stat st;
+        if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            const qint64 mtime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            _snapshot.insert(path, qMakePair(mtime, qint64(st.st_size)));
+        }
+    }
+
+private:
+    FolderWatcherPrivate *_watcher;
+    QStringList _roots;
+    QString _currentRoot;
+    IgnoreMatcher _ignores;
+    int _directories;
+    PollSnapshot _snapshot;
+};
+
 FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString& path)
     : QObject(),
       _parent(p),
-      _folder(path)
+      _folder(path),
+      _buffer(64 * 1024, Qt::Uninitialized),
+      _pendingRegistrations(0),
+      _maxWatches(maxWatches()),
+      _polling(false)
 {
+    qRegisterMetaType<PollSnapshot>("PollSnapshot");
+    _pool.setMaxThreadCount(1);
+    _pollTimer.setInterval(pollInterval());
+    connect(&_pollTimer, SIGNAL(timeout()), SLOT(slotPoll()));
+
     _fd = inotify_init();
     if (_fd != -1) {
         _socket.reset( new QSocketNotifier(_fd, QSocketNotifier::Read) );
@@ -39,151 +285,193 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString& path
         qDebug() << Q_FUNC_INFO << "notify_init() failed: " << strerror(errno);
     }
 
-    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
-
+    // The root right away, the rest once the ignore files were added.
+    // Changes in the rest are missed until then.
+    p->setReliable(false);
+    inotifyRegisterPath(QDir(path).absolutePath());
+    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Qt::QueuedConnection, Q_ARG(QString, path));
 }
 
 FolderWatcherPrivate::~FolderWatcherPrivate()
 {
-
-}
-
-// attention: result list passed by reference!
-bool FolderWatcherPrivate::findFoldersBelow( const QDir& dir, QStringList& fullList )
-{
-    bool ok = true;
-    if( !(dir.exists() && dir.isReadable()) ) {
-        qDebug() << "Non existing path coming in: " << dir.absolutePath();
-        ok = false;
-    } else {
-        QStringList nameFilter;
-        nameFilter << QLatin1String("*");
-        QDir::Filters filter = QDir::Dirs | QDir::NoDotAndDotDot|QDir::NoSymLinks;
-        const QStringList pathes = dir.entryList(nameFilter, filter);
-
-        QStringList::const_iterator constIterator;
-        for (constIterator = pathes.constBegin(); constIterator != pathes.constEnd();
-               ++constIterator) {
-            const QString fullPath(dir.path()+QLatin1String("/")+(*constIterator));
-            fullList.append(fullPath);
-            ok = findFoldersBelow(QDir(fullPath), fullList);
-        }
+    _aborted.fetchAndStoreOrdered(1);
+    _pool.waitForDone();
+    _socket.reset();
+    if (_fd != -1) {
+        close(_fd);
     }
-
-    return ok;
 }
 
 void FolderWatcherPrivate::inotifyRegisterPath(const QString& path)
 {
     if( !path.isEmpty()) {
-        int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
-                                   IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE |
-                                   IN_CREATE |IN_DELETE | IN_DELETE_SELF |
-                                   IN_MOVE_SELF |IN_UNMOUNT |IN_ONLYDIR |
-                                   IN_DONT_FOLLOW );
+        QMutexLocker locker(&_watchesMutex);
+        if (_watchedPaths.contains(path)) {
+            return;
+        }
+        int wd = inotify_add_watch(_fd, QFile::encodeName(path).constData(), watchMask);
         if( wd > -1 ) {
             _watches.insert(wd, path);
-         }
+            _watchedPaths.insert(path, wd);
+        }
     }
 }
 
 void FolderWatcherPrivate::slotAddFolderRecursive(const QString &path)
 {
-    int subdirs = 0;
-    qDebug() << "(+) Watcher:" << path;
+    if (_fd == -1) {
+        return;
+    }
+    // The directories are registered in the background, a huge tree takes a while
+    const IgnoreMatcher ignores = _parent ? _parent->ignoreMatcher() : IgnoreMatcher();
+    _pendingRegistrations++;
+    updateReliable();
+    _pool.start(new InotifyRegistration(this, QDir(path).absolutePath(), ignores));
+}
 
-    QDir inPath(path);
-    inotifyRegisterPath(inPath.absolutePath());
+void FolderWatcherPrivate::slotRegistrationFinished(const QStringList &unwatched)
+{
+    _pendingRegistrations--;
+    foreach (const QString &path, unwatched) {
+        if (!_unwatched.contains(path)) {
+            _unwatched.append(path);
+        }
+    }
+    if (!_unwatched.isEmpty() && !_pollTimer.isActive()) {
+        qWarning() << "Falling back to polling for" << _unwatched.count() << "directory trees";
+        _pollTimer.start();
+        slotPoll(); // the reference snapshot, and the number of directories
+    }
+    updateReliable();
+}
 
-    const QStringList watchedFolders = _watches.values();
+void FolderWatcherPrivate::updateReliable()
+{
+    if (_parent) {
+        _parent->setReliable(_fd != -1 && _pendingRegistrations == 0 && _unwatched.isEmpty());
+    }
+}
 
-    QStringList allSubfolders;
-    if( !findFoldersBelow(QDir(path), allSubfolders)) {
-        qDebug() << "Could not traverse all sub folders";
+void FolderWatcherPrivate::slotPoll()
+{
+    if (_polling || !_parent) {
+        return;
     }
-    // qDebug() << "currently watching " << watchedFolders;
-    QStringListIterator subfoldersIt(allSubfolders);
-    while (subfoldersIt.hasNext()) {
-        QString subfolder = subfoldersIt.next();
-        // qDebug() << "  (**) subfolder: " << subfolder;
-        QDir folder (subfolder);
-        if (folder.exists() && !watchedFolders.contains(folder.absolutePath())) {
-            subdirs++;
-            if( _parent->pathIsIgnored(subfolder) ) {
-                qDebug() << "* Not adding" << folder.path();
-                continue;
+    if (_unwatched.isEmpty()) {
+        _pollTimer.stop();
+        _pollSnapshot.clear();
+        _parent->setPolledDirectoryCount(0);
+        updateReliable();
+        return;
+    }
+    _polling = true;
+    _pool.start(new PollScan(this, _unwatched, _parent->ignoreMatcher()));
+}
+
+void FolderWatcherPrivate::slotPollFinished(const PollSnapshot &snapshot, int directories)
+{
+    _polling = false;
+
+    // The first scan only makes the reference
+    QStringList changed;
+    if (!_pollSnapshot.isEmpty()) {
+        PollSnapshot::const_iterator it;
+        for (it = snapshot.constBegin(); it != snapshot.constEnd(); ++it) {
+            PollSnapshot::const_iterator old = _pollSnapshot.constFind(it.key());
+            if (old == _pollSnapshot.constEnd() || old.value() != it.value()) {
+                changed.append(it.key());
+            }
+        }
+        for (it = _pollSnapshot.constBegin(); it != _pollSnapshot.constEnd(); ++it) {
+            if (!snapshot.contains(it.key())) {
+                changed.append(it.key());
             }
-            inotifyRegisterPath(folder.absolutePath());
-        } else {
-            qDebug() << "    `-> discarded:" << folder.path();
         }
     }
+    _pollSnapshot = snapshot;
 
-    if (subdirs >0) {
-        qDebug() << "    `-> and" << subdirs << "subdirectories";
+    _parent->setPolledDirectoryCount(directories);
+    foreach (const QString &path, changed) {
+        _parent->changeDetected(path, FolderWatcher::Modified);
     }
 }
 
 void FolderWatcherPrivate::slotReceivedNotification(int fd)
 {
     int len;
-    struct inotify_event* event;
-    int i;
-    int error;
-    QVarLengthArray<char, 2048> buffer(2048);
-
-    do {
-         len = read(fd, buffer.data(), buffer.size());
-         error = errno;
-         /**
-          * From inotify documentation:
-          *
-          * The behavior when the buffer given to read(2) is too
-          * small to return information about the next event
-          * depends on the kernel version: in kernels  before 2.6.21,
-          * read(2) returns 0; since kernel 2.6.21, read(2) fails with
-          * the error EINVAL.
-          */
-         if (len < 0 && error == EINVAL)
-         {
-             // double the buffer size
-             buffer.resize(buffer.size() * 2);
-             /* and try again ... */
-             continue;
-         }
-     } while (false);
-
-    // reset counter
-    i = 0;
-    // while there are enough events in the buffer
-    while(i + sizeof(struct inotify_event) < static_cast<unsigned int>(len)) {
-        // cast an inotify_event
-        event = (struct inotify_event*)&buffer[i];
-        // with the help of watch descriptor, retrieve, corresponding INotify
-        if (event == NULL) {
-            qDebug() << "NULL event";
-            i += sizeof(struct inotify_event);
+    forever {
+        // All the events that are queued are read at once, a burst takes a few reads only
+        len = read(fd, _buffer.data(), _buffer.size());
+        /**
+         * From inotify documentation:
+         *
+         * The behavior when the buffer given to read(2) is too
+         * small to return information about the next event
+         * depends on the kernel version: in kernels  before 2.6.21,
+         * read(2) returns 0; since kernel 2.6.21, read(2) fails with
+         * the error EINVAL.
+         */
+        if (len < 0 && errno == EINVAL) {
+            // double the buffer size and try again
+            _buffer.resize(_buffer.size() * 2);
             continue;
         }
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+
+    int i = 0;
+    // while there are complete events in the buffer
+    while (len > 0 && i + int(sizeof(struct inotify_event)) <= len) {
+        const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(_buffer.constData() + i);
+        i += sizeof(struct inotify_event) + event->len;
 
-        // fire event
-        // Note: The name of the changed file and stuff could be taken from
-        // the event data structure. That does not happen yet.
-        if (event->len > 0 && event->wd > -1) {
-            // qDebug() << Q_FUNC_INFO << event->name;
-            if (QByteArray(event->name).startsWith(".csync") ||
-                    QByteArray(event->name).startsWith(".owncloudsync.log")) {
-                // qDebug() << "ignore journal";
-            } else {
-                const QString p = _watches[event->wd];
-                _parent->changeDetected(p);
+        if (event->mask & IN_Q_OVERFLOW) {
+            qDebug() << Q_FUNC_INFO << "the inotify queue overflowed, changes were lost";
+            _parent->overflowDetected();
+            continue;
+        }
+        QString directory;
+        {
+            QMutexLocker locker(&_watchesMutex);
+            directory = _watches.value(event->wd);
+            if (event->mask & IN_IGNORED) {
+                // the watch was removed, e.g. because the directory is gone
+                _watches.remove(event->wd);
+                _watchedPaths.remove(directory);
+                continue;
             }
         }
+        if (event->len == 0 || directory.isEmpty()) {
+            continue;
+        }
 
-        // increment counter
-        i += sizeof(struct inotify_event) + event->len;
-    }
+        const QByteArray name(event->name); // the name is padded with zeros
+        if (name.startsWith(".csync") || name.startsWith(".owncloudsync.log")) {
+            // ignore journal
+            continue;
+        }
 
+        int type = 0;
+        if (event->mask & (IN_CLOSE_WRITE | IN_ATTRIB)) {
+            type |= FolderWatcher::Modified;
+        }
+        if (event->mask & IN_CREATE) {
+            type |= FolderWatcher::Created;
+        }
+        if (event->mask & IN_DELETE) {
+            type |= FolderWatcher::Removed;
+        }
+        if (event->mask & IN_MOVE) {
+            type |= FolderWatcher::Moved;
+        }
+        if (event->mask & IN_ISDIR) {
+            type |= FolderWatcher::Directory;
+        }
+        _parent->changeDetected(directory + QLatin1Char('/') + QFile::decodeName(name), type);
+    }
 }
 
 void FolderWatcherPrivate::addPath(const QString& path)
@@ -193,20 +481,15 @@ void FolderWatcherPrivate::addPath(const QString& path)
 
 void FolderWatcherPrivate::removePath(const QString& path)
 {
-    int wid = -1;
-    // Remove the inotify watch.
-    QHash<int, QString>::const_iterator i = _watches.constBegin();
+    _unwatched.removeAll(path);
 
-    while (i != _watches.constEnd()) {
-        if( i.value() == path ) {
-            wid = i.key();
-            break;
-        }
-        ++i;
-    }
-    if( wid > -1 )  {
-        inotify_rm_watch(_fd, wid);
-        _watches.remove(wid);
+    // Remove the inotify watch.
+    QMutexLocker locker(&_watchesMutex);
+    QHash<QString, int>::iterator it = _watchedPaths.find(path);
+    if (it != _watchedPaths.end()) {
+        inotify_rm_watch(_fd, it.value());
+        _watches.remove(it.value());
+        _watchedPaths.erase(it);
     }
 }
 
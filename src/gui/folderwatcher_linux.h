@@ -19,37 +19,70 @@
 #include <QSocketNotifier>
 #include <QHash>
 #include <QDir>
+#include <QMutex>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "folderwatcher.h"
 
 namespace Mirall
 {
+
+/*
+ * The directories are registered with inotify in a worker thread, so that
+ * huge trees do not block the GUI. When the system does not allow more
+ * watches, the directories that could not be watched are polled instead.
+ */
 class FolderWatcherPrivate : public QObject
 {
     Q_OBJECT
 public:
-    FolderWatcherPrivate() { }
+    FolderWatcherPrivate() : _parent(0), _fd(-1), _buffer(64 * 1024, Qt::Uninitialized), _pendingRegistrations(0), _maxWatches(0), _polling(false) { }
     FolderWatcherPrivate(FolderWatcher *p, const QString &path);
     ~FolderWatcherPrivate();
 
     void addPath(const QString &path);
     void removePath(const QString &);
 
+    /* The modification time and size of the entries below the polled directories */
+    typedef QHash<QString, QPair<qint64, qint64> > PollSnapshot;
+
 protected slots:
     void slotReceivedNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
+    void slotRegistrationFinished(const QStringList &unwatched);
+    void slotPoll();
+    void slotPollFinished(const PollSnapshot &snapshot, int directories);
 
 protected:
-    bool findFoldersBelow( const QDir& dir, QStringList& fullList );
     void inotifyRegisterPath(const QString& path);
+    void updateReliable();
 
 private:
+    friend class InotifyRegistration;
+    friend class PollScan;
+
     FolderWatcher *_parent;
 
     QString _folder;
+    // the watches, accessed by the registration thread as well
+    QMutex _watchesMutex;
     QHash <int, QString> _watches;
+    QHash <QString, int> _watchedPaths;
     QScopedPointer<QSocketNotifier> _socket;
     int _fd;
+    QByteArray _buffer; // for the events, reused by every read
+
+    QThreadPool _pool; // one thread, for the registrations and the polls
+    QAtomicInt _aborted;
+    int _pendingRegistrations; // started, and not finished yet
+    int _maxWatches; // OWNCLOUD_WATCHER_MAX_WATCHES, 0 for no limit but the system one
+
+    // the roots of the trees that could not be watched
+    QStringList _unwatched;
+    QTimer _pollTimer;
+    bool _polling;
+    PollSnapshot _pollSnapshot; // the last scan, the next one is compared with it
 };
 
 }
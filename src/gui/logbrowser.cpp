@@ -123,6 +123,7 @@ LogBrowser::LogBrowser(QWidget *parent) :
     int lines = cfg.maxLogLines();
     // qDebug() << "#        ##  Have " << lines << " Loglines!";
     _logWidget->document()->setMaximumBlockCount( lines );
+    Logger::instance()->setHistorySize( lines );
 
 }
 
@@ -130,6 +131,13 @@ LogBrowser::~LogBrowser()
 {
 }
 
+void LogBrowser::showEvent(QShowEvent *)
+{
+    // the lines logged while the window was hidden
+    _logWidget->setPlainText( Logger::instance()->history().join(QLatin1String("\n")) );
+    _logWidget->moveCursor(QTextCursor::End);
+}
+
 void LogBrowser::closeEvent(QCloseEvent *)
 {
     MirallConfigFile cfg;
@@ -201,6 +209,7 @@ void LogBrowser::slotSave()
 void LogBrowser::slotClearLog()
 {
     _logWidget->clear();
+    Logger::instance()->clearHistory();
 }
 
 } // namespace
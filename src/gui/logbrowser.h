@@ -48,6 +48,7 @@ public:
     void setLogFile(const QString& , bool );
 
 protected:
+    void showEvent(QShowEvent *) Q_DECL_OVERRIDE;
     void closeEvent(QCloseEvent *) Q_DECL_OVERRIDE;
 
 protected slots:
@@ -33,34 +33,28 @@ namespace Mirall {
 
 ProtocolWidget::ProtocolWidget(QWidget *parent) :
     QWidget(parent),
-    IgnoredIndicatorRole( Qt::UserRole +1 ),
-    _ui(new Ui::ProtocolWidget)
+    _ui(new Ui::ProtocolWidget),
+    _model(new ActivityListModel(this))
 {
     _ui->setupUi(this);
 
     connect(ProgressDispatcher::instance(), SIGNAL(progressInfo(QString,Progress::Info)),
             this, SLOT(slotProgressInfo(QString,Progress::Info)));
 
-    connect(_ui->_treeWidget, SIGNAL(itemActivated(QTreeWidgetItem*,int)), SLOT(slotOpenFile(QTreeWidgetItem*,int)));
-
-    // Adjust copyToClipboard() when making changes here!
-    QStringList header;
-    header << tr("Time");
-    header << tr("File");
-    header << tr("Folder");
-    header << tr("Action");
-    header << tr("Size");
-
-    _ui->_treeWidget->setHeaderLabels( header );
-    _ui->_treeWidget->setColumnWidth(1, 180);
-    _ui->_treeWidget->setColumnCount(5);
-    _ui->_treeWidget->setRootIsDecorated(false);
-    _ui->_treeWidget->setTextElideMode(Qt::ElideMiddle);
-    _ui->_treeWidget->header()->setObjectName("ActivityListHeader");
+    _ui->_treeView->setModel(_model);
+    connect(_ui->_treeView, SIGNAL(activated(QModelIndex)), SLOT(slotOpenFile(QModelIndex)));
+
+    _ui->_treeView->setColumnWidth(ActivityListModel::FileColumn, 180);
+    _ui->_treeView->setRootIsDecorated(false);
+    _ui->_treeView->setTextElideMode(Qt::ElideMiddle);
+    _ui->_treeView->header()->setObjectName("ActivityListHeader");
 #if defined(Q_OS_MAC)
-    _ui->_treeWidget->setMinimumWidth(400);
+    _ui->_treeView->setMinimumWidth(400);
 #endif
 
+    _errorIcon = Theme::instance()->syncStateIcon(SyncResult::Error);
+    _warningIcon = Theme::instance()->syncStateIcon(SyncResult::Problem);
+
     connect(this, SIGNAL(guiLog(QString,QString)), Logger::instance(), SIGNAL(guiLog(QString,QString)));
 
     _clearBlacklistBtn = _ui->_dialogButtonBox->addButton(tr("Retry Sync"), QDialogButtonBox::ActionRole);
@@ -73,13 +67,13 @@ ProtocolWidget::ProtocolWidget(QWidget *parent) :
     connect(_copyBtn, SIGNAL(clicked()), SLOT(copyToClipboard()));
 
     MirallConfigFile cfg;
-    cfg.restoreGeometryHeader(_ui->_treeWidget->header());
+    cfg.restoreGeometryHeader(_ui->_treeView->header());
 }
 
 ProtocolWidget::~ProtocolWidget()
 {
     MirallConfigFile cfg;
-    cfg.saveGeometryHeader(_ui->_treeWidget->header() );
+    cfg.saveGeometryHeader(_ui->_treeView->header() );
 
     delete _ui;
 }
@@ -89,25 +83,25 @@ void ProtocolWidget::copyToClipboard()
     QString text;
     QTextStream ts(&text);
 
-    int topLevelItems = _ui->_treeWidget->topLevelItemCount();
-    for (int i = 0; i < topLevelItems; i++) {
-        QTreeWidgetItem *child = _ui->_treeWidget->topLevelItem(i);
+    _model->flush();
+    int rows = _model->rowCount();
+    for (int i = 0; i < rows; i++) {
         ts << left
                 // time stamp
             << qSetFieldWidth(10)
-            << child->data(0,Qt::DisplayRole).toString()
+            << _model->index(i, ActivityListModel::TimeColumn).data().toString()
                 // file name
             << qSetFieldWidth(64)
-            << child->data(1,Qt::DisplayRole).toString()
+            << _model->index(i, ActivityListModel::FileColumn).data().toString()
                 // folder
             << qSetFieldWidth(15)
-            << child->data(2, Qt::DisplayRole).toString()
+            << _model->index(i, ActivityListModel::FolderColumn).data().toString()
                 // action
             << qSetFieldWidth(15)
-            << child->data(3, Qt::DisplayRole).toString()
+            << _model->index(i, ActivityListModel::ActionColumn).data().toString()
                 // size
             << qSetFieldWidth(10)
-            << child->data(4, Qt::DisplayRole).toString()
+            << _model->index(i, ActivityListModel::SizeColumn).data().toString()
             << qSetFieldWidth(0)
             << endl;
     }
@@ -132,46 +126,14 @@ void ProtocolWidget::slotClearBlacklist()
 
 void ProtocolWidget::cleanIgnoreItems(const QString& folder)
 {
-    int itemCnt = _ui->_treeWidget->topLevelItemCount();
-
-    // Limit the number of items
-    while(itemCnt > 2000) {
-        delete _ui->_treeWidget->takeTopLevelItem(itemCnt - 1);
-        itemCnt--;
-    }
-
-    for( int cnt = itemCnt-1; cnt >=0 ; cnt-- ) {
-        QTreeWidgetItem *item = _ui->_treeWidget->topLevelItem(cnt);
-        bool isErrorItem = item->data(0, IgnoredIndicatorRole).toBool();
-        QString itemFolder = item->data(2, Qt::DisplayRole).toString();
-        if( isErrorItem && itemFolder == folder ) {
-            delete item;
-        }
-    }
+    _model->removeIgnoredEntries(folder);
 }
 
-QString ProtocolWidget::timeString(QDateTime dt, QLocale::FormatType format) const
+void ProtocolWidget::slotOpenFile( const QModelIndex& index )
 {
-    QLocale loc = QLocale::system();
-    QString timeStr;
-    QDate today = QDate::currentDate();
-
-    if( format == QLocale::NarrowFormat ) {
-        if( dt.date().day() == today.day() ) {
-            timeStr = loc.toString(dt.time(), QLocale::NarrowFormat);
-        } else {
-            timeStr = loc.toString(dt, QLocale::NarrowFormat);
-        }
-    } else {
-        timeStr = loc.toString(dt, format);
-    }
-    return timeStr;
-}
-
-void ProtocolWidget::slotOpenFile( QTreeWidgetItem *item, int )
-{
-    QString folderName = item->text(2);
-    QString fileName = item->text(1);
+    const ActivityListModel::Entry entry = _model->entry(index.row());
+    QString folderName = entry.folder;
+    QString fileName = entry.file;
 
     Folder *folder = FolderMan::instance()->folder(folderName);
     if (folder) {
@@ -183,46 +145,32 @@ void ProtocolWidget::slotOpenFile( QTreeWidgetItem *item, int )
     }
 }
 
-QTreeWidgetItem* ProtocolWidget::createCompletedTreewidgetItem(const QString& folder, const SyncFileItem& item)
+ActivityListModel::Entry ProtocolWidget::createCompletedEntry(const QString& folder, const SyncFileItem& item)
 {
-    QStringList columns;
-    QDateTime timestamp = QDateTime::currentDateTime();
-    const QString timeStr = timeString(timestamp);
-    const QString longTimeStr = timeString(timestamp, QLocale::LongFormat);
-    QIcon icon;
-    QString message;
-
-    columns << timeStr;
-    columns << item._file;
-    columns << folder;
+    ActivityListModel::Entry entry;
+    entry.timestamp = QDateTime::currentDateTime();
+    entry.file = item._file;
+    entry.folder = folder;
     if (Progress::isWarningKind(item._status)) {
-        message= item._errorString;
-        columns << message;
+        entry.message = item._errorString;
         if (item._status == SyncFileItem::NormalError || item._status == SyncFileItem::FatalError) {
-            icon = Theme::instance()->syncStateIcon(SyncResult::Error);
+            entry.icon = _errorIcon;
         } else {
-            icon = Theme::instance()->syncStateIcon(SyncResult::Problem);
+            entry.icon = _warningIcon;
         }
 
     } else {
-        message = Progress::asResultString(item);
-        columns << message;
+        entry.message = Progress::asResultString(item);
         if (Progress::isSizeDependent(item._instruction)) {
-            columns <<  Utility::octetsToString( item._size );
+            entry.size = item._size;
         }
     }
 
-    QTreeWidgetItem *twitem = new QTreeWidgetItem(columns);
     if (item._status == SyncFileItem::FileIgnored) {
         // Tell that we want to remove it on the next sync.
-        twitem->setData(0, IgnoredIndicatorRole, true);
+        entry.ignored = true;
     }
-
-    twitem->setIcon(0, icon);
-    twitem->setToolTip(0, longTimeStr);
-    twitem->setToolTip(1, item._file);
-    twitem->setToolTip(3, message );
-    return twitem;
+    return entry;
 }
 
 void ProtocolWidget::computeResyncButtonEnabled()
@@ -258,12 +206,9 @@ void ProtocolWidget::slotProgressInfo( const QString& folder, const Progress::In
     SyncFileItem last = progress._lastCompletedItem;
     if (last.isEmpty()) return;
 
-    QTreeWidgetItem *item = createCompletedTreewidgetItem(folder, last);
-    if(item) {
-        _ui->_treeWidget->insertTopLevelItem(0, item);
-        if (!_copyBtn->isEnabled()) {
-            _copyBtn->setEnabled(true);
-        }
+    _model->addEntry(createCompletedEntry(folder, last));
+    if (!_copyBtn->isEnabled()) {
+        _copyBtn->setEnabled(true);
     }
 }
 
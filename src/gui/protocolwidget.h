@@ -15,10 +15,10 @@
 #define PROTOCOLWIDGET_H
 
 #include <QDialog>
-#include <QDateTime>
-#include <QLocale>
+#include <QIcon>
 
 #include "progressdispatcher.h"
+#include "activitylistmodel.h"
 
 #include "ui_protocolwidget.h"
 
@@ -43,7 +43,7 @@ signals:
 
 public slots:
     void slotProgressInfo( const QString& folder, const Progress::Info& progress );
-    void slotOpenFile( QTreeWidgetItem* item, int );
+    void slotOpenFile( const QModelIndex& index );
 
 protected slots:
     void copyToClipboard();
@@ -57,12 +57,12 @@ private:
     void cleanIgnoreItems( const QString& folder );
     void computeResyncButtonEnabled();
 
-    QTreeWidgetItem* createCompletedTreewidgetItem(const QString &folder, const SyncFileItem &item );
+    ActivityListModel::Entry createCompletedEntry(const QString &folder, const SyncFileItem &item );
 
-    QString timeString(QDateTime dt, QLocale::FormatType format = QLocale::NarrowFormat) const;
-
-    const int IgnoredIndicatorRole;
     Ui::ProtocolWidget *_ui;
+    ActivityListModel *_model;
+    QIcon _errorIcon;
+    QIcon _warningIcon;
     QPushButton *_clearBlacklistBtn;
     QPushButton *_copyBtn;
 };
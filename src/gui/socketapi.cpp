@@ -22,22 +22,15 @@
 #include "theme.h"
 #include "syncjournalfilerecord.h"
 #include "syncfileitem.h"
-#include "version.h"
 
 #include <QDebug>
 #include <QUrl>
-#include <QMetaObject>
 #include <QStringList>
 #include <QScopedPointer>
 #include <QFile>
 #include <QDir>
 #include <QApplication>
 
-// This is the version that is returned when the client asks for the VERSION.
-// The first number should be changed if there is an incompatible change that breaks old clients.
-// The second number should be changed when there are new features.
-#define MIRALL_SOCKET_API_VERSION "1.0"
-
 extern "C" {
 
 enum csync_exclude_type_e {
@@ -63,59 +56,11 @@ namespace Mirall {
 
 namespace SocketApiHelper {
 
-SyncFileStatus fileStatus(Folder *folder, const QString& systemFileName, c_strlist_t *excludes );
-
-/**
- * @brief recursiveFolderStatus
- * @param fileName - the relative file name to examine
- * @return the resulting status
- *
- * The resulting status can only be either SYNC which means all files
- * are in sync, ERROR if an error occured, or EVAL if something needs
- * to be synced underneath this dir.
- */
-// compute the file status of a directory recursively. It returns either
-// "all in sync" or "needs update" or "error", no more details.
-SyncFileStatus recursiveFolderStatus(Folder *folder, const QString& fileName, c_strlist_t *excludes  )
-{
-    QDir dir(folder->path() + fileName);
-
-    const QStringList dirEntries = dir.entryList( QDir::AllEntries | QDir::NoDotAndDotDot );
-
-    SyncFileStatus result(SyncFileStatus::STATUS_SYNC);
-
-    foreach( const QString entry, dirEntries ) {
-        QString normalizedFile = QString(fileName + QLatin1Char('/') + entry).normalized(QString::NormalizationForm_C);
-        QFileInfo fi(entry);
-        SyncFileStatus sfs;
-
-        if( fi.isDir() ) {
-            sfs = recursiveFolderStatus(folder, normalizedFile, excludes );
-        } else {
-            QString fs( normalizedFile );
-            if( fileName.isEmpty() ) {
-                // toplevel, no slash etc. needed.
-                fs = entry.normalized(QString::NormalizationForm_C);
-            }
-            sfs = fileStatus(folder, fs, excludes);
-        }
-
-        if( sfs.tag() == SyncFileStatus::STATUS_STAT_ERROR || sfs.tag() == SyncFileStatus::STATUS_ERROR ) {
-            return SyncFileStatus::STATUS_ERROR;
-        } else if( sfs.tag() == SyncFileStatus::STATUS_EVAL || sfs.tag() == SyncFileStatus::STATUS_NEW) {
-            result.set(SyncFileStatus::STATUS_EVAL);
-        }
-    }
-    return result;
-}
-
 /**
  * Get status about a single file.
  */
 SyncFileStatus fileStatus(Folder *folder, const QString& systemFileName, c_strlist_t *excludes )
 {
-    // FIXME: Find a way for STATUS_ERROR
-
     QString file = folder->path();
     QString fileName = systemFileName.normalized(QString::NormalizationForm_C);
 
@@ -161,15 +106,16 @@ SyncFileStatus fileStatus(Folder *folder, const QString& systemFileName, c_strli
         return SyncFileStatus(SyncFileStatus::STATUS_NEW);
     }
 
-    SyncFileStatus status(SyncFileStatus::STATUS_NONE);
-    if( type == CSYNC_FTW_TYPE_DIR ) {
-        // compute recursive status of the directory
-        status = recursiveFolderStatus( folder, fileName, excludes );
-    } else if(fi.lastModified() != rec._modtime ) {
-        // file was locally modified.
-        status.set(SyncFileStatus::STATUS_EVAL);
-    } else {
-        status.set(SyncFileStatus::STATUS_SYNC);
+    // The status tree knows the entries that are not in sync, and for a directory
+    // whether something below it needs to be synced or had an error.
+    SyncFileStatus status(folder->statusTree().status(unixFileName));
+    if( status.tag() == SyncFileStatus::STATUS_NONE ) {
+        if( type == CSYNC_FTW_TYPE_FILE && fi.lastModified() != rec._modtime ) {
+            // file was locally modified.
+            status.set(SyncFileStatus::STATUS_EVAL);
+        } else {
+            status.set(SyncFileStatus::STATUS_SYNC);
+        }
     }
 
     if (rec._remotePerm.contains("S")) {
@@ -184,16 +130,11 @@ SyncFileStatus fileStatus(Folder *folder, const QString& systemFileName, c_strli
 }
 
 SocketApi::SocketApi(QObject* parent)
-    : QObject(parent)
-    , _localServer(new QTcpServer(this))
+    : SocketApiServer(parent)
     , _excludes(0)
 {
     // setup socket
-    DEBUG << "Establishing SocketAPI server at" << PORT;
-    if (!_localServer->listen(QHostAddress::LocalHost, PORT)) {
-        DEBUG << "Failed to bind to port" << PORT;
-    }
-    connect(_localServer, SIGNAL(newConnection()), this, SLOT(slotNewConnection()));
+    listen(PORT, localSocketPath());
 
     // folder watcher
     connect(FolderMan::instance(), SIGNAL(folderSyncStateChange(QString)), this, SLOT(slotUpdateFolderView(QString)));
@@ -206,10 +147,22 @@ SocketApi::SocketApi(QObject* parent)
 SocketApi::~SocketApi()
 {
     DEBUG << "dtor";
-    _localServer->close();
     slotClearExcludesList();
 }
 
+QString SocketApi::localSocketPath()
+{
+#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
+    return QString();
+#else
+    QString runtimeDir = QFile::decodeName(qgetenv("XDG_RUNTIME_DIR"));
+    if (runtimeDir.isEmpty()) {
+        runtimeDir = MirallConfigFile().configPath();
+    }
+    return runtimeDir + QLatin1Char('/') + Theme::instance()->appName() + QLatin1String("/socket");
+#endif
+}
+
 void SocketApi::slotClearExcludesList()
 {
     c_strlist_clear(_excludes);
@@ -231,56 +184,13 @@ void SocketApi::slotReadExcludes()
     }
 }
 
-void SocketApi::slotNewConnection()
+void SocketApi::listenerAdded(QIODevice *)
 {
-    QTcpSocket* socket = _localServer->nextPendingConnection();
-
-    if( ! socket ) {
-        return;
-    }
-    DEBUG << "New connection" << socket;
-    connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadSocket()));
-    connect(socket, SIGNAL(disconnected()), this, SLOT(onLostConnection()));
-    Q_ASSERT(socket->readAll().isEmpty());
-
-    _listeners.append(socket);
-
     foreach( QString alias, FolderMan::instance()->map().keys() ) {
        slotRegisterPath(alias);
     }
 }
 
-void SocketApi::onLostConnection()
-{
-    DEBUG << "Lost connection " << sender();
-
-    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
-    _listeners.removeAll(socket);
-}
-
-
-void SocketApi::slotReadSocket()
-{
-    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
-    Q_ASSERT(socket);
-
-    while(socket->canReadLine()) {
-        QString line = QString::fromUtf8(socket->readLine()).trimmed();
-        QString command = line.split(":").first();
-        QString function = QString(QLatin1String("command_")).append(command);
-
-        QString functionWithArguments = function + QLatin1String("(QString,QTcpSocket*)");
-        int indexOfMethod = this->metaObject()->indexOfMethod(functionWithArguments.toAscii());
-
-        QString argument = line.remove(0, command.length()+1).trimmed();
-        if(indexOfMethod != -1) {
-            QMetaObject::invokeMethod(this, function.toAscii(), Q_ARG(QString, argument), Q_ARG(QTcpSocket*, socket));
-        } else {
-            DEBUG << "The command is not supported by this version of the client:" << command << "with argument:" << argument;
-        }
-    }
-}
-
 void SocketApi::slotRegisterPath( const QString& alias )
 {
     Folder *f = FolderMan::instance()->folder(alias);
@@ -330,7 +240,7 @@ void SocketApi::slotJobCompleted(const QString &folder, const SyncFileItem &item
     if (Progress::isWarningKind(item._status)) {
         command = QLatin1String("ERROR");
     }
-    broadcastMessage(QLatin1String("STATUS"), path, command);
+    queueStatusChange(f->path(), path, command);
 }
 
 void SocketApi::slotSyncItemDiscovered(const QString &folder, const SyncFileItem &item)
@@ -347,87 +257,21 @@ void SocketApi::slotSyncItemDiscovered(const QString &folder, const SyncFileItem
     const QString path = f->path() + item.destination();
 
     const QString command = QLatin1String("SYNC");
-    broadcastMessage(QLatin1String("STATUS"), path, command);
-}
-
-
-
-void SocketApi::sendMessage(QTcpSocket *socket, const QString& message, bool doWait)
-{
-    DEBUG << "Sending message: " << message;
-    QString localMessage = message;
-    if( ! localMessage.endsWith(QLatin1Char('\n'))) {
-        localMessage.append(QLatin1Char('\n'));
-    }
-    qint64 sent = socket->write(localMessage.toUtf8());
-    if( doWait ) {
-        socket->waitForBytesWritten(1000);
-    }
-    if( sent != localMessage.toUtf8().length() ) {
-        qDebug() << "WARN: Could not send all data on socket for " << localMessage;
-    }
-
-}
-
-void SocketApi::broadcastMessage( const QString& verb, const QString& path, const QString& status, bool doWait )
-{
-    QString msg(verb);
-
-    if( !status.isEmpty() ) {
-        msg.append(QLatin1Char(':'));
-        msg.append(status);
-    }
-    if( !path.isEmpty() ) {
-        msg.append(QLatin1Char(':'));
-        msg.append(QDir::toNativeSeparators(path));
-    }
-
-    DEBUG << "Broadcasting to" << _listeners.count() << "listeners: " << msg;
-    foreach(QTcpSocket *socket, _listeners) {
-        sendMessage(socket, msg, doWait);
-    }
+    queueStatusChange(f->path(), path, command);
 }
 
-void SocketApi::command_RETRIEVE_FOLDER_STATUS(const QString& argument, QTcpSocket* socket)
+QString SocketApi::fileStatus(const QString &path)
 {
-    // This command is the same as RETRIEVE_FILE_STATUS
-
-    qDebug() << Q_FUNC_INFO << argument;
-    command_RETRIEVE_FILE_STATUS(argument, socket);
-}
-
-void SocketApi::command_RETRIEVE_FILE_STATUS(const QString& argument, QTcpSocket* socket)
-{
-    if( !socket ) {
-        qDebug() << "No valid socket object.";
-        return;
-    }
-
-    qDebug() << Q_FUNC_INFO << argument;
-
-    QString statusString;
-
-    Folder* syncFolder = FolderMan::instance()->folderForPath( argument );
+    Folder* syncFolder = FolderMan::instance()->folderForPath( path );
     if (!syncFolder) {
         // this can happen in offline mode e.g.: nothing to worry about
-        DEBUG << "folder offline or not watched:" << argument;
-        statusString = QLatin1String("NOP");
-    } else {
-        const QString file = argument.mid(syncFolder->path().length());
-        SyncFileStatus fileStatus = SocketApiHelper::fileStatus(syncFolder, file, _excludes);
-
-        statusString = fileStatus.toSocketAPIString();
+        DEBUG << "folder offline or not watched:" << path;
+        return QLatin1String("NOP");
     }
 
-    QString message = QLatin1String("STATUS:")+statusString+QLatin1Char(':')
-            +QDir::toNativeSeparators(argument);
-    sendMessage(socket, message);
+    const QString file = path.mid(syncFolder->path().length());
+    SyncFileStatus fileStatus = SocketApiHelper::fileStatus(syncFolder, file, _excludes);
+    return fileStatus.toSocketAPIString();
 }
 
-void SocketApi::command_VERSION(const QString&, QTcpSocket* socket)
-{
-    sendMessage(socket, QLatin1String("VERSION:" MIRALL_VERSION_STRING ":" MIRALL_SOCKET_API_VERSION));
-}
-
-
 } // namespace Mirall
@@ -20,19 +20,19 @@ extern "C" {
 #include <std/c_string.h>
 }
 
-#include <QWeakPointer>
-#include <QTcpSocket>
-#include <QTcpServer>
-
+#include "socketapiserver.h"
 #include "syncfileitem.h"
 
-class QUrl;
-class QLocalSocket;
-class QStringList;
-
 namespace Mirall {
 
-class SocketApi : public QObject
+/**
+ * @brief The server side of the file manager integration
+ *
+ * Listens on the TCP port on localhost, and on Linux on a unix domain socket in the
+ * runtime directory. Answers with the statuses of the files of the folders, and
+ * pushes their changes during the syncs.
+ */
+class SocketApi : public SocketApiServer
 {
 Q_OBJECT
 
@@ -40,6 +40,9 @@ public:
     SocketApi(QObject* parent);
     virtual ~SocketApi();
 
+    /** The path of the unix domain socket, empty where there is none */
+    static QString localSocketPath();
+
 public slots:
     void slotUpdateFolderView(const QString&);
     void slotUnregisterPath( const QString& alias );
@@ -47,24 +50,14 @@ public slots:
     void slotReadExcludes();
     void slotClearExcludesList();
 private slots:
-    void slotNewConnection();
-    void onLostConnection();
-    void slotReadSocket();
     void slotJobCompleted(const QString &, const SyncFileItem &);
     void slotSyncItemDiscovered(const QString &, const SyncFileItem &);
 
-private:
-    void sendMessage(QTcpSocket* socket, const QString& message, bool doWait = false);
-    void broadcastMessage(const QString& verb, const QString &path, const QString &status = QString::null, bool doWait = false);
-
-    Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString& argument, QTcpSocket* socket);
-    Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString& argument, QTcpSocket* socket);
-
-    Q_INVOKABLE void command_VERSION(const QString& argument, QTcpSocket* socket);
+protected:
+    QString fileStatus(const QString &path) Q_DECL_OVERRIDE;
+    void listenerAdded(QIODevice *socket) Q_DECL_OVERRIDE;
 
 private:
-    QTcpServer *_localServer;
-    QList<QTcpSocket*> _listeners;
     c_strlist_t *_excludes;
 };
 
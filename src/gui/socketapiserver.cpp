@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) by Dominik Schmidt <dev@dominik-schmidt.de>
+ * Copyright (C) by Klaas Freitag <freitag@owncloud.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "socketapiserver.h"
+
+#include "version.h"
+
+#include <QDebug>
+#include <QMetaObject>
+#include <QStringList>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+// This is the version that is returned when the client asks for the VERSION.
+// The first number should be changed if there is an incompatible change that breaks old clients.
+// The second number should be changed when there are new features.
+#define MIRALL_SOCKET_API_VERSION "1.1"
+
+namespace {
+    // separates the paths of RETRIEVE_STATUS_BATCH
+    const QChar batchSeparator(0x1f);
+
+    // the status changes are pushed at most that often
+    int pushInterval()
+    {
+        static int interval = qgetenv("OWNCLOUD_SOCKETAPI_PUSH_INTERVAL").toInt();
+        if (interval <= 0) {
+            interval = 200; //default
+        }
+        return interval;
+    }
+
+    // a folder with more changes in one interval gets an UPDATE_VIEW instead
+    const int maxPushedPaths = 500;
+}
+
+namespace Mirall {
+
+#define DEBUG qDebug() << "SocketApi: "
+
+SocketApiServer::SocketApiServer(QObject* parent)
+    : QObject(parent)
+    , _localServer(0)
+    , _unixServer(0)
+{
+    _pushTimer.setSingleShot(true);
+    _pushTimer.setInterval(pushInterval());
+    connect(&_pushTimer, SIGNAL(timeout()), this, SLOT(slotFlushStatusChanges()));
+}
+
+SocketApiServer::~SocketApiServer()
+{
+    if (_localServer) {
+        _localServer->close();
+    }
+    if (_unixServer) {
+        _unixServer->close();
+    }
+}
+
+void SocketApiServer::listen(quint16 port, const QString &socketPath)
+{
+    if (port != 0) {
+        _localServer = new QTcpServer(this);
+        DEBUG << "Establishing SocketAPI server at" << port;
+        if (!_localServer->listen(QHostAddress::LocalHost, port)) {
+            DEBUG << "Failed to bind to port" << port;
+        }
+        connect(_localServer, SIGNAL(newConnection()), this, SLOT(slotNewConnection()));
+    }
+
+    if (!socketPath.isEmpty()) {
+        QDir().mkpath(QFileInfo(socketPath).path());
+        // a stale socket of a crashed instance would make listen() fail
+        QLocalServer::removeServer(socketPath);
+        _unixServer = new QLocalServer(this);
+        DEBUG << "Establishing SocketAPI server at" << socketPath;
+        if (_unixServer->listen(socketPath)) {
+            QFile::setPermissions(socketPath, QFile::ReadOwner | QFile::WriteOwner);
+        } else {
+            DEBUG << "Failed to listen on" << socketPath << _unixServer->errorString();
+        }
+        connect(_unixServer, SIGNAL(newConnection()), this, SLOT(slotNewLocalConnection()));
+    }
+}
+
+void SocketApiServer::slotNewConnection()
+{
+    addListener(_localServer->nextPendingConnection());
+}
+
+void SocketApiServer::slotNewLocalConnection()
+{
+    addListener(_unixServer->nextPendingConnection());
+}
+
+void SocketApiServer::addListener(QIODevice *socket)
+{
+    if( ! socket ) {
+        return;
+    }
+    DEBUG << "New connection" << socket;
+    connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadSocket()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(onLostConnection()));
+    Q_ASSERT(socket->readAll().isEmpty());
+
+    _listeners.append(socket);
+    listenerAdded(socket);
+}
+
+void SocketApiServer::onLostConnection()
+{
+    DEBUG << "Lost connection " << sender();
+
+    QIODevice* socket = qobject_cast<QIODevice*>(sender());
+    _listeners.removeAll(socket);
+    socket->deleteLater();
+}
+
+
+void SocketApiServer::slotReadSocket()
+{
+    QIODevice* socket = qobject_cast<QIODevice*>(sender());
+    Q_ASSERT(socket);
+
+    while(socket->canReadLine()) {
+        QString line = QString::fromUtf8(socket->readLine()).trimmed();
+        QString command = line.split(":").first();
+        QString function = QString(QLatin1String("command_")).append(command);
+
+        QString functionWithArguments = function + QLatin1String("(QString,QIODevice*)");
+        int indexOfMethod = this->metaObject()->indexOfMethod(functionWithArguments.toAscii());
+
+        QString argument = line.remove(0, command.length()+1).trimmed();
+        if(indexOfMethod != -1) {
+            QMetaObject::invokeMethod(this, function.toAscii(), Q_ARG(QString, argument), Q_ARG(QIODevice*, socket));
+        } else {
+            DEBUG << "The command is not supported by this version of the client:" << command << "with argument:" << argument;
+        }
+    }
+}
+
+void SocketApiServer::queueStatusChange(const QString &folderPath, const QString &path, const QString &status)
+{
+    if (_listeners.isEmpty()) {
+        return;
+    }
+    // only the latest status of a path is sent
+    _pendingStatus[folderPath].insert(path, status);
+    if (!_pushTimer.isActive()) {
+        _pushTimer.start();
+    }
+}
+
+void SocketApiServer::slotFlushStatusChanges()
+{
+    _pushTimer.stop();
+    if (_pendingStatus.isEmpty()) {
+        return;
+    }
+
+    QString messages;
+    QHash<QString, QHash<QString, QString> >::const_iterator folderIt;
+    for (folderIt = _pendingStatus.constBegin(); folderIt != _pendingStatus.constEnd(); ++folderIt) {
+        if (folderIt.value().count() > maxPushedPaths) {
+            // cheaper for the client to ask again for what it shows
+            messages += QLatin1String("UPDATE_VIEW:") + QDir::toNativeSeparators(folderIt.key()) + QLatin1Char('\n');
+            continue;
+        }
+        QHash<QString, QString>::const_iterator it;
+        for (it = folderIt.value().constBegin(); it != folderIt.value().constEnd(); ++it) {
+            messages += QLatin1String("STATUS:") + it.value() + QLatin1Char(':')
+                    + QDir::toNativeSeparators(it.key()) + QLatin1Char('\n');
+        }
+    }
+    _pendingStatus.clear();
+
+    DEBUG << "Pushing status changes to" << _listeners.count() << "listeners";
+    foreach(QIODevice *socket, _listeners) {
+        sendMessage(socket, messages);
+    }
+}
+
+
+
+void SocketApiServer::sendMessage(QIODevice *socket, const QString& message, bool doWait)
+{
+    if( message.count(QLatin1Char('\n')) <= 1 ) {
+        DEBUG << "Sending message: " << message;
+    }
+    QString localMessage = message;
+    if( ! localMessage.endsWith(QLatin1Char('\n'))) {
+        localMessage.append(QLatin1Char('\n'));
+    }
+    qint64 sent = socket->write(localMessage.toUtf8());
+    if( doWait ) {
+        socket->waitForBytesWritten(1000);
+    }
+    if( sent != localMessage.toUtf8().length() ) {
+        qDebug() << "WARN: Could not send all data on socket for " << localMessage;
+    }
+
+}
+
+void SocketApiServer::broadcastMessage( const QString& verb, const QString& path, const QString& status, bool doWait )
+{
+    // keep the order: the pending status changes were emitted before
+    slotFlushStatusChanges();
+
+    QString msg(verb);
+
+    if( !status.isEmpty() ) {
+        msg.append(QLatin1Char(':'));
+        msg.append(status);
+    }
+    if( !path.isEmpty() ) {
+        msg.append(QLatin1Char(':'));
+        msg.append(QDir::toNativeSeparators(path));
+    }
+
+    DEBUG << "Broadcasting to" << _listeners.count() << "listeners: " << msg;
+    foreach(QIODevice *socket, _listeners) {
+        sendMessage(socket, msg, doWait);
+    }
+}
+
+void SocketApiServer::command_RETRIEVE_FOLDER_STATUS(const QString& argument, QIODevice* socket)
+{
+    // This command is the same as RETRIEVE_FILE_STATUS
+
+    qDebug() << Q_FUNC_INFO << argument;
+    command_RETRIEVE_FILE_STATUS(argument, socket);
+}
+
+void SocketApiServer::command_RETRIEVE_FILE_STATUS(const QString& argument, QIODevice* socket)
+{
+    if( !socket ) {
+        qDebug() << "No valid socket object.";
+        return;
+    }
+
+    qDebug() << Q_FUNC_INFO << argument;
+
+    sendMessage(socket, statusMessage(argument));
+}
+
+/**
+ * The status of many files and directories in one request: the paths are separated
+ * by the ASCII unit separator (0x1f). The STATUS lines of all of them are sent back
+ * at once, in the order of the request.
+ */
+void SocketApiServer::command_RETRIEVE_STATUS_BATCH(const QString& argument, QIODevice* socket)
+{
+    if( !socket ) {
+        qDebug() << "No valid socket object.";
+        return;
+    }
+
+    const QStringList paths = argument.split(batchSeparator, QString::SkipEmptyParts);
+    qDebug() << Q_FUNC_INFO << paths.count() << "paths";
+    if( paths.isEmpty() ) {
+        return;
+    }
+
+    QString messages;
+    foreach( const QString &path, paths ) {
+        messages += statusMessage(path) + QLatin1Char('\n');
+    }
+    sendMessage(socket, messages);
+}
+
+QString SocketApiServer::statusMessage(const QString &path)
+{
+    return QLatin1String("STATUS:") + fileStatus(path) + QLatin1Char(':')
+            + QDir::toNativeSeparators(path);
+}
+
+void SocketApiServer::command_VERSION(const QString&, QIODevice* socket)
+{
+    sendMessage(socket, QLatin1String("VERSION:" MIRALL_VERSION_STRING ":" MIRALL_SOCKET_API_VERSION));
+}
+
+
+} // namespace Mirall
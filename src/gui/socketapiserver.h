@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) by Dominik Schmidt <dev@dominik-schmidt.de>
+ * Copyright (C) by Klaas Freitag <freitag@owncloud.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+
+#ifndef SOCKETAPISERVER_H
+#define SOCKETAPISERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QTimer>
+
+class QIODevice;
+class QTcpServer;
+class QLocalServer;
+
+namespace Mirall {
+
+/**
+ * @brief The protocol of the file manager integration, without the folders
+ *
+ * The clients connect to a TCP port on localhost, or to a unix domain socket.
+ * The protocol is line based, a request "COMMAND:argument" calls the command_
+ * method of that name. The status changes are pushed coalesced: the latest status
+ * of a path is sent at most every pushInterval() ms, and a folder with too many
+ * changes gets a single UPDATE_VIEW instead.
+ *
+ * The statuses come from fileStatus(), see SocketApi.
+ */
+class SocketApiServer : public QObject
+{
+Q_OBJECT
+
+public:
+    SocketApiServer(QObject* parent);
+    virtual ~SocketApiServer();
+
+    /** Listens on \a port of localhost unless it is 0, and on \a socketPath unless it is empty */
+    void listen(quint16 port, const QString &socketPath);
+
+private slots:
+    void slotNewConnection();
+    void slotNewLocalConnection();
+    void onLostConnection();
+    void slotReadSocket();
+    void slotFlushStatusChanges();
+
+protected:
+    /** The status of a file or directory, e.g. "OK" or "NOP" */
+    virtual QString fileStatus(const QString &path) = 0;
+    /** Called for each client that connects */
+    virtual void listenerAdded(QIODevice *socket) { Q_UNUSED(socket) }
+
+    void sendMessage(QIODevice* socket, const QString& message, bool doWait = false);
+    void broadcastMessage(const QString& verb, const QString &path, const QString &status = QString::null, bool doWait = false);
+    /** Pushes \a status for \a path with the other changes, \a folderPath is the folder it is in */
+    void queueStatusChange(const QString &folderPath, const QString &path, const QString &status);
+
+private:
+    void addListener(QIODevice *socket);
+    QString statusMessage(const QString &path);
+
+    Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString& argument, QIODevice* socket);
+    Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString& argument, QIODevice* socket);
+    Q_INVOKABLE void command_RETRIEVE_STATUS_BATCH(const QString& argument, QIODevice* socket);
+
+    Q_INVOKABLE void command_VERSION(const QString& argument, QIODevice* socket);
+
+    QTcpServer *_localServer;
+    QLocalServer *_unixServer;
+    QList<QIODevice*> _listeners;
+
+    // the status changes not pushed yet: path -> status, per folder path
+    QHash<QString, QHash<QString, QString> > _pendingStatus;
+    QTimer _pushTimer;
+};
+
+}
+#endif // SOCKETAPISERVER_H
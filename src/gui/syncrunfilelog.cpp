@@ -84,7 +84,7 @@ QString SyncRunFileLog::instructionToStr( csync_instructions_e inst )
 }
 
 
-void SyncRunFileLog::start(const QString &folderPath,  const Utility::StopWatch &stopWatch )
+void SyncRunFileLog::start(const QString &folderPath)
 {
     const qint64 logfileMaxSize = 1024*1024; // 1MiB
 
@@ -105,9 +105,6 @@ void SyncRunFileLog::start(const QString &folderPath,  const Utility::StopWatch
     _file->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
     _out.setDevice( _file.data() );
 
-    QDateTime dt = stopWatch.startTime();
-    QDateTime de = stopWatch.timeOfLap(QLatin1String("Sync Finished"));
-
     if (!exists) {
         // We are creating a new file, add the note.
         _out << "# timestamp | duration | file | instruction | dir | modtime | etag | "
@@ -119,8 +116,8 @@ void SyncRunFileLog::start(const QString &folderPath,  const Utility::StopWatch
     }
 
 
-    _out << "#=#=#=# Syncrun started " << dateTimeStr(dt) << " until " << dateTimeStr(de) << " ("
-            << stopWatch.durationOfLap(QLatin1String("Sync Finished")) << " msec)" << endl;
+    _out << "#=#=#=# Syncrun started " << dateTimeStr(QDateTime::currentDateTime()) << endl;
+    _duration.start();
 }
 
 void SyncRunFileLog::logItem( const SyncFileItem& item )
@@ -156,11 +153,19 @@ void SyncRunFileLog::logItem( const SyncFileItem& item )
     _out << item.log._other_fileId << L;
     _out << instructionToStr(item.log._other_instruction) << L;
 
-    _out << endl;
+    // flushed by the caller, once per batch of items
+    _out << QLatin1Char('\n');
+}
+
+void SyncRunFileLog::flush()
+{
+    _out.flush();
 }
 
 void SyncRunFileLog::close()
 {
+    _out << "#=#=#=# Syncrun finished " << dateTimeStr(QDateTime::currentDateTime()) << " ("
+            << _duration.elapsed() << " msec)" << endl;
     _file->close();
 }
 
@@ -14,6 +14,7 @@
 #ifndef SYNCRUNFILELOG_H
 #define SYNCRUNFILELOG_H
 
+#include <QElapsedTimer>
 #include <QFile>
 #include <QTextStream>
 #include <QScopedPointer>
@@ -28,8 +29,9 @@ class SyncRunFileLog
 {
 public:
     SyncRunFileLog();
-    void start( const QString& folderPath, const Utility::StopWatch& stopWatch );
+    void start( const QString& folderPath );
     void logItem( const SyncFileItem& item );
+    void flush();
     void close();
 
 protected:
@@ -41,6 +43,7 @@ private:
 
     QScopedPointer<QFile> _file;
     QTextStream _out;
+    QElapsedTimer _duration;
 
 };
 }
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncrunprocessor.h"
+
+#include "syncrunfilelog.h"
+
+#include <QDebug>
+#include <QMetaObject>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+
+namespace Mirall {
+
+const int SyncRunProcessor::maxSummaryErrors;
+
+SyncRunSummary::SyncRunSummary()
+    : newItems(0)
+    , removedItems(0)
+    , updatedItems(0)
+    , renamedItems(0)
+    , ignoredItems(0)
+    , errorCount(0)
+{
+}
+
+void SyncRunSummary::addItem(const SyncFileItem &item)
+{
+    if( item._status == SyncFileItem::FatalError || item._status == SyncFileItem::NormalError ) {
+        if (errors.size() < SyncRunProcessor::maxSummaryErrors) {
+            errors.append(qMakePair(item._file, item._errorString));
+        }
+        errorCount++;
+        return;
+    }
+
+    if (item._direction == SyncFileItem::Down) {
+        switch (item._instruction) {
+        case CSYNC_INSTRUCTION_NEW:
+            newItems++;
+            if (firstItemNew.isEmpty())
+                firstItemNew = item;
+            break;
+        case CSYNC_INSTRUCTION_REMOVE:
+            removedItems++;
+            if (firstItemDeleted.isEmpty())
+                firstItemDeleted = item;
+            break;
+        case CSYNC_INSTRUCTION_CONFLICT:
+        case CSYNC_INSTRUCTION_SYNC:
+            updatedItems++;
+            if (firstItemUpdated.isEmpty())
+                firstItemUpdated = item;
+            break;
+        case CSYNC_INSTRUCTION_ERROR:
+            qDebug() << "Got Instruction ERROR. " << item._file << item._errorString;
+            break;
+        case CSYNC_INSTRUCTION_RENAME:
+            if (firstItemRenamed.isEmpty()) {
+                firstItemRenamed = item;
+            }
+            renamedItems++;
+            break;
+        default:
+            // nothing.
+            break;
+        }
+    } else if( item._direction == SyncFileItem::None ) { // ignored files counting.
+        if( item._instruction == CSYNC_INSTRUCTION_IGNORE ) {
+            ignoredItems++;
+        }
+    }
+}
+
+/*
+ * What the processor and its worker share. The worker keeps a reference,
+ * so that it can finish the log once the processor is gone.
+ */
+struct SyncRunState
+{
+    SyncRunState(SyncRunProcessor *p, const QString &path)
+        : processor(p)
+        , folderPath(path)
+        , finishRequested(false)
+        , workerRunning(false)
+        , done(false)
+        , logStarted(false)
+    {
+    }
+
+    SyncRunProcessor *processor; // 0 once it is destroyed
+    QString folderPath;
+
+    QMutex mutex;
+    SyncFileItemVector pending;
+    bool finishRequested;
+    bool workerRunning;
+    bool done;
+
+    // used by the worker, or once it is done
+    bool logStarted;
+    SyncRunFileLog log;
+    SyncRunSummary summary;
+};
+
+/*
+ * Handles the pending items of one processor. There is at most one worker
+ * per processor at a time, so the items of a run keep their order.
+ */
+class SyncRunWorker : public QRunnable
+{
+public:
+    explicit SyncRunWorker(const QSharedPointer<SyncRunState> &state) : _state(state) {}
+    void run() Q_DECL_OVERRIDE;
+private:
+    QSharedPointer<SyncRunState> _state;
+};
+
+void SyncRunWorker::run()
+{
+    SyncRunState *state = _state.data();
+    if (!state->logStarted) {
+        state->log.start(state->folderPath);
+        state->logStarted = true;
+    }
+
+    forever {
+        SyncFileItemVector items;
+        bool finishing;
+        {
+            QMutexLocker locker(&state->mutex);
+            items.swap(state->pending);
+            finishing = state->finishRequested;
+            if (items.isEmpty() && !finishing) {
+                if (!state->processor) {
+                    // the sync did not finish, the log still gets its last items
+                    state->log.close();
+                }
+                state->workerRunning = false;
+                return;
+            }
+        }
+
+        foreach (const SyncFileItem &item, items) {
+            state->log.logItem(item);
+            state->summary.addItem(item);
+        }
+        state->log.flush();
+
+        if (finishing) {
+            // finish() comes after the last addItem(): everything is in
+            state->log.close();
+            QMutexLocker locker(&state->mutex);
+            state->done = true;
+            state->workerRunning = false;
+            if (state->processor) {
+                QMetaObject::invokeMethod(state->processor, "finished", Qt::QueuedConnection);
+            }
+            return;
+        }
+    }
+}
+
+SyncRunProcessor::SyncRunProcessor(const QString &folderPath, QObject *parent)
+    : QObject(parent)
+    , _state(new SyncRunState(this, folderPath))
+{
+}
+
+SyncRunProcessor::~SyncRunProcessor()
+{
+    QMutexLocker locker(&_state->mutex);
+    _state->processor = 0;
+    if (!_state->workerRunning && _state->logStarted && !_state->done) {
+        // the sync did not finish, the log still gets its last items
+        _state->log.close();
+    }
+}
+
+void SyncRunProcessor::addItem(const SyncFileItem &item)
+{
+    QMutexLocker locker(&_state->mutex);
+    if (_state->finishRequested) {
+        qDebug() << Q_FUNC_INFO << "Item completed after the end of the sync:" << item._file;
+        return;
+    }
+    _state->pending.append(item);
+    startWorker();
+}
+
+void SyncRunProcessor::finish()
+{
+    QMutexLocker locker(&_state->mutex);
+    if (_state->finishRequested) {
+        return;
+    }
+    _state->finishRequested = true;
+    startWorker();
+}
+
+SyncRunSummary SyncRunProcessor::summary() const
+{
+    QMutexLocker locker(&_state->mutex);
+    if (!_state->done) {
+        return SyncRunSummary();
+    }
+    return _state->summary;
+}
+
+// Must be called with the mutex locked
+void SyncRunProcessor::startWorker()
+{
+    if (!_state->workerRunning) {
+        _state->workerRunning = true;
+        QThreadPool::globalInstance()->start(new SyncRunWorker(_state));
+    }
+}
+
+}
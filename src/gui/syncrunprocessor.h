@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SYNCRUNPROCESSOR_H
+#define SYNCRUNPROCESSOR_H
+
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QSharedPointer>
+
+#include "syncfileitem.h"
+
+namespace Mirall {
+
+struct SyncRunState;
+
+/**
+ * @brief What a sync run did, counted from its completed items
+ */
+struct SyncRunSummary
+{
+    SyncRunSummary();
+
+    void addItem(const SyncFileItem &item);
+
+    int newItems;
+    int removedItems;
+    int updatedItems;
+    int renamedItems;
+    int ignoredItems;
+    int errorCount;
+
+    // the first downloaded item of each kind, for the notifications
+    SyncFileItem firstItemNew;
+    SyncFileItem firstItemDeleted;
+    SyncFileItem firstItemUpdated;
+    SyncFileItem firstItemRenamed;
+
+    // file name and error string of the first errorCount items in error
+    QList<QPair<QString, QString> > errors;
+};
+
+/**
+ * @brief Writes the sync run file log and counts the items off the GUI thread
+ *
+ * The items are handed over with addItem() as they complete; a worker of
+ * the global thread pool appends them to the .owncloudsync.log of the
+ * folder in batches and adds them to the summary. Once finish() was called
+ * and the worker caught up, the log is closed and finished() is emitted.
+ */
+class SyncRunProcessor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncRunProcessor(const QString &folderPath, QObject *parent = 0);
+    /** Does not wait: the worker logs the items handed over so far and closes the log on its own */
+    ~SyncRunProcessor();
+
+    void addItem(const SyncFileItem &item);
+    void finish();
+
+    /** Complete once finished() was emitted */
+    SyncRunSummary summary() const;
+
+    static const int maxSummaryErrors = 50;
+
+signals:
+    void finished();
+
+private:
+    void startWorker();
+
+    // shared with the worker, which may outlive the processor
+    QSharedPointer<SyncRunState> _state;
+};
+
+}
+
+#endif // SYNCRUNPROCESSOR_H
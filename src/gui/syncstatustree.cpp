@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncstatustree.h"
+
+#include <QStringList>
+#include <QVarLengthArray>
+
+namespace Mirall {
+
+static bool isError(SyncFileStatus::SyncFileStatusTag tag)
+{
+    return tag == SyncFileStatus::STATUS_ERROR || tag == SyncFileStatus::STATUS_STAT_ERROR;
+}
+
+static bool isPending(SyncFileStatus::SyncFileStatusTag tag)
+{
+    return tag == SyncFileStatus::STATUS_EVAL || tag == SyncFileStatus::STATUS_NEW;
+}
+
+SyncStatusTree::SyncStatusTree()
+    : _root(new Node)
+{
+}
+
+SyncStatusTree::~SyncStatusTree()
+{
+    delete _root;
+}
+
+void SyncStatusTree::setStatus(const QString &path, SyncFileStatus::SyncFileStatusTag tag)
+{
+    if (isError(tag)) {
+        tag = SyncFileStatus::STATUS_ERROR;
+    } else if (!isPending(tag)) {
+        tag = SyncFileStatus::STATUS_NONE;
+    }
+
+    const QStringList components = path.split(QLatin1Char('/'), QString::SkipEmptyParts);
+    if (components.isEmpty()) {
+        return; // the folder itself is never stored
+    }
+
+    QVarLengthArray<Node *, 32> chain;
+    chain.append(_root);
+    foreach (const QString &component, components) {
+        Node *node = chain.last()->children.value(component);
+        if (!node) {
+            if (tag == SyncFileStatus::STATUS_NONE) {
+                return; // nothing to remove
+            }
+            node = new Node;
+            chain.last()->children.insert(component, node);
+        }
+        chain.append(node);
+    }
+
+    Node *leaf = chain.last();
+    const int errorDelta = int(isError(tag)) - int(isError(leaf->own));
+    const int pendingDelta = int(isPending(tag)) - int(isPending(leaf->own));
+    leaf->own = tag;
+    for (int i = 0; i < chain.size(); ++i) {
+        chain[i]->errors += errorDelta;
+        chain[i]->pending += pendingDelta;
+    }
+
+    // Remove the nodes that do not hold anything anymore
+    for (int i = chain.size() - 1; i > 0; --i) {
+        Node *node = chain[i];
+        if (node->own != SyncFileStatus::STATUS_NONE || !node->children.isEmpty()) {
+            break;
+        }
+        chain[i - 1]->children.remove(components.at(i - 1));
+        delete node;
+    }
+}
+
+SyncFileStatus::SyncFileStatusTag SyncStatusTree::status(const QString &path) const
+{
+    const Node *node = _root;
+    foreach (const QString &component, path.split(QLatin1Char('/'), QString::SkipEmptyParts)) {
+        node = node->children.value(component);
+        if (!node) {
+            return SyncFileStatus::STATUS_NONE;
+        }
+    }
+
+    if (node->errors > 0) {
+        return SyncFileStatus::STATUS_ERROR;
+    }
+    if (node->own != SyncFileStatus::STATUS_NONE) {
+        return node->own;
+    }
+    if (node->pending > 0) {
+        return SyncFileStatus::STATUS_EVAL;
+    }
+    return SyncFileStatus::STATUS_NONE;
+}
+
+int SyncStatusTree::count() const
+{
+    return _root->errors + _root->pending;
+}
+
+void SyncStatusTree::clear()
+{
+    delete _root;
+    _root = new Node;
+}
+
+}
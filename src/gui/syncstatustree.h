@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef MIRALL_SYNCSTATUSTREE_H
+#define MIRALL_SYNCSTATUSTREE_H
+
+#include <QHash>
+#include <QString>
+
+#include "syncfilestatus.h"
+
+namespace Mirall {
+
+/**
+ * @brief The entries of a folder that are not in sync, as a tree
+ *
+ * Only the entries that need to be synced or that could not be synced are
+ * stored, so that the tree stays small. Every node counts the errors and the
+ * pending entries below it, the status of a directory is thus known without
+ * looking at its content: a lookup is linear in the depth of the path.
+ */
+class SyncStatusTree
+{
+public:
+    SyncStatusTree();
+    ~SyncStatusTree();
+
+    /**
+     * Set the status of the entry at \a path, relative to the folder.
+     * STATUS_ERROR and STATUS_STAT_ERROR are stored as errors, STATUS_EVAL and
+     * STATUS_NEW as pending, every other status removes the entry.
+     */
+    void setStatus(const QString &path, SyncFileStatus::SyncFileStatusTag tag);
+
+    /**
+     * The status of \a path: STATUS_ERROR if it or an entry below it has an error,
+     * its own status if it has one, STATUS_EVAL if an entry below it is pending,
+     * and STATUS_NONE if the tree knows nothing about it.
+     */
+    SyncFileStatus::SyncFileStatusTag status(const QString &path) const;
+
+    /** The number of entries that are not in sync */
+    int count() const;
+
+    void clear();
+
+private:
+    struct Node {
+        Node() : own(SyncFileStatus::STATUS_NONE), errors(0), pending(0) {}
+        ~Node() { qDeleteAll(children); }
+
+        QHash<QString, Node *> children;
+        SyncFileStatus::SyncFileStatusTag own;
+        int errors;  // in this node and below
+        int pending; // in this node and below
+    };
+
+    Q_DISABLE_COPY(SyncStatusTree)
+
+    Node *_root;
+};
+
+}
+
+#endif
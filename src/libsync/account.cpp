@@ -18,6 +18,7 @@
 #include "mirallconfigfile.h"
 #include "mirallaccessmanager.h"
 #include "quotainfo.h"
+#include "connectionmanager.h"
 #include "owncloudtheme.h"
 #include "creds/abstractcredentials.h"
 #include "creds/credentialsfactory.h"
@@ -70,6 +71,7 @@ Account::Account(AbstractSslErrorHandler *sslErrorHandler, QObject *parent)
     , _sslErrorHandler(sslErrorHandler)
     , _quotaInfo(new QuotaInfo(this))
     , _am(0)
+    , _connectionManager(new ConnectionManager(this))
     , _credentials(0)
     , _treatSslErrorsAsFailure(false)
     , _state(Account::Disconnected)
@@ -229,6 +231,7 @@ void Account::setCredentials(AbstractCredentials *cred)
     if (jar) {
         _am->setCookieJar(jar);
     }
+    _connectionManager->setAccessManager(_am);
     connect(_am, SIGNAL(sslErrors(QNetworkReply*,QList<QSslError>)),
             SLOT(slotHandleErrors(QNetworkReply*,QList<QSslError>)));
 }
@@ -261,6 +264,7 @@ QNetworkReply *Account::headRequest(const QString &relPath)
 QNetworkReply *Account::headRequest(const QUrl &url)
 {
     QNetworkRequest request(url);
+    _connectionManager->prepareRequest(request);
     return _am->head(request);
 }
 
@@ -272,6 +276,7 @@ QNetworkReply *Account::getRequest(const QString &relPath)
 QNetworkReply *Account::getRequest(const QUrl &url)
 {
     QNetworkRequest request(url);
+    _connectionManager->prepareRequest(request);
     return _am->get(request);
 }
 
@@ -283,6 +288,7 @@ QNetworkReply *Account::davRequest(const QByteArray &verb, const QString &relPat
 QNetworkReply *Account::davRequest(const QByteArray &verb, const QUrl &url, QNetworkRequest req, QIODevice *data)
 {
     req.setUrl(url);
+    _connectionManager->prepareRequest(req);
     return _am->sendCustomRequest(req, verb, data);
 }
 
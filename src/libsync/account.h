@@ -35,6 +35,7 @@ class AbstractCredentials;
 class Account;
 class QuotaInfo;
 class MirallAccessManager;
+class ConnectionManager;
 
 class OWNCLOUDSYNC_EXPORT AccountManager : public QObject {
     Q_OBJECT
@@ -153,6 +154,9 @@ public:
 
     QNetworkAccessManager* networkAccessManager();
 
+    /** Keeps the TLS session and the connection statistics across access managers */
+    ConnectionManager *connectionManager() const { return _connectionManager; }
+
     QuotaInfo *quotaInfo();
 signals:
     void stateChanged(int state);
@@ -168,6 +172,7 @@ private:
     QScopedPointer<AbstractSslErrorHandler> _sslErrorHandler;
     QuotaInfo *_quotaInfo;
     QNetworkAccessManager *_am;
+    ConnectionManager *_connectionManager;
     AbstractCredentials* _credentials;
     bool _treatSslErrorsAsFailure;
     int _state;
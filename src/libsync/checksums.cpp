@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "checksums.h"
+
+#include <QFile>
+#include <QThreadPool>
+#include <QDebug>
+
+namespace Mirall {
+
+static const quint32 adlerBase = 65521;
+// Largest number of bytes that can be summed before the 32 bit sums could overflow
+static const qint64 adlerMaxRun = 5552;
+
+ContentChecksum::ContentChecksum(Type type)
+    : _type(type), _bytesHashed(0), _sha1(QCryptographicHash::Sha1), _adlerA(1), _adlerB(0)
+{
+}
+
+ContentChecksum::Type ContentChecksum::configuredType()
+{
+    static Type type = NoChecksum;
+    static bool initialized = false;
+    if (!initialized) {
+        QByteArray env = qgetenv("OWNCLOUD_CHECKSUM_TYPE").toLower();
+        if (env == "none") {
+            type = NoChecksum;
+        } else if (env == "adler32") {
+            type = Adler32;
+        } else {
+            type = SHA1;
+        }
+        initialized = true;
+    }
+    return type;
+}
+
+ContentChecksum::Type ContentChecksum::typeOf(const QByteArray &checksum)
+{
+    if (checksum.startsWith("SHA1:")) {
+        return SHA1;
+    } else if (checksum.startsWith("Adler32:")) {
+        return Adler32;
+    }
+    return NoChecksum;
+}
+
+QByteArray ContentChecksum::fileChecksum(const QString &fileName, Type type)
+{
+    if (type == NoChecksum) {
+        return QByteArray();
+    }
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << Q_FUNC_INFO << "Could not open" << fileName << file.errorString();
+        return QByteArray();
+    }
+    ContentChecksum checksum(type);
+    if (!checksum.hashUpTo(&file, file.size())) {
+        return QByteArray();
+    }
+    return checksum.result();
+}
+
+void ContentChecksum::addData(qint64 offset, const char *data, qint64 len)
+{
+    if (offset > _bytesHashed || offset + len <= _bytesHashed) {
+        // Not contiguous with what we have, or already hashed.
+        return;
+    }
+    const qint64 skip = _bytesHashed - offset;
+    data += skip;
+    len -= skip;
+    _bytesHashed += len;
+
+    switch (_type) {
+    case SHA1:
+        _sha1.addData(data, len);
+        break;
+    case Adler32: {
+        const uchar *p = reinterpret_cast<const uchar *>(data);
+        while (len > 0) {
+            qint64 run = qMin(len, adlerMaxRun);
+            len -= run;
+            while (run--) {
+                _adlerA += *p++;
+                _adlerB += _adlerA;
+            }
+            _adlerA %= adlerBase;
+            _adlerB %= adlerBase;
+        }
+        break;
+    }
+    case NoChecksum:
+        break;
+    }
+}
+
+bool ContentChecksum::hashUpTo(QIODevice *device, qint64 end)
+{
+    if (_bytesHashed >= end) {
+        return true;
+    }
+    if (!device->seek(_bytesHashed)) {
+        return false;
+    }
+    QByteArray buffer(int(qMin<qint64>(end - _bytesHashed, 1024 * 1024)), Qt::Uninitialized);
+    while (_bytesHashed < end) {
+        qint64 r = device->read(buffer.data(), qMin<qint64>(end - _bytesHashed, buffer.size()));
+        if (r <= 0) {
+            qDebug() << Q_FUNC_INFO << "Could not read the data to hash:" << device->errorString();
+            return false;
+        }
+        addData(_bytesHashed, buffer.constData(), r);
+    }
+    return true;
+}
+
+QByteArray ContentChecksum::result()
+{
+    switch (_type) {
+    case SHA1:
+        return "SHA1:" + _sha1.result().toHex();
+    case Adler32:
+        return "Adler32:" + QByteArray::number((_adlerB << 16) | _adlerA, 16).rightJustified(8, '0');
+    case NoChecksum:
+        break;
+    }
+    return QByteArray();
+}
+
+QThreadPool *ComputeChecksum::threadPool()
+{
+    static QThreadPool *pool = 0;
+    if (!pool) {
+        pool = new QThreadPool;
+        int threads = qgetenv("OWNCLOUD_CHECKSUM_THREADS").toInt();
+        pool->setMaxThreadCount(threads > 0 ? threads : 2);
+    }
+    return pool;
+}
+
+void ComputeChecksum::start(const QString &fileName, ContentChecksum::Type type)
+{
+    ChecksumRunnable *runnable = new ChecksumRunnable(fileName, type);
+    connect(runnable, SIGNAL(done(QByteArray)), this, SIGNAL(done(QByteArray)), Qt::QueuedConnection);
+    threadPool()->start(runnable);
+}
+
+void ChecksumRunnable::run()
+{
+    emit done(ContentChecksum::fileChecksum(_fileName, _type));
+    deleteLater();
+}
+
+}
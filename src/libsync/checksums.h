@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+
+#include <owncloudlib.h>
+
+class QIODevice;
+class QThreadPool;
+
+namespace Mirall {
+
+/**
+ * Computes the checksum of a file's content while it is streamed.
+ *
+ * The data is fed with its offset in the file. Only data that continues what was already
+ * hashed is taken into account, so a device that is read twice (QNAM may rewind an upload
+ * when the connection is reset) or out of order does not corrupt the result. The gaps are
+ * filled by reading the file with hashUpTo().
+ *
+ * The result has the form "<type>:<hex value>", e.g. "SHA1:da39a3ee5e6b4b0d3255bfef95601890afd80709",
+ * which is what is sent in the OC-Checksum header and stored in the journal.
+ */
+class OWNCLOUDSYNC_EXPORT ContentChecksum
+{
+public:
+    enum Type {
+        NoChecksum,
+        SHA1,
+        Adler32
+    };
+
+    explicit ContentChecksum(Type type);
+
+    /**
+     * The type set in the OWNCLOUD_CHECKSUM_TYPE environment variable:
+     * "SHA1" (the default), "Adler32" or "none"
+     */
+    static Type configuredType();
+
+    /** The type of a checksum as returned by result(); NoChecksum if it is not known */
+    static Type typeOf(const QByteArray &checksum);
+
+    /** Compute the checksum of the whole file \a fileName. Returns an empty array on error */
+    static QByteArray fileChecksum(const QString &fileName, Type type);
+
+    Type type() const { return _type; }
+
+    /** Number of bytes from the start of the file that were hashed so far */
+    qint64 bytesHashed() const { return _bytesHashed; }
+
+    void addData(qint64 offset, const char *data, qint64 len);
+
+    /**
+     * Read from \a device what was not hashed yet, up to the offset \a end.
+     * The position of the device is changed.
+     */
+    bool hashUpTo(QIODevice *device, qint64 end);
+
+    /** The checksum of the data that was added so far */
+    QByteArray result();
+
+private:
+    Q_DISABLE_COPY(ContentChecksum)
+
+    Type _type;
+    qint64 _bytesHashed;
+    QCryptographicHash _sha1;
+    quint32 _adlerA;
+    quint32 _adlerB;
+};
+
+/**
+ * @brief Computes the checksum of a file on a worker thread
+ *
+ * The work runs on a pool shared by all the instances, so hashing many big files neither
+ * blocks the thread of the caller nor uses more than OWNCLOUD_CHECKSUM_THREADS threads
+ * (2 by default). done() is emitted in the thread of this object, with an empty array if
+ * the file could not be read. Deleting the object before that is fine.
+ */
+class OWNCLOUDSYNC_EXPORT ComputeChecksum : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ComputeChecksum(QObject *parent = 0) : QObject(parent) {}
+
+    void start(const QString &fileName, ContentChecksum::Type type);
+
+    static QThreadPool *threadPool();
+
+signals:
+    void done(const QByteArray &checksum);
+};
+
+/**
+ * The work item of ComputeChecksum. It lives in the thread of the ComputeChecksum, which
+ * receives the result through a queued connection, and deletes itself once it has run.
+ */
+class ChecksumRunnable : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    ChecksumRunnable(const QString &fileName, ContentChecksum::Type type)
+        : _fileName(fileName), _type(type) { setAutoDelete(false); }
+
+    void run() Q_DECL_OVERRIDE;
+
+signals:
+    void done(const QByteArray &checksum);
+
+private:
+    QString _fileName;
+    ContentChecksum::Type _type;
+};
+
+}
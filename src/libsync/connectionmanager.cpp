@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "connectionmanager.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSslConfiguration>
+#include <QDebug>
+
+namespace Mirall {
+
+// What QNetworkAccessManager opens at most to the same server
+static const int maxConnectionsPerHost = 6;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+// A ticket is only valid for the server that issued it
+static QString sessionKey(const QUrl &url)
+{
+    return url.host() + QLatin1Char(':') + QString::number(url.port(443));
+}
+#endif
+
+ConnectionManager::ConnectionManager(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void ConnectionManager::setAccessManager(QNetworkAccessManager *am)
+{
+    if (_am) {
+        disconnect(_am, 0, this, 0);
+    }
+    _am = am;
+    if (!am) {
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 1, 0)
+    connect(am, SIGNAL(encrypted(QNetworkReply*)), SLOT(slotEncrypted(QNetworkReply*)));
+#endif
+    connect(am, SIGNAL(finished(QNetworkReply*)), SLOT(slotFinished(QNetworkReply*)));
+}
+
+void ConnectionManager::prepareRequest(QNetworkRequest &request) const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    if (request.url().scheme() != QLatin1String("https")) {
+        return;
+    }
+    QSslConfiguration config = request.sslConfiguration();
+    // Makes the session ticket of the connection available, for the next ones
+    config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    const QByteArray ticket = _sessionTickets.value(sessionKey(request.url()));
+    if (!ticket.isEmpty()) {
+        config.setSessionTicket(ticket);
+    }
+    request.setSslConfiguration(config);
+#else
+    Q_UNUSED(request)
+#endif
+}
+
+void ConnectionManager::warmUp(const QUrl &url, int connections)
+{
+    if (!_am) {
+        return;
+    }
+    connections = qMin(connections, maxConnectionsPerHost);
+    qDebug() << Q_FUNC_INFO << "opening" << connections << "connections to" << url.host();
+    for (int i = 0; i < connections; ++i) {
+        QNetworkRequest request(url);
+        prepareRequest(request);
+        QNetworkReply *reply = _am->head(request);
+        connect(reply, SIGNAL(finished()), reply, SLOT(deleteLater()));
+    }
+}
+
+void ConnectionManager::slotEncrypted(QNetworkReply *reply)
+{
+    ++_stats.handshakes;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    const QByteArray ticket = reply->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty()) {
+        _sessionTickets.insert(sessionKey(reply->url()), ticket);
+    }
+#else
+    Q_UNUSED(reply)
+#endif
+}
+
+void ConnectionManager::slotFinished(QNetworkReply *)
+{
+    ++_stats.requests;
+}
+
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QPointer>
+#include <QByteArray>
+#include <QHash>
+#include <QUrl>
+
+#include "owncloudlib.h"
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QNetworkRequest;
+
+namespace Mirall {
+
+/**
+ * @brief Account level state of the connections to the server
+ *
+ * The QNetworkAccessManager of the account is replaced when the credentials change,
+ * which drops its connections. What is worth keeping lives here instead:
+ *  - the last TLS session ticket of each server, offered with the requests to that
+ *    server so the new connections resume the session instead of doing a full
+ *    handshake (Qt >= 5.4)
+ *  - the statistics about the requests and the handshakes, for all the folders of the
+ *    account together: they share the connections
+ *
+ * warmUp() opens the keep-alive connections the propagation is going to use in parallel.
+ */
+class OWNCLOUDSYNC_EXPORT ConnectionManager : public QObject {
+    Q_OBJECT
+public:
+    struct Stats {
+        Stats() : requests(0), handshakes(0) {}
+        qint64 requests;   // finished requests
+        qint64 handshakes; // TLS handshakes, each one is a new connection
+
+        /** Share of the requests sent over a connection that was already encrypted */
+        double reuseRatio() const {
+            return requests > 0 ? 1.0 - qMin(1.0, double(handshakes) / requests) : 0.0;
+        }
+    };
+
+    explicit ConnectionManager(QObject *parent = 0);
+
+    /** Called by the account each time it creates a new access manager */
+    void setAccessManager(QNetworkAccessManager *am);
+
+    /** Lets the request resume the cached TLS session of its server */
+    void prepareRequest(QNetworkRequest &request) const;
+
+    /**
+     * Open up to \a connections keep-alive connections to the server of \a url by sending
+     * that many requests at once. QNAM uses at most 6 connections per server.
+     */
+    void warmUp(const QUrl &url, int connections);
+
+    Stats stats() const { return _stats; }
+
+private slots:
+    void slotEncrypted(QNetworkReply *reply);
+    void slotFinished(QNetworkReply *reply);
+
+private:
+    QPointer<QNetworkAccessManager> _am;
+    QHash<QString, QByteArray> _sessionTickets; // by host:port
+    Stats _stats;
+};
+
+}
@@ -0,0 +1,690 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "deltadownload.h"
+#include "account.h"
+
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QMultiHash>
+#include <QNetworkReply>
+#include <QRegExp>
+#include <QThreadPool>
+#include <QDebug>
+
+namespace Mirall {
+
+static const char manifestMimeType[] = "application/x-block-manifest";
+
+// Limits of one multi-range GET: its whole body is kept in memory
+static const int maxRangesPerRequest = 32;
+static const qint64 maxBytesPerRequest = 16 * 1024 * 1024;
+
+// Size of the reads done when scanning or copying the local file
+static const qint64 localReadSize = 1024 * 1024;
+
+static bool parseContentRange(const QByteArray &header, qint64 *start, qint64 *end)
+{
+    QRegExp rx("bytes\\s+(\\d+)-(\\d+)");
+    if (rx.indexIn(QString::fromLatin1(header)) < 0) {
+        return false;
+    }
+    *start = rx.cap(1).toLongLong();
+    *end = rx.cap(2).toLongLong() + 1;
+    return *end > *start;
+}
+
+bool BlockManifest::parse(const QByteArray &data, BlockManifest *manifest)
+{
+    BlockManifest m;
+    const QList<QByteArray> lines = data.split('\n');
+    bool versionOk = false;
+    bool ok = true;
+    int i = 0;
+    for (; i < lines.size() && ok; ++i) {
+        const QByteArray line = lines.at(i).trimmed();
+        if (line.isEmpty()) {
+            ++i;
+            break;
+        }
+        int colon = line.indexOf(':');
+        if (colon < 0) {
+            return false;
+        }
+        const QByteArray key = line.left(colon).trimmed();
+        const QByteArray value = line.mid(colon + 1).trimmed();
+        if (key == "BlockManifest") {
+            versionOk = value == "1";
+        } else if (key == "Length") {
+            m.length = value.toLongLong(&ok);
+        } else if (key == "BlockSize") {
+            m.blockSize = value.toInt(&ok);
+        } else if (key == "Checksum") {
+            m.checksum = value;
+        }
+        // Other headers are ignored, for later versions
+    }
+    if (!ok || !versionOk || m.length < 0 || m.blockSize <= 0) {
+        return false;
+    }
+
+    const qint64 blockCount = (m.length + m.blockSize - 1) / m.blockSize;
+    m.blocks.reserve(blockCount);
+    for (; i < lines.size(); ++i) {
+        const QByteArray line = lines.at(i).trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+        int space = line.indexOf(' ');
+        Block block;
+        block.weak = line.left(space).toUInt(&ok, 16);
+        block.strong = QByteArray::fromHex(line.mid(space + 1).trimmed());
+        if (space < 0 || !ok || block.strong.size() != 20) {
+            return false;
+        }
+        m.blocks.append(block);
+    }
+    if (m.blocks.size() != blockCount) {
+        return false;
+    }
+    *manifest = m;
+    return true;
+}
+
+QByteArray BlockManifest::toByteArray() const
+{
+    QByteArray result = "BlockManifest: 1\nLength: " + QByteArray::number(length)
+            + "\nBlockSize: " + QByteArray::number(blockSize) + "\n";
+    if (!checksum.isEmpty()) {
+        result += "Checksum: " + checksum + "\n";
+    }
+    result += "\n";
+    foreach (const Block &block, blocks) {
+        result += QByteArray::number(block.weak, 16) + ' ' + block.strong.toHex() + '\n';
+    }
+    return result;
+}
+
+BlockManifest BlockManifest::compute(QIODevice *device, int blockSize)
+{
+    BlockManifest m;
+    m.blockSize = blockSize;
+    ContentChecksum checksum(ContentChecksum::SHA1);
+    while (true) {
+        const QByteArray data = device->read(blockSize);
+        if (data.isEmpty()) {
+            break;
+        }
+        checksum.addData(m.length, data.constData(), data.size());
+        m.length += data.size();
+        Block block;
+        block.weak = weakChecksum(data.constData(), data.size());
+        block.strong = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+        m.blocks.append(block);
+    }
+    m.checksum = checksum.result();
+    return m;
+}
+
+quint32 BlockManifest::weakChecksum(const char *data, int len)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    quint32 a = 0;
+    quint32 b = 0;
+    for (int i = 0; i < len; ++i) {
+        a += p[i];
+        b += (len - i) * p[i];
+    }
+    return (a & 0xffff) | (b & 0xffff) << 16;
+}
+
+QVector<qint64> BlockManifest::findBlocks(QIODevice *device) const
+{
+    QVector<qint64> found(blocks.size(), -1);
+    const int fullBlocks = int(length / blockSize);
+    QMultiHash<quint32, int> byWeak;
+    byWeak.reserve(fullBlocks);
+    for (int i = 0; i < fullBlocks; ++i) {
+        byWeak.insert(blocks.at(i).weak, i);
+    }
+    int remaining = fullBlocks;
+    if (remaining == 0 || !device->seek(0)) {
+        return found;
+    }
+
+    const qint64 B = blockSize;
+    QByteArray buffer;
+    qint64 bufferStart = 0;
+    bool atEnd = false;
+    qint64 pos = 0;
+    bool hashValid = false;
+    quint32 a = 0;
+    quint32 b = 0;
+    while (remaining > 0) {
+        // The window and the byte that comes next must be in the buffer
+        if (pos + B + 1 > bufferStart + buffer.size() && !atEnd) {
+            buffer.remove(0, int(pos - bufferStart));
+            bufferStart = pos;
+            const QByteArray more = device->read(qMax(localReadSize, B + 1));
+            atEnd = more.isEmpty();
+            buffer += more;
+            continue;
+        }
+        if (pos + B > bufferStart + buffer.size()) {
+            break;
+        }
+        const uchar *window = reinterpret_cast<const uchar *>(buffer.constData() + (pos - bufferStart));
+        if (!hashValid) {
+            const quint32 weak = weakChecksum(buffer.constData() + (pos - bufferStart), B);
+            a = weak & 0xffff;
+            b = weak >> 16;
+            hashValid = true;
+        }
+
+        bool matched = false;
+        QByteArray strong;
+        QMultiHash<quint32, int>::const_iterator it = byWeak.constFind(a | b << 16);
+        for (; it != byWeak.constEnd() && it.key() == (a | b << 16); ++it) {
+            if (found.at(it.value()) >= 0) {
+                continue;
+            }
+            if (strong.isEmpty()) {
+                strong = QCryptographicHash::hash(QByteArray::fromRawData(
+                        reinterpret_cast<const char *>(window), B), QCryptographicHash::Sha1);
+            }
+            // All the identical blocks can be copied from here
+            if (strong == blocks.at(it.value()).strong) {
+                found[it.value()] = pos;
+                --remaining;
+                matched = true;
+            }
+        }
+        if (matched) {
+            pos += B;
+            hashValid = false;
+            continue;
+        }
+
+        if (pos + B >= bufferStart + buffer.size()) {
+            break;
+        }
+        const quint32 out = window[0];
+        const quint32 in = window[B];
+        a = (a - out + in) & 0xffff;
+        b = (b - B * out + a) & 0xffff;
+        ++pos;
+    }
+    return found;
+}
+
+QList<QPair<qint64, qint64> > BlockManifest::missingRanges(const QVector<qint64> &found) const
+{
+    QList<QPair<qint64, qint64> > ranges;
+    for (int i = 0; i < found.size(); ++i) {
+        if (found.at(i) >= 0) {
+            continue;
+        }
+        const qint64 start = qint64(i) * blockSize;
+        const qint64 end = qMin(start + blockSize, length);
+        if (!ranges.isEmpty() && ranges.last().second == start) {
+            ranges.last().second = end;
+        } else {
+            ranges.append(qMakePair(start, end));
+        }
+    }
+    return ranges;
+}
+
+bool parseRangeReply(const QByteArray &contentType, const QByteArray &contentRange,
+                     const QByteArray &body, QList<RangeData> *parts)
+{
+    if (!contentType.toLower().startsWith("multipart/byteranges")) {
+        RangeData part;
+        qint64 end;
+        if (!parseContentRange(contentRange, &part.offset, &end) || end - part.offset != body.size()) {
+            return false;
+        }
+        part.data = body;
+        parts->append(part);
+        return true;
+    }
+
+    int boundaryPos = contentType.indexOf("boundary=");
+    if (boundaryPos < 0) {
+        return false;
+    }
+    QByteArray boundary = contentType.mid(boundaryPos + 9);
+    if (boundary.contains(';')) {
+        boundary.truncate(boundary.indexOf(';'));
+    }
+    boundary = boundary.trimmed();
+    if (boundary.startsWith('"') && boundary.endsWith('"') && boundary.size() > 1) {
+        boundary = boundary.mid(1, boundary.size() - 2);
+    }
+    const QByteArray delimiter = "--" + boundary;
+
+    int pos = body.indexOf(delimiter);
+    while (pos >= 0) {
+        pos += delimiter.size();
+        if (body.mid(pos, 2) == "--") {
+            break; // the closing delimiter
+        }
+        const int headersEnd = body.indexOf("\r\n\r\n", pos);
+        if (headersEnd < 0) {
+            return false;
+        }
+        RangeData part;
+        qint64 end = -1;
+        foreach (const QByteArray &header, body.mid(pos, headersEnd - pos).split('\n')) {
+            if (header.trimmed().toLower().startsWith("content-range:")) {
+                parseContentRange(header.mid(header.indexOf(':') + 1).trimmed(), &part.offset, &end);
+            }
+        }
+        const int dataStart = headersEnd + 4;
+        if (end < 0 || dataStart + (end - part.offset) > body.size()) {
+            return false;
+        }
+        part.data = body.mid(dataStart, int(end - part.offset));
+        parts->append(part);
+        pos = body.indexOf(delimiter, dataStart + part.data.size());
+    }
+    return !parts->isEmpty();
+}
+
+/*********************************************************************************************/
+
+GetBlockManifestJob::GetBlockManifestJob(Account *account, const QString &path,
+                                         const QByteArray &etag, QObject *parent)
+    : AbstractNetworkJob(account, path, parent), _etag(etag), _valid(false)
+{
+}
+
+void GetBlockManifestJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader("Accept", manifestMimeType);
+    // The manifest must be the one of the version we are about to download
+    req.setRawHeader("If-Match", '"' + _etag + '"');
+    setReply(davRequest("GET", path(), req));
+    setupConnections(reply());
+    connect(reply(), SIGNAL(metaDataChanged()), this, SLOT(slotMetaDataChanged()));
+    AbstractNetworkJob::start();
+}
+
+void GetBlockManifestJob::slotMetaDataChanged()
+{
+    // A server without manifests sends the file itself: do not wait for it.
+    if (reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 200
+            || !reply()->rawHeader("Content-Type").startsWith(manifestMimeType)) {
+        reply()->abort();
+    }
+}
+
+bool GetBlockManifestJob::finished()
+{
+    if (reply()->error() == QNetworkReply::NoError
+            && reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200
+            && reply()->rawHeader("Content-Type").startsWith(manifestMimeType)) {
+        _valid = BlockManifest::parse(reply()->readAll(), &_manifest);
+        if (!_valid) {
+            qDebug() << Q_FUNC_INFO << "invalid block manifest for" << path();
+        }
+    }
+    emit finishedSignal();
+    return true;
+}
+
+void GetBlockManifestJob::slotTimeout()
+{
+    reply()->abort();
+}
+
+GetRangesJob::GetRangesJob(Account *account, const QString &path, const QByteArray &etag,
+                           const QList<QPair<qint64, qint64> > &ranges, QObject *parent)
+    : AbstractNetworkJob(account, path, parent), _etag(etag), _ranges(ranges), _valid(false)
+{
+}
+
+void GetRangesJob::start()
+{
+    QByteArray range = "bytes=";
+    for (int i = 0; i < _ranges.size(); ++i) {
+        if (i > 0) {
+            range += ',';
+        }
+        range += QByteArray::number(_ranges.at(i).first) + '-' + QByteArray::number(_ranges.at(i).second - 1);
+    }
+    QNetworkRequest req;
+    req.setRawHeader("Range", range);
+    req.setRawHeader("If-Match", '"' + _etag + '"');
+    setReply(davRequest("GET", path(), req));
+    setupConnections(reply());
+    connect(reply(), SIGNAL(metaDataChanged()), this, SLOT(slotMetaDataChanged()));
+    connect(reply(), SIGNAL(downloadProgress(qint64,qint64)), this, SIGNAL(downloadProgress(qint64,qint64)));
+    AbstractNetworkJob::start();
+}
+
+void GetRangesJob::slotMetaDataChanged()
+{
+    // 200 means the ranges are ignored and the whole file follows
+    if (reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 206) {
+        reply()->abort();
+    }
+}
+
+bool GetRangesJob::finished()
+{
+    if (reply()->error() == QNetworkReply::NoError
+            && reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 206) {
+        _valid = parseRangeReply(reply()->rawHeader("Content-Type"), reply()->rawHeader("Content-Range"),
+                                 reply()->readAll(), &_parts);
+        // The server may merge ranges, but it must send all of them
+        for (int i = 0; _valid && i < _ranges.size(); ++i) {
+            bool covered = false;
+            foreach (const RangeData &part, _parts) {
+                covered = covered || (part.offset <= _ranges.at(i).first
+                                      && part.offset + part.data.size() >= _ranges.at(i).second);
+            }
+            _valid = covered;
+        }
+    }
+    emit finishedSignal();
+    return true;
+}
+
+void GetRangesJob::slotTimeout()
+{
+    reply()->abort();
+}
+
+/*********************************************************************************************/
+
+DeltaDownload::DeltaDownload(Account *account, const QString &remotePath, const QByteArray &etag,
+                             const QString &localFile, QFile *output, QObject *parent)
+    : QObject(parent), _account(account), _remotePath(remotePath), _etag(etag), _local(localFile),
+      _output(output), _timeout(0), _aborted(false), _verifyBlocks(false), _written(0), _bytesDownloaded(0)
+{
+}
+
+void DeltaDownload::start()
+{
+    GetBlockManifestJob *job = new GetBlockManifestJob(_account, _remotePath, _etag, this);
+    if (_timeout > 0) {
+        job->setTimeout(_timeout);
+    }
+    connect(job, SIGNAL(finishedSignal()), this, SLOT(slotManifestFinished()));
+    _job = job;
+    job->start();
+}
+
+void DeltaDownload::abort()
+{
+    // In case the local file is being scanned
+    _aborted = true;
+    if (_job && _job->reply()) {
+        _job->reply()->abort();
+    }
+}
+
+void DeltaDownload::slotManifestFinished()
+{
+    GetBlockManifestJob *job = qobject_cast<GetBlockManifestJob *>(sender());
+    Q_ASSERT(job);
+    job->deleteLater();
+    if (!job->isValid()) {
+        fail(QLatin1String("no block manifest"));
+        return;
+    }
+    _manifest = job->manifest();
+    if (!_local.open(QIODevice::ReadOnly)) {
+        fail(_local.errorString());
+        return;
+    }
+
+    // Scanning a big file takes a while, it is not done in this thread
+    FindBlocksRunnable *runnable = new FindBlocksRunnable(_manifest, _local.fileName());
+    connect(runnable, SIGNAL(done()), this, SLOT(slotBlocksFound()), Qt::QueuedConnection);
+    ComputeChecksum::threadPool()->start(runnable);
+}
+
+void DeltaDownload::slotBlocksFound()
+{
+    FindBlocksRunnable *runnable = qobject_cast<FindBlocksRunnable *>(sender());
+    Q_ASSERT(runnable);
+    if (_aborted) {
+        fail(QLatin1String("aborted"));
+        return;
+    }
+    if (runnable->found().isEmpty() && !_manifest.blocks.isEmpty()) {
+        fail(runnable->errorString());
+        return;
+    }
+    _found = runnable->found();
+
+    QList<QPair<qint64, qint64> > ranges = _manifest.missingRanges(_found);
+    qint64 missing = 0;
+    for (int i = 0; i < ranges.size(); ++i) {
+        missing += ranges.at(i).second - ranges.at(i).first;
+    }
+    qDebug() << Q_FUNC_INFO << _remotePath << "is missing" << missing << "of" << _manifest.length
+             << "bytes in" << ranges.size() << "ranges";
+    if (missing > _manifest.length / 2) {
+        fail(QLatin1String("too many changes"));
+        return;
+    }
+
+    // Group the ranges into requests, splitting the ones that are too big. The ranges are
+    // made of whole blocks, and are only split between two blocks.
+    const qint64 maxBytes = qMax(maxBytesPerRequest / _manifest.blockSize, qint64(1)) * _manifest.blockSize;
+    QList<QPair<qint64, qint64> > request;
+    qint64 requestBytes = 0;
+    while (!ranges.isEmpty()) {
+        QPair<qint64, qint64> range = ranges.takeFirst();
+        if (range.second - range.first > maxBytes - requestBytes) {
+            ranges.prepend(qMakePair(range.first + maxBytes - requestBytes, range.second));
+            range.second = range.first + maxBytes - requestBytes;
+        }
+        request.append(range);
+        requestBytes += range.second - range.first;
+        if (request.size() == maxRangesPerRequest || requestBytes == maxBytes) {
+            _requests.append(request);
+            request.clear();
+            requestBytes = 0;
+        }
+    }
+    if (!request.isEmpty()) {
+        _requests.append(request);
+    }
+
+    ContentChecksum::Type type = ContentChecksum::typeOf(_manifest.checksum);
+    if (type == ContentChecksum::NoChecksum) {
+        // Nothing to check the result against, check the blocks instead
+        _verifyBlocks = true;
+        type = ContentChecksum::configuredType();
+    }
+    if (type != ContentChecksum::NoChecksum) {
+        _checksum.reset(new ContentChecksum(type));
+    }
+    startNextRanges();
+}
+
+void DeltaDownload::startNextRanges()
+{
+    if (_requests.isEmpty()) {
+        if (!appendUpTo(_manifest.length, QList<RangeData>())) {
+            return;
+        }
+        if (_checksum) {
+            _checksumResult = _checksum->result();
+            if (_checksum->type() == ContentChecksum::typeOf(_manifest.checksum)
+                    && _checksumResult != _manifest.checksum) {
+                fail(QString::fromLatin1("checksum mismatch %1 != %2")
+                     .arg(QString::fromLatin1(_checksumResult), QString::fromLatin1(_manifest.checksum)));
+                return;
+            }
+        }
+        _local.close();
+        emit finished(true);
+        return;
+    }
+
+    GetRangesJob *job = new GetRangesJob(_account, _remotePath, _etag, _requests.first(), this);
+    if (_timeout > 0) {
+        job->setTimeout(_timeout);
+    }
+    connect(job, SIGNAL(finishedSignal()), this, SLOT(slotRangesFinished()));
+    connect(job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotRangesProgress(qint64,qint64)));
+    _job = job;
+    job->start();
+}
+
+void DeltaDownload::slotRangesFinished()
+{
+    GetRangesJob *job = qobject_cast<GetRangesJob *>(sender());
+    Q_ASSERT(job);
+    job->deleteLater();
+    if (!job->isValid()) {
+        fail(QLatin1String("the ranges were not sent"));
+        return;
+    }
+    const QList<QPair<qint64, qint64> > ranges = _requests.takeFirst();
+    for (int i = 0; i < ranges.size(); ++i) {
+        _bytesDownloaded += ranges.at(i).second - ranges.at(i).first;
+    }
+    if (appendUpTo(ranges.last().second, job->parts())) {
+        startNextRanges();
+    }
+}
+
+void DeltaDownload::slotRangesProgress(qint64 received, qint64)
+{
+    emit progress(_written + received);
+}
+
+bool DeltaDownload::appendUpTo(qint64 end, const QList<RangeData> &parts)
+{
+    const qint64 B = _manifest.blockSize;
+    while (_written < end) {
+        int block = int(_written / B);
+        const qint64 offsetInBlock = _written - block * B;
+        if (_found.at(block) >= 0) {
+            // Copy all the following blocks that are also following each other locally
+            int last = block;
+            while ((last + 1) * B < end && _found.at(last + 1) == _found.at(last) + B) {
+                ++last;
+            }
+            const qint64 len = qMin(qMin((last + 1) * B, _manifest.length), end) - _written;
+            if (!appendLocal(_found.at(block) + offsetInBlock, len)) {
+                return false;
+            }
+            continue;
+        }
+
+        const RangeData *part = 0;
+        foreach (const RangeData &p, parts) {
+            if (p.offset <= _written && p.offset + p.data.size() > _written) {
+                part = &p;
+                break;
+            }
+        }
+        if (!part) {
+            fail(QLatin1String("no data for offset ") + QString::number(_written));
+            return false;
+        }
+        if (_verifyBlocks) {
+            // The block comes whole in one part, see slotBlocksFound()
+            const qint64 blockEnd = qMin((block + 1) * B, _manifest.length);
+            if (offsetInBlock != 0 || part->offset + part->data.size() < blockEnd) {
+                fail(QLatin1String("incomplete block ") + QString::number(block));
+                return false;
+            }
+            const char *data = part->data.constData() + (_written - part->offset);
+            const QByteArray hash = QCryptographicHash::hash(QByteArray::fromRawData(data, int(blockEnd - _written)),
+                                                             QCryptographicHash::Sha1);
+            if (hash != _manifest.blocks.at(block).strong) {
+                fail(QLatin1String("block ") + QString::number(block) + QLatin1String(" does not match the manifest"));
+                return false;
+            }
+            if (!append(data, blockEnd - _written)) {
+                return false;
+            }
+            continue;
+        }
+        const qint64 len = qMin(part->offset + part->data.size(), end) - _written;
+        if (!append(part->data.constData() + (_written - part->offset), len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaDownload::append(const char *data, qint64 len)
+{
+    if (_output->write(data, len) != len) {
+        fail(_output->errorString());
+        return false;
+    }
+    if (_checksum) {
+        _checksum->addData(_written, data, len);
+    }
+    _written += len;
+    emit progress(_written);
+    return true;
+}
+
+bool DeltaDownload::appendLocal(qint64 localOffset, qint64 len)
+{
+    if (!_local.seek(localOffset)) {
+        fail(_local.errorString());
+        return false;
+    }
+    QByteArray buffer(int(qMin(len, localReadSize)), Qt::Uninitialized);
+    while (len > 0) {
+        const qint64 r = _local.read(buffer.data(), qMin<qint64>(len, buffer.size()));
+        if (r <= 0) {
+            // The local file changed since it was scanned
+            fail(_local.errorString());
+            return false;
+        }
+        if (!append(buffer.constData(), r)) {
+            return false;
+        }
+        len -= r;
+    }
+    return true;
+}
+
+void FindBlocksRunnable::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+    QFile file(_fileName);
+    if (file.open(QIODevice::ReadOnly)) {
+        _found = _manifest.findBlocks(&file);
+        qDebug() << Q_FUNC_INFO << _fileName << "scanned in" << timer.elapsed() << "ms";
+    } else {
+        _errorString = file.errorString();
+    }
+    emit done();
+    deleteLater();
+}
+
+void DeltaDownload::fail(const QString &reason)
+{
+    qDebug() << Q_FUNC_INFO << _remotePath << "delta download not possible:" << reason;
+    _errorString = reason;
+    _local.close();
+    emit finished(false);
+}
+
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "networkjobs.h"
+#include "checksums.h"
+
+#include <QFile>
+#include <QPair>
+#include <QPointer>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QVector>
+
+namespace Mirall {
+
+/**
+ * @brief The block hashes of one version of a remote file
+ *
+ * The server sends it as text when the file is requested with
+ * "Accept: application/x-block-manifest":
+ *
+ *     BlockManifest: 1
+ *     Length: <size of the file>
+ *     BlockSize: <size of the blocks>
+ *     Checksum: SHA1:<hex>               (optional, of the whole file)
+ *
+ *     <weak hex> <sha1 hex>              (one line per block)
+ *
+ * The weak hash is the rsync rolling checksum of the block, see weakChecksum().
+ * The last block is shorter if the length is not a multiple of the block size.
+ */
+class OWNCLOUDSYNC_EXPORT BlockManifest
+{
+public:
+    struct Block {
+        quint32 weak;
+        QByteArray strong; // raw SHA1
+    };
+
+    BlockManifest() : length(0), blockSize(0) {}
+
+    qint64 length;
+    int blockSize;
+    QByteArray checksum;
+    QVector<Block> blocks;
+
+    /** Returns false if \a data is not a valid manifest */
+    static bool parse(const QByteArray &data, BlockManifest *manifest);
+    QByteArray toByteArray() const;
+
+    /** The manifest of the content of \a device, what the server computes */
+    static BlockManifest compute(QIODevice *device, int blockSize);
+
+    /** rsync's checksum: a = sum(x), b = sum((len - i) * x), both modulo 2^16; a | b << 16 */
+    static quint32 weakChecksum(const char *data, int len);
+
+    /**
+     * Scan \a device for the blocks with the rolling checksum. Returns, for each block, its
+     * offset in \a device or -1 if it was not found. The last block is only looked for if
+     * it is a full one.
+     */
+    QVector<qint64> findBlocks(QIODevice *device) const;
+
+    /** The byte ranges [first, second) of the blocks not found in \a found, merged */
+    QList<QPair<qint64, qint64> > missingRanges(const QVector<qint64> &found) const;
+};
+
+/**
+ * A part of a 206 reply: the data starting at \a offset in the file
+ */
+struct OWNCLOUDSYNC_EXPORT RangeData {
+    qint64 offset;
+    QByteArray data;
+};
+
+/**
+ * Split the body of a 206 reply in its parts. \a contentType and \a contentRange are the
+ * headers of the reply: a "multipart/byteranges" body has a part per range, otherwise the
+ * body is the single range of \a contentRange. Returns false if it cannot be parsed.
+ */
+OWNCLOUDSYNC_EXPORT bool parseRangeReply(const QByteArray &contentType, const QByteArray &contentRange,
+                                         const QByteArray &body, QList<RangeData> *parts);
+
+/**
+ * @brief Downloads the BlockManifest of a file version
+ */
+class OWNCLOUDSYNC_EXPORT GetBlockManifestJob : public AbstractNetworkJob {
+    Q_OBJECT
+    QByteArray _etag;
+    BlockManifest _manifest;
+    bool _valid;
+public:
+    explicit GetBlockManifestJob(Account *account, const QString &path, const QByteArray &etag,
+                                 QObject *parent = 0);
+
+    void start() Q_DECL_OVERRIDE;
+
+    /** False if the server has no manifest for this version of the file */
+    bool isValid() const { return _valid; }
+    const BlockManifest &manifest() const { return _manifest; }
+
+signals:
+    void finishedSignal();
+
+private slots:
+    void slotMetaDataChanged();
+    virtual bool finished() Q_DECL_OVERRIDE;
+    virtual void slotTimeout() Q_DECL_OVERRIDE;
+};
+
+/**
+ * @brief GET several byte ranges of a file version in one request
+ */
+class OWNCLOUDSYNC_EXPORT GetRangesJob : public AbstractNetworkJob {
+    Q_OBJECT
+    QByteArray _etag;
+    QList<QPair<qint64, qint64> > _ranges;
+    QList<RangeData> _parts;
+    bool _valid;
+public:
+    explicit GetRangesJob(Account *account, const QString &path, const QByteArray &etag,
+                          const QList<QPair<qint64, qint64> > &ranges, QObject *parent = 0);
+
+    void start() Q_DECL_OVERRIDE;
+
+    /** True if the server sent all the ranges */
+    bool isValid() const { return _valid; }
+    const QList<RangeData> &parts() const { return _parts; }
+
+signals:
+    void finishedSignal();
+    void downloadProgress(qint64, qint64);
+
+private slots:
+    void slotMetaDataChanged();
+    virtual bool finished() Q_DECL_OVERRIDE;
+    virtual void slotTimeout() Q_DECL_OVERRIDE;
+};
+
+/**
+ * @brief Builds the new version of a file from the old one and the blocks that changed
+ *
+ * The manifest of the new version is downloaded, the blocks it lists are looked for in
+ * the local file and those that are not found are downloaded with multi-range GETs.
+ * The new content is appended to \a output in order, the local blocks being copied
+ * between the downloaded ranges. The local file is scanned on the checksum thread pool.
+ * When the manifest has no checksum of the whole file, each downloaded block is checked
+ * against its hash before it is written.
+ *
+ * finished(false) is emitted when the server has no manifest, does not support ranges, or
+ * when the result would not be worth it. The caller must then truncate the output and
+ * download the whole file.
+ */
+class OWNCLOUDSYNC_EXPORT DeltaDownload : public QObject {
+    Q_OBJECT
+public:
+    DeltaDownload(Account *account, const QString &remotePath, const QByteArray &etag,
+                  const QString &localFile, QFile *output, QObject *parent = 0);
+
+    void setTimeout(qint64 msec) { _timeout = msec; }
+
+    void start();
+    void abort();
+
+    /** Checksum of what was written, of the type of the manifest's checksum or the configured one */
+    QByteArray checksum() const { return _checksumResult; }
+    qint64 bytesDownloaded() const { return _bytesDownloaded; }
+    QString errorString() const { return _errorString; }
+
+signals:
+    void finished(bool ok);
+    void progress(qint64 written);
+
+private slots:
+    void slotManifestFinished();
+    void slotBlocksFound();
+    void slotRangesFinished();
+    void slotRangesProgress(qint64 received, qint64);
+
+private:
+    void startNextRanges();
+    bool appendUpTo(qint64 end, const QList<RangeData> &parts);
+    bool append(const char *data, qint64 len);
+    bool appendLocal(qint64 localOffset, qint64 len);
+    void fail(const QString &reason);
+
+    Account *_account;
+    QString _remotePath;
+    QByteArray _etag;
+    QFile _local;
+    QFile *_output;
+    qint64 _timeout;
+    bool _aborted;
+
+    BlockManifest _manifest;
+    bool _verifyBlocks;
+    QVector<qint64> _found;
+    QList<QList<QPair<qint64, qint64> > > _requests; // the missing ranges, per request
+    QPointer<AbstractNetworkJob> _job;
+    qint64 _written;
+    qint64 _bytesDownloaded;
+    QScopedPointer<ContentChecksum> _checksum;
+    QByteArray _checksumResult;
+    QString _errorString;
+};
+
+/**
+ * The scan of the local file of a DeltaDownload. It lives in the thread of the
+ * DeltaDownload, which gets the result when done() is emitted, and deletes itself
+ * once it has run.
+ */
+class FindBlocksRunnable : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    FindBlocksRunnable(const BlockManifest &manifest, const QString &fileName)
+        : _manifest(manifest), _fileName(fileName) { setAutoDelete(false); }
+
+    void run() Q_DECL_OVERRIDE;
+
+    /** The offsets of the blocks, see BlockManifest::findBlocks(). Empty on error */
+    const QVector<qint64> &found() const { return _found; }
+    QString errorString() const { return _errorString; }
+
+signals:
+    void done();
+
+private:
+    BlockManifest _manifest;
+    QString _fileName;
+    QVector<qint64> _found;
+    QString _errorString;
+};
+
+}
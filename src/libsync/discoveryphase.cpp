@@ -13,9 +13,25 @@
  */
 
 #include "discoveryphase.h"
+#include "account.h"
+#include "owncloudpropagator.h"
+#include "utility.h"
+#include "syncmetrics.h"
+#include "synctrace.h"
 #include <csync_private.h>
+#include <csync_statedb.h>
+#include <csync_update.h>
 #include <qdebug.h>
 
+#include <QBuffer>
+#include <QLocale>
+#include <QNetworkReply>
+#include <QSet>
+#include <QUrl>
+
+#include <errno.h>
+#include <string.h>
+
 namespace Mirall {
 
 bool DiscoveryJob::isInBlackList(const QString& path) const
@@ -50,6 +66,28 @@ int DiscoveryJob::isInWhiteListCallBack(void *data, const char *path)
     return static_cast<DiscoveryJob*>(data)->isInBlackList(QString::fromUtf8(path));
 }
 
+bool DiscoveryJob::isOutsideLocalDiscovery(const QString &path) const
+{
+    if (_localDiscoveryPaths.isEmpty()) {
+        // No restriction, everything is walked
+        return false;
+    }
+
+    const QString pathSlash = path + QLatin1Char('/');
+    foreach (const QString &discoveryPath, _localDiscoveryPaths) {
+        const QString discoveryPathSlash = discoveryPath + QLatin1Char('/');
+        if (pathSlash.startsWith(discoveryPathSlash) || discoveryPathSlash.startsWith(pathSlash)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int DiscoveryJob::skipLocalDiscoveryCallBack(void *data, const char *path)
+{
+    return static_cast<DiscoveryJob*>(data)->isOutsideLocalDiscovery(QString::fromUtf8(path));
+}
+
 void DiscoveryJob::update_job_update_callback (bool local,
                                     const char *dirUrl,
                                     void *userdata)
@@ -70,29 +108,930 @@ void DiscoveryJob::update_job_update_callback (bool local,
     }
 }
 
+int DiscoveryJob::propfindWindow()
+{
+    static int window = qgetenv("OWNCLOUD_MAX_PARALLEL_PROPFIND").toInt();
+    if (window <= 0) {
+        window = 4;
+    }
+    return window;
+}
+
+void DiscoveryJob::setErrorString(const QString &msg)
+{
+    SAFE_FREE(_csync_ctx->error_string);
+    _csync_ctx->error_string = strdup(msg.toUtf8().constData());
+}
+
+void *DiscoveryJob::remote_vio_opendir_hook (const char *url, void *userdata)
+{
+    DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
+    const char *root = discoveryJob->_csync_ctx->remote.uri;
+    const size_t rootLen = strlen(root);
+    if (strncmp(url, root, rootLen) != 0) {
+        qDebug() << Q_FUNC_INFO << url << "is not in" << root;
+        errno = EINVAL;
+        return 0;
+    }
+    QString path = QString::fromUtf8(url + rootLen);
+    if (path.startsWith(QLatin1Char('/'))) {
+        path.remove(0, 1);
+    }
+
+    int errorCode = 0;
+    QString errorString;
+    DiscoveryDirectoryResult *result =
+            discoveryJob->_vioMainThread->openDirectory(path, &errorCode, &errorString);
+    if (!result) {
+        qDebug() << Q_FUNC_INFO << "Listing" << path << "failed:" << errorCode << errorString;
+        // csync_ftw sets its own message for these
+        if (errorCode != ENOENT && errorCode != EACCES) {
+            discoveryJob->setErrorString(errorString);
+        }
+        errno = errorCode;
+        return 0;
+    }
+    result->traceStart = SyncTrace::now();
+    return result;
+}
+
+csync_vio_file_stat_t *DiscoveryJob::remote_vio_readdir_hook (void *dhandle, void *userdata)
+{
+    DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
+    DiscoveryDirectoryResult *result = static_cast<DiscoveryDirectoryResult*>(dhandle);
+    DiscoveryMainThread *mainThread = discoveryJob->_vioMainThread;
+
+    QVector<csync_vio_file_stat_t *> lookahead;
+    int errorCode = 0;
+    QString errorString;
+    csync_vio_file_stat_t *fs = mainThread->readEntry(result, mainThread->window() > 1 ? &lookahead : 0,
+                                                      &errorCode, &errorString);
+
+    // Start listing the sub directories the walker will enter after this entry
+    foreach (const csync_vio_file_stat_t *entry, lookahead) {
+        if (entry->type != CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+            continue;
+        }
+        QString path = QString::fromUtf8(entry->name);
+        if (!result->path.isEmpty()) {
+            path.prepend(result->path + QLatin1Char('/'));
+        }
+        result->dirsSeen++;
+        if (csync_update_remote_dir_needs_listing(discoveryJob->_csync_ctx, path.toUtf8().constData(),
+                                                  entry->etag, entry->file_id, entry->remotePerm)) {
+            result->dirsChanged++;
+            mainThread->prefetchDirectory(path, discoveryJob->listRecursively(result, path, entry));
+        }
+    }
+
+    if (!fs && errorCode != 0) {
+        qDebug() << Q_FUNC_INFO << "Listing" << result->path << "failed:" << errorCode << errorString;
+        discoveryJob->setErrorString(errorString);
+        // An entry without a name makes csync_ftw fail
+        fs = csync_vio_file_stat_new();
+        errno = errorCode;
+    }
+    return fs;
+}
+
+// A changed directory is listed with one Depth infinity PROPFIND instead of being walked
+// with Depth 1 when most of its tree is likely to have changed too: the server gave it
+// another file id, or most of its siblings changed. Then it depends on the size of its
+// tree in the journal.
+bool DiscoveryJob::listRecursively(DiscoveryDirectoryResult *parent, const QString &path,
+                                   const csync_vio_file_stat_t *entry)
+{
+    if (!_vioMainThread->canListRecursively(path)) {
+        return false;
+    }
+    const QByteArray pathUtf8 = path.toUtf8();
+    const bool replaced = csync_update_remote_dir_replaced(_csync_ctx, pathUtf8.constData(), entry->file_id);
+    const double staleFraction = replaced ? 1.0 : double(parent->dirsChanged) / qMax(parent->dirsSeen, 4);
+    if (staleFraction < 0.5) {
+        return false;
+    }
+    int dirs = 0;
+    int records = csync_statedb_count_below_path(_csync_ctx, pathUtf8.constData(), &dirs);
+    return _vioMainThread->recursiveListingCheaper(records, dirs, staleFraction);
+}
+
+void DiscoveryJob::remote_vio_closedir_hook (void *dhandle, void *userdata)
+{
+    DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
+    DiscoveryDirectoryResult *result = static_cast<DiscoveryDirectoryResult*>(dhandle);
+    if (SyncTrace::isActive()) {
+        SyncTrace::complete("discovery", QLatin1Char('/') + result->path, result->traceStart,
+                            SyncTrace::Args() << qMakePair(QByteArray("entries"), QVariant(result->readIndex)));
+    }
+    discoveryJob->_vioMainThread->closeDirectory(result);
+}
+
 void DiscoveryJob::start() {
     _selectiveSyncBlackList.sort();
     _csync_ctx->checkBlackListHook = isInWhiteListCallBack;
     _csync_ctx->checkBlackListData = this;
+    if (!_localDiscoveryPaths.isEmpty()) {
+        _csync_ctx->skipLocalDiscoveryHook = skipLocalDiscoveryCallBack;
+        _csync_ctx->skipLocalDiscoveryData = this;
+    }
 
     _csync_ctx->callbacks.update_callback = update_job_update_callback;
     _csync_ctx->callbacks.update_callback_userdata = this;
 
+    if (_vioMainThread) {
+        _csync_ctx->callbacks.remote_opendir_hook = remote_vio_opendir_hook;
+        _csync_ctx->callbacks.remote_readdir_hook = remote_vio_readdir_hook;
+        _csync_ctx->callbacks.remote_closedir_hook = remote_vio_closedir_hook;
+        _csync_ctx->callbacks.vio_userdata = this;
+    }
+
 
     csync_set_log_callback(_log_callback);
     csync_set_log_level(_log_level);
     csync_set_log_userdata(_log_userdata);
     lastUpdateProgressCallbackCall.invalidate();
+    const qint64 updateStart = SyncTrace::now();
     int ret = csync_update(_csync_ctx);
+    SyncTrace::complete("discovery", QLatin1String("csync_update"), updateStart);
+    if (ret >= 0) {
+        SyncMetrics::observe("owncloud_discovery_duration_seconds", qint64(_csync_ctx->local.update_time * 1e6),
+                             "replica=\"local\"");
+        SyncMetrics::observe("owncloud_discovery_duration_seconds", qint64(_csync_ctx->remote.update_time * 1e6),
+                             "replica=\"remote\"");
+    }
 
     _csync_ctx->checkBlackListHook = 0;
     _csync_ctx->checkBlackListData = 0;
+    _csync_ctx->skipLocalDiscoveryHook = 0;
+    _csync_ctx->skipLocalDiscoveryData = 0;
 
     _csync_ctx->callbacks.update_callback = 0;
     _csync_ctx->callbacks.update_callback_userdata = 0;
 
+    _csync_ctx->callbacks.remote_opendir_hook = 0;
+    _csync_ctx->callbacks.remote_readdir_hook = 0;
+    _csync_ctx->callbacks.remote_closedir_hook = 0;
+    _csync_ctx->callbacks.vio_userdata = 0;
+
     emit finished(ret);
     deleteLater();
 }
 
+/*********************************************************************************************/
+
+// Decoded path of a href or an url, without the trailing '/'
+static QString hrefToPath(QByteArray href)
+{
+    int schemeEnd = href.indexOf("://");
+    if (schemeEnd >= 0) {
+        int pathStart = href.indexOf('/', schemeEnd + 3);
+        href = pathStart >= 0 ? href.mid(pathStart) : QByteArray("/");
+    }
+    QString path = QUrl::fromPercentEncoding(href);
+    while (path.contains(QLatin1String("//"))) {
+        path.replace(QLatin1String("//"), QLatin1String("/"));
+    }
+    if (path.endsWith(QLatin1Char('/'))) {
+        path.chop(1);
+    }
+    return path;
+}
+
+// RFC 1123 date as sent in getlastmodified, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+static time_t httpDateToTime_t(const QString &date)
+{
+    QDateTime dt = QLocale::c().toDateTime(date.mid(date.indexOf(QLatin1Char(',')) + 1).trimmed(),
+                                           QLatin1String("dd MMM yyyy HH:mm:ss 'GMT'"));
+    if (!dt.isValid()) {
+        return 0;
+    }
+    dt.setTimeSpec(Qt::UTC);
+    return Utility::qDateTimeToTime_t(dt);
+}
+
+// Same mapping as set_errno_from_http_errcode and set_errno_from_neon_errcode in csync
+static int errnoFromReply(QNetworkReply *reply, int httpCode)
+{
+    switch (httpCode) {
+    case 401:
+    case 402:
+    case 405:
+    case 407:
+        return EPERM;
+    case 404:
+    case 410:
+        return ENOENT;
+    case 408:
+    case 504:
+        return EAGAIN;
+    case 423:
+        return EACCES;
+    case 503:
+        return ERRNO_SERVICE_UNAVAILABLE;
+    case 507:
+        return ENOSPC;
+    default:
+        break;
+    }
+    switch (reply->error()) {
+    case QNetworkReply::HostNotFoundError:
+        return ERRNO_LOOKUP_ERROR;
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::RemoteHostClosedError:
+        return ERRNO_CONNECT;
+    case QNetworkReply::TimeoutError:
+        return ERRNO_TIMEOUT;
+    case QNetworkReply::AuthenticationRequiredError:
+        return ERRNO_USER_UNKNOWN_ON_SERVER;
+    case QNetworkReply::ProxyAuthenticationRequiredError:
+        return ERRNO_PROXY_AUTH;
+    default:
+        break;
+    }
+    return ERRNO_ERROR_STRING;
+}
+
+DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(Account *account, const QString &path, QObject *parent)
+    : AbstractNetworkJob(account, path, parent), _inPropstat(false), _propstatOk(false), _timedOut(false),
+      _recursive(false), _hrefMismatch(false), _started(false)
+{
+}
+
+DiscoverySingleDirectoryJob::~DiscoverySingleDirectoryJob()
+{
+    foreach (csync_vio_file_stat_t *fs, _entries) {
+        csync_vio_file_stat_destroy(fs);
+    }
+}
+
+void DiscoverySingleDirectoryJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader("Depth", _recursive ? "infinity" : "1");
+    QByteArray xml("<?xml version=\"1.0\" ?>\n"
+                   "<d:propfind xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n"
+                   "  <d:prop>\n"
+                   "    <d:getlastmodified/>\n"
+                   "    <d:getcontentlength/>\n"
+                   "    <d:resourcetype/>\n"
+                   "    <d:getetag/>\n"
+                   "    <oc:id/>\n"
+                   "    <oc:dDU/>\n"
+                   "    <oc:dDC/>\n"
+                   "    <oc:permissions/>\n"
+                   "  </d:prop>\n"
+                   "</d:propfind>\n");
+    QBuffer *buf = new QBuffer(this);
+    buf->setData(xml);
+    buf->open(QIODevice::ReadOnly);
+    QNetworkReply *reply = davRequest("PROPFIND", path(), req, buf);
+    buf->setParent(reply);
+    setReply(reply);
+    setupConnections(reply);
+    connect(reply, SIGNAL(metaDataChanged()), this, SLOT(slotMetaDataChanged()));
+    connect(reply, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
+    _dirPath = hrefToPath(reply->request().url().toEncoded());
+    AbstractNetworkJob::start();
+}
+
+QVector<csync_vio_file_stat_t *> DiscoverySingleDirectoryJob::takeEntries()
+{
+    QVector<csync_vio_file_stat_t *> entries = _entries;
+    _entries.clear();
+    return entries;
+}
+
+void DiscoverySingleDirectoryJob::slotMetaDataChanged()
+{
+    // A Depth infinity listing is only known to work when it gives its first entry
+    if (reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 207 && !_recursive) {
+        _started = true;
+        emit listingStarted();
+    }
+}
+
+void DiscoverySingleDirectoryJob::slotReadyRead()
+{
+    if (reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 207) {
+        // The error page is not parsed
+        return;
+    }
+    resetTimeout();
+    _reader.addData(reply()->readAll());
+    parse();
+    if (!_entries.isEmpty()) {
+        if (!_started) {
+            _started = true;
+            emit listingStarted();
+        }
+        emit entriesReceived();
+    }
+    if (_hrefMismatch) {
+        reply()->abort();
+    }
+}
+
+void DiscoverySingleDirectoryJob::slotTimeout()
+{
+    qDebug() << Q_FUNC_INFO << path();
+    _timedOut = true;
+    reply()->abort();
+}
+
+bool DiscoverySingleDirectoryJob::finished()
+{
+    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    int errorCode = 0;
+    QString errorString;
+    if (_timedOut) {
+        errorCode = ERRNO_TIMEOUT;
+        errorString = tr("Connection Timeout");
+    } else if (_hrefMismatch) {
+        errorCode = ERRNO_WRONG_CONTENT;
+        errorString = tr("Invalid listing of %1").arg(path());
+    } else if (reply()->error() != QNetworkReply::NoError || httpCode != 207) {
+        errorCode = errnoFromReply(reply(), httpCode);
+        errorString = reply()->errorString();
+    } else {
+        _reader.addData(reply()->readAll());
+        parse();
+        if (_hrefMismatch) {
+            errorCode = ERRNO_WRONG_CONTENT;
+            errorString = tr("Invalid listing of %1").arg(path());
+        } else if (_reader.hasError()) {
+            // Also when the document is truncated
+            errorCode = ERRNO_WRONG_CONTENT;
+            errorString = tr("Invalid listing of %1: %2").arg(path(), _reader.errorString());
+        } else if (!_entries.isEmpty()) {
+            emit entriesReceived();
+        }
+    }
+    emit finishedListing(errorCode, errorString);
+    return true;
+}
+
+void DiscoverySingleDirectoryJob::parse()
+{
+    while (!_reader.atEnd() && !_hrefMismatch) {
+        QXmlStreamReader::TokenType type = _reader.readNext();
+        if (type == QXmlStreamReader::Invalid) {
+            // The end of what was received so far, or an error reported by finished()
+            return;
+        }
+        if (type == QXmlStreamReader::Characters) {
+            _text += _reader.text().toString();
+        } else if (type == QXmlStreamReader::StartElement) {
+            const bool isDav = _reader.namespaceUri() == QLatin1String("DAV:");
+            _text.clear();
+            if (isDav && _reader.name() == QLatin1String("response")) {
+                _href.clear();
+                _properties.clear();
+            } else if (isDav && _reader.name() == QLatin1String("propstat")) {
+                _inPropstat = true;
+                _propstatOk = false;
+                _propstatProperties.clear();
+            } else if (isDav && _reader.name() == QLatin1String("collection")) {
+                _propstatProperties.insert(QLatin1String("resourcetype"), QLatin1String("collection"));
+            }
+        } else if (type == QXmlStreamReader::EndElement) {
+            const bool isDav = _reader.namespaceUri() == QLatin1String("DAV:");
+            const QString name = _reader.name().toString();
+            if (isDav && name == QLatin1String("href") && !_inPropstat) {
+                _href = _text;
+            } else if (isDav && name == QLatin1String("status") && _inPropstat) {
+                _propstatOk = _text.contains(QLatin1String(" 200 "));
+            } else if (isDav && name == QLatin1String("propstat")) {
+                // Only the properties the server found
+                if (_propstatOk) {
+                    QHash<QString, QString>::const_iterator it;
+                    for (it = _propstatProperties.constBegin(); it != _propstatProperties.constEnd(); ++it) {
+                        _properties.insert(it.key(), it.value());
+                    }
+                }
+                _inPropstat = false;
+            } else if (isDav && name == QLatin1String("response")) {
+                addEntry();
+            } else if (_inPropstat && name != QLatin1String("prop") && name != QLatin1String("resourcetype")
+                       && name != QLatin1String("collection")) {
+                _propstatProperties.insert(name, _text);
+            }
+            _text.clear();
+        }
+    }
+}
+
+void DiscoverySingleDirectoryJob::addEntry()
+{
+    const QString path = hrefToPath(_href.toUtf8());
+    if (_href.isEmpty() || path == _dirPath) {
+        // The directory itself
+        return;
+    }
+    QString name;
+    if (_recursive) {
+        if (!path.startsWith(_dirPath + QLatin1Char('/'))) {
+            // We could not tell in which directory it is
+            qDebug() << Q_FUNC_INFO << path << "is not in" << _dirPath;
+            _hrefMismatch = true;
+            return;
+        }
+        name = path.mid(_dirPath.size() + 1);
+    } else {
+        name = path.mid(path.lastIndexOf(QLatin1Char('/')) + 1);
+    }
+    if (name.isEmpty()) {
+        return;
+    }
+
+    csync_vio_file_stat_t *fs = csync_vio_file_stat_new();
+    int fields = CSYNC_VIO_FILE_STAT_FIELDS_TYPE | CSYNC_VIO_FILE_STAT_FIELDS_MTIME
+            | CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+    fs->name = strdup(name.toUtf8().constData());
+    fs->type = _properties.value(QLatin1String("resourcetype")) == QLatin1String("collection")
+            ? CSYNC_VIO_FILE_TYPE_DIRECTORY : CSYNC_VIO_FILE_TYPE_REGULAR;
+    fs->mtime = httpDateToTime_t(_properties.value(QLatin1String("getlastmodified")));
+    fs->size = _properties.value(QLatin1String("getcontentlength")).toLongLong();
+    if (_properties.contains(QLatin1String("getetag"))) {
+        fs->etag = csync_normalize_etag(_properties.value(QLatin1String("getetag")).toUtf8().constData());
+        fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+    }
+    if (_properties.contains(QLatin1String("dDU"))) {
+        fs->directDownloadUrl = strdup(_properties.value(QLatin1String("dDU")).toUtf8().constData());
+        fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL;
+    }
+    if (_properties.contains(QLatin1String("dDC"))) {
+        fs->directDownloadCookies = strdup(_properties.value(QLatin1String("dDC")).toUtf8().constData());
+        fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES;
+    }
+    if (_properties.contains(QLatin1String("permissions"))) {
+        QByteArray perm = _properties.value(QLatin1String("permissions")).toUtf8();
+        if (perm.isEmpty()) {
+            // special meaning for our code: server returned permissions but are empty
+            // meaning only reading is allowed for this resource (see _csync_detect_update)
+            fs->remotePerm[0] = ' ';
+        } else if (perm.size() < int(sizeof(fs->remotePerm))) {
+            strncpy(fs->remotePerm, perm.constData(), sizeof(fs->remotePerm));
+        }
+        fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
+    }
+    fs->fields = csync_vio_file_stat_fields_e(fields);
+    // sets its own field
+    csync_vio_file_stat_set_file_id(fs, _properties.value(QLatin1String("id")).toUtf8().constData());
+    _entries.append(fs);
+}
+
+/*********************************************************************************************/
+
+DiscoveryDirectoryResult::~DiscoveryDirectoryResult()
+{
+    foreach (csync_vio_file_stat_t *fs, entries) {
+        csync_vio_file_stat_destroy(fs);
+    }
+}
+
+DiscoveryMainThread::DiscoveryMainThread(Account *account, const QString &remotePath, int window, QObject *parent)
+    : QObject(parent), _account(account), _remoteFolder(remotePath), _window(window),
+      _timeout(OwncloudPropagator::httpTimeout()), _listRootRecursively(false), _aborted(false),
+      _prefetchRunning(0), _prefetchUnused(0), _recursiveRunning(0), _recursiveRefused(false),
+      _latencyMs(-1), _msPerEntry(1),
+      _listedCount(0), _prefetchedCount(0), _prefetchUsedCount(0), _waitCount(0), _recursiveCount(0)
+{
+    if (!_remoteFolder.endsWith(QLatin1Char('/'))) {
+        _remoteFolder += QLatin1Char('/');
+    }
+    _duration.start();
+}
+
+DiscoveryMainThread::~DiscoveryMainThread()
+{
+    abort();
+    qDebug() << "Discovery listed" << _listedCount << "remote folders in" << _duration.elapsed() << "ms,"
+             << "window" << _window << ":" << _prefetchedCount << "queued in advance,"
+             << _prefetchUsedCount << "used," << _waitCount << "waited for,"
+             << _recursiveCount << "with Depth infinity";
+
+    // The closed ones whose job was still running are only in _jobs
+    QSet<DiscoveryDirectoryResult *> results = _results.values().toSet();
+    results.unite(_jobs.values().toSet());
+    qDeleteAll(results);
+}
+
+bool DiscoveryMainThread::isEnabled()
+{
+    static bool useNeon = qgetenv("OWNCLOUD_NEON_DISCOVERY").toInt();
+    return !useNeon;
+}
+
+DiscoveryDirectoryResult *DiscoveryMainThread::openDirectory(const QString &path, int *errorCode,
+                                                             QString *errorString)
+{
+    QMutexLocker locker(&_mutex);
+    DiscoveryDirectoryResult *result = _results.value(path);
+    if (!result) {
+        result = new DiscoveryDirectoryResult(path);
+        if (path.isEmpty() && _listRootRecursively) {
+            result->recursiveRoot = result;
+            _recursiveRunning++;
+            _recursiveCount++;
+        }
+        _results.insert(path, result);
+        _queue.append(result);
+    } else if (result->prefetched) {
+        // Started in advance
+        _prefetchUnused--;
+        _prefetchUsedCount++;
+    }
+    result->opened = true;
+    if (result->state == DiscoveryDirectoryResult::Queued) {
+        // The walker waits for it: before the prefetched ones
+        _queue.removeOne(result);
+        _queue.prepend(result);
+        QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+    }
+
+    if (!result->statusKnown && !_aborted) {
+        _waitCount++;
+    }
+    while (!result->statusKnown && !_aborted) {
+        _cond.wait(&_mutex);
+    }
+    if (!result->statusKnown) {
+        *errorCode = ERRNO_USER_ABORT;
+        *errorString = tr("Aborted by the user");
+    } else {
+        *errorCode = result->code;
+        *errorString = result->msg;
+    }
+    if (*errorCode != 0) {
+        release(result);
+        return 0;
+    }
+    return result;
+}
+
+csync_vio_file_stat_t *DiscoveryMainThread::readEntry(DiscoveryDirectoryResult *result,
+                                                      QVector<csync_vio_file_stat_t *> *lookahead,
+                                                      int *errorCode, QString *errorString)
+{
+    QMutexLocker locker(&_mutex);
+    while (result->readIndex >= result->entries.size()
+           && result->state != DiscoveryDirectoryResult::Finished && !_aborted) {
+        _cond.wait(&_mutex);
+    }
+    if (result->readIndex < result->entries.size()) {
+        csync_vio_file_stat_t *fs = result->entries[result->readIndex];
+        result->entries[result->readIndex] = 0; // now owned by csync
+        result->readIndex++;
+        if (lookahead) {
+            for (int i = qMax(result->scanIndex, result->readIndex); i < result->entries.size(); ++i) {
+                lookahead->append(result->entries[i]);
+            }
+            result->scanIndex = result->entries.size();
+        }
+        return fs;
+    }
+    if (result->state != DiscoveryDirectoryResult::Finished) {
+        *errorCode = ERRNO_USER_ABORT;
+        *errorString = tr("Aborted by the user");
+    } else {
+        *errorCode = result->code;
+        *errorString = result->msg;
+    }
+    return 0;
+}
+
+void DiscoveryMainThread::closeDirectory(DiscoveryDirectoryResult *result)
+{
+    QMutexLocker locker(&_mutex);
+    release(result);
+}
+
+// Called with the mutex locked
+void DiscoveryMainThread::release(DiscoveryDirectoryResult *result)
+{
+    const bool running = result->state == DiscoveryDirectoryResult::Running;
+    const bool filledByAncestor = result->recursiveRoot && result->recursiveRoot != result;
+    if (running && filledByAncestor) {
+        // Stays in _results so the entries still received for it are dropped,
+        // deleted by finishRecursiveListing()
+        result->closed = true;
+        return;
+    }
+    if (_results.value(result->path) == result) {
+        _results.remove(result->path);
+    }
+    if (running) {
+        // Deleted when the job is done, schedule() aborts it
+        result->closed = true;
+        QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+    } else {
+        _queue.removeOne(result);
+        delete result;
+    }
+}
+
+void DiscoveryMainThread::prefetchDirectory(const QString &path, bool recursive)
+{
+    QMutexLocker locker(&_mutex);
+    if (_aborted || _results.contains(path)) {
+        return;
+    }
+    DiscoveryDirectoryResult *result = new DiscoveryDirectoryResult(path);
+    if (recursive) {
+        result->recursiveRoot = result;
+        _recursiveRunning++;
+        _recursiveCount++;
+    }
+    _results.insert(path, result);
+    _queue.append(result);
+    _prefetchedCount++;
+    QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+}
+
+bool DiscoveryMainThread::canListRecursively(const QString &path)
+{
+    QMutexLocker locker(&_mutex);
+    // One at a time: the walker waits for the whole reply
+    return !_aborted && !_recursiveRefused && _recursiveRunning == 0 && _latencyMs >= 0
+            && !_results.contains(path);
+}
+
+bool DiscoveryMainThread::recursiveListingCheaper(int records, int dirs, double staleFraction)
+{
+    QMutexLocker locker(&_mutex);
+    if (records < 50 || _latencyMs < 0) {
+        return false;
+    }
+    // The changed directories, listed 'window' at a time
+    const double depthOneMs = staleFraction * (dirs + 1) * _latencyMs / _window;
+    // One request, but the unchanged entries are sent too, and the walker only gets
+    // to the end of a directory when the whole reply is received.
+    const double infinityMs = _latencyMs + records * _msPerEntry;
+    if (2 * infinityMs >= depthOneMs) {
+        return false;
+    }
+    qDebug() << "Listing a tree of" << records << "entries," << dirs << "folders with Depth infinity:"
+             << "expecting" << int(infinityMs) << "ms instead of" << int(depthOneMs) << "ms";
+    return true;
+}
+
+void DiscoveryMainThread::schedule()
+{
+    QList<DiscoveryDirectoryResult *> toStart;
+    QList<DiscoverySingleDirectoryJob *> jobsToStart;
+    QList<DiscoverySingleDirectoryJob *> toAbort;
+    {
+        QMutexLocker locker(&_mutex);
+        if (_aborted) {
+            return;
+        }
+        QHash<DiscoverySingleDirectoryJob *, DiscoveryDirectoryResult *>::const_iterator jobIt;
+        for (jobIt = _jobs.constBegin(); jobIt != _jobs.constEnd(); ++jobIt) {
+            if (jobIt.value()->closed) {
+                toAbort.append(jobIt.key());
+            }
+        }
+
+        // The walker does not wait for the prefetched ones: limit them, and how many
+        // listings are kept in memory before it uses them.
+        while (!_queue.isEmpty()) {
+            DiscoveryDirectoryResult *result = _queue.first();
+            if (!result->opened) {
+                if (_prefetchRunning >= _window - 1 || _prefetchUnused >= 8 * _window) {
+                    break;
+                }
+                result->prefetched = true;
+                _prefetchRunning++;
+                _prefetchUnused++;
+            }
+            _queue.removeFirst();
+            result->state = DiscoveryDirectoryResult::Running;
+            toStart.append(result);
+        }
+
+        foreach (DiscoveryDirectoryResult *result, toStart) {
+            DiscoverySingleDirectoryJob *job = new DiscoverySingleDirectoryJob(_account,
+                    _remoteFolder + result->path, this);
+            job->setRecursive(result->recursiveRoot == result);
+            result->timer.start();
+            result->latency = -1;
+            _jobs.insert(job, result);
+            jobsToStart.append(job);
+        }
+    }
+
+    // Outside of the lock: abort() emits finished() right away
+    foreach (DiscoverySingleDirectoryJob *job, toAbort) {
+        job->reply()->abort();
+    }
+
+    foreach (DiscoverySingleDirectoryJob *job, jobsToStart) {
+        connect(job, SIGNAL(listingStarted()), this, SLOT(slotListingStarted()));
+        connect(job, SIGNAL(entriesReceived()), this, SLOT(slotEntriesReceived()));
+        connect(job, SIGNAL(finishedListing(int,QString)), this, SLOT(slotFinishedListing(int,QString)));
+        job->setTimeout(_timeout * 1000);
+        job->start();
+    }
+}
+
+// Called with the mutex locked
+DiscoveryDirectoryResult *DiscoveryMainThread::resultForSender()
+{
+    return _jobs.value(qobject_cast<DiscoverySingleDirectoryJob *>(sender()));
+}
+
+void DiscoveryMainThread::slotListingStarted()
+{
+    QMutexLocker locker(&_mutex);
+    if (DiscoveryDirectoryResult *result = resultForSender()) {
+        result->statusKnown = true;
+        if (result->recursiveRoot != result) {
+            result->latency = result->timer.elapsed();
+            _latencyMs = _latencyMs < 0 ? result->latency : (3 * _latencyMs + result->latency) / 4;
+        }
+        _cond.wakeAll();
+    }
+}
+
+void DiscoveryMainThread::slotEntriesReceived()
+{
+    DiscoverySingleDirectoryJob *job = qobject_cast<DiscoverySingleDirectoryJob *>(sender());
+    if (!job) {
+        return;
+    }
+    QVector<csync_vio_file_stat_t *> entries = job->takeEntries();
+
+    QMutexLocker locker(&_mutex);
+    DiscoveryDirectoryResult *result = resultForSender();
+    if (!result || result->closed) {
+        foreach (csync_vio_file_stat_t *fs, entries) {
+            csync_vio_file_stat_destroy(fs);
+        }
+        return;
+    }
+    if (result->recursiveRoot == result) {
+        addRecursiveEntries(result, entries);
+    } else {
+        result->entries += entries;
+    }
+    _cond.wakeAll();
+}
+
+// Called with the mutex locked. Gives the entries of a Depth infinity listing to the
+// directory they are in, named relative to it.
+void DiscoveryMainThread::addRecursiveEntries(DiscoveryDirectoryResult *root,
+                                              const QVector<csync_vio_file_stat_t *> &entries)
+{
+    foreach (csync_vio_file_stat_t *fs, entries) {
+        const QString relative = QString::fromUtf8(fs->name);
+        const int slash = relative.lastIndexOf(QLatin1Char('/'));
+        const QString prefix = root->path.isEmpty() ? QString() : root->path + QLatin1Char('/');
+        root->recursiveDepth = qMax(root->recursiveDepth, relative.count(QLatin1Char('/')) + 1);
+
+        if (fs->type == CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+            // Known before the walker opens it, also when it is empty
+            recursiveResult(root, prefix + relative);
+        }
+
+        DiscoveryDirectoryResult *dir = root;
+        if (slash >= 0) {
+            dir = recursiveResult(root, prefix + relative.left(slash));
+            char *name = strdup(relative.mid(slash + 1).toUtf8().constData());
+            SAFE_FREE(fs->name);
+            fs->name = name;
+        }
+        if (!dir || dir->closed) {
+            csync_vio_file_stat_destroy(fs);
+            continue;
+        }
+        dir->entries.append(fs);
+    }
+}
+
+// Called with the mutex locked. 0 if the directory is listed by another job.
+DiscoveryDirectoryResult *DiscoveryMainThread::recursiveResult(DiscoveryDirectoryResult *root,
+                                                               const QString &path)
+{
+    DiscoveryDirectoryResult *result = _results.value(path);
+    if (result) {
+        return result->recursiveRoot == root ? result : 0;
+    }
+    result = new DiscoveryDirectoryResult(path);
+    result->state = DiscoveryDirectoryResult::Running;
+    result->statusKnown = true;
+    result->recursiveRoot = root;
+    _results.insert(path, result);
+    return result;
+}
+
+// Called with the mutex locked when the Depth infinity listing of root is done.
+// Returns false if root needs to be listed again with Depth 1.
+bool DiscoveryMainThread::finishRecursiveListing(DiscoveryDirectoryResult *root, int errorCode,
+                                                 const QString &errorString)
+{
+    root->recursiveRoot = 0;
+    _recursiveRunning--;
+    if (errorCode != 0 && !root->statusKnown && !root->closed) {
+        qDebug() << "Depth infinity listing of" << root->path << "refused:" << errorCode << errorString
+                 << "- listing it with Depth 1";
+        _recursiveRefused = true;
+        if (root->prefetched) {
+            // schedule() counts it again if it starts before the walker opens it
+            root->prefetched = false;
+            if (!root->opened) {
+                _prefetchUnused--;
+            }
+        }
+        root->state = DiscoveryDirectoryResult::Queued;
+        _queue.prepend(root);
+        return false;
+    }
+
+    // Without anything two levels deep, the server only gave us the first level:
+    // the sub directories only look empty.
+    const bool complete = errorCode != 0 || root->recursiveDepth >= 2;
+    int count = 0;
+    foreach (DiscoveryDirectoryResult *result, _results.values()) {
+        if (result->recursiveRoot != root) {
+            continue;
+        }
+        count++;
+        result->recursiveRoot = 0;
+        if (result->closed) {
+            _results.remove(result->path);
+            delete result;
+        } else if (!complete) {
+            result->state = DiscoveryDirectoryResult::Queued;
+            result->statusKnown = false;
+            if (result->opened) {
+                _queue.prepend(result);
+            } else {
+                _queue.append(result);
+            }
+        } else {
+            result->state = DiscoveryDirectoryResult::Finished;
+            result->code = errorCode;
+            result->msg = errorString;
+        }
+    }
+    _cond.wakeAll();
+    qDebug() << "Depth infinity listing of" << root->path << "gave" << count << "folders,"
+             << root->recursiveDepth << "levels deep" << (complete ? "" : "- listing them with Depth 1");
+    return true;
+}
+
+void DiscoveryMainThread::slotFinishedListing(int errorCode, const QString &errorString)
+{
+    {
+        QMutexLocker locker(&_mutex);
+        DiscoveryDirectoryResult *result = resultForSender();
+        if (!result) {
+            return;
+        }
+        _jobs.remove(qobject_cast<DiscoverySingleDirectoryJob *>(sender()));
+        _listedCount++;
+        if (result->prefetched) {
+            _prefetchRunning--;
+        }
+        if (errorCode == 0 && result->recursiveRoot != result && result->entries.size() >= 20) {
+            // Large enough for the time per entry not to be the latency
+            const double msPerEntry = double(result->timer.elapsed()) / result->entries.size();
+            _msPerEntry = (3 * _msPerEntry + msPerEntry) / 4;
+        }
+        if (result->recursiveRoot == result && !finishRecursiveListing(result, errorCode, errorString)) {
+            // Queued again
+        } else if (result->closed) {
+            delete result;
+        } else {
+            result->state = DiscoveryDirectoryResult::Finished;
+            result->statusKnown = true;
+            result->code = errorCode;
+            result->msg = errorString;
+            _cond.wakeAll();
+        }
+    }
+    // A slot is free for the next one
+    schedule();
+}
+
+void DiscoveryMainThread::abort()
+{
+    QList<DiscoverySingleDirectoryJob *> jobs;
+    {
+        QMutexLocker locker(&_mutex);
+        if (_aborted) {
+            return;
+        }
+        _aborted = true;
+        jobs = _jobs.keys();
+        _cond.wakeAll();
+    }
+    foreach (DiscoverySingleDirectoryJob *job, jobs) {
+        disconnect(job, 0, this, 0);
+        if (job->reply()) {
+            job->reply()->abort();
+        }
+    }
+}
+
 }
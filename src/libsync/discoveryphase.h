@@ -17,11 +17,208 @@
 #include <QObject>
 #include <QElapsedTimer>
 #include <QStringList>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
+#include <QXmlStreamReader>
 #include <csync.h>
+#include <vio/csync_vio_file_stat.h>
+#include "networkjobs.h"
 
 
 namespace Mirall {
 
+class Account;
+class DiscoveryMainThread;
+
+/**
+ * Depth 1 PROPFIND listing a remote directory, with the properties csync needs.
+ *
+ * The reply is parsed as it arrives: entriesReceived() is emitted when new entries can be
+ * taken with takeEntries(), so the directory can be walked before the listing is complete.
+ *
+ * With setRecursive(), the whole tree below the directory is listed with Depth infinity.
+ * The name of each entry is then its path relative to the directory.
+ */
+class DiscoverySingleDirectoryJob : public AbstractNetworkJob {
+    Q_OBJECT
+public:
+    explicit DiscoverySingleDirectoryJob(Account *account, const QString &path, QObject *parent = 0);
+    ~DiscoverySingleDirectoryJob();
+    void start() Q_DECL_OVERRIDE;
+
+    void setRecursive(bool recursive) { _recursive = recursive; }
+
+    /** The entries parsed since the last call. The caller takes ownership */
+    QVector<csync_vio_file_stat_t *> takeEntries();
+
+signals:
+    /** The server accepted the request: the listing follows. For Depth infinity, sent with the first entries */
+    void listingStarted();
+    void entriesReceived();
+    /** errorCode is an errno value as used by csync, 0 on success */
+    void finishedListing(int errorCode, const QString &errorString);
+
+private slots:
+    void slotMetaDataChanged();
+    void slotReadyRead();
+    virtual void slotTimeout() Q_DECL_OVERRIDE;
+
+private:
+    virtual bool finished() Q_DECL_OVERRIDE;
+    void parse();
+    void addEntry();
+
+    QXmlStreamReader _reader;
+    QString _dirPath; // decoded path of the directory on the server, to skip its own entry
+    QString _text;
+    QString _href;
+    QHash<QString, QString> _properties; // of the current response
+    QHash<QString, QString> _propstatProperties;
+    bool _inPropstat;
+    bool _propstatOk;
+    bool _timedOut;
+    bool _recursive;
+    bool _hrefMismatch; // an entry of a Depth infinity listing is not below the directory
+    bool _started; // listingStarted() was emitted
+    QVector<csync_vio_file_stat_t *> _entries;
+};
+
+/**
+ * The listing of one remote directory.
+ * Filled in the main thread and read in the discovery thread, protected by the mutex
+ * of DiscoveryMainThread.
+ */
+struct DiscoveryDirectoryResult {
+    enum State { Queued, Running, Finished };
+
+    explicit DiscoveryDirectoryResult(const QString &path_)
+        : path(path_), state(Queued), opened(false), prefetched(false), closed(false),
+          statusKnown(false), code(0), readIndex(0), scanIndex(0), recursiveRoot(0), recursiveDepth(0),
+          latency(-1), dirsSeen(0), dirsChanged(0), traceStart(0) {}
+    ~DiscoveryDirectoryResult();
+
+    QString path; // relative to the root of the sync
+    State state;
+    bool opened; // by the walker
+    bool prefetched; // started before the walker opened it
+    bool closed;
+    bool statusKnown; // we know whether the listing succeeded or not
+    int code; // errno value as used by csync, 0 on success
+    QString msg;
+    QVector<csync_vio_file_stat_t *> entries;
+    int readIndex; // next entry returned by readdir
+    int scanIndex; // next entry to look at for prefetching
+    // The Depth infinity listing filling this one, 0 for a Depth 1 listing.
+    // Its directories are only complete when the whole reply is received.
+    DiscoveryDirectoryResult *recursiveRoot;
+    int recursiveDepth; // of the root of a Depth infinity listing: the deepest level received
+    QElapsedTimer timer; // since the request was sent
+    qint64 latency; // until the reply headers were received, -1 before
+    // Only used by the discovery thread: the sub directories looked at for prefetching,
+    // and how many of them need to be listed
+    int dirsSeen;
+    int dirsChanged;
+    qint64 traceStart; // when the walker opened it, see SyncTrace
+};
+
+/**
+ * Lists the remote directories with the network jobs of the account, for the csync walker
+ * running in the discovery thread.
+ *
+ * The walker opens the directories with openDirectory() and reads them with readEntry();
+ * both wait until the main thread received the data. Directories the walker will open
+ * later can be listed in advance with prefetchDirectory(): up to 'window' of these
+ * requests run at the same time.
+ */
+class DiscoveryMainThread : public QObject {
+    Q_OBJECT
+public:
+    DiscoveryMainThread(Account *account, const QString &remotePath, int window, QObject *parent = 0);
+    ~DiscoveryMainThread();
+
+    /**
+     * Whether the discovery is done with the network jobs.
+     * Set OWNCLOUD_NEON_DISCOVERY=1 to use the owncloud module of csync instead.
+     */
+    static bool isEnabled();
+
+    int window() const { return _window; }
+
+    /**
+     * List the tree with one Depth infinity PROPFIND when the walker opens the root,
+     * for the first sync. Falls back to Depth 1 if the server refuses it.
+     */
+    void setListRootRecursively(bool enabled) { _listRootRecursively = enabled; }
+
+    // Called from the discovery thread
+    /** Returns 0 and the errno value and message on error */
+    DiscoveryDirectoryResult *openDirectory(const QString &path, int *errorCode, QString *errorString);
+    /**
+     * The next entry, 0 at the end or on error (then errorCode is not 0).
+     * lookahead receives the entries received after this one that were not given before.
+     */
+    csync_vio_file_stat_t *readEntry(DiscoveryDirectoryResult *result,
+                                     QVector<csync_vio_file_stat_t *> *lookahead,
+                                     int *errorCode, QString *errorString);
+    void closeDirectory(DiscoveryDirectoryResult *result);
+    /** With recursive, the whole tree below path is listed with one Depth infinity PROPFIND */
+    void prefetchDirectory(const QString &path, bool recursive = false);
+
+    /** Whether a Depth infinity listing of path could be started now */
+    bool canListRecursively(const QString &path);
+    /**
+     * Whether listing a changed tree with one Depth infinity PROPFIND is expected to be
+     * faster than walking it with Depth 1, given its size in the journal, the part of it
+     * that is expected to have changed, and the latency observed so far.
+     */
+    bool recursiveListingCheaper(int records, int dirs, double staleFraction);
+
+    /** Makes the waiting discovery thread fail. Called from the main thread */
+    void abort();
+
+private slots:
+    void schedule();
+    void slotListingStarted();
+    void slotEntriesReceived();
+    void slotFinishedListing(int errorCode, const QString &errorString);
+
+private:
+    DiscoveryDirectoryResult *resultForSender();
+    void release(DiscoveryDirectoryResult *result);
+    void addRecursiveEntries(DiscoveryDirectoryResult *root, const QVector<csync_vio_file_stat_t *> &entries);
+    DiscoveryDirectoryResult *recursiveResult(DiscoveryDirectoryResult *root, const QString &path);
+    bool finishRecursiveListing(DiscoveryDirectoryResult *root, int errorCode, const QString &errorString);
+
+    Account *_account;
+    QString _remoteFolder; // ends with '/'
+    int _window;
+    int _timeout;
+    bool _listRootRecursively;
+
+    QMutex _mutex;
+    QWaitCondition _cond;
+    bool _aborted;
+    QHash<QString, DiscoveryDirectoryResult *> _results; // by path, until closed
+    QList<DiscoveryDirectoryResult *> _queue; // the ones the walker waits for first
+    QHash<DiscoverySingleDirectoryJob *, DiscoveryDirectoryResult *> _jobs;
+    int _prefetchRunning;
+    int _prefetchUnused; // started in advance and not opened yet, running or done
+    int _recursiveRunning; // Depth infinity listings queued or running
+    bool _recursiveRefused; // the server does not do Depth infinity
+    double _latencyMs; // average time until the headers of a Depth 1 listing, -1 before the first one
+    double _msPerEntry; // average time per entry of the large Depth 1 listings
+
+    // Statistics, logged when destroyed
+    QElapsedTimer _duration;
+    int _listedCount;
+    int _prefetchedCount;
+    int _prefetchUsedCount;
+    int _waitCount;
+    int _recursiveCount;
+};
+
 /**
  * The Discovery Phase was once called "update" phase in csync therms.
  * Its goal is to look at the files in one of the remote and check comared to the db
@@ -43,12 +240,28 @@ class DiscoveryJob : public QObject {
     bool isInBlackList(const QString &path) const;
     static int isInWhiteListCallBack(void *, const char *);
 
+    /**
+     * return true if the local directory does not need to be walked because
+     * it is neither in _localDiscoveryPaths nor a parent of one of them
+     */
+    bool isOutsideLocalDiscovery(const QString &path) const;
+    static int skipLocalDiscoveryCallBack(void *, const char *);
+
     static void update_job_update_callback (bool local,
                                             const char *dirname,
                                             void *userdata);
+
+    // The csync vio hooks, used when _vioMainThread is set
+    static void *remote_vio_opendir_hook (const char *url, void *userdata);
+    static csync_vio_file_stat_t *remote_vio_readdir_hook (void *dhandle, void *userdata);
+    static void remote_vio_closedir_hook (void *dhandle, void *userdata);
+    bool listRecursively(DiscoveryDirectoryResult *parent, const QString &path,
+                         const csync_vio_file_stat_t *entry);
+    void setErrorString(const QString &msg);
+
 public:
     explicit DiscoveryJob(CSYNC *ctx, QObject* parent = 0)
-            : QObject(parent), _csync_ctx(ctx) {
+            : QObject(parent), _csync_ctx(ctx), _vioMainThread(0) {
         // We need to forward the log property as csync uses thread local
         // and updates run in another thread
         _log_callback = csync_get_log_callback();
@@ -57,7 +270,17 @@ public:
     }
 
     QStringList _selectiveSyncBlackList;
+    // If not empty, the local tree is only walked in these paths, the rest is read from the journal
+    QStringList _localDiscoveryPaths;
+    // If set, the remote directories are listed with it instead of the owncloud module
+    DiscoveryMainThread *_vioMainThread;
     Q_INVOKABLE void start();
+
+    /**
+     * Number of remote directories that can be listed at the same time.
+     * Set with the OWNCLOUD_MAX_PARALLEL_PROPFIND environment variable (default 4, 1 to disable)
+     */
+    static int propfindWindow();
 signals:
     void finished(int result);
     void folderDiscovered(bool local, QString folderUrl);
@@ -22,6 +22,15 @@
 #ifdef Q_OS_WIN
 #include <windef.h>
 #include <winbase.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
 #endif
 
 
@@ -116,6 +125,32 @@ bool FileSystem::renameReplace(const QString& originFileName, const QString& des
     return true;
 }
 
+bool FileSystem::preallocate(QFile& file, qint64 size)
+{
+#ifdef Q_OS_LINUX
+    // FALLOC_FL_KEEP_SIZE: the size of a partially downloaded file is used to know from where
+    // to resume, so we must only reserve the blocks and not extend the file.
+    if (fallocate(file.handle(), FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+        qDebug() << "preallocate: could not reserve" << size << "bytes for" << file.fileName()
+                 << strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(file);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
 
+bool FileSystem::syncToDisk(QFile& file)
+{
+    file.flush();
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
 
 }
@@ -16,6 +16,8 @@
 #include <QString>
 #include <ctime>
 
+class QFile;
+
 #include <owncloudlib.h>
 
 namespace Mirall {
@@ -41,4 +43,14 @@ void setModTime(const QString &filename, time_t modTime);
 bool renameReplace(const QString &originFileName, const QString &destinationFileName,
                    QString *errorString);
 
+/**
+ * Reserve \a size bytes of disk space for the open \a file, without changing its apparent size.
+ * This avoids fragmentation when the file is then written by small appends.
+ * Only has an effect on Linux; returns false if nothing was reserved.
+ */
+bool preallocate(QFile &file, qint64 size);
+
+/** Flush the data of the open \a file to the disk */
+bool syncToDisk(QFile &file);
+
 }}
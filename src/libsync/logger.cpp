@@ -15,7 +15,11 @@
 #include "logger.h"
 
 #include <QDir>
+#include <QElapsedTimer>
 #include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+#include <QVector>
 
 namespace Mirall {
 
@@ -23,24 +27,384 @@ namespace Mirall {
 // logging handler.
 static void mirallLogCatcher(QtMsgType type, const char *msg)
 {
-  Q_UNUSED(type)
   // qDebug() exports to local8Bit, which is not always UTF-8
   Logger::instance()->mirallLog( QString::fromLocal8Bit(msg) );
+  if (type == QtFatalMsg) {
+      // the application aborts right after
+      Logger::instance()->flush();
+  }
 }
 static void qInstallMessageHandler(QtMsgHandler h) {
     qInstallMsgHandler(h);
 }
 #else
-static void mirallLogCatcher(QtMsgType, const QMessageLogContext &ctx, const QString &message) {
+static void mirallLogCatcher(QtMsgType type, const QMessageLogContext &ctx, const QString &message) {
     Q_UNUSED(ctx);
 
     QByteArray file = ctx.file;
     file = file.mid(file.lastIndexOf('/') + 1);
     Logger::instance()->mirallLog( QString::fromLocal8Bit(file) + QLatin1Char(':') + QString::number(ctx.line)
                                     + QLatin1Char(' ')  + message) ;
+    if (type == QtFatalMsg) {
+        // the application aborts right after
+        Logger::instance()->flush();
+    }
 }
 #endif
 
+/*
+ * Bounded multi-producer queue of log lines, after Dmitry Vyukov's MPMC queue.
+ * Every slot has a sequence number: a producer may fill the slot when it equals
+ * the position it claimed, the consumer may take it when it is one more.
+ * There is a single consumer, the LogWriter.
+ * The requests to change the log file go through the queue too, so that they
+ * apply after the lines logged before them.
+ */
+class LogQueue
+{
+public:
+    enum EntryType { Line, SetFile, NextFile };
+
+    explicit LogQueue(int capacity)
+        : _slots(capacity), _mask(capacity - 1), _dequeuePos(0)
+    {
+        Q_ASSERT((capacity & _mask) == 0);
+        for (int i = 0; i < capacity; ++i) {
+            _slots[i].sequence.fetchAndStoreRelaxed(i);
+        }
+        _buffer = _slots.data();
+    }
+
+    /** Returns false if the queue is full */
+    bool enqueue(const QString &text, EntryType type = Line)
+    {
+        uint pos = _enqueuePos.fetchAndAddRelaxed(0);
+        Slot *slot;
+        forever {
+            slot = &_buffer[pos & _mask];
+            const int diff = int(uint(slot->sequence.fetchAndAddAcquire(0)) - pos);
+            if (diff == 0) {
+                if (_enqueuePos.testAndSetRelaxed(int(pos), int(pos + 1))) {
+                    break;
+                }
+                pos = _enqueuePos.fetchAndAddRelaxed(0);
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueuePos.fetchAndAddRelaxed(0);
+            }
+        }
+        slot->text = text;
+        slot->type = type;
+        slot->sequence.fetchAndStoreRelease(int(pos + 1));
+        return true;
+    }
+
+    /** Only called by the consumer. Returns false if the queue is empty */
+    bool dequeue(QString *text, EntryType *type)
+    {
+        Slot *slot = &_buffer[_dequeuePos & _mask];
+        const int diff = int(uint(slot->sequence.fetchAndAddAcquire(0)) - (_dequeuePos + 1));
+        if (diff < 0) {
+            return false;
+        }
+        text->swap(slot->text);
+        slot->text.clear();
+        *type = slot->type;
+        slot->sequence.fetchAndStoreRelease(int(_dequeuePos + _mask + 1));
+        ++_dequeuePos;
+        return true;
+    }
+
+private:
+    struct Slot {
+        Slot() : type(Line) {}
+        QAtomicInt sequence;
+        QString text; // the line, or the argument of the request
+        EntryType type;
+    };
+
+    QVector<Slot> _slots;
+    Slot *_buffer; // the data of _slots, which must not be detached concurrently
+    const uint _mask;
+    QAtomicInt _enqueuePos;
+    uint _dequeuePos;
+};
+
+/*
+ * The thread writing the log file. It also applies the requests of the Logger
+ * that touch the file: opening another one and the rotation, which lists and
+ * expires the old files of the log directory.
+ */
+class LogWriter : public QThread
+{
+public:
+    explicit LogWriter(Logger *logger)
+        : _historySize(20000), _logExpire(0), _logger(logger), _queue(queueCapacity()), _flushCount(0)
+    {
+    }
+
+    static int queueCapacity()
+    {
+        return 8192; // a power of two
+    }
+
+    void push(const QString &line)
+    {
+        QElapsedTimer waiting;
+        bool full = false;
+        while (!_queue.enqueue(line)) {
+            // Full: wait a bit for the writer, but never forever as the writer
+            // itself may log, and a stalled disk must not stall the sync.
+            if (!full) {
+                full = true;
+                waiting.start();
+            } else if (QThread::currentThread() == this || waiting.elapsed() > 100) {
+                _dropped.ref();
+                return;
+            }
+            wake();
+            QThread::yieldCurrentThread();
+        }
+        if (_sleeping.testAndSetOrdered(1, 0)) {
+            wake();
+        }
+    }
+
+    /** Unlike a line, a request to change the file is never dropped */
+    void addCommand(LogQueue::EntryType type, const QString &argument = QString())
+    {
+        Q_ASSERT(QThread::currentThread() != this);
+        while (!_queue.enqueue(argument, type)) {
+            wake();
+            QThread::yieldCurrentThread();
+        }
+        wake();
+    }
+
+    void flush()
+    {
+        if (!isRunning() || QThread::currentThread() == this) {
+            return;
+        }
+        QMutexLocker lock(&_mutex);
+        const int flushed = _flushCount;
+        _flushRequested.fetchAndStoreOrdered(1);
+        _wakeUp.wakeOne();
+        // at most a second: a stalled disk must not stall the caller
+        QElapsedTimer waiting;
+        waiting.start();
+        while (_flushCount == flushed) {
+            const qint64 remaining = 1000 - waiting.elapsed();
+            if (remaining <= 0 || !_flushed.wait(&_mutex, remaining)) {
+                break;
+            }
+        }
+    }
+
+    void stop()
+    {
+        _stop.fetchAndStoreOrdered(1);
+        wake();
+        wait();
+    }
+
+    friend class Logger;
+
+    // accessed by the GUI and the writer, under _historyMutex
+    mutable QMutex _historyMutex;
+    QStringList _history;
+    int _historySize;
+
+    // accessed by the GUI and the writer, under _mutex
+    QString _logDirectory; // passed with each rotation request
+    int _logExpire;
+
+    QAtomicInt _doFileFlush;
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        QStringList batch;
+        forever {
+            QString text;
+            LogQueue::EntryType type;
+            while (batch.size() < 1000 && _queue.dequeue(&text, &type)) {
+                if (type == LogQueue::Line) {
+                    batch.append(text);
+                    continue;
+                }
+                // the lines logged before the request go to the previous file
+                if (!batch.isEmpty()) {
+                    write(batch);
+                    batch.clear();
+                }
+                runCommand(type, text);
+            }
+            const int dropped = _dropped.fetchAndStoreRelaxed(0);
+            if (dropped) {
+                batch.append(QString::fromLatin1("[%1 log lines were dropped]").arg(dropped));
+            }
+
+            if (!batch.isEmpty()) {
+                write(batch);
+                batch.clear();
+                continue;
+            }
+
+            // Everything that was logged so far is written
+            if (_flushRequested.fetchAndStoreOrdered(0)) {
+                if (_logstream) {
+                    _logstream->flush();
+                }
+                QMutexLocker lock(&_mutex);
+                _flushCount++;
+                _flushed.wakeAll();
+            }
+            if (_stop.fetchAndAddOrdered(0)) {
+                break;
+            }
+
+            QMutexLocker lock(&_mutex);
+            if (_flushRequested.fetchAndAddOrdered(0)) {
+                // requested since the check above, its wake up was missed
+                continue;
+            }
+            _sleeping.fetchAndStoreOrdered(1);
+            // the timeout covers a push between the dequeue and here
+            _wakeUp.wait(&_mutex, 100);
+            _sleeping.fetchAndStoreOrdered(0);
+        }
+
+        if (_logstream) {
+            _logstream->flush();
+        }
+    }
+
+private:
+    void wake()
+    {
+        QMutexLocker lock(&_mutex);
+        _wakeUp.wakeOne();
+    }
+
+    void write(const QStringList &batch)
+    {
+        if (_logstream) {
+            foreach (const QString &line, batch) {
+                (*_logstream) << line << QLatin1Char('\n');
+            }
+            if (_doFileFlush.fetchAndAddRelaxed(0)) {
+                _logstream->flush();
+            }
+        }
+
+        {
+            QMutexLocker lock(&_historyMutex);
+            _history += batch;
+            if (_history.size() > _historySize) {
+                _history.erase(_history.begin(), _history.begin() + (_history.size() - _historySize));
+            }
+        }
+
+        // one signal per batch, the log browser appends the lines at once
+        emit _logger->newLog(batch.join(QLatin1String("\n")));
+    }
+
+    void runCommand(LogQueue::EntryType type, const QString &argument)
+    {
+        if (type == LogQueue::SetFile) {
+            setLogFile(argument);
+        } else {
+            int logExpire;
+            {
+                QMutexLocker lock(&_mutex);
+                logExpire = _logExpire;
+            }
+            // the directory is the one set when the rotation was requested
+            enterNextLogFile(argument, logExpire);
+        }
+    }
+
+    void setLogFile(const QString &name)
+    {
+        if( _logstream ) {
+            _logstream.reset(0);
+            _logFile.close();
+        }
+
+        if( name.isEmpty() ) {
+            return;
+        }
+
+        bool openSucceeded = false;
+        if (name == QLatin1String("-")) {
+            openSucceeded = _logFile.open(1, QIODevice::WriteOnly);
+        } else {
+            _logFile.setFileName( name );
+            openSucceeded = _logFile.open(QIODevice::WriteOnly);
+        }
+
+        if(!openSucceeded) {
+            _logger->postGuiMessage( Logger::tr("Error"),
+                                     QString(Logger::tr("<nobr>File '%1'<br/>cannot be opened for writing.<br/><br/>"
+                                                        "The log output can <b>not</b> be saved!</nobr>"))
+                                     .arg(name));
+            return;
+        }
+
+        _logstream.reset(new QTextStream( &_logFile ));
+    }
+
+    void enterNextLogFile(const QString &logDirectory, int logExpire)
+    {
+        if (logDirectory.isEmpty()) {
+            return;
+        }
+        QDir dir(logDirectory);
+        if (!dir.exists()) {
+            dir.mkpath(".");
+        }
+
+        // Find out what is the file with the highest nymber if any
+        QStringList files = dir.entryList(QStringList("owncloud.log.*"),
+                                    QDir::Files);
+        QRegExp rx("owncloud.log.(\\d+)");
+        uint maxNumber = 0;
+        QDateTime now = QDateTime::currentDateTime();
+        foreach(const QString &s, files) {
+            if (rx.exactMatch(s)) {
+                maxNumber = qMax(maxNumber, rx.cap(1).toUInt());
+                if (logExpire > 0) {
+                    QFileInfo fileInfo = dir.absoluteFilePath(s);
+                    if (fileInfo.lastModified().addSecs(60*60 * logExpire) < now) {
+                        dir.remove(s);
+                    }
+                }
+            }
+        }
+
+        QString filename = logDirectory + "/owncloud.log." + QString::number(maxNumber+1);
+        setLogFile(filename);
+    }
+
+    Logger *_logger;
+    LogQueue _queue;
+    QAtomicInt _dropped;
+
+    QMutex _mutex;
+    QWaitCondition _wakeUp;
+    QAtomicInt _sleeping;
+    QAtomicInt _flushRequested;
+    int _flushCount; // under _mutex, the flushes done
+    QWaitCondition _flushed;
+    QAtomicInt _stop;
+
+    // only used by the writer thread
+    QFile _logFile;
+    QScopedPointer<QTextStream> _logstream;
+};
+
 Logger *Logger::instance()
 {
     static Logger log;
@@ -48,13 +412,15 @@ Logger *Logger::instance()
 }
 
 Logger::Logger( QObject* parent) : QObject(parent),
-  _showTime(true), _doLogging(false), _doFileFlush(false), _logExpire(0)
+  _showTime(true), _writer(new LogWriter(this))
 {
+    _writer->start();
     qInstallMessageHandler(mirallLogCatcher);
 }
 
 Logger::~Logger() {
     qInstallMessageHandler(0);
+    _writer->stop();
 }
 
 
@@ -86,18 +452,8 @@ void Logger::log(Log log)
         // msg += "ownCloud - ";
     }
     msg += log.message;
-    // _logs.append(log);
-    // std::cout << qPrintable(log.message) << std::endl;
 
-    {
-        QMutexLocker lock(&_mutex);
-        if( _logstream ) {
-            (*_logstream) << msg << endl;
-            if( _doFileFlush ) _logstream->flush();
-        }
-    }
-
-    emit newLog(msg);
+    _writer->push(msg);
 }
 
 void Logger::csyncLog( const QString& message )
@@ -120,83 +476,65 @@ void Logger::mirallLog( const QString& message )
     Logger::instance()->log( log_ );
 }
 
-void Logger::setLogFile(const QString & name)
+QStringList Logger::history() const
 {
-    QMutexLocker locker(&_mutex);
+    QMutexLocker lock(&_writer->_historyMutex);
+    return _writer->_history;
+}
 
-    if( _logstream ) {
-        _logstream.reset(0);
-        _logFile.close();
-    }
+void Logger::clearHistory()
+{
+    QMutexLocker lock(&_writer->_historyMutex);
+    _writer->_history.clear();
+}
 
-    if( name.isEmpty() ) {
-        return;
-    }
+int Logger::historySize() const
+{
+    QMutexLocker lock(&_writer->_historyMutex);
+    return _writer->_historySize;
+}
 
-    bool openSucceeded = false;
-    if (name == QLatin1String("-")) {
-        openSucceeded = _logFile.open(1, QIODevice::WriteOnly);
-    } else {
-        _logFile.setFileName( name );
-        openSucceeded = _logFile.open(QIODevice::WriteOnly);
-    }
+void Logger::setHistorySize( int lines )
+{
+    QMutexLocker lock(&_writer->_historyMutex);
+    _writer->_historySize = qMax(0, lines);
+}
 
-    if(!openSucceeded) {
-        locker.unlock(); // Just in case postGuiMessage has a qDebug()
-        postGuiMessage( tr("Error"),
-                        QString(tr("<nobr>File '%1'<br/>cannot be opened for writing.<br/><br/>"
-                                   "The log output can <b>not</b> be saved!</nobr>"))
-                        .arg(name));
-        return;
-    }
+void Logger::flush()
+{
+    _writer->flush();
+}
 
-    _logstream.reset(new QTextStream( &_logFile ));
+void Logger::setLogFile(const QString & name)
+{
+    _writer->addCommand(LogQueue::SetFile, name);
 }
 
 void Logger::setLogExpire( int expire )
 {
-    _logExpire = expire;
+    QMutexLocker lock(&_writer->_mutex);
+    _writer->_logExpire = expire;
 }
 
 void Logger::setLogDir( const QString& dir )
 {
-    _logDirectory = dir;
+    QMutexLocker lock(&_writer->_mutex);
+    _writer->_logDirectory = dir;
 }
 
 void Logger::setLogFlush( bool flush )
 {
-    _doFileFlush = flush;
+    _writer->_doFileFlush.fetchAndStoreRelaxed(flush ? 1 : 0);
 }
 
 void Logger::enterNextLogFile()
 {
-    if (!_logDirectory.isEmpty()) {
-        QDir dir(_logDirectory);
-        if (!dir.exists()) {
-            dir.mkpath(".");
-        }
-
-        // Find out what is the file with the highest nymber if any
-        QStringList files = dir.entryList(QStringList("owncloud.log.*"),
-                                    QDir::Files);
-        QRegExp rx("owncloud.log.(\\d+)");
-        uint maxNumber = 0;
-        QDateTime now = QDateTime::currentDateTime();
-        foreach(const QString &s, files) {
-            if (rx.exactMatch(s)) {
-                maxNumber = qMax(maxNumber, rx.cap(1).toUInt());
-                if (_logExpire > 0) {
-                    QFileInfo fileInfo = dir.absoluteFilePath(s);
-                    if (fileInfo.lastModified().addSecs(60*60 * _logExpire) < now) {
-                        dir.remove(s);
-                    }
-                }
-            }
-        }
-
-        QString filename = _logDirectory + "/owncloud.log." + QString::number(maxNumber+1);
-        setLogFile(filename);
+    QString logDirectory;
+    {
+        QMutexLocker lock(&_writer->_mutex);
+        logDirectory = _writer->_logDirectory;
     }
+    _writer->addCommand(LogQueue::NextFile, logDirectory);
 }
 
 } // namespace Mirall
@@ -19,6 +19,7 @@
 #include <QList>
 #include <QDateTime>
 #include <QFile>
+#include <QStringList>
 #include <QTextStream>
 #include <qmutex.h>
 
@@ -37,6 +38,15 @@ struct Log{
   QString message;
 };
 
+class LogWriter;
+
+/**
+ * @brief The log of the application
+ *
+ * log() only formats the line and puts it in a lock-free queue: the file is
+ * written, rotated and flushed by a writer thread. The last lines are kept in
+ * a bounded history for the log browser.
+ */
 class OWNCLOUDSYNC_EXPORT Logger : public QObject
 {
   Q_OBJECT
@@ -47,7 +57,14 @@ public:
   static void csyncLog( const QString& message );
   static void mirallLog( const QString& message );
 
-  const QList<Log>& logs() const {return _logs;}
+  /** The last historySize() lines, the oldest first */
+  QStringList history() const;
+  void clearHistory();
+  int historySize() const;
+  void setHistorySize( int lines );
+
+  /** Wait until the lines logged so far are written to the log file */
+  void flush();
 
   static Logger* instance();
 
@@ -67,21 +84,16 @@ signals:
   void optionalGuiLog(const QString&, const QString&);
 
 public slots:
+  /** Switch to the next file of the log directory, in the writer thread */
   void enterNextLogFile();
 
 private:
   Logger(QObject* parent=0);
   ~Logger();
-  QList<Log> _logs;
   bool       _showTime;
-  bool       _doLogging;
-  QFile       _logFile;
-  bool        _doFileFlush;
-  int         _logExpire;
-  QScopedPointer<QTextStream> _logstream;
-  QMutex      _mutex;
-  QString     _logDirectory;
+  QScopedPointer<LogWriter> _writer;
 
+  friend class LogWriter;
 };
 
 } // namespace Mirall
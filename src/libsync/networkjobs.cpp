@@ -31,6 +31,9 @@
 
 #include "networkjobs.h"
 #include "account.h"
+#include "owncloudpropagator_p.h"
+#include "syncmetrics.h"
+#include "synctrace.h"
 
 #include "creds/credentialsfactory.h"
 #include "creds/abstractcredentials.h"
@@ -43,6 +46,11 @@ AbstractNetworkJob::AbstractNetworkJob(Account *account, const QString &path, QO
     : QObject(parent)
     , _duration(0)
     , _ignoreCredentialFailure(false)
+    , _requestRunning(false)
+    , _traced(false)
+    , _gotReplyHeaders(false)
+    , _bytesReceived(0)
+    , _bytesSent(0)
     , _reply(0)
     , _account(account)
     , _path(path)
@@ -90,9 +98,66 @@ void AbstractNetworkJob::setPath(const QString &path)
     _path = path;
 }
 
+static QByteArray replyVerb(QNetworkReply *reply)
+{
+    QByteArray verb = reply->request().attribute(QNetworkRequest::CustomVerbAttribute).toByteArray();
+    if (!verb.isEmpty()) {
+        return verb;
+    }
+    switch (reply->operation()) {
+    case QNetworkAccessManager::HeadOperation: return "HEAD";
+    case QNetworkAccessManager::GetOperation: return "GET";
+    case QNetworkAccessManager::PutOperation: return "PUT";
+    case QNetworkAccessManager::PostOperation: return "POST";
+    case QNetworkAccessManager::DeleteOperation: return "DELETE";
+    default: return "CUSTOM";
+    }
+}
+
 void AbstractNetworkJob::setupConnections(QNetworkReply *reply)
 {
     connect(reply, SIGNAL(finished()), SLOT(slotFinished()));
+    connect(reply, SIGNAL(metaDataChanged()), SLOT(slotMetricsMetaDataChanged()));
+    connect(reply, SIGNAL(downloadProgress(qint64,qint64)), SLOT(slotMetricsDownloadProgress(qint64,qint64)));
+    connect(reply, SIGNAL(uploadProgress(qint64,qint64)), SLOT(slotMetricsUploadProgress(qint64,qint64)));
+
+    if (!_requestRunning) {
+        SyncMetrics::addToGauge("owncloud_network_requests_in_flight", 1);
+    }
+    _requestRunning = true;
+    _gotReplyHeaders = false;
+    _bytesReceived = 0;
+    _bytesSent = 0;
+    _verb = replyVerb(reply);
+    _requestTimer.start();
+
+    _traced = SyncTrace::isActive();
+    if (_traced) {
+        SyncTrace::asyncBegin("network", QString::fromLatin1(_verb) + QLatin1Char(' ') + _path, this,
+                              SyncTrace::Args() << qMakePair(QByteArray("job"), QVariant(QString::fromLatin1(metaObject()->className()))));
+    }
+}
+
+void AbstractNetworkJob::slotMetricsMetaDataChanged()
+{
+    if (!_gotReplyHeaders && _requestRunning) {
+        _gotReplyHeaders = true;
+        SyncMetrics::observe("owncloud_network_first_byte_seconds", _requestTimer.nsecsElapsed() / 1000,
+                             "verb=\"" + _verb + '"');
+        if (_traced) {
+            SyncTrace::asyncStep("network", QLatin1String("first byte"), this);
+        }
+    }
+}
+
+void AbstractNetworkJob::slotMetricsDownloadProgress(qint64 received, qint64)
+{
+    _bytesReceived = received;
+}
+
+void AbstractNetworkJob::slotMetricsUploadProgress(qint64 sent, qint64)
+{
+    _bytesSent = sent;
 }
 
 QNetworkReply* AbstractNetworkJob::addTimer(QNetworkReply *reply)
@@ -148,6 +213,26 @@ void AbstractNetworkJob::slotFinished()
     _responseTimestamp = QString::fromAscii(_reply->rawHeader("Date"));
     _duration = _durationTimer.elapsed();
 
+    if (_requestRunning) {
+        _requestRunning = false;
+        const QVariant status = _reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+        const QByteArray verbLabel = "verb=\"" + _verb + '"';
+        SyncMetrics::addToGauge("owncloud_network_requests_in_flight", -1);
+        SyncMetrics::increment("owncloud_network_requests_total", 1, verbLabel + ",code=\""
+                               + (status.isValid() ? status.toByteArray() : QByteArray("none")) + '"');
+        SyncMetrics::observe("owncloud_network_request_duration_seconds", _requestTimer.nsecsElapsed() / 1000, verbLabel);
+        SyncMetrics::increment("owncloud_network_bytes_total", _bytesReceived, "direction=\"received\"");
+        SyncMetrics::increment("owncloud_network_bytes_total", _bytesSent, "direction=\"sent\"");
+        if (_traced) {
+            SyncTrace::asyncEnd("network", QString::fromLatin1(_verb) + QLatin1Char(' ') + _path, this,
+                                SyncTrace::Args()
+                                << qMakePair(QByteArray("status"), status)
+                                << qMakePair(QByteArray("error"), QVariant(int(_reply->error())))
+                                << qMakePair(QByteArray("bytes_received"), QVariant(_bytesReceived))
+                                << qMakePair(QByteArray("bytes_sent"), QVariant(_bytesSent)));
+        }
+    }
+
     bool discard = finished();
     AbstractCredentials *creds = _account->credentials();
     if (!creds->stillValid(_reply) &&! _ignoreCredentialFailure
@@ -180,6 +265,10 @@ QString AbstractNetworkJob::responseTimestamp()
 }
 
 AbstractNetworkJob::~AbstractNetworkJob() {
+    if (_requestRunning) {
+        // aborted
+        SyncMetrics::addToGauge("owncloud_network_requests_in_flight", -1);
+    }
     if (_reply)
         _reply->deleteLater();
 }
@@ -196,14 +285,14 @@ void AbstractNetworkJob::start()
 /*********************************************************************************************/
 
 RequestEtagJob::RequestEtagJob(Account *account, const QString &path, QObject *parent)
-    : AbstractNetworkJob(account, path, parent)
+    : AbstractNetworkJob(account, path, parent), _listChildren(false)
 {
 }
 
 void RequestEtagJob::start()
 {
     QNetworkRequest req;
-    if (path().isEmpty() || path() == QLatin1String("/")) {
+    if (_listChildren || path().isEmpty() || path() == QLatin1String("/")) {
         /* For the root directory, we need to query the etags of all the sub directories
          * because, at the time I am writing this comment (Owncloud 5.0.9), the etag of the
          * root directory is not updated when the sub directories changes */
@@ -238,15 +327,42 @@ bool RequestEtagJob::finished()
         QXmlStreamReader reader(reply());
         reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
         QString etag;
+        QString currentPath;
+        QList<QPair<QString, QByteArray> > pathEtags;
         while (!reader.atEnd()) {
             QXmlStreamReader::TokenType type = reader.readNext();
             if (type == QXmlStreamReader::StartElement &&
                     reader.namespaceUri() == QLatin1String("DAV:")) {
                 QString name = reader.name().toString();
-                if (name == QLatin1String("getetag")) {
-                    etag += reader.readElementText();
+                if (name == QLatin1String("href")) {
+                    currentPath = QUrl::fromEncoded(reader.readElementText().toLatin1()).path();
+                    if (currentPath.endsWith(QLatin1Char('/'))) {
+                        currentPath.chop(1);
+                    }
+                } else if (name == QLatin1String("getetag")) {
+                    const QString itemEtag = reader.readElementText();
+                    etag += itemEtag;
+                    pathEtags.append(qMakePair(currentPath, parseEtag(itemEtag.toUtf8().constData())));
+                }
+            }
+        }
+        if (_listChildren && !pathEtags.isEmpty()) {
+            // The requested folder itself has the shortest href, everything else is a child
+            int rootIndex = 0;
+            for (int i = 1; i < pathEtags.size(); ++i) {
+                if (pathEtags.at(i).first.size() < pathEtags.at(rootIndex).first.size()) {
+                    rootIndex = i;
+                }
+            }
+            QHash<QString, QByteArray> childEtags;
+            for (int i = 0; i < pathEtags.size(); ++i) {
+                const QString &childPath = pathEtags.at(i).first;
+                if (i != rootIndex && !childPath.isEmpty()) {
+                    childEtags.insert(childPath.mid(childPath.lastIndexOf(QLatin1Char('/')) + 1),
+                                      pathEtags.at(i).second);
                 }
             }
+            emit childEtagsRetrieved(childEtags);
         }
         emit etagRetreived(etag);
     }
@@ -452,7 +568,12 @@ void PropfindJob::start()
     req.setRawHeader("Depth", "0");
     QByteArray propStr;
     foreach (const QByteArray &prop, properties) {
-        propStr += "    <d:" + prop + " />\n";
+        int colIdx = prop.lastIndexOf(':');
+        if (colIdx >= 0) {
+            propStr += "    <" + prop.mid(colIdx + 1) + " xmlns=\"" + prop.left(colIdx) + "\" />\n";
+        } else {
+            propStr += "    <d:" + prop + " />\n";
+        }
     }
     QByteArray xml = "<?xml version=\"1.0\" ?>\n"
                      "<d:propfind xmlns:d=\"DAV:\">\n"
@@ -490,30 +611,29 @@ bool PropfindJob::finished()
         reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
 
         QVariantMap items;
-        // introduced to nesting is ignored
-        QStack<QString> curElement;
-
+        // The properties are the direct children of the d:prop element.
+        bool inProp = false;
         while (!reader.atEnd()) {
             QXmlStreamReader::TokenType type = reader.readNext();
-            if (type == QXmlStreamReader::StartElement &&
-                    reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (curElement.isEmpty()) {
-                    curElement.push(reader.name().toString());
-                    items.insert(reader.name().toString(), reader.text().toString());
+            if (type == QXmlStreamReader::StartElement) {
+                if (inProp) {
+                    items.insert(reader.name().toString(),
+                                 reader.readElementText(QXmlStreamReader::SkipChildElements));
+                } else if (reader.namespaceUri() == QLatin1String("DAV:")
+                           && reader.name() == QLatin1String("prop")) {
+                    inProp = true;
                 }
+            } else if (type == QXmlStreamReader::EndElement
+                       && reader.namespaceUri() == QLatin1String("DAV:")
+                       && reader.name() == QLatin1String("prop")) {
+                inProp = false;
             }
-            if (type == QXmlStreamReader::EndElement &&
-                    reader.namespaceUri() == QLatin1String("DAV:")) {
-                if(curElement.top() == reader.name()) {
-                    curElement.pop();
-                }
-            }
-
         }
         emit result(items);
     } else {
-        qDebug() << "Quota request *not* successful, http result code is" << http_result_code
+        qDebug() << "PROPFIND request *not* successful, http result code is" << http_result_code
                  << (http_result_code == 302 ? reply()->header(QNetworkRequest::LocationHeader).toString()  : QLatin1String(""));
+        emit finishedWithError();
     }
     return true;
 }
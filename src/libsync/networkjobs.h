@@ -24,6 +24,7 @@
 #include <QElapsedTimer>
 #include <QDateTime>
 #include <QTimer>
+#include <QHash>
 
 class QUrl;
 
@@ -88,6 +89,9 @@ protected:
     QNetworkReply* headRequest(const QString &relPath);
     QNetworkReply* headRequest(const QUrl &url);
 
+    /** For the requests not sent with the methods above: lets the job's timeout be paused */
+    QNetworkReply* addTimer(QNetworkReply *reply);
+
     int maxRedirects() const { return 10; }
     virtual bool finished() = 0;
     QString       _responseTimestamp;
@@ -97,10 +101,22 @@ protected:
 private slots:
     void slotFinished();
     virtual void slotTimeout() {}
+    // for the SyncMetrics and the SyncTrace of the request; named apart from
+    // the slots of the subclasses, which would override them otherwise
+    void slotMetricsMetaDataChanged();
+    void slotMetricsDownloadProgress(qint64 received, qint64);
+    void slotMetricsUploadProgress(qint64 sent, qint64);
 
 private:
-    QNetworkReply* addTimer(QNetworkReply *reply);
     bool _ignoreCredentialFailure;
+    // The request started by setupConnections()
+    bool _requestRunning;
+    bool _traced;
+    bool _gotReplyHeaders;
+    QByteArray _verb;
+    QElapsedTimer _requestTimer;
+    qint64 _bytesReceived;
+    qint64 _bytesSent;
     QPointer<QNetworkReply> _reply; // (QPointer because the NetworkManager may be destroyed before the jobs at exit)
     Account *_account;
     QString _path;
@@ -141,6 +157,10 @@ private slots:
 
 /**
  * @brief The PropfindJob class
+ *
+ * Fetch the properties of a single resource (Depth 0).
+ * The properties are names in the DAV: namespace, or "namespace:name" for other namespaces
+ * (e.g. "http://owncloud.org/ns:id"). The result is keyed by the name without namespace.
  */
 class PropfindJob : public AbstractNetworkJob {
     Q_OBJECT
@@ -152,6 +172,8 @@ public:
 
 signals:
     void result(const QVariantMap &values);
+    /** Emitted instead of result() if the server did not reply with a multistatus */
+    void finishedWithError();
 
 private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
@@ -214,11 +236,22 @@ public:
     explicit RequestEtagJob(Account *account, const QString &path, QObject *parent = 0);
     void start() Q_DECL_OVERRIDE;
 
+    /**
+     * Also fetch the etags of the direct children of the path (a Depth 1 PROPFIND,
+     * which is always done for the root) and report them with childEtagsRetrieved()
+     */
+    void setListChildren(bool listChildren) { _listChildren = listChildren; }
+
 signals:
     void etagRetreived(const QString &etag);
+    /** The normalized etags of the children, by name. Emitted before etagRetreived() */
+    void childEtagsRetrieved(const QHash<QString, QByteArray> &etags);
 
 private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
+
+private:
+    bool _listChildren;
 };
 
 /**
@@ -21,6 +21,8 @@
 #include "propagator_legacy.h"
 #include "mirallconfigfile.h"
 #include "utility.h"
+#include "syncmetrics.h"
+#include "synctrace.h"
 
 #ifdef Q_OS_WIN
 #include <windef.h>
@@ -42,6 +44,41 @@ static int maximumActiveJob() {
     return max;
 }
 
+/* The maximum number of small file transfers in parallel, in addition to maximumActiveJob() */
+static int maximumActiveSmallJob() {
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_SMALL").toUInt();
+    if (!max) {
+        max = 6; //default
+    }
+    return max;
+}
+
+/* The propagations running in this process. They share the budgets above. */
+static QAtomicInt runningPropagations;
+
+/* The share of \a max of one propagation when several folders are synced at the same time */
+static int fairShare(int max)
+{
+    const int running = qMax(1, runningPropagations.fetchAndAddRelaxed(0));
+    return qMax(1, max / running);
+}
+
+/* Uploads and downloads of files, which are the jobs actually using the bandwidth */
+static bool isTransfer(const SyncFileItem &item)
+{
+    return !item._isDirectory && (item._instruction == CSYNC_INSTRUCTION_NEW
+            || item._instruction == CSYNC_INSTRUCTION_SYNC
+            || item._instruction == CSYNC_INSTRUCTION_CONFLICT);
+}
+
+static QByteArray metricsLabels(const SyncFileItem &item)
+{
+    static const char *directions[] = { "none", "up", "down" };
+    static const char *results[] = { "none", "fatal_error", "error", "soft_error",
+                                      "success", "conflict", "ignored", "restoration" };
+    return QByteArray("direction=\"") + directions[item._direction] + "\",result=\"" + results[item._status] + '"';
+}
+
 void PropagateItemJob::done(SyncFileItem::Status status, const QString &errorString)
 {
     if (_item._isRestoration) {
@@ -63,6 +100,19 @@ void PropagateItemJob::done(SyncFileItem::Status status, const QString &errorStr
 
     _item._status = status;
 
+    if (_state == Running) { // not for the restoration jobs, which are not scheduled
+        SyncMetrics::increment("owncloud_propagated_items_total", 1, metricsLabels(_item));
+        if (isTransfer(_item) && (status == SyncFileItem::Success || status == SyncFileItem::Conflict)) {
+            SyncMetrics::increment("owncloud_propagated_bytes_total", _item._size,
+                                   _item._direction == SyncFileItem::Up ? "direction=\"up\"" : "direction=\"down\"");
+        }
+        if (SyncTrace::isActive()) {
+            SyncTrace::asyncEnd("propagation", _item._file, this, SyncTrace::Args()
+                                << qMakePair(QByteArray("status"), QVariant(int(status)))
+                                << qMakePair(QByteArray("size"), QVariant(qint64(_item._size))));
+        }
+    }
+
     // Blacklisting
     int retries = 0;
 
@@ -185,11 +235,13 @@ PropagateItemJob* OwncloudPropagator::createJob(const SyncFileItem& item) {
     switch(item._instruction) {
         case CSYNC_INSTRUCTION_REMOVE:
             if (item._direction == SyncFileItem::Down) return new PropagateLocalRemove(this, item);
-            else return new PropagateRemoteRemove(this, item);
+            else if (useLegacyJobs()) return new PropagateRemoteRemove(this, item);
+            else return new PropagateRemoteRemoveQNAM(this, item);
         case CSYNC_INSTRUCTION_NEW:
             if (item._isDirectory) {
                 if (item._direction == SyncFileItem::Down) return new PropagateLocalMkdir(this, item);
-                else return new PropagateRemoteMkdir(this, item);
+                else if (useLegacyJobs()) return new PropagateRemoteMkdir(this, item);
+                else return new PropagateRemoteMkdirQNAM(this, item);
             }   //fall trough
         case CSYNC_INSTRUCTION_SYNC:
         case CSYNC_INSTRUCTION_CONFLICT:
@@ -212,7 +264,10 @@ PropagateItemJob* OwncloudPropagator::createJob(const SyncFileItem& item) {
             }
         case CSYNC_INSTRUCTION_RENAME:
             if (item._direction == SyncFileItem::Up) {
-                return new PropagateRemoteRename(this, item);
+                if (useLegacyJobs()) {
+                    return new PropagateRemoteRename(this, item);
+                }
+                return new PropagateRemoteRenameQNAM(this, item);
             } else {
                 return new PropagateLocalRename(this, item);
             }
@@ -232,11 +287,22 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
      * In order to do that we loop over the items. (which are sorted by destination)
      * When we enter adirectory, we can create the directory job and push it on the stack. */
 
+    if (!_running) {
+        _running = true;
+        runningPropagations.ref();
+    }
+
     _rootJob.reset(new PropagateDirectory(this));
     QStack<QPair<QString /* directory name */, PropagateDirectory* /* job */> > directories;
     directories.push(qMakePair(QString(), _rootJob.data()));
     QVector<PropagatorJob*> directoriesToRemove;
     QString removedDirectory;
+
+    // The renames are done in the sync order, and the removes between two renames may run
+    // in parallel. Other jobs depend on the last rename that came before them in their directory.
+    PropagatorJob *lastRename = 0;
+    QVector<PropagatorJob*> removesSinceLastRename;
+    QHash<PropagateDirectory*, PropagatorJob*> lastRenameInDirectory;
     foreach(const SyncFileItem &item, items) {
 
         if (!removedDirectory.isEmpty() && item._file.startsWith(removedDirectory)) {
@@ -261,9 +327,33 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
             directories.pop();
         }
 
+        PropagateDirectory* currentDirJob = directories.top().second;
+        PropagateItemJob *job = createJob(item);
+        const bool inRemovedDirectory = !removedDirectory.isEmpty() && item._file.startsWith(removedDirectory);
+        if (job && !inRemovedDirectory
+                && !(item._isDirectory && item._instruction == CSYNC_INSTRUCTION_REMOVE)) {
+            // (The removal of directories is done at the end, see below.)
+            if (item._instruction == CSYNC_INSTRUCTION_RENAME) {
+                if (lastRename) {
+                    job->_dependencies.append(lastRename);
+                }
+                job->_dependencies += removesSinceLastRename;
+                removesSinceLastRename.clear();
+                lastRename = job;
+                lastRenameInDirectory[currentDirJob] = job;
+            } else if (item._instruction == CSYNC_INSTRUCTION_REMOVE) {
+                if (lastRename) {
+                    job->_dependencies.append(lastRename);
+                }
+                removesSinceLastRename.append(job);
+            } else if (PropagatorJob *rename = lastRenameInDirectory.value(currentDirJob)) {
+                job->_dependencies.append(rename);
+            }
+        }
+
         if (item._isDirectory) {
             PropagateDirectory *dir = new PropagateDirectory(this, item);
-            dir->_firstJob.reset(createJob(item));
+            dir->_firstJob.reset(job);
             if (item._instruction == CSYNC_INSTRUCTION_REMOVE) {
                 //We do the removal of directories at the end, because there might be moves from
                 // this directories that will happen later.
@@ -278,17 +368,16 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
                     directories[i].second->_item._should_update_etag = false;
                 }
             } else {
-                PropagateDirectory* currentDirJob = directories.top().second;
                 currentDirJob->append(dir);
             }
             directories.push(qMakePair(item.destination() + "/" , dir));
-        } else if (PropagateItemJob* current = createJob(item)) {
-            directories.top().second->append(current);
+        } else if (job) {
+            currentDirJob->append(job);
         }
     }
 
     foreach(PropagatorJob* it, directoriesToRemove) {
-        _rootJob->append(it);
+        _rootJob->appendDeferred(it);
     }
 
     connect(_rootJob.data(), SIGNAL(completed(SyncFileItem)), this, SIGNAL(completed(SyncFileItem)));
@@ -300,6 +389,166 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
     QMetaObject::invokeMethod(_rootJob.data(), "start", Qt::QueuedConnection);
 }
 
+void OwncloudPropagator::scheduleJob(PropagateItemJob* job)
+{
+    connect(job, SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotJobFinished(SyncFileItem::Status)), Qt::QueuedConnection);
+    job->_pendingDependencies = 0;
+    foreach (PropagatorJob *dependency, job->_dependencies) {
+        if (dependency->_state != PropagatorJob::Finished) {
+            _waitingJobs.insert(dependency, job);
+            job->_pendingDependencies++;
+        }
+    }
+    if (job->_pendingDependencies > 0) {
+        return;
+    }
+    enqueueReadyJob(job);
+    scheduleNextJobs();
+}
+
+PropagateItemJob* OwncloudPropagator::takeFirst(TransferQueue &queue)
+{
+    TransferQueue::iterator first = queue.begin();
+    PropagateItemJob *job = first.value();
+    queue.erase(first);
+    return job;
+}
+
+void OwncloudPropagator::enqueueReadyJob(PropagateItemJob* job)
+{
+    if (!isTransfer(job->_item)) {
+        // mkdir, remove, rename, ...  are cheap and might unblock other jobs, do them first
+        _readyJobs.append(job);
+        return;
+    }
+    TransferQueue &queue = job->_item._size <= smallFileSize() && !useLegacyJobs()
+            ? _readySmallTransfers
+            : job->_item._direction == SyncFileItem::Up ? _readyUploads : _readyDownloads;
+    queue.insert(qMakePair(qint64(job->_item._size), _readyTransferCount++), job);
+}
+
+PropagateItemJob* OwncloudPropagator::takeNextReadyJob()
+{
+    if (!_readyJobs.isEmpty()) {
+        return _readyJobs.takeFirst();
+    }
+    // Alternate uploads and downloads so both directions of the link are used
+    bool upload = _lastStartedUpload ? _readyDownloads.isEmpty() : !_readyUploads.isEmpty();
+    TransferQueue &queue = upload ? _readyUploads : _readyDownloads;
+    if (queue.isEmpty()) {
+        return 0;
+    }
+    _lastStartedUpload = upload;
+    return takeFirst(queue);
+}
+
+void OwncloudPropagator::scheduleNextJobs()
+{
+    if (_fatalError || _abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    const int maxSmallJobs = fairShare(maximumActiveSmallJob());
+
+    // The small files do not wait behind the big transfers. (This lane is empty with the legacy jobs)
+    while (_activeSmallJobs < maxSmallJobs && !_readySmallTransfers.isEmpty()) {
+        PropagateItemJob *next = takeFirst(_readySmallTransfers);
+        next->_smallTransfer = true;
+        _activeSmallJobs++;
+        startJob(next);
+    }
+
+    // The legacy jobs all use the same neon session, they need to run one after the other
+    const int maxJobs = useLegacyJobs() ? 1 : fairShare(maximumActiveJob());
+    while (_activeJobs < maxJobs) {
+        PropagateItemJob *next = takeNextReadyJob();
+        if (!next && _activeSmallJobs >= maxSmallJobs && !_readySmallTransfers.isEmpty()) {
+            // nothing else to do: use the free slot for the small files as well
+            next = takeFirst(_readySmallTransfers);
+        }
+        if (!next) {
+            return;
+        }
+        _activeJobs++;
+        startJob(next);
+    }
+}
+
+void OwncloudPropagator::startJob(PropagateItemJob* job)
+{
+    job->_state = PropagatorJob::Running;
+    SyncMetrics::addToGauge("owncloud_propagation_jobs_in_flight", 1);
+    if (SyncTrace::isActive()) {
+        SyncTrace::asyncBegin("propagation", job->_item._file, job, SyncTrace::Args()
+                              << qMakePair(QByteArray("instruction"), QVariant(int(job->_item._instruction)))
+                              << qMakePair(QByteArray("job"), QVariant(QString::fromLatin1(job->metaObject()->className())))
+                              << qMakePair(QByteArray("small"), QVariant(job->_smallTransfer)));
+    }
+    QMetaObject::invokeMethod(job, "start", Qt::QueuedConnection);
+}
+
+void OwncloudPropagator::releaseDependents(PropagatorJob* job)
+{
+    QList<PropagateItemJob *> dependents = _waitingJobs.values(job);
+    _waitingJobs.remove(job);
+    // values() returns the most recently inserted first
+    for (int i = dependents.count() - 1; i >= 0; --i) {
+        PropagateItemJob *dependent = dependents.at(i);
+        if (--dependent->_pendingDependencies == 0) {
+            enqueueReadyJob(dependent);
+        }
+    }
+}
+
+void OwncloudPropagator::slotJobFinished(SyncFileItem::Status status)
+{
+    PropagateItemJob *job = qobject_cast<PropagateItemJob *>(sender());
+    Q_ASSERT(job);
+    if (job->_state != PropagatorJob::Running) {
+        return;
+    }
+    job->_state = PropagatorJob::Finished;
+    SyncMetrics::addToGauge("owncloud_propagation_jobs_in_flight", -1);
+    if (job->_smallTransfer) {
+        _activeSmallJobs--;
+    } else {
+        _activeJobs--;
+    }
+
+    if (status == SyncFileItem::FatalError) {
+        // The directories take care of aborting, just stop starting new jobs.
+        _fatalError = true;
+        return;
+    }
+    releaseDependents(job);
+    scheduleNextJobs();
+}
+
+void OwncloudPropagator::skipJobs(PropagatorJob* job)
+{
+    markSkipped(job);
+    // The jobs that only waited for the skipped ones are ready now
+    scheduleNextJobs();
+}
+
+void OwncloudPropagator::markSkipped(PropagatorJob* job)
+{
+    if (PropagateDirectory *dir = qobject_cast<PropagateDirectory *>(job)) {
+        if (dir->_firstJob) {
+            markSkipped(dir->_firstJob.data());
+        }
+        foreach (PropagatorJob *subJob, dir->_subJobs) {
+            markSkipped(subJob);
+        }
+        foreach (PropagatorJob *subJob, dir->_deferredSubJobs) {
+            markSkipped(subJob);
+        }
+    } else if (job->_state == PropagatorJob::NotYetStarted) {
+        job->_state = PropagatorJob::Finished;
+        releaseDependents(job);
+    }
+}
+
 bool OwncloudPropagator::isInSharedDirectory(const QString& file)
 {
     bool re = false;
@@ -346,6 +595,40 @@ int OwncloudPropagator::httpTimeout()
     return timeout;
 }
 
+qint64 OwncloudPropagator::smallFileSize()
+{
+    static qint64 size = qgetenv("OWNCLOUD_SMALL_FILE_SIZE").toLongLong();
+    if (size <= 0) {
+        size = 8 * 1024; // default to 8 KiB
+    }
+    return size;
+}
+
+OwncloudPropagator::~OwncloudPropagator()
+{
+    // the jobs still running when the sync was aborted
+    SyncMetrics::addToGauge("owncloud_propagation_jobs_in_flight", -(_activeJobs + _activeSmallJobs));
+    if (_running) {
+        runningPropagations.deref();
+    }
+}
+
+void OwncloudPropagator::emitFinished()
+{
+    if (_running) {
+        _running = false;
+        runningPropagations.deref();
+    }
+    if (!_finishedEmited)
+        emit finished();
+    _finishedEmited = true;
+}
+
+int OwncloudPropagator::maximumParallelRequests()
+{
+    return maximumActiveJob() + maximumActiveSmallJob();
+}
+
 bool OwncloudPropagator::localFileNameClash( const QString& relFile )
 {
     bool re = false;
@@ -401,68 +684,127 @@ bool OwncloudPropagator::localFileNameClash( const QString& relFile )
 
 // ================================================================================
 
+PropagateDirectory::~PropagateDirectory()
+{
+    qDeleteAll(_subJobs);
+    qDeleteAll(_deferredSubJobs);
+}
+
 void PropagateDirectory::start()
 {
-    _current = -1;
+    _state = Running;
     _hasError = SyncFileItem::NoStatus;
     if (!_firstJob) {
-        slotSubJobReady();
+        startSubJobs(_subJobs);
     } else {
-        startJob(_firstJob.data());
+        connect(_firstJob.data(), SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotFirstJobFinished(SyncFileItem::Status)), Qt::QueuedConnection);
+        connect(_firstJob.data(), SIGNAL(completed(SyncFileItem)), this, SIGNAL(completed(SyncFileItem)));
+        connect(_firstJob.data(), SIGNAL(progress(SyncFileItem,quint64)), this, SIGNAL(progress(SyncFileItem,quint64)));
+        _propagator->scheduleJob(_firstJob.data());
+    }
+}
+
+void PropagateDirectory::abort()
+{
+    if (_firstJob)
+        _firstJob->abort();
+    foreach (PropagatorJob *j, _subJobs)
+        j->abort();
+    foreach (PropagatorJob *j, _deferredSubJobs)
+        j->abort();
+}
+
+void PropagateDirectory::startSubJobs(const QVector<PropagatorJob *> &jobs)
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        _state = Finished;
+        emit finished(SyncFileItem::SoftError);
+        return;
+    }
+    foreach (PropagatorJob *next, jobs) {
+        connect(next, SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotSubJobFinished(SyncFileItem::Status)), Qt::QueuedConnection);
+        connect(next, SIGNAL(completed(SyncFileItem)), this, SIGNAL(completed(SyncFileItem)));
+        connect(next, SIGNAL(progress(SyncFileItem,quint64)), this, SIGNAL(progress(SyncFileItem,quint64)));
+        _runningNow++;
+    }
+    foreach (PropagatorJob *next, jobs) {
+        if (PropagateItemJob *item = qobject_cast<PropagateItemJob *>(next)) {
+            _propagator->scheduleJob(item);
+        } else {
+            // sub directory: it will hand its own jobs to the propagator
+            next->start();
+        }
+    }
+    if (_runningNow == 0) {
+        allSubJobsFinished();
     }
 }
 
+void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
+{
+    if (status != SyncFileItem::Success && status != SyncFileItem::Restoration) {
+        // The directory could not be created, moved or removed: don't touch what is inside.
+        if (status != SyncFileItem::FatalError) {
+            _propagator->skipJobs(this);
+        }
+        abort();
+        _state = Finished;
+        emit finished(status);
+        return;
+    }
+    startSubJobs(_subJobs);
+}
+
 void PropagateDirectory::slotSubJobFinished(SyncFileItem::Status status)
 {
-    if (status == SyncFileItem::FatalError ||
-            (_current == -1 && status != SyncFileItem::Success && status != SyncFileItem::Restoration)) {
+    if (_state == Finished) {
+        return;
+    }
+    if (status == SyncFileItem::FatalError) {
         abort();
+        _state = Finished;
         emit finished(status);
         return;
     } else if (status == SyncFileItem::NormalError || status == SyncFileItem::SoftError) {
         _hasError = status;
     }
     _runningNow--;
-    slotSubJobReady();
+    if (_runningNow == 0) {
+        allSubJobsFinished();
+    }
 }
 
-void PropagateDirectory::slotSubJobReady()
+void PropagateDirectory::allSubJobsFinished()
 {
-    if (_runningNow && _current == -1)
-        return; // Ignore the case when the _fistJob is ready and not yet finished
-    if (_runningNow && _current >= 0 && _current < _subJobs.count()) {
-        // there is a job running and the current one is not ready yet, we can't start new job
-        if (!_subJobs[_current]->_readySent || _propagator->_activeJobs >= maximumActiveJob())
-            return;
-    }
-
-    _current++;
-    if (_current < _subJobs.size() && !_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
-        PropagatorJob *next = _subJobs.at(_current);
-        startJob(next);
+    if (!_deferredStarted && !_deferredSubJobs.isEmpty()) {
+        _deferredStarted = true;
+        startSubJobs(_deferredSubJobs);
         return;
     }
+    finalize();
+}
+
+void PropagateDirectory::finalize()
+{
     // We finished to processing all the jobs
-    emitReady();
-    if (!_runningNow) {
-        if (!_item.isEmpty() && _hasError == SyncFileItem::NoStatus) {
-            if( !_item._renameTarget.isEmpty() ) {
-                _item._file = _item._renameTarget;
-            }
+    if (!_item.isEmpty() && _hasError == SyncFileItem::NoStatus) {
+        if( !_item._renameTarget.isEmpty() ) {
+            _item._file = _item._renameTarget;
+        }
 
-            if (_item._should_update_etag && _item._instruction != CSYNC_INSTRUCTION_REMOVE) {
-                if (PropagateRemoteMkdir* mkdir = qobject_cast<PropagateRemoteMkdir*>(_firstJob.data())) {
-                    // special case from MKDIR, get the fileId from the job there
-                    if (_item._fileId.isEmpty() && !mkdir->_item._fileId.isEmpty()) {
-                        _item._fileId = mkdir->_item._fileId;
-                    }
+        if (_item._should_update_etag && _item._instruction != CSYNC_INSTRUCTION_REMOVE) {
+            if (_firstJob && _item._instruction == CSYNC_INSTRUCTION_NEW && _item._direction == SyncFileItem::Up) {
+                // special case from MKDIR, get the fileId from the job there
+                if (_item._fileId.isEmpty() && !_firstJob->_item._fileId.isEmpty()) {
+                    _item._fileId = _firstJob->_item._fileId;
                 }
-                SyncJournalFileRecord record(_item,  _propagator->_localDir + _item._file);
-                _propagator->_journal->setFileRecord(record);
             }
+            SyncJournalFileRecord record(_item,  _propagator->_localDir + _item._file);
+            _propagator->_journal->setFileRecord(record);
         }
-        emit finished(_hasError == SyncFileItem::NoStatus ? SyncFileItem::Success : _hasError);
     }
+    _state = Finished;
+    emit finished(_hasError == SyncFileItem::NoStatus ? SyncFileItem::Success : _hasError);
 }
 
 }
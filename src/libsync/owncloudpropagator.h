@@ -17,7 +17,9 @@
 
 #include <neon/ne_request.h>
 #include <QHash>
+#include <QMap>
 #include <QObject>
+#include <QVector>
 #include <qelapsedtimer.h>
 
 #include "syncfileitem.h"
@@ -36,15 +38,21 @@ class PropagatorJob : public QObject {
     Q_OBJECT
 protected:
     OwncloudPropagator *_propagator;
-    void emitReady() {
-        bool wasReady = _readySent;
-        _readySent = true;
-        if (!wasReady)
-            emit ready();
-    };
 public:
-    bool _readySent;
-    explicit PropagatorJob(OwncloudPropagator* propagator) : _propagator(propagator), _readySent(false) {}
+    enum JobState {
+        NotYetStarted,
+        Running,
+        Finished /* or skipped */
+    };
+    JobState _state;
+
+    /* Jobs that need to be finished before this one can be started. (Besides the job
+     * creating the parent directory, which is handled by the PropagateDirectory) */
+    QVector<PropagatorJob *> _dependencies;
+    int _pendingDependencies; // number of _dependencies not yet finished, used by the OwncloudPropagator
+
+    explicit PropagatorJob(OwncloudPropagator* propagator)
+        : _propagator(propagator), _state(NotYetStarted), _pendingDependencies(0) {}
 
 public slots:
     virtual void start() = 0;
@@ -60,71 +68,10 @@ signals:
      */
     void completed(const SyncFileItem &);
 
-    /**
-     * Emitted when all the sub-jobs have been scheduled and
-     * we are ready and more jobs might be started
-     * This signal is not always emitted.
-     */
-    void ready();
-
     void progress(const SyncFileItem& item, quint64 bytes);
 
 };
 
-/*
- * Propagate a directory, and all its sub entries.
- */
-class PropagateDirectory : public PropagatorJob {
-    Q_OBJECT
-public:
-    // e.g: create the directory
-    QScopedPointer<PropagatorJob>_firstJob;
-
-    // all the sub files or sub directories.
-    QVector<PropagatorJob *> _subJobs;
-
-    SyncFileItem _item;
-
-    int _current; // index of the current running job
-    int _runningNow; // number of subJob running now
-    SyncFileItem::Status _hasError;  // NoStatus,  or NormalError / SoftError if there was an error
-
-
-    explicit PropagateDirectory(OwncloudPropagator *propagator, const SyncFileItem &item = SyncFileItem())
-        : PropagatorJob(propagator)
-        , _firstJob(0), _item(item),  _current(-1), _runningNow(0), _hasError(SyncFileItem::NoStatus) { }
-
-    virtual ~PropagateDirectory() {
-        qDeleteAll(_subJobs);
-    }
-
-    void append(PropagatorJob *subJob) {
-        _subJobs.append(subJob);
-    }
-
-    virtual void start() Q_DECL_OVERRIDE;
-    virtual void abort() Q_DECL_OVERRIDE {
-        if (_firstJob)
-            _firstJob->abort();
-        foreach (PropagatorJob *j, _subJobs)
-            j->abort();
-    }
-
-private slots:
-    void startJob(PropagatorJob *next) {
-        connect(next, SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotSubJobFinished(SyncFileItem::Status)), Qt::QueuedConnection);
-        connect(next, SIGNAL(completed(SyncFileItem)), this, SIGNAL(completed(SyncFileItem)));
-        connect(next, SIGNAL(progress(SyncFileItem,quint64)), this, SIGNAL(progress(SyncFileItem,quint64)));
-        connect(next, SIGNAL(ready()), this, SLOT(slotSubJobReady()));
-        _runningNow++;
-        QMetaObject::invokeMethod(next, "start", Qt::QueuedConnection);
-    }
-
-    void slotSubJobFinished(SyncFileItem::Status status);
-    void slotSubJobReady();
-};
-
-
 /*
  * Abstract class to propagate a single item
  * (Only used for neon job)
@@ -155,10 +102,13 @@ protected slots:
 
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
+    friend class OwncloudPropagator; // for the scheduling
+    friend class PropagateDirectory; // So it can access the _item of the _firstJob
+    bool _smallTransfer; // set by the OwncloudPropagator when the job runs in the small file lane
 
 public:
     PropagateItemJob(OwncloudPropagator* propagator, const SyncFileItem &item)
-        : PropagatorJob(propagator), _item(item) {}
+        : PropagatorJob(propagator), _item(item), _smallTransfer(false) {}
 
 };
 
@@ -175,6 +125,61 @@ public:
 };
 
 
+/*
+ * Propagate a directory, and all its sub entries.
+ *
+ * The directory does not start the jobs of its files itself, it hands them to the
+ * OwncloudPropagator which decides when to run them. It only makes sure they are not
+ * handed over before the directory itself exists, and keeps track of when all of them
+ * are finished.
+ */
+class PropagateDirectory : public PropagatorJob {
+    Q_OBJECT
+public:
+    // e.g: create the directory
+    QScopedPointer<PropagateItemJob>_firstJob;
+
+    // all the sub files or sub directories.
+    QVector<PropagatorJob *> _subJobs;
+
+    // sub jobs only started once all the _subJobs are finished
+    QVector<PropagatorJob *> _deferredSubJobs;
+
+    SyncFileItem _item;
+
+    int _runningNow; // number of subJob started and not yet finished
+    bool _deferredStarted;
+    SyncFileItem::Status _hasError;  // NoStatus,  or NormalError / SoftError if there was an error
+
+
+    explicit PropagateDirectory(OwncloudPropagator *propagator, const SyncFileItem &item = SyncFileItem())
+        : PropagatorJob(propagator)
+        , _firstJob(0), _item(item), _runningNow(0), _deferredStarted(false), _hasError(SyncFileItem::NoStatus) { }
+
+    virtual ~PropagateDirectory();
+
+    void append(PropagatorJob *subJob) {
+        _subJobs.append(subJob);
+    }
+
+    void appendDeferred(PropagatorJob *subJob) {
+        _deferredSubJobs.append(subJob);
+    }
+
+    virtual void start() Q_DECL_OVERRIDE;
+    virtual void abort() Q_DECL_OVERRIDE;
+
+private:
+    void startSubJobs(const QVector<PropagatorJob *> &jobs);
+    void allSubJobsFinished();
+    void finalize();
+
+private slots:
+    void slotFirstJobFinished(SyncFileItem::Status status);
+    void slotSubJobFinished(SyncFileItem::Status status);
+};
+
+
 class OwncloudPropagator : public QObject {
     Q_OBJECT
 
@@ -182,6 +187,31 @@ class OwncloudPropagator : public QObject {
     QScopedPointer<PropagateDirectory> _rootJob;
     bool useLegacyJobs();
 
+    /* Transfers sorted by size, smallest first, and in the order they got ready for the same size */
+    typedef QMap<QPair<qint64, quint64>, PropagateItemJob *> TransferQueue;
+
+    /* Jobs whose dependency is finished, waiting for a free slot. */
+    QList<PropagateItemJob *> _readyJobs;
+    TransferQueue _readyUploads;
+    TransferQueue _readyDownloads;
+    /* Uploads and downloads of small files, which have their own budget of active jobs */
+    TransferQueue _readySmallTransfers;
+    quint64 _readyTransferCount;
+    int _activeSmallJobs;
+    bool _lastStartedUpload; // to alternate between uploads and downloads
+    /* Jobs waiting for one of their dependencies (the key) to be finished */
+    QMultiHash<PropagatorJob *, PropagateItemJob *> _waitingJobs;
+    bool _fatalError;
+
+    static PropagateItemJob *takeFirst(TransferQueue &queue);
+    void enqueueReadyJob(PropagateItemJob *job);
+    PropagateItemJob *takeNextReadyJob();
+    void releaseDependents(PropagatorJob *job);
+    /* Finishes the jobs of skipJobs() that have not been started, without scheduling */
+    void markSkipped(PropagatorJob *job);
+    void scheduleNextJobs();
+    void startJob(PropagateItemJob *job);
+
 public:
     /* 'const' because they are accessed by the thread */
 
@@ -194,28 +224,47 @@ public:
 
     SyncJournalDb * const _journal;
     bool _finishedEmited; // used to ensure that finished is only emit once
+    bool _running; // counted in the propagations sharing the job budget
 
 public:
     OwncloudPropagator(ne_session_s *session, const QString &localDir, const QString &remoteDir, const QString &remoteFolder,
                        SyncJournalDb *progressDb, QThread *neonThread)
-            : _neonThread(neonThread)
+            : _readyTransferCount(0)
+            , _activeSmallJobs(0)
+            , _lastStartedUpload(false)
+            , _fatalError(false)
+            , _neonThread(neonThread)
             , _session(session)
             , _localDir((localDir.endsWith(QChar('/'))) ? localDir : localDir+'/' )
             , _remoteDir((remoteDir.endsWith(QChar('/'))) ? remoteDir : remoteDir+'/' )
             , _remoteFolder((remoteFolder.endsWith(QChar('/'))) ? remoteFolder : remoteFolder+'/' )
             , _journal(progressDb)
             , _finishedEmited(false)
+            , _running(false)
             , _activeJobs(0)
     { }
+    ~OwncloudPropagator();
 
     void start(const SyncFileItemVector &_syncedItems);
 
+    /**
+     * Called by the PropagateDirectory when \a job can be started as far as the directory is
+     * concerned. The job is started once its _dependencies are finished and there is a free slot.
+     */
+    void scheduleJob(PropagateItemJob *job);
+
+    /**
+     * Mark all the jobs of this directory (or this job) that have not been started as finished,
+     * so that the jobs depending on them are not blocked forever.
+     */
+    void skipJobs(PropagatorJob *job);
+
     QAtomicInt _downloadLimit;
     QAtomicInt _uploadLimit;
 
     QAtomicInt _abortRequested; // boolean set by the main thread to abort.
 
-    /* The number of currently active jobs */
+    /* The number of currently active jobs (started by scheduleJob and not yet finished) */
     int _activeJobs;
 
     bool isInSharedDirectory(const QString& file);
@@ -232,14 +281,19 @@ public:
     // timeout in seconds
     static int httpTimeout();
 
+    /* Files up to that size are small: their transfer is bound by the latency rather than
+     * the bandwidth, so they are run in a lane of their own with more parallelism */
+    static qint64 smallFileSize();
+
+    /* How many requests the propagation runs at the same time at most. When several folders
+     * are synced at the same time, they share that budget evenly. */
+    static int maximumParallelRequests();
+
 private slots:
+    void slotJobFinished(SyncFileItem::Status status);
 
     /** Emit the finished signal and make sure it is only emit once */
-    void emitFinished() {
-        if (!_finishedEmited)
-            emit finished();
-        _finishedEmited = true;
-    }
+    void emitFinished();
 
 signals:
     void completed(const SyncFileItem &);
@@ -38,6 +38,27 @@ static qint64 chunkSize() {
     return chunkSize;
 }
 
+/* Size of the blocks read from the network reply and written to the file in one go */
+static const qint64 downloadBufferSize = 1024 * 1024;
+
+/* Number of downloaded bytes after which the data is flushed to the disk.
+ * 0 (the default) leaves it to the operating system */
+static qint64 downloadSyncInterval() {
+    static qint64 interval = qgetenv("OWNCLOUD_DOWNLOAD_SYNC_INTERVAL").toLongLong();
+    return interval;
+}
+
+/* Files whose local and remote versions are at least that big are updated with a
+ * DeltaDownload when the server has block manifests. Negative disables it */
+static qint64 deltaDownloadMinSize() {
+    static qint64 size = -2;
+    if (size == -2) {
+        QByteArray env = qgetenv("OWNCLOUD_DELTA_MIN_SIZE");
+        size = env.isEmpty() ? 10 * 1024 * 1024 : env.toLongLong();
+    }
+    return size;
+}
+
 static QByteArray get_etag_from_reply(QNetworkReply *reply)
 {
     QByteArray ret = parseEtag(reply->rawHeader("OC-ETag"));
@@ -104,6 +125,114 @@ void PropagateUploadFileQNAM::start()
         return;
     }
 
+    if (_item._instruction == CSYNC_INSTRUCTION_SYNC && _item._size == _item.log._other_size) {
+        // The local file was touched, but if the journal knows the checksum of what was uploaded
+        // last time the content might be the same. Compare on a worker thread.
+        const QByteArray previousChecksum = _propagator->_journal->getFileRecord(_item._file)._contentChecksum;
+        const ContentChecksum::Type type = ContentChecksum::typeOf(previousChecksum);
+        if (type != ContentChecksum::NoChecksum) {
+            _computeChecksum = new ComputeChecksum(this);
+            connect(_computeChecksum, SIGNAL(done(QByteArray)), SLOT(slotLocalChecksumComputed(QByteArray)));
+            _computeChecksum->start(_propagator->_localDir + _item._file, type);
+            return;
+        }
+    }
+    startTransfer();
+}
+
+void PropagateUploadFileQNAM::startTransfer()
+{
+    _duration.start();
+    emit progress(_item, 0);
+
+    const ContentChecksum::Type checksumType = ContentChecksum::configuredType();
+    if (_item._instruction == CSYNC_INSTRUCTION_NEW && _item._size > OwncloudPropagator::smallFileSize()
+            && checksumType != ContentChecksum::NoChecksum
+            && _propagator->_journal->hasFileRecordOfSize(_item._size)) {
+        // Maybe a copy of a file that is already on the server. Find out on a worker thread,
+        // hashing big files would block the other jobs.
+        _computeChecksum = new ComputeChecksum(this);
+        connect(_computeChecksum, SIGNAL(done(QByteArray)), SLOT(slotChecksumComputed(QByteArray)));
+        _computeChecksum->start(_propagator->_localDir + _item._file, checksumType);
+        return;
+    }
+    startUpload();
+}
+
+/**
+ * Look for a synced file with the same content. If its local version was not modified since it
+ * was synced, the server has that content: copy it there instead of uploading.
+ */
+void PropagateUploadFileQNAM::slotChecksumComputed(const QByteArray &checksum)
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    const QStringList paths = checksum.isEmpty() ? QStringList()
+            : _propagator->_journal->getFilePathsByContent(_item._size, checksum);
+    foreach (const QString &path, paths) {
+        if (path == _item._file) {
+            continue;
+        }
+        SyncJournalFileRecord record = _propagator->_journal->getFileRecord(path);
+        const QFileInfo source(_propagator->_localDir + path);
+        if (!record.isValid() || record._etag.isEmpty() || !source.isFile()
+                || quint64(source.size()) != _item._size
+                || Utility::qDateTimeToTime_t(source.lastModified()) != Utility::qDateTimeToTime_t(record._modtime)) {
+            continue;
+        }
+
+        qDebug() << Q_FUNC_INFO << _item._file << "has the content of" << path << ", copying it on the server";
+        _item._contentChecksum = checksum;
+        // The If-Match makes sure the server copies the version the checksum was recorded for
+        _copyJob = new CopyJob(AccountManager::instance()->account(), _propagator->_remoteFolder + path,
+                               _propagator->_remoteFolder + _item._file, record._etag, this);
+        _copyJob->setTimeout(_propagator->httpTimeout() * 1000);
+        connect(_copyJob, SIGNAL(finishedSignal()), this, SLOT(slotCopyFinished()));
+        _copyJob->start();
+        return;
+    }
+    startUpload();
+}
+
+void PropagateUploadFileQNAM::slotCopyFinished()
+{
+    CopyJob *job = qobject_cast<CopyJob *>(sender());
+    Q_ASSERT(job);
+
+    QNetworkReply::NetworkError err = job->reply()->error();
+    if (err == QNetworkReply::OperationCanceledError && _propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        done(SyncFileItem::NormalError, tr("Aborted by the user"));
+        return;
+    }
+    if (err != QNetworkReply::NoError) {
+        // The source changed or went away on the server, or COPY is not allowed there
+        qDebug() << Q_FUNC_INFO << "COPY failed, uploading" << _item._file
+                 << job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt()
+                 << job->reply()->errorString();
+        _item._contentChecksum.clear();
+        startUpload();
+        return;
+    }
+
+    _item._fileId = job->reply()->rawHeader("OC-FileID");
+    _item._etag = get_etag_from_reply(job->reply());
+    _item._responseTimeStamp = job->responseTimestamp();
+    emit progress(_item, _item._size);
+
+    // The copy has the modification time of the source, set ours. That also gets the new etag.
+    PropagatorJob *newJob = new UpdateMTimeAndETagJob(_propagator, _item);
+    QObject::connect(newJob, SIGNAL(completed(SyncFileItem)), this, SLOT(finalize(SyncFileItem)));
+    QMetaObject::invokeMethod(newJob, "start");
+}
+
+void PropagateUploadFileQNAM::startUpload()
+{
+    const ContentChecksum::Type checksumType = ContentChecksum::configuredType();
+    if (checksumType != ContentChecksum::NoChecksum) {
+        _checksum.reset(new ContentChecksum(checksumType));
+    }
+
     quint64 fileSize = _file->size();
     _chunkCount = std::ceil(fileSize/double(chunkSize()));
     _startChunk = 0;
@@ -117,28 +246,93 @@ void PropagateUploadFileQNAM::start()
         qDebug() << Q_FUNC_INFO << _item._file << ": Resuming from chunk " << _startChunk;
     }
 
-    _currentChunk = 0;
-    _duration.start();
+    if (_chunkCount > 1) {
+        _chunkHashes = QVector<QByteArray>(_chunkCount);
+        _previousChunkHashes = _propagator->_journal->getChunkHashes(_item._file);
+        // The server copies the chunk from the version we replace, which the If-Match designates
+        _chunkReuse = _previousChunkHashes._valid && _item._instruction == CSYNC_INSTRUCTION_SYNC
+                && _previousChunkHashes._chunkSize == chunkSize()
+                && !_item._etag.isEmpty() && _previousChunkHashes._etag == _item._etag;
+    }
 
-    _propagator->_activeJobs++;
-    emit progress(_item, 0);
-    emitReady();
+    _currentChunk = 0;
     this->startNextChunk();
 }
 
+/**
+ * If the content is the same as what was uploaded last time, only the journal needs to be updated.
+ */
+void PropagateUploadFileQNAM::slotLocalChecksumComputed(const QByteArray &checksum)
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    SyncJournalFileRecord record = _propagator->_journal->getFileRecord(_item._file);
+    if (checksum.isEmpty() || checksum != record._contentChecksum) {
+        startTransfer();
+        return;
+    }
+
+    qDebug() << Q_FUNC_INFO << _item._file << "has the same content as on the server, not uploading";
+    const QString fn = _propagator->_localDir + _item._file;
+    SyncJournalFileRecord newRecord(_item, fn);
+    newRecord._etag = record._etag;
+    newRecord._fileId = record._fileId;
+    newRecord._remotePerm = record._remotePerm;
+    newRecord._contentChecksum = record._contentChecksum;
+    _propagator->_journal->setFileRecord(newRecord);
+    _propagator->_journal->setUploadInfo(_item._file, SyncJournalDb::UploadInfo());
+    _propagator->_journal->commit("upload skipped, same content");
+    done(SyncFileItem::Success);
+}
+
+/**
+ * The SHA1 of \a size bytes of \a file from \a start, also fed to \a checksum if not null.
+ * Returns an empty array if they cannot be read.
+ */
+static QByteArray chunkHash(QIODevice *file, qint64 start, qint64 size, ContentChecksum *checksum)
+{
+    if (!file->seek(start)) {
+        return QByteArray();
+    }
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QByteArray buffer(int(qMin<qint64>(size, 1024 * 1024)), Qt::Uninitialized);
+    for (qint64 done = 0; done < size;) {
+        qint64 r = file->read(buffer.data(), qMin<qint64>(size - done, buffer.size()));
+        if (r <= 0) {
+            return QByteArray();
+        }
+        hash.addData(buffer.constData(), r);
+        if (checksum) {
+            checksum->addData(start + done, buffer.constData(), r);
+        }
+        done += r;
+    }
+    return hash.result();
+}
+
 struct ChunkDevice : QIODevice {
 public:
     QPointer<QIODevice> _file;
     qint64 _read;
     qint64 _size;
     qint64 _start;
+    ContentChecksum *_checksum; // fed with what is read, may be null
+    QCryptographicHash _hash; // SHA1 of the chunk, computed while it is sent
+    qint64 _hashed;
 
-    ChunkDevice(QIODevice *file,  qint64 start, qint64 size)
-            : QIODevice(file), _file(file), _read(0), _size(size), _start(start) {
+    ChunkDevice(QIODevice *file,  qint64 start, qint64 size, ContentChecksum *checksum)
+            : QIODevice(file), _file(file), _read(0), _size(size), _start(start), _checksum(checksum),
+              _hash(QCryptographicHash::Sha1), _hashed(0) {
         _file = QPointer<QIODevice>(file);
         _file.data()->seek(start);
     }
 
+    /** The SHA1 of the chunk, or an empty array if it was not entirely read */
+    QByteArray hash() const {
+        return _hashed == _size ? _hash.result() : QByteArray();
+    }
+
     virtual qint64 writeData(const char* , qint64 ) Q_DECL_OVERRIDE {
         Q_ASSERT(!"write to read only device");
         return 0;
@@ -156,6 +350,14 @@ public:
         qint64 ret = _file.data()->read(data, maxlen);
         if (ret < 0)
             return -1;
+        if (_checksum) {
+            _checksum->addData(_start + _read, data, ret);
+        }
+        // QNAM may seek back to send the data again: only hash what follows
+        if (_read <= _hashed && _read + ret > _hashed) {
+            _hash.addData(data + (_hashed - _read), _read + ret - _hashed);
+            _hashed = _read + ret;
+        }
         _read += ret;
         return ret;
     }
@@ -227,22 +429,71 @@ void PropagateUploadFileQNAM::startNextChunk()
 
     QString path = _item._file;
     QIODevice *device = 0;
+    _chunkDevice = 0;
+    qint64 chunkStart = 0;
+    qint64 currentChunkSize = fileSize;
     if (_chunkCount > 1) {
         int sendingChunk = (_currentChunk + _startChunk) % _chunkCount;
         // XOR with chunk size to make sure everything goes well if chunk size change between runs
         uint transid = _transferId ^ chunkSize();
         path +=  QString("-chunking-%1-%2-%3").arg(transid).arg(_chunkCount).arg(sendingChunk);
         headers["OC-Chunked"] = "1";
-        int currentChunkSize = chunkSize();
+        currentChunkSize = chunkSize();
         if (sendingChunk == _chunkCount - 1) { // last chunk
             currentChunkSize = (fileSize % chunkSize());
             if( currentChunkSize == 0 ) { // if the last chunk pretents to be 0, its actually the full chunk size.
                 currentChunkSize = chunkSize();
             }
         }
-        device = new ChunkDevice(_file, chunkSize() * quint64(sendingChunk), currentChunkSize);
+        chunkStart = chunkSize() * quint64(sendingChunk);
+    }
+
+    if (_checksum && _currentChunk + 1 >= _chunkCount) {
+        // The checksum of the whole file goes in a header of the last request, so it must be
+        // known before the body is sent. What the previous requests did not send (this chunk,
+        // or more when resuming) is hashed from the file; the chunk is then streamed as usual.
+        if (!_checksum->hashUpTo(_file, fileSize)) {
+            done(SyncFileItem::NormalError, _file->errorString());
+            return;
+        }
+        _item._contentChecksum = _checksum->result();
+        headers["OC-Checksum"] = _item._contentChecksum;
+    }
+
+    if (_chunkCount > 1) {
+        int sendingChunk = (_currentChunk + _startChunk) % _chunkCount;
+        _chunkHashes[sendingChunk].clear();
+
+        // The last chunk to be sent, or the last of the file, may complete the upload: always send
+        // their data so a server that ignores the reuse headers never assembles an empty chunk.
+        if (_chunkReuse && _currentChunk + 1 < _chunkCount && sendingChunk != _chunkCount - 1
+                && sendingChunk < _previousChunkHashes._hashes.size()) {
+            // Hash the chunk before sending it, to know if the server already has it.
+            // (Reading it twice is cheap: the second read comes from the cache.)
+            const QByteArray hash = chunkHash(_file, chunkStart, currentChunkSize, _checksum.data());
+            if (hash.isEmpty()) {
+                done(SyncFileItem::NormalError, _file->errorString());
+                return;
+            }
+            _chunkHashes[sendingChunk] = hash;
+            _reusingChunk = _previousChunkHashes._hashes.at(sendingChunk) == hash;
+        }
+        if (_reusingChunk) {
+            qDebug() << Q_FUNC_INFO << _item._file << "chunk" << sendingChunk << "did not change";
+            headers["OC-Chunk-Reuse"] = _chunkHashes.at(sendingChunk).toHex();
+            headers["OC-Chunk-Offset"] = QByteArray::number(chunkStart);
+            headers["OC-Chunk-Length"] = QByteArray::number(currentChunkSize);
+            device = new QBuffer;
+        } else {
+            // Otherwise the chunk is hashed while it is sent
+            ChunkDevice *chunkDevice = new ChunkDevice(_file, chunkStart, currentChunkSize, _checksum.data());
+            if (_chunkHashes.at(sendingChunk).isEmpty()) {
+                _chunkDevice = chunkDevice;
+            }
+            device = chunkDevice;
+        }
     } else {
-        device = _file;
+        device = new ChunkDevice(_file, chunkStart, currentChunkSize, _checksum.data());
     }
 
     bool isOpen = true;
@@ -276,9 +527,21 @@ void PropagateUploadFileQNAM::slotPutFinished()
              << job->reply()->attribute(QNetworkRequest::HttpReasonPhraseAttribute);
 
     QNetworkReply::NetworkError err = job->reply()->error();
+    if (_reusingChunk) {
+        _reusingChunk = false;
+        const int httpCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if ((err != QNetworkReply::NoError || job->reply()->rawHeader("OC-Chunk-Reused") != "1")
+                && httpCode != 412) {
+            // The server does not know how to reuse chunks (and may have stored an empty one):
+            // send the data of this chunk, and of the next ones.
+            qDebug() << Q_FUNC_INFO << "the server did not reuse the chunk" << httpCode;
+            _chunkReuse = false;
+            startNextChunk();
+            return;
+        }
+    }
     if (err != QNetworkReply::NoError) {
         _item._httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-        _propagator->_activeJobs--;
         if(checkForProblemsWithShared(_item._httpErrorCode,
             tr("The file was edited locally but is part of a read only share. "
                "It is restored and your edit is in the conflict file."))) {
@@ -303,20 +566,24 @@ void PropagateUploadFileQNAM::slotPutFinished()
         return;
     }
 
+    if (_chunkDevice) {
+        // stays empty, and the hashes are not stored, if the chunk was not entirely sent
+        _chunkHashes[(_currentChunk + _startChunk) % _chunkCount] = _chunkDevice->hash();
+        _chunkDevice = 0;
+    }
+
     bool finished = job->reply()->hasRawHeader("ETag")
             || job->reply()->hasRawHeader("OC-ETag");
 
     if (!finished) {
         QFileInfo fi(_propagator->_localDir + _item._file);
         if( !fi.exists() ) {
-            _propagator->_activeJobs--;
             done(SyncFileItem::SoftError, tr("The local file was removed during sync."));
             return;
         }
 
         if (Utility::qDateTimeToTime_t(fi.lastModified()) != _item._modtime) {
             qDebug() << "The local file has changed during upload:" << _item._modtime << "!=" << Utility::qDateTimeToTime_t(fi.lastModified())  << fi.lastModified();
-            _propagator->_activeJobs--;
             done(SyncFileItem::SoftError, tr("Local file changed during sync."));
             // FIXME:  the legacy code was retrying for a few seconds.
             //         and also checking that after the last chunk, and removed the file in case of INSTRUCTION_NEW
@@ -326,7 +593,6 @@ void PropagateUploadFileQNAM::slotPutFinished()
         // Proceed to next chunk.
         _currentChunk++;
         if (_currentChunk >= _chunkCount) {
-            _propagator->_activeJobs--;
             done(SyncFileItem::NormalError, tr("The server did not acknowledge the last chunk. (No e-tag were present)"));
             return;
         }
@@ -377,13 +643,19 @@ void PropagateUploadFileQNAM::finalize(const SyncFileItem &copy)
     _item._etag = copy._etag;
     _item._fileId = copy._fileId;
 
-    _propagator->_activeJobs--;
-
     _item._requestDuration = _duration.elapsed();
 
     _propagator->_journal->setFileRecord(SyncJournalFileRecord(_item, _propagator->_localDir + _item._file));
     // Remove from the progress database:
     _propagator->_journal->setUploadInfo(_item._file, SyncJournalDb::UploadInfo());
+    SyncJournalDb::ChunkHashes chunkHashes;
+    if (_chunkCount > 1 && !_chunkHashes.contains(QByteArray())) {
+        chunkHashes._etag = _item._etag;
+        chunkHashes._chunkSize = chunkSize();
+        chunkHashes._hashes = _chunkHashes.toList();
+        chunkHashes._valid = true;
+    }
+    _propagator->_journal->setChunkHashes(_item._file, chunkHashes);
     _propagator->_journal->commit("upload file start");
 
     done(SyncFileItem::Success);
@@ -404,6 +676,9 @@ void PropagateUploadFileQNAM::abort()
         qDebug() << Q_FUNC_INFO << this->_item._file;
         _job->reply()->abort();
     }
+    if (_copyJob && _copyJob->reply()) {
+        _copyJob->reply()->abort();
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -414,7 +689,9 @@ GETFileJob::GETFileJob(Account* account, const QString& path, QFile *device,
                     quint64 _resumeStart,  QObject* parent)
 : AbstractNetworkJob(account, path, parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume),
-  _resumeStart(_resumeStart) , _errorStatus(SyncFileItem::NoStatus)
+  _resumeStart(_resumeStart) , _errorStatus(SyncFileItem::NoStatus),
+  _writeCount(0), _bytesWritten(0), _bytesSinceSync(0), _pipeliningAllowed(false),
+  _contentUnchanged(false)
 {
 }
 
@@ -423,7 +700,9 @@ GETFileJob::GETFileJob(Account* account, const QUrl& url, QFile *device,
                     QObject* parent)
 : AbstractNetworkJob(account, url.toEncoded(), parent),
   _device(device), _headers(headers), _resumeStart(0),
-  _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url)
+  _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url),
+  _writeCount(0), _bytesWritten(0), _bytesSinceSync(0), _pipeliningAllowed(false),
+  _contentUnchanged(false)
 {
 }
 
@@ -433,6 +712,9 @@ void GETFileJob::start() {
     for(QMap<QByteArray, QByteArray>::const_iterator it = _headers.begin(); it != _headers.end(); ++it) {
         req.setRawHeader(it.key(), it.value());
     }
+    if (_pipeliningAllowed) {
+        req.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
+    }
 
     if (_directDownloadUrl.isEmpty()) {
         setReply(davRequest("GET", path(), req));
@@ -441,7 +723,7 @@ void GETFileJob::start() {
         setReply(davRequest("GET", _directDownloadUrl, req));
     }
     setupConnections(reply());
-    reply()->setReadBufferSize(128 * 1024);
+    reply()->setReadBufferSize(downloadBufferSize);
 
     if( reply()->error() != QNetworkReply::NoError ) {
         qWarning() << Q_FUNC_INFO << " Network error: " << reply()->errorString();
@@ -511,15 +793,37 @@ void GETFileJob::slotMetaDataChanged()
         }
     }
 
+    _remoteChecksum = reply()->rawHeader("OC-Checksum");
+    if (!_localChecksum.isEmpty() && _remoteChecksum == _localChecksum) {
+        qDebug() << Q_FUNC_INFO << "Same checksum as the local file, no need to download" << _remoteChecksum;
+        _contentUnchanged = true;
+        reply()->abort();
+        return;
+    }
+
+    if (!_checksum) {
+        // Compute the same kind of checksum as the server so it can be verified
+        ContentChecksum::Type type = ContentChecksum::typeOf(_remoteChecksum);
+        if (type == ContentChecksum::NoChecksum) {
+            type = ContentChecksum::configuredType();
+        }
+        if (type != ContentChecksum::NoChecksum) {
+            _checksum.reset(new ContentChecksum(type));
+        }
+    }
 }
 
 void GETFileJob::slotReadyRead()
 {
-    int bufferSize = qMin(1024*8ll , reply()->bytesAvailable());
-    QByteArray buffer(bufferSize, Qt::Uninitialized);
+    // Read as much as the reply has buffered, so the (unbuffered) file sees few, big writes.
+    // The buffer only grows as far as the data that arrived, small files keep a small one.
+    const qint64 wanted = qMin(downloadBufferSize, reply()->bytesAvailable());
+    if (_readBuffer.size() < wanted) {
+        _readBuffer.resize(wanted);
+    }
 
     while(reply()->bytesAvailable() > 0) {
-        qint64 r = reply()->read(buffer.data(), bufferSize);
+        qint64 r = reply()->read(_readBuffer.data(), _readBuffer.size());
         if (r < 0) {
             _errorString = reply()->errorString();
             _errorStatus = SyncFileItem::NormalError;
@@ -528,7 +832,7 @@ void GETFileJob::slotReadyRead()
             return;
         }
 
-        qint64 w = _device->write(buffer.constData(), r);
+        qint64 w = _device->write(_readBuffer.constData(), r);
         if (w != r) {
             _errorString = _device->errorString();
             _errorStatus = SyncFileItem::NormalError;
@@ -536,6 +840,16 @@ void GETFileJob::slotReadyRead()
             reply()->abort();
             return;
         }
+        if (_checksum) {
+            _checksum->addData(_resumeStart + _bytesWritten, _readBuffer.constData(), w);
+        }
+        _writeCount++;
+        _bytesWritten += w;
+        _bytesSinceSync += w;
+        if (downloadSyncInterval() > 0 && _bytesSinceSync >= downloadSyncInterval()) {
+            FileSystem::syncToDisk(*_device);
+            _bytesSinceSync = 0;
+        }
     }
     resetTimeout();
 }
@@ -595,6 +909,11 @@ void PropagateDownloadFileQNAM::start()
 
     FileSystem::setFileHidden(_tmpFile.fileName(), true);
 
+    if (_tmpFile.size() < _item._size) {
+        // Reserve the space now so the file does not get fragmented by the many appends.
+        FileSystem::preallocate(_tmpFile, _item._size);
+    }
+
     {
         SyncJournalDb::DownloadInfo pi;
         pi._etag = _item._etag;
@@ -605,20 +924,40 @@ void PropagateDownloadFileQNAM::start()
     }
 
 
+    quint64 startSize = _tmpFile.size();
+    if (startSize > 0 && startSize == _item._size) {
+        qDebug() << "File is already complete, no need to download";
+        downloadFinished();
+        return;
+    }
+
+    const QString fn = _propagator->_localDir + _item._file;
+    const qint64 minSize = deltaDownloadMinSize();
+    if (startSize == 0 && _item._directDownloadUrl.isEmpty() && minSize >= 0
+            && _item._size >= minSize && QFileInfo(fn).size() >= minSize) {
+        // Only fetch the blocks that are not in the file we have. The result is appended to
+        // the temporary file in order, so an interrupted one is resumed as usual.
+        _delta = new DeltaDownload(AccountManager::instance()->account(),
+                                   _propagator->_remoteFolder + _item._file,
+                                   _item._etag, fn, &_tmpFile, this);
+        _delta->setTimeout(_propagator->httpTimeout() * 1000);
+        connect(_delta, SIGNAL(finished(bool)), this, SLOT(slotDeltaFinished(bool)));
+        connect(_delta, SIGNAL(progress(qint64)), this, SLOT(slotDeltaProgress(qint64)));
+        _delta->start();
+        return;
+    }
+
+    startDownload(startSize, expectedEtagForResume);
+}
+
+void PropagateDownloadFileQNAM::startDownload(quint64 startSize, const QByteArray &expectedEtagForResume)
+{
     QMap<QByteArray, QByteArray> headers;
 
-    quint64 startSize = 0;
-    if (_tmpFile.size() > 0) {
-        quint64 done = _tmpFile.size();
-        if (done == _item._size) {
-            qDebug() << "File is already complete, no need to download";
-            downloadFinished();
-            return;
-        }
-        headers["Range"] = "bytes=" + QByteArray::number(done) +'-';
+    if (startSize > 0) {
+        headers["Range"] = "bytes=" + QByteArray::number(startSize) +'-';
         headers["Accept-Ranges"] = "bytes";
         qDebug() << "Retry with range " << headers["Range"];
-        startSize = done;
     }
 
     if (_item._directDownloadUrl.isEmpty()) {
@@ -638,17 +977,23 @@ void PropagateDownloadFileQNAM::start()
         qDebug() << Q_FUNC_INFO << "directDownloadUrl given for " << _item._file << _item._directDownloadUrl;
     }
     _job->setTimeout(_propagator->httpTimeout() * 1000);
+    // For small files the round trip dominates: allow QNAM to pipeline them.
+    // They share the account's QNAM, and so its connections, with the other transfers: a
+    // second QNAM would need its own cookies, credentials and SSL error handling. The
+    // small lane of the OwncloudPropagator bounds how many of them are in flight instead.
+    _job->setPipeliningAllowed(_item._size <= OwncloudPropagator::smallFileSize());
+    if (_item._instruction == CSYNC_INSTRUCTION_SYNC && startSize == 0) {
+        // The local file did not change: if the server has the same content (only the mtime
+        // changed) we can stop as soon as we see the checksum.
+        _job->setLocalChecksum(_propagator->_journal->getFileRecord(_item._file)._contentChecksum);
+    }
     connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotGetFinished()));
     connect(_job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotDownloadProgress(qint64,qint64)));
-    _propagator->_activeJobs ++;
     _job->start();
-    emitReady();
 }
 
 void PropagateDownloadFileQNAM::slotGetFinished()
 {
-    _propagator->_activeJobs--;
-
     GETFileJob *job = qobject_cast<GETFileJob *>(sender());
     Q_ASSERT(job);
 
@@ -656,6 +1001,20 @@ void PropagateDownloadFileQNAM::slotGetFinished()
              << job->reply()->error()
              << (job->reply()->error() == QNetworkReply::NoError ? QLatin1String("") : job->reply()->errorString());
 
+    if (job->contentUnchanged()) {
+        _tmpFile.close();
+        _tmpFile.remove();
+        QString fn = _propagator->_localDir + _item._file;
+        FileSystem::setModTime(fn, _item._modtime);
+        _item._contentChecksum = job->remoteChecksum();
+        _item._responseTimeStamp = job->responseTimestamp();
+        _propagator->_journal->setFileRecord(SyncJournalFileRecord(_item, fn));
+        _propagator->_journal->setDownloadInfo(_item._file, SyncJournalDb::DownloadInfo());
+        _propagator->_journal->commit("download skipped, same content");
+        done(SyncFileItem::Success);
+        return;
+    }
+
     QNetworkReply::NetworkError err = job->reply()->error();
     if (err != QNetworkReply::NoError) {
         if (_tmpFile.size() == 0) {
@@ -665,7 +1024,6 @@ void PropagateDownloadFileQNAM::slotGetFinished()
             _propagator->_journal->setDownloadInfo(_item._file, SyncJournalDb::DownloadInfo());
         }
         _item._httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-        _propagator->_activeJobs--;
         SyncFileItem::Status status = job->errorStatus();
         if (status == SyncFileItem::NoStatus) {
             status = classifyError(err, _item._httpErrorCode);
@@ -682,11 +1040,81 @@ void PropagateDownloadFileQNAM::slotGetFinished()
     _item._requestDuration = job->duration();
     _item._responseTimeStamp = job->responseTimestamp();
 
+    if (_item._requestDuration > 0) {
+        qDebug() << Q_FUNC_INFO << _item._file << "received" << job->bytesWritten() << "bytes in"
+                 << job->writeCount() << "writes,"
+                 << (job->bytesWritten() / 1024.0 / 1024.0) / (_item._requestDuration / 1000.0) << "MB/s";
+    }
+
+    if (ContentChecksum *checksum = job->checksum()) {
+        // When resuming, the part downloaded before was not hashed: read it back.
+        bool ok = true;
+        if (checksum->bytesHashed() != _tmpFile.size()) {
+            QFile reader(_tmpFile.fileName());
+            ok = reader.open(QIODevice::ReadOnly) && checksum->hashUpTo(&reader, reader.size());
+        }
+        if (ok) {
+            _item._contentChecksum = checksum->result();
+        }
+        const QByteArray remoteChecksum = job->remoteChecksum();
+        if (ok && ContentChecksum::typeOf(remoteChecksum) == checksum->type()
+                && remoteChecksum != _item._contentChecksum) {
+            qDebug() << Q_FUNC_INFO << "Checksum mismatch for" << _item._file
+                     << remoteChecksum << "!=" << _item._contentChecksum;
+            _tmpFile.close();
+            _tmpFile.remove();
+            _propagator->_journal->setDownloadInfo(_item._file, SyncJournalDb::DownloadInfo());
+            done(SyncFileItem::NormalError, tr("The downloaded file does not match the checksum sent by the server."));
+            return;
+        }
+    }
+
+    if (downloadSyncInterval() > 0) {
+        FileSystem::syncToDisk(_tmpFile);
+    }
     _tmpFile.close();
     _tmpFile.flush();
     downloadFinished();
 }
 
+void PropagateDownloadFileQNAM::slotDeltaFinished(bool ok)
+{
+    DeltaDownload *delta = qobject_cast<DeltaDownload *>(sender());
+    Q_ASSERT(delta);
+    delta->deleteLater();
+
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        done(SyncFileItem::NormalError, tr("Aborted by the user"));
+        return;
+    }
+
+    if (!ok) {
+        // Download the whole file as if nothing happened
+        if (!_tmpFile.resize(0)) {
+            done(SyncFileItem::NormalError, _tmpFile.errorString());
+            return;
+        }
+        startDownload(0, QByteArray());
+        return;
+    }
+
+    qDebug() << Q_FUNC_INFO << _item._file << "updated by downloading" << delta->bytesDownloaded()
+             << "of" << _item._size << "bytes";
+    if (!delta->checksum().isEmpty()) {
+        _item._contentChecksum = delta->checksum();
+    }
+    if (downloadSyncInterval() > 0) {
+        FileSystem::syncToDisk(_tmpFile);
+    }
+    _tmpFile.close();
+    downloadFinished();
+}
+
+void PropagateDownloadFileQNAM::slotDeltaProgress(qint64 written)
+{
+    emit progress(_item, written);
+}
+
 QString makeConflictFileName(const QString &fn, const QDateTime &dt)
 {
     QString conflictFileName(fn);
@@ -756,9 +1184,272 @@ void PropagateDownloadFileQNAM::slotDownloadProgress(qint64 received, qint64)
 
 
 void PropagateDownloadFileQNAM::abort()
+{
+    if (_delta)
+        _delta->abort();
+    if (_job &&  _job->reply())
+        _job->reply()->abort();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DeleteJob::start()
+{
+    setReply(davRequest("DELETE", path()));
+    setupConnections(reply());
+
+    if( reply()->error() != QNetworkReply::NoError ) {
+        qWarning() << Q_FUNC_INFO << " Network error: " << reply()->errorString();
+    }
+    AbstractNetworkJob::start();
+}
+
+void MoveJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader("Destination", Account::concatUrlPath(account()->davUrl(), _destination).toEncoded());
+    req.setRawHeader("Overwrite", "T");
+    setReply(davRequest("MOVE", path(), req));
+    setupConnections(reply());
+
+    if( reply()->error() != QNetworkReply::NoError ) {
+        qWarning() << Q_FUNC_INFO << " Network error: " << reply()->errorString();
+    }
+    AbstractNetworkJob::start();
+}
+
+void CopyJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader("Destination", Account::concatUrlPath(account()->davUrl(), _destination).toEncoded());
+    req.setRawHeader("Overwrite", "F");
+    req.setRawHeader("If-Match", '"' + _sourceEtag + '"');
+    setReply(davRequest("COPY", path(), req));
+    setupConnections(reply());
+
+    if( reply()->error() != QNetworkReply::NoError ) {
+        qWarning() << Q_FUNC_INFO << " Network error: " << reply()->errorString();
+    }
+    AbstractNetworkJob::start();
+}
+
+void PropagateRemoteRemoveQNAM::start()
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    qDebug() << Q_FUNC_INFO << _item._file;
+    _job = new DeleteJob(AccountManager::instance()->account(), _propagator->_remoteFolder + _item._file, this);
+    _job->setTimeout(_propagator->httpTimeout() * 1000);
+    connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotDeleteJobFinished()));
+    emit progress(_item, 0);
+    _job->start();
+}
+
+void PropagateRemoteRemoveQNAM::abort()
 {
     if (_job &&  _job->reply())
         _job->reply()->abort();
 }
 
+void PropagateRemoteRemoveQNAM::slotDeleteJobFinished()
+{
+    DeleteJob *job = qobject_cast<DeleteJob *>(sender());
+    Q_ASSERT(job);
+
+    QNetworkReply::NetworkError err = job->reply()->error();
+    _item._httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    /* Ignore the error 404,  it means it is already deleted */
+    if (err != QNetworkReply::NoError && _item._httpErrorCode != 404) {
+        if( checkForProblemsWithShared(_item._httpErrorCode,
+                tr("The file has been removed from a read only share. It was restored.")) ) {
+            return;
+        }
+        done(classifyError(err, _item._httpErrorCode), job->reply()->errorString());
+        return;
+    }
+
+    _item._responseTimeStamp = job->responseTimestamp();
+    _propagator->_journal->deleteFileRecord(_item._originalFile, _item._isDirectory);
+    _propagator->_journal->commit("Remote Remove");
+    done(SyncFileItem::Success);
+}
+
+void PropagateRemoteMkdirQNAM::start()
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    qDebug() << Q_FUNC_INFO << _item._file;
+    MkColJob *job = new MkColJob(AccountManager::instance()->account(), _propagator->_remoteFolder + _item._file, this);
+    job->setTimeout(_propagator->httpTimeout() * 1000);
+    connect(job, SIGNAL(finished(QNetworkReply::NetworkError)), this, SLOT(slotMkcolJobFinished()));
+    _job = job;
+    job->start();
+}
+
+void PropagateRemoteMkdirQNAM::abort()
+{
+    if (_job &&  _job->reply())
+        _job->reply()->abort();
+}
+
+void PropagateRemoteMkdirQNAM::slotMkcolJobFinished()
+{
+    MkColJob *job = qobject_cast<MkColJob *>(sender());
+    Q_ASSERT(job);
+
+    QNetworkReply::NetworkError err = job->reply()->error();
+    _item._httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    _item._responseTimeStamp = job->responseTimestamp();
+
+    /* Special for mkcol: it returns 405 if the directory already exists.
+     * Ignore that error */
+    if (err != QNetworkReply::NoError && _item._httpErrorCode != 405) {
+        done(classifyError(err, _item._httpErrorCode), job->reply()->errorString());
+        return;
+    }
+
+    _item._fileId = job->reply()->rawHeader("OC-FileId");
+    if (_item._fileId.isEmpty()) {
+        // Owncloud 7.0.0 and before did not have a header with the file id.
+        // (https://github.com/owncloud/core/issues/9000)
+        // So we must get the file id using a PROPFIND
+        // This is required so that wa can detect moves even if the folder is renamed on the server
+        // while files are still uploading
+        PropfindJob *propfindJob = new PropfindJob(AccountManager::instance()->account(),
+                                                   _propagator->_remoteFolder + _item._file, this);
+        propfindJob->setProperties(QList<QByteArray>() << "getetag" << "http://owncloud.org/ns:id");
+        propfindJob->setTimeout(_propagator->httpTimeout() * 1000);
+        connect(propfindJob, SIGNAL(result(QVariantMap)), this, SLOT(slotPropfindResult(QVariantMap)));
+        connect(propfindJob, SIGNAL(finishedWithError()), this, SLOT(slotPropfindError()));
+        _job = propfindJob;
+        propfindJob->start();
+        return;
+    }
+    qDebug() << "MKCOL: " << _item._file << " FileID from header:" << _item._fileId;
+    done(SyncFileItem::Success);
+}
+
+void PropagateRemoteMkdirQNAM::slotPropfindResult(const QVariantMap &values)
+{
+    _item._etag = parseEtag(values.value("getetag").toByteArray());
+    QByteArray fileId = values.value("id").toByteArray();
+    if (!fileId.isEmpty()) {
+        _item._fileId = fileId;
+        qDebug() << "MKCOL: " << _item._file << " FileID set it to " << fileId;
+
+        // save the file id already so we can detect rename
+        SyncJournalFileRecord record(_item, _propagator->_localDir + _item._renameTarget);
+        _propagator->_journal->setFileRecord(record);
+    }
+    done(SyncFileItem::Success);
+}
+
+void PropagateRemoteMkdirQNAM::slotPropfindError()
+{
+    // The directory was created, we just don't know its file id yet.
+    done(SyncFileItem::Success);
+}
+
+void PropagateRemoteRenameQNAM::start()
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    if (_item._file == _item._renameTarget) {
+        // The parents has been renamed already so there is nothing more to do.
+        finalize();
+        return;
+    } else if (_item._file == QLatin1String("Shared") ) {
+        // Check if it is the toplevel Shared folder and do not propagate it.
+        if( QFile::rename(  _propagator->_localDir + _item._renameTarget, _propagator->_localDir + QLatin1String("Shared")) ) {
+            done(SyncFileItem::NormalError, tr("This folder must not be renamed. It is renamed back to its original name."));
+        } else {
+            done(SyncFileItem::NormalError, tr("This folder must not be renamed. Please name it back to Shared."));
+        }
+        return;
+    }
+
+    emit progress(_item, 0);
+    qDebug() << "MOVE on Server: " << _item._file << "->" << _item._renameTarget;
+    MoveJob *job = new MoveJob(AccountManager::instance()->account(), _propagator->_remoteFolder + _item._file,
+                               _propagator->_remoteFolder + _item._renameTarget, this);
+    job->setTimeout(_propagator->httpTimeout() * 1000);
+    connect(job, SIGNAL(finishedSignal()), this, SLOT(slotMoveJobFinished()));
+    _job = job;
+    job->start();
+}
+
+void PropagateRemoteRenameQNAM::abort()
+{
+    if (_job &&  _job->reply())
+        _job->reply()->abort();
+}
+
+void PropagateRemoteRenameQNAM::slotMoveJobFinished()
+{
+    MoveJob *job = qobject_cast<MoveJob *>(sender());
+    Q_ASSERT(job);
+
+    QNetworkReply::NetworkError err = job->reply()->error();
+    _item._httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    if (err != QNetworkReply::NoError) {
+        if( checkForProblemsWithShared(_item._httpErrorCode,
+                tr("The file was renamed but is part of a read only share. The original file was restored."))) {
+            return;
+        }
+        done(classifyError(err, _item._httpErrorCode), job->reply()->errorString());
+        return;
+    }
+    _item._responseTimeStamp = job->responseTimestamp();
+
+    // The server keeps the modification time when moving, but we need the new etag.
+    PropfindJob *propfindJob = new PropfindJob(AccountManager::instance()->account(),
+                                               _propagator->_remoteFolder + _item._renameTarget, this);
+    propfindJob->setProperties(QList<QByteArray>() << "getetag");
+    propfindJob->setTimeout(_propagator->httpTimeout() * 1000);
+    connect(propfindJob, SIGNAL(result(QVariantMap)), this, SLOT(slotPropfindResult(QVariantMap)));
+    connect(propfindJob, SIGNAL(finishedWithError()), this, SLOT(slotPropfindError()));
+    _job = propfindJob;
+    propfindJob->start();
+}
+
+void PropagateRemoteRenameQNAM::slotPropfindResult(const QVariantMap &values)
+{
+    QByteArray etag = parseEtag(values.value("getetag").toByteArray());
+    if (!etag.isEmpty()) {
+        _item._etag = etag;
+    }
+    finalize();
+}
+
+void PropagateRemoteRenameQNAM::slotPropfindError()
+{
+    PropfindJob *job = qobject_cast<PropfindJob *>(sender());
+    Q_ASSERT(job);
+    QNetworkReply::NetworkError err = job->reply()->error();
+    if (err == QNetworkReply::NoError) {
+        // Not a multistatus, but no error either: keep the previous etag
+        finalize();
+        return;
+    }
+    _item._httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    done(classifyError(err, _item._httpErrorCode), job->reply()->errorString());
+}
+
+void PropagateRemoteRenameQNAM::finalize()
+{
+    _item._contentChecksum = _propagator->_journal->getFileRecord(_item._originalFile)._contentChecksum;
+    _propagator->_journal->deleteFileRecord(_item._originalFile);
+    SyncJournalFileRecord record(_item, _propagator->_localDir + _item._renameTarget);
+    record._path = _item._renameTarget;
+
+    _propagator->_journal->setFileRecord(record);
+    _propagator->_journal->commit("Remote Rename");
+    done(SyncFileItem::Success);
+}
+
 }
@@ -18,6 +18,9 @@
 #include "owncloudpropagator.h"
 #include "owncloudpropagator_p.h"
 #include "networkjobs.h"
+#include "checksums.h"
+#include "deltadownload.h"
+#include "syncjournaldb.h"
 
 #include <QBuffer>
 #include <QFile>
@@ -80,6 +83,30 @@ signals:
     void uploadProgress(qint64,qint64);
 };
 
+/**
+ * @brief WebDAV COPY of a file, on the condition that the source still has the etag \a sourceEtag
+ */
+class CopyJob : public AbstractNetworkJob {
+    Q_OBJECT
+    const QString _destination; // relative to the dav url
+    const QByteArray _sourceEtag;
+public:
+    explicit CopyJob(Account* account, const QString& path, const QString &destination,
+                     const QByteArray &sourceEtag, QObject* parent = 0)
+        : AbstractNetworkJob(account, path, parent), _destination(destination), _sourceEtag(sourceEtag) {}
+
+    virtual void start() Q_DECL_OVERRIDE;
+    virtual bool finished() Q_DECL_OVERRIDE {
+        emit finishedSignal();
+        return true;
+    }
+
+signals:
+    void finishedSignal();
+};
+
+
+struct ChunkDevice;
 
 class PropagateUploadFileQNAM : public PropagateItemJob {
     Q_OBJECT
@@ -90,9 +117,18 @@ class PropagateUploadFileQNAM : public PropagateItemJob {
     int _chunkCount;
     int _transferId;
     QElapsedTimer _duration;
+    QScopedPointer<ContentChecksum> _checksum; // of the whole file, computed while it is sent
+    QVector<QByteArray> _chunkHashes; // SHA1 of the chunks sent, stored in the journal at the end
+    SyncJournalDb::ChunkHashes _previousChunkHashes; // of the version on the server
+    bool _chunkReuse; // the unchanged chunks can be taken from the version on the server
+    bool _reusingChunk; // the current request asks the server to reuse the chunk
+    QPointer<ChunkDevice> _chunkDevice; // hashes the chunk being sent, if its hash is not known yet
+    QPointer<ComputeChecksum> _computeChecksum;
+    QPointer<CopyJob> _copyJob;
 public:
     PropagateUploadFileQNAM(OwncloudPropagator* propagator,const SyncFileItem& item)
-        : PropagateItemJob(propagator, item), _startChunk(0), _currentChunk(0), _chunkCount(0), _transferId(0) {}
+        : PropagateItemJob(propagator, item), _startChunk(0), _currentChunk(0), _chunkCount(0), _transferId(0),
+          _chunkReuse(false), _reusingChunk(false) {}
     void start() Q_DECL_OVERRIDE;
 private slots:
     void slotPutFinished();
@@ -100,6 +136,12 @@ private slots:
     void abort() Q_DECL_OVERRIDE;
     void startNextChunk();
     void finalize(const SyncFileItem&);
+    void slotLocalChecksumComputed(const QByteArray &checksum);
+    void slotChecksumComputed(const QByteArray &checksum);
+    void slotCopyFinished();
+private:
+    void startTransfer();
+    void startUpload();
 };
 
 
@@ -113,6 +155,15 @@ class GETFileJob : public AbstractNetworkJob {
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
+    QByteArray _readBuffer; // reused by slotReadyRead for every block
+    qint64 _writeCount; // number of write() calls done on the device, for statistics
+    qint64 _bytesWritten;
+    qint64 _bytesSinceSync;
+    bool _pipeliningAllowed;
+    QScopedPointer<ContentChecksum> _checksum; // of what is received
+    QByteArray _remoteChecksum; // as sent by the server in the OC-Checksum header
+    QByteArray _localChecksum;
+    bool _contentUnchanged;
 public:
 
     // DOES NOT take owncership of the device.
@@ -140,6 +191,22 @@ public:
 
     QByteArray &etag() { return _etag; }
     quint64 resumeStart() { return _resumeStart; }
+    qint64 writeCount() const { return _writeCount; }
+    qint64 bytesWritten() const { return _bytesWritten; }
+
+    /** Let QNAM send this request on a connection that still waits for other replies */
+    void setPipeliningAllowed(bool allowed) { _pipeliningAllowed = allowed; }
+
+    /**
+     * Checksum of the file we already have. If the server sends the same checksum, the
+     * download is aborted and contentUnchanged() returns true.
+     */
+    void setLocalChecksum(const QByteArray &checksum) { _localChecksum = checksum; }
+    bool contentUnchanged() const { return _contentUnchanged; }
+
+    QByteArray remoteChecksum() const { return _remoteChecksum; }
+    /** The checksum of the received data, null if checksums are disabled */
+    ContentChecksum *checksum() { return _checksum.data(); }
 
 
 signals:
@@ -154,6 +221,7 @@ private slots:
 class PropagateDownloadFileQNAM : public PropagateItemJob {
     Q_OBJECT
     QPointer<GETFileJob> _job;
+    QPointer<DeltaDownload> _delta;
 
 //  QFile *_file;
     QFile _tmpFile;
@@ -163,13 +231,99 @@ public:
     void start() Q_DECL_OVERRIDE;
 private slots:
     void slotGetFinished();
+    void slotDeltaFinished(bool ok);
+    void slotDeltaProgress(qint64 written);
     void abort() Q_DECL_OVERRIDE;
     void downloadFinished();
     void slotDownloadProgress(qint64,qint64);
+private:
+    void startDownload(quint64 startSize, const QByteArray &expectedEtagForResume);
 
 
 };
 
 
+class DeleteJob : public AbstractNetworkJob {
+    Q_OBJECT
+public:
+    explicit DeleteJob(Account* account, const QString& path, QObject* parent = 0)
+        : AbstractNetworkJob(account, path, parent) {}
+
+    virtual void start() Q_DECL_OVERRIDE;
+    virtual bool finished() Q_DECL_OVERRIDE {
+        emit finishedSignal();
+        return true;
+    }
+
+signals:
+    void finishedSignal();
+};
+
+
+class MoveJob : public AbstractNetworkJob {
+    Q_OBJECT
+    const QString _destination; // relative to the dav url
+public:
+    explicit MoveJob(Account* account, const QString& path, const QString &destination, QObject* parent = 0)
+        : AbstractNetworkJob(account, path, parent), _destination(destination) {}
+
+    virtual void start() Q_DECL_OVERRIDE;
+    virtual bool finished() Q_DECL_OVERRIDE {
+        emit finishedSignal();
+        return true;
+    }
+
+signals:
+    void finishedSignal();
+};
+
+
+/*
+ * The QNAM counterparts of PropagateRemoteRemove, PropagateRemoteMkdir and PropagateRemoteRename
+ * They do not block the neon thread, so several of them can run at the same time.
+ */
+class PropagateRemoteRemoveQNAM : public PropagateItemJob {
+    Q_OBJECT
+    QPointer<DeleteJob> _job;
+public:
+    PropagateRemoteRemoveQNAM(OwncloudPropagator* propagator,const SyncFileItem& item)
+        : PropagateItemJob(propagator, item) {}
+    void start() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+private slots:
+    void slotDeleteJobFinished();
+};
+
+class PropagateRemoteMkdirQNAM : public PropagateItemJob {
+    Q_OBJECT
+    QPointer<AbstractNetworkJob> _job;
+public:
+    PropagateRemoteMkdirQNAM(OwncloudPropagator* propagator,const SyncFileItem& item)
+        : PropagateItemJob(propagator, item) {}
+    void start() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+private slots:
+    void slotMkcolJobFinished();
+    void slotPropfindResult(const QVariantMap &values);
+    void slotPropfindError();
+};
+
+class PropagateRemoteRenameQNAM : public PropagateItemJob {
+    Q_OBJECT
+    QPointer<AbstractNetworkJob> _job;
+public:
+    PropagateRemoteRenameQNAM(OwncloudPropagator* propagator,const SyncFileItem& item)
+        : PropagateItemJob(propagator, item) {}
+    void start() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+private slots:
+    void slotMoveJobFinished();
+    void slotPropfindResult(const QVariantMap &values);
+    void slotPropfindError();
+private:
+    void finalize();
+};
+
+
 
 }
@@ -260,6 +260,8 @@ void PropagateLocalRename::start()
         }
     }
 
+    // A rename does not change the content
+    _item._contentChecksum = _propagator->_journal->getFileRecord(_item._originalFile)._contentChecksum;
     _propagator->_journal->deleteFileRecord(_item._originalFile);
 
     // store the rename file name in the item.
@@ -319,6 +321,7 @@ void PropagateRemoteRename::start()
     QDateTime dt = QDateTime::currentDateTimeUtc();
     _item._responseTimeStamp = dt.toString("hh:mm:ss");
 
+    _item._contentChecksum = _propagator->_journal->getFileRecord(_item._originalFile)._contentChecksum;
     _propagator->_journal->deleteFileRecord(_item._originalFile);
     SyncJournalFileRecord record(_item, _propagator->_localDir + _item._renameTarget);
     record._path = _item._renameTarget;
@@ -97,7 +97,6 @@ public:
 private:
     static void propfind_results(void *userdata, const ne_uri *uri, const ne_prop_result_set *set);
     static void post_headers(ne_request *req, void *userdata, const ne_status *status);
-    friend class PropagateDirectory; // So it can access the _item;
 };
 class PropagateLocalRename : public PropagateItemJob {
     Q_OBJECT
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "remotechangenotifier.h"
+#include "account.h"
+#include "connectionmanager.h"
+#include "owncloudpropagator_p.h"
+#include "creds/abstractcredentials.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkCookieJar>
+#include <QNetworkReply>
+#include <QDebug>
+
+namespace Mirall {
+
+// After the server said it does not know the endpoint, or when failing again and again
+static const int maxRetryInterval = 30 * 60 * 1000;
+
+LongPollJob::LongPollJob(Account *account, QNetworkAccessManager *accessManager, const QString &path,
+                         const QByteArray &knownEtag, int waitSeconds, QObject *parent)
+    : AbstractNetworkJob(account, path, parent), _accessManager(accessManager)
+    , _knownEtag(knownEtag), _waitSeconds(waitSeconds)
+{
+    // A failing notification must not make the user log in again, the other jobs will
+    setIgnoreCredentialFailure(true);
+}
+
+void LongPollJob::start()
+{
+    QUrl url = Account::concatUrlPath(account()->url(), path());
+    url.setQueryItems(QList<QPair<QString, QString> >()
+                      << qMakePair(QString::fromLatin1("etag"), QString::fromUtf8(_knownEtag))
+                      << qMakePair(QString::fromLatin1("timeout"), QString::number(_waitSeconds)));
+    QNetworkRequest request(url);
+    account()->connectionManager()->prepareRequest(request);
+    setReply(addTimer(_accessManager->get(request)));
+    setupConnections(reply());
+    AbstractNetworkJob::start();
+    // The server holds the request up to _waitSeconds, give it some more
+    setTimeout((_waitSeconds + 30) * 1000);
+}
+
+bool LongPollJob::unsupported() const
+{
+    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return httpCode == 404 || httpCode == 405 || httpCode == 501;
+}
+
+bool LongPollJob::finished()
+{
+    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply()->error() == QNetworkReply::NoError && httpCode == 200) {
+        QByteArray body = reply()->read(1024).trimmed();
+        // Not an etag, e.g. a login or error page served with 200
+        if (!body.isEmpty() && !body.contains('<') && !body.contains('\n') && !body.contains(' ')) {
+            _etag = parseEtag(body.constData());
+        } else {
+            qDebug() << Q_FUNC_INFO << "unexpected reply" << body.left(100);
+        }
+    }
+    emit finishedSignal();
+    return true;
+}
+
+void LongPollJob::slotTimeout()
+{
+    qDebug() << Q_FUNC_INFO << "no answer after" << _waitSeconds + 30 << "s";
+    if (reply()->isRunning()) {
+        reply()->abort();
+    }
+}
+
+/*********************************************************************************************/
+
+RemoteChangeNotifier::RemoteChangeNotifier(QObject *parent)
+    : QObject(parent)
+    , _path(configuredPath())
+    , _waitSeconds(qgetenv("OWNCLOUD_LONGPOLL_TIMEOUT").toInt())
+    , _retryInterval(10 * 1000)
+    , _failures(0)
+    , _accessManager(0)
+    , _active(false)
+    , _running(false)
+{
+    if (_waitSeconds <= 0) {
+        _waitSeconds = 60;
+    }
+    _retryTimer.setSingleShot(true);
+    connect(&_retryTimer, SIGNAL(timeout()), this, SLOT(sendRequest()));
+}
+
+QString RemoteChangeNotifier::configuredPath()
+{
+    static QString path = QString::fromUtf8(qgetenv("OWNCLOUD_LONGPOLL_PATH"));
+    return path;
+}
+
+void RemoteChangeNotifier::start(Account *account)
+{
+    if (_running && _account == account) {
+        return;
+    }
+    stop();
+    if (!account || _path.isEmpty()) {
+        return;
+    }
+    qDebug() << Q_FUNC_INFO << "waiting for changes on" << _path;
+    _account = account;
+    _etag.clear();
+    _failures = 0;
+    _running = true;
+    sendRequest();
+}
+
+void RemoteChangeNotifier::stop()
+{
+    _running = false;
+    _retryTimer.stop();
+    if (_job && _job->reply()) {
+        // slotJobFinished ignores it as we are no longer running
+        _job->reply()->abort();
+    }
+    _job = 0;
+    setActive(false);
+}
+
+void RemoteChangeNotifier::sendRequest()
+{
+    if (!_running || !_account) {
+        return;
+    }
+    _job = new LongPollJob(_account, accessManager(), _path, _etag, _waitSeconds, this);
+    connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotJobFinished()));
+    _job->start();
+}
+
+QNetworkAccessManager *RemoteChangeNotifier::accessManager()
+{
+    AbstractCredentials *credentials = _account->credentials();
+    if (!_accessManager || _accessManagerCredentials != credentials) {
+        // made by credentials that were replaced since
+        if (_accessManager) {
+            _accessManager->deleteLater();
+        }
+        _accessManager = credentials->getQNAM();
+        _accessManager->setParent(this);
+        _accessManagerCredentials = credentials;
+        connect(_accessManager, SIGNAL(sslErrors(QNetworkReply*,QList<QSslError>)),
+                _account, SLOT(slotHandleErrors(QNetworkReply*,QList<QSslError>)));
+    }
+    _accessManager->cookieJar()->setCookiesFromUrl(_account->lastAuthCookies(), _account->url());
+    return _accessManager;
+}
+
+void RemoteChangeNotifier::slotJobFinished()
+{
+    LongPollJob *job = qobject_cast<LongPollJob *>(sender());
+    if (!_running || !job || job != _job) {
+        return;
+    }
+    _job = 0;
+
+    const QByteArray etag = job->etag();
+    if (job->unsupported()) {
+        qDebug() << Q_FUNC_INFO << "the server does not support change notifications";
+        retryLater(true);
+        return;
+    }
+    if (etag.isEmpty()) {
+        retryLater(false);
+        return;
+    }
+    if (etag == _etag && job->duration() < quint64(_waitSeconds) * 500) {
+        // The server does not hold the request, that would be worse than polling
+        qDebug() << Q_FUNC_INFO << "the server answered after" << job->duration() << "ms without change";
+        retryLater(true);
+        return;
+    }
+
+    _failures = 0;
+    const bool changed = !_etag.isEmpty() && etag != _etag;
+    _etag = etag;
+    setActive(true);
+    if (changed) {
+        qDebug() << Q_FUNC_INFO << "remote change notified, etag" << etag;
+        emit remoteChanged();
+    }
+    sendRequest();
+}
+
+void RemoteChangeNotifier::retryLater(bool unsupported)
+{
+    setActive(false);
+    ++_failures;
+    int delay = unsupported ? maxRetryInterval
+                            : qMin(_retryInterval << qMin(_failures - 1, 10), maxRetryInterval);
+    qDebug() << Q_FUNC_INFO << "trying again in" << delay << "ms";
+    _retryTimer.start(delay);
+}
+
+void RemoteChangeNotifier::setActive(bool active)
+{
+    if (_active != active) {
+        _active = active;
+        qDebug() << Q_FUNC_INFO << "change notifications" << (active ? "active" : "inactive");
+        emit activeChanged(active);
+    }
+}
+
+}
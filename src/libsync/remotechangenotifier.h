@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "networkjobs.h"
+
+#include <QPointer>
+#include <QTimer>
+
+class QNetworkAccessManager;
+
+namespace Mirall {
+
+class Account;
+class AbstractCredentials;
+
+/**
+ * @brief One long poll request, see RemoteChangeNotifier
+ */
+class OWNCLOUDSYNC_EXPORT LongPollJob : public AbstractNetworkJob {
+    Q_OBJECT
+    QPointer<QNetworkAccessManager> _accessManager;
+    QByteArray _knownEtag;
+    int _waitSeconds;
+    QByteArray _etag;
+public:
+    /** The request is sent with \a accessManager rather than with the account's one */
+    explicit LongPollJob(Account *account, QNetworkAccessManager *accessManager, const QString &path,
+                         const QByteArray &knownEtag, int waitSeconds, QObject *parent = 0);
+
+    void start() Q_DECL_OVERRIDE;
+
+    /** The etag of the storage sent by the server, empty if the request failed */
+    QByteArray etag() const { return _etag; }
+
+    /** The server does not know the endpoint */
+    bool unsupported() const;
+
+signals:
+    void finishedSignal();
+
+private slots:
+    virtual bool finished() Q_DECL_OVERRIDE;
+    virtual void slotTimeout() Q_DECL_OVERRIDE;
+};
+
+/**
+ * @brief Waits for changes of the user's storage with long poll requests
+ *
+ * The endpoint is queried with GET <path>?etag=<last etag>&timeout=<seconds>, the path being
+ * relative to the account url. The server answers as soon as the etag of the user's storage
+ * differs from the one sent, or when the timeout is over, with the current etag as text body.
+ * remoteChanged() is emitted for every new etag and the next request is sent right away.
+ *
+ * While the server answers like that, isActive() is true and the folders can poll less often.
+ * If the endpoint is unknown or a request fails, the notifier becomes inactive so the folders
+ * go back to polling, and it tries again later.
+ *
+ * The requests go through an access manager of the notifier, made by the account's credentials
+ * and given the account's authentication cookies. QNAM opens at most 6 connections per server;
+ * a request held by the server on the account's access manager would take one of them from the
+ * sync jobs for the whole wait.
+ */
+class OWNCLOUDSYNC_EXPORT RemoteChangeNotifier : public QObject {
+    Q_OBJECT
+public:
+    explicit RemoteChangeNotifier(QObject *parent = 0);
+
+    /**
+     * The endpoint set in the OWNCLOUD_LONGPOLL_PATH environment variable.
+     * Empty if not set, the notifier is then never started.
+     */
+    static QString configuredPath();
+
+    void setPath(const QString &path) { _path = path; }
+    QString path() const { return _path; }
+
+    /** How long the server may hold a request, in seconds. OWNCLOUD_LONGPOLL_TIMEOUT, default 60 */
+    void setWaitSeconds(int seconds) { _waitSeconds = seconds; }
+
+    /** Delay before retrying after the first failure, in msec. Doubled for each further failure */
+    void setRetryInterval(int msec) { _retryInterval = msec; }
+
+    bool isActive() const { return _active; }
+    bool isRunning() const { return _running; }
+
+public slots:
+    /** Start waiting for changes of \a account. Does nothing if it already does */
+    void start(Account *account);
+    void stop();
+
+signals:
+    void remoteChanged();
+    void activeChanged(bool active);
+
+private slots:
+    void slotJobFinished();
+    void sendRequest();
+
+private:
+    void setActive(bool active);
+    void retryLater(bool unsupported);
+    QNetworkAccessManager *accessManager();
+
+    QPointer<Account> _account;
+    QPointer<LongPollJob> _job;
+    QNetworkAccessManager *_accessManager;
+    QPointer<AbstractCredentials> _accessManagerCredentials; // which made _accessManager
+    QString _path;
+    int _waitSeconds;
+    int _retryInterval;
+    int _failures;
+    QTimer _retryTimer;
+    QByteArray _etag;
+    bool _active;
+    bool _running;
+};
+
+}
@@ -15,11 +15,14 @@
 
 #include "syncengine.h"
 #include "account.h"
+#include "connectionmanager.h"
 #include "theme.h"
 #include "owncloudpropagator.h"
 #include "syncjournaldb.h"
 #include "syncjournalfilerecord.h"
 #include "discoveryphase.h"
+#include "syncmetrics.h"
+#include "synctrace.h"
 #include "creds/abstractcredentials.h"
 #include "csync_util.h"
 
@@ -46,15 +49,15 @@
 
 namespace Mirall {
 
-bool SyncEngine::_syncRunning = false;
-
 SyncEngine::SyncEngine(CSYNC *ctx, const QString& localPath, const QString& remoteURL, const QString& remotePath, Mirall::SyncJournalDb* journal)
-  : _csync_ctx(ctx)
+  : _syncRunning(false)
+  , _csync_ctx(ctx)
   , _needsUpdate(false)
   , _localPath(localPath)
   , _remoteUrl(remoteURL)
   , _remotePath(remotePath)
   , _journal(journal)
+  , _discoveryMainThread(0)
   , _hasNoneFiles(false)
   , _hasRemoveFile(false)
   , _uploadLimit(0)
@@ -70,6 +73,10 @@ SyncEngine::SyncEngine(CSYNC *ctx, const QString& localPath, const QString& remo
 
 SyncEngine::~SyncEngine()
 {
+    // The discovery thread may be waiting for a listing
+    if (_discoveryMainThread) {
+        _discoveryMainThread->abort();
+    }
     _thread.quit();
     _thread.wait();
 }
@@ -185,6 +192,23 @@ QString SyncEngine::csyncErrorToString(CSYNC_STATUS err)
 
 }
 
+// Whether OwncloudPropagator::createJob() makes a job that talks to the server for this item
+static bool needsNetworkJob(const SyncFileItem &item)
+{
+    switch (item._instruction) {
+    case CSYNC_INSTRUCTION_REMOVE:
+    case CSYNC_INSTRUCTION_RENAME:
+        return item._direction == SyncFileItem::Up;
+    case CSYNC_INSTRUCTION_NEW:
+        return !item._isDirectory || item._direction == SyncFileItem::Up;
+    case CSYNC_INSTRUCTION_SYNC:
+    case CSYNC_INSTRUCTION_CONFLICT:
+        return !item._isDirectory;
+    default:
+        return false;
+    }
+}
+
 bool SyncEngine::checkBlacklisting( SyncFileItem *item )
 {
     bool re = false;
@@ -443,6 +467,7 @@ void SyncEngine::handleSyncError(CSYNC *ctx, const char *state) {
     if( errStr.contains("owncloud://") ) errStr.replace("owncloud://", "http://");
 
     qDebug() << " #### ERROR during "<< state << ": " << errStr;
+    SyncMetrics::increment("owncloud_sync_errors_total");
 
     if( CSYNC_STATUS_IS_EQUAL( err, CSYNC_STATUS_ABORTED) ) {
         qDebug() << "Update phase was aborted by user!";
@@ -459,6 +484,7 @@ void SyncEngine::startSync()
 {
     Q_ASSERT(!_syncRunning);
     _syncRunning = true;
+    SyncTrace::startRun(this, _localPath);
 
     Q_ASSERT(_csync_ctx);
 
@@ -468,8 +494,10 @@ void SyncEngine::startSync()
 
     csync_resume(_csync_ctx);
 
+    bool recursivePropfind = false;
     if (!_journal->exists()) {
         qDebug() << "=====sync looks new (no DB exists), activating recursive PROPFIND if csync supports it";
+        recursivePropfind = true;
         bool no_recursive_propfind = false;
         csync_set_module_property(_csync_ctx, "no_recursive_propfind", &no_recursive_propfind);
     } else {
@@ -488,6 +516,7 @@ void SyncEngine::startSync()
             // database creation error!
         } else if ( fileRecordCount < 50 ) {
             qDebug() << "=====sync DB has only" << fileRecordCount << "items, enable recursive PROPFIND if csync supports it";
+            recursivePropfind = true;
             bool no_recursive_propfind = false;
             csync_set_module_property(_csync_ctx, "no_recursive_propfind", &no_recursive_propfind);
         } else {
@@ -536,7 +565,21 @@ void SyncEngine::startSync()
 
     DiscoveryJob *job = new DiscoveryJob(_csync_ctx);
     job->_selectiveSyncBlackList = _selectiveSyncWhiteList;
+    job->_localDiscoveryPaths = _localDiscoveryPaths;
+    if (!_localDiscoveryPaths.isEmpty()) {
+        qDebug() << "Only walking the local tree in" << _localDiscoveryPaths;
+    }
+    Account *account = AccountManager::instance()->account();
+    if (account && DiscoveryMainThread::isEnabled()) {
+        // List the remote directories with the account's QNAM instead of neon
+        int propfindWindow = DiscoveryJob::propfindWindow();
+        qDebug() << "Listing up to" << propfindWindow << "remote folders at the same time";
+        _discoveryMainThread = new DiscoveryMainThread(account, _remotePath, propfindWindow, this);
+        _discoveryMainThread->setListRootRecursively(recursivePropfind);
+        job->_vioMainThread = _discoveryMainThread;
+    }
     job->moveToThread(&_thread);
+    SyncTrace::asyncBegin("discovery", QLatin1String("discovery"), this);
     connect(job, SIGNAL(finished(int)), this, SLOT(slotDiscoveryJobFinished(int)));
     connect(job, SIGNAL(folderDiscovered(bool,QString)),
             this, SIGNAL(folderDiscovered(bool,QString)));
@@ -545,6 +588,13 @@ void SyncEngine::startSync()
 
 void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
 {
+    SyncTrace::asyncEnd("discovery", QLatin1String("discovery"), this,
+                        SyncTrace::Args() << qMakePair(QByteArray("result"), QVariant(discoveryResult)));
+
+    // The discovery thread is done with it
+    delete _discoveryMainThread;
+    _discoveryMainThread = 0;
+
     // To clean the progress info
     emit folderDiscovered(false, QString());
 
@@ -554,10 +604,16 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     }
     qDebug() << "<<#### Discovery end #################################################### " << _stopWatch.addLapTime(QLatin1String("Discovery Finished"));
 
+    const qint64 reconcileStart = SyncTrace::now();
     if( csync_reconcile(_csync_ctx) < 0 ) {
         handleSyncError(_csync_ctx, "csync_reconcile");
         return;
     }
+    SyncTrace::complete("reconcile", QLatin1String("csync_reconcile"), reconcileStart);
+    SyncMetrics::observe("owncloud_reconcile_duration_seconds", qint64(_csync_ctx->local.reconcile_time * 1e6),
+                         "replica=\"local\"");
+    SyncMetrics::observe("owncloud_reconcile_duration_seconds", qint64(_csync_ctx->remote.reconcile_time * 1e6),
+                         "replica=\"remote\"");
 
     _stopWatch.addLapTime(QLatin1String("Reconcile Finished"));
 
@@ -635,6 +691,27 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // do a database commit
     _journal->commit("post treewalk");
 
+    // Open the connections the propagation is going to use while it gets ready
+    int networkItems = 0;
+    QString removedDirectory;
+    foreach (const SyncFileItem &item, _syncedItems) {
+        if (!removedDirectory.isEmpty() && item._file.startsWith(removedDirectory)) {
+            // taken care of by the removal of the directory
+            continue;
+        }
+        if (item._isDirectory && item._instruction == CSYNC_INSTRUCTION_REMOVE) {
+            removedDirectory = item._file + QLatin1Char('/');
+        }
+        if (needsNetworkJob(item)) {
+            ++networkItems;
+        }
+    }
+    Account *account = AccountManager::instance()->account();
+    if (account && networkItems > 1) {
+        account->connectionManager()->warmUp(Account::concatUrlPath(account->url(), QLatin1String("status.php")),
+                                             qMin(networkItems, OwncloudPropagator::maximumParallelRequests()));
+    }
+
     _propagator.reset(new OwncloudPropagator (session, _localPath, _remoteUrl, _remotePath,
                                               _journal, &_thread));
     connect(_propagator.data(), SIGNAL(completed(SyncFileItem)),
@@ -647,6 +724,8 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // apply the network limits to the propagator
     setNetworkLimits(_uploadLimit, _downloadLimit);
 
+    SyncTrace::asyncBegin("propagation", QLatin1String("propagation"), this,
+                          SyncTrace::Args() << qMakePair(QByteArray("items"), QVariant(_syncedItems.count())));
     _propagator->start(_syncedItems);
 }
 
@@ -706,6 +785,17 @@ void SyncEngine::slotJobCompleted(const SyncFileItem &item)
 
 void SyncEngine::slotFinished()
 {
+    SyncTrace::asyncEnd("propagation", QLatin1String("propagation"), this);
+
+    const qint64 propagationMsec = _stopWatch.addLapTime(QLatin1String("Propagation Finished"))
+            - _stopWatch.durationOfLap(QLatin1String("Reconcile Finished"));
+    if (propagationMsec > 0) {
+        SyncMetrics::setGauge("owncloud_sync_items_per_second",
+                              _progressInfo._completedFileCount * 1000 / propagationMsec);
+        SyncMetrics::setGauge("owncloud_sync_bytes_per_second",
+                              _progressInfo._completedSize * 1000 / propagationMsec);
+    }
+
     // emit the treewalk results.
     if( ! _journal->postSyncCleanup( _seenFiles ) ) {
         qDebug() << "Cleaning of synced ";
@@ -722,8 +812,19 @@ void SyncEngine::finalize()
     _thread.wait();
     csync_commit(_csync_ctx);
 
-    qDebug() << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished"));
+    const quint64 syncMsec = _stopWatch.addLapTime(QLatin1String("Sync Finished"));
+    qDebug() << "CSync run took " << syncMsec;
+    SyncMetrics::increment("owncloud_sync_runs_total");
+    SyncMetrics::observe("owncloud_sync_duration_seconds", syncMsec * 1000);
     _stopWatch.stop();
+    SyncTrace::finishRun(this, SyncTrace::Args() << qMakePair(QByteArray("items"), QVariant(_syncedItems.count())));
+
+    if (Account *account = AccountManager::instance()->account()) {
+        // The folders of the account sync in parallel on the same connections: no share of them is ours
+        ConnectionManager::Stats stats = account->connectionManager()->stats();
+        qDebug() << "Connections of the account so far:" << stats.requests << "requests," << stats.handshakes
+                 << "TLS handshakes, reuse ratio" << stats.reuseRatio();
+    }
 
     _propagator.reset(0);
     _syncRunning = false;
@@ -955,6 +1056,8 @@ QByteArray SyncEngine::getPermissions(const QString& file) const
 void SyncEngine::abort()
 {
     csync_request_abort(_csync_ctx);
+    if (_discoveryMainThread)
+        _discoveryMainThread->abort();
     if(_propagator)
         _propagator->abort();
 }
@@ -44,6 +44,8 @@ class SyncJournalDb;
 
 class OwncloudPropagator;
 
+class DiscoveryMainThread;
+
 class OWNCLOUDSYNC_EXPORT SyncEngine : public QObject
 {
     Q_OBJECT
@@ -64,6 +66,14 @@ public:
     void setSelectiveSyncBlackList(const QStringList &list)
     { _selectiveSyncWhiteList = list; }
 
+    /**
+     * Restrict the walk of the local tree to these paths for the next sync. The rest
+     * of the local tree is assumed to be unchanged since the last sync and is read
+     * from the journal. An empty list (the default) walks everything.
+     */
+    void setLocalDiscoveryPaths(const QStringList &paths)
+    { _localDiscoveryPaths = paths; }
+
 signals:
     void csyncError( const QString& );
     void csyncUnavailable();
@@ -110,7 +120,7 @@ private:
     // cleanup and emit the finished signal
     void finalize();
 
-    static bool _syncRunning; //true when one sync is running somewhere (for debugging)
+    bool _syncRunning; //true while this engine syncs; the engines of other folders may run at the same time (for debugging)
     QMap<QString, SyncFileItem> _syncItemMap;
     SyncFileItemVector _syncedItems;
 
@@ -124,6 +134,8 @@ private:
     QString _lastDeleted; // if the last item was a path and it has been deleted
     QSet<QString> _seenFiles;
     QThread _thread;
+    // Lists the remote directories for the discovery thread, while it runs
+    DiscoveryMainThread *_discoveryMainThread;
 
     Progress::Info _progressInfo;
 
@@ -150,6 +162,7 @@ private:
     QHash<QString, QByteArray> _remotePerms;
 
     QStringList _selectiveSyncWhiteList;
+    QStringList _localDiscoveryPaths;
 };
 
 }
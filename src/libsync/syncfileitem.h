@@ -89,6 +89,7 @@ public:
     bool                 _should_update_etag;
     QByteArray           _fileId;
     QByteArray           _remotePerm;
+    QByteArray           _contentChecksum; // "<type>:<value>", see ContentChecksum
     QString              _directDownloadUrl;
     QString              _directDownloadCookies;
     bool                 _blacklistedInDb;
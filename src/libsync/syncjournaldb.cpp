@@ -16,6 +16,7 @@
 #include <QDebug>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QElapsedTimer>
 
 #include <inttypes.h>
 
@@ -23,6 +24,8 @@
 #include "syncjournalfilerecord.h"
 #include "utility.h"
 #include "version.h"
+#include "syncmetrics.h"
+#include "synctrace.h"
 
 #include "../../csync/src/std/c_jhash.h"
 
@@ -57,6 +60,7 @@ void SyncJournalDb::startTransaction()
             return;
         }
         _transaction = 1;
+        SyncTrace::asyncBegin("journal", QLatin1String("transaction"), this);
         // qDebug() << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX Transaction start!";
     } else {
         qDebug() << "Database Transaction is running, do not starting another one!";
@@ -66,10 +70,22 @@ void SyncJournalDb::startTransaction()
 void SyncJournalDb::commitTransaction()
 {
     if( _transaction == 1 ) {
+        const qint64 traceStart = SyncTrace::now();
+        QElapsedTimer commitTimer;
+        commitTimer.start();
         if( ! _db.commit() ) {
             qDebug() << "ERROR committing to the database: " << _db.lastError().text();
+            // The transaction is still open, the next commit tries again: so does its span
+            const SyncTrace::Args args = SyncTrace::Args()
+                    << qMakePair(QByteArray("error"), QVariant(_db.lastError().text()));
+            SyncTrace::complete("journal", QLatin1String("commit"), traceStart, args);
+            SyncTrace::asyncEnd("journal", QLatin1String("transaction"), this, args);
+            SyncTrace::asyncBegin("journal", QLatin1String("transaction"), this);
             return;
         }
+        SyncMetrics::observe("owncloud_journal_commit_duration_seconds", commitTimer.nsecsElapsed() / 1000);
+        SyncTrace::complete("journal", QLatin1String("commit"), traceStart);
+        SyncTrace::asyncEnd("journal", QLatin1String("transaction"), this);
         _transaction = 0;
         // qDebug() << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX Transaction END!";
     } else {
@@ -181,6 +197,18 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table uploadinfo", createQuery);
     }
 
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS chunkhashes("
+                           "path VARCHAR(4096),"
+                           "etag VARCHAR(32),"
+                           "chunksize INTEGER(8),"
+                           "hashes BLOB," // the raw SHA1 of the chunks, one after the other
+                           "PRIMARY KEY(path)"
+                           ");");
+
+    if (!createQuery.exec()) {
+        return sqlFail("Create table chunkhashes", createQuery);
+    }
+
     // create the blacklist table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS blacklist ("
                         "path VARCHAR(4096),"
@@ -229,13 +257,13 @@ bool SyncJournalDb::checkConnect()
     bool rc = updateDatabaseStructure();
 
     _getFileRecordQuery.reset(new QSqlQuery(_db));
-    _getFileRecordQuery->prepare("SELECT path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm FROM "
+    _getFileRecordQuery->prepare("SELECT path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, contentChecksum, filesize FROM "
                                  "metadata WHERE phash=:ph" );
 
     _setFileRecordQuery.reset(new QSqlQuery(_db) );
     _setFileRecordQuery->prepare("INSERT OR REPLACE INTO metadata "
-                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm) "
-                                 "VALUES ( ? , ?, ? , ? , ? , ? , ?,  ? , ? , ?, ?, ? )" );
+                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, contentChecksum, filesize) "
+                                 "VALUES ( ? , ?, ? , ? , ? , ? , ?,  ? , ? , ?, ?, ?, ?, ? )" );
 
     _getDownloadInfoQuery.reset(new QSqlQuery(_db) );
     _getDownloadInfoQuery->prepare( "SELECT tmpfile, etag, errorcount FROM "
@@ -337,6 +365,37 @@ bool SyncJournalDb::updateDatabaseStructure()
         }
         commitInternal("update database structure (remotePerm");
     }
+    if( columns.indexOf(QLatin1String("contentChecksum")) == -1 ) {
+
+        QSqlQuery query(_db);
+        query.prepare("ALTER TABLE metadata ADD COLUMN contentChecksum VARCHAR(128);");
+        re = re && query.exec();
+        if(!re) {
+            qDebug() << Q_FUNC_INFO << "SQL Error " << query.lastError().text();
+        }
+        commitInternal("update database structure (contentChecksum");
+    }
+    if( columns.indexOf(QLatin1String("filesize")) == -1 ) {
+
+        QSqlQuery query(_db);
+        query.prepare("ALTER TABLE metadata ADD COLUMN filesize INTEGER(8);");
+        re = re && query.exec();
+        if(!re) {
+            qDebug() << Q_FUNC_INFO << "SQL Error " << query.lastError().text();
+        }
+        commitInternal("update database structure (filesize");
+    }
+
+    if( 1 ) {
+        QSqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_filesize ON metadata(filesize);");
+        re = re && query.exec();
+
+        if(!re) {
+            qDebug() << Q_FUNC_INFO << "SQL Error " << query.lastError().text();
+        }
+        commitInternal("update database structure: add filesize index");
+    }
 
     if( 1 ) {
         QSqlQuery query(_db);
@@ -433,6 +492,8 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
         if( fileId.isEmpty() ) fileId = "";
         QString remotePerm (record._remotePerm);
         if (remotePerm.isEmpty()) remotePerm = QString(); // have NULL in DB (vs empty)
+        QString contentChecksum (record._contentChecksum);
+        if (contentChecksum.isEmpty()) contentChecksum = QString();
 
         _setFileRecordQuery->bindValue(0, QString::number(phash));
         _setFileRecordQuery->bindValue(1, plen);
@@ -446,6 +507,8 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
         _setFileRecordQuery->bindValue(9, etag );
         _setFileRecordQuery->bindValue(10, fileId );
         _setFileRecordQuery->bindValue(11, remotePerm );
+        _setFileRecordQuery->bindValue(12, contentChecksum );
+        _setFileRecordQuery->bindValue(13, record._fileSize );
 
         if( !_setFileRecordQuery->exec() ) {
             qWarning() << "Error SQL statement setFileRecord: " << _setFileRecordQuery->lastQuery() <<  " :"
@@ -456,7 +519,7 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
         qDebug() <<  _setFileRecordQuery->lastQuery() << phash << plen << record._path << record._inode
                  << record._mode
                  << QString::number(Utility::qDateTimeToTime_t(record._modtime)) << QString::number(record._type)
-                 << record._etag << record._fileId << record._remotePerm;
+                 << record._etag << record._fileId << record._remotePerm << record._contentChecksum;
         _setFileRecordQuery->finish();
 
         return true;
@@ -532,6 +595,8 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord( const QString& filename )
             rec._etag    = _getFileRecordQuery->value(7).toByteArray();
             rec._fileId  = _getFileRecordQuery->value(8).toByteArray();
             rec._remotePerm = _getFileRecordQuery->value(9).toByteArray();
+            rec._contentChecksum = _getFileRecordQuery->value(10).toByteArray();
+            rec._fileSize = _getFileRecordQuery->value(11).toULongLong(&ok);
 
             _getFileRecordQuery->finish();
         } else {
@@ -542,6 +607,47 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord( const QString& filename )
     return rec;
 }
 
+bool SyncJournalDb::hasFileRecordOfSize(quint64 size)
+{
+    QMutexLocker locker(&_mutex);
+
+    if( !checkConnect() ) {
+        return false;
+    }
+
+    QSqlQuery query(_db);
+    query.prepare("SELECT 1 FROM metadata WHERE filesize=? LIMIT 1");
+    query.bindValue(0, size);
+    if( !query.exec() ) {
+        qDebug() << Q_FUNC_INFO << "SQL error: " << query.lastError().text();
+        return false;
+    }
+    return query.next();
+}
+
+QStringList SyncJournalDb::getFilePathsByContent(quint64 size, const QByteArray &checksum)
+{
+    QMutexLocker locker(&_mutex);
+    QStringList paths;
+
+    if( checksum.isEmpty() || !checkConnect() ) {
+        return paths;
+    }
+
+    QSqlQuery query(_db);
+    query.prepare("SELECT path FROM metadata WHERE filesize=? AND contentChecksum=? AND type=0"); // CSYNC_FTW_TYPE_FILE == 0
+    query.bindValue(0, size);
+    query.bindValue(1, QString::fromLatin1(checksum));
+    if( !query.exec() ) {
+        qDebug() << Q_FUNC_INFO << "SQL error: " << query.lastError().text();
+        return paths;
+    }
+    while( query.next() ) {
+        paths.append(query.value(0).toString());
+    }
+    return paths;
+}
+
 bool SyncJournalDb::postSyncCleanup(const QSet<QString> &items )
 {
     QMutexLocker locker(&_mutex);
@@ -580,6 +686,13 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &items )
             return false;
         }
     }
+
+    // The chunk hashes of the files that are gone
+    QSqlQuery chunkQuery(_db);
+    chunkQuery.prepare("DELETE FROM chunkhashes WHERE path NOT IN (SELECT path FROM metadata)");
+    if( !chunkQuery.exec() ) {
+        qDebug() << "Error removing superfluous chunk hashes: " << chunkQuery.lastError().text();
+    }
     return true;
 }
 
@@ -734,6 +847,64 @@ void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::Uplo
     }
 }
 
+SyncJournalDb::ChunkHashes SyncJournalDb::getChunkHashes(const QString& file)
+{
+    QMutexLocker locker(&_mutex);
+
+    ChunkHashes res;
+
+    if( !checkConnect() ) {
+        return res;
+    }
+
+    QSqlQuery query(_db);
+    query.prepare("SELECT etag, chunksize, hashes FROM chunkhashes WHERE path=?");
+    query.bindValue(0, file);
+    if( !query.exec() ) {
+        qDebug() << Q_FUNC_INFO << "SQL error: " << query.lastError().text();
+        return res;
+    }
+    if( query.next() ) {
+        bool ok = true;
+        res._etag      = query.value(0).toByteArray();
+        res._chunkSize = query.value(1).toLongLong(&ok);
+        const QByteArray hashes = query.value(2).toByteArray();
+        for (int i = 0; i + 20 <= hashes.size(); i += 20) {
+            res._hashes.append(hashes.mid(i, 20));
+        }
+        res._valid = ok && hashes.size() % 20 == 0;
+    }
+    return res;
+}
+
+void SyncJournalDb::setChunkHashes(const QString& file, const SyncJournalDb::ChunkHashes& h)
+{
+    QMutexLocker locker(&_mutex);
+
+    if( !checkConnect() ) {
+        return;
+    }
+
+    QSqlQuery query(_db);
+    if (h._valid) {
+        query.prepare("INSERT OR REPLACE INTO chunkhashes (path, etag, chunksize, hashes) VALUES ( ? , ? , ? , ? )");
+        query.bindValue(0, file);
+        query.bindValue(1, QString::fromUtf8(h._etag));
+        query.bindValue(2, h._chunkSize);
+        QByteArray hashes;
+        foreach (const QByteArray &hash, h._hashes) {
+            hashes += hash;
+        }
+        query.bindValue(3, hashes);
+    } else {
+        query.prepare("DELETE FROM chunkhashes WHERE path=?");
+        query.bindValue(0, file);
+    }
+    if( !query.exec() ) {
+        qWarning() << "Exec error of SQL statement: " << query.lastQuery() << " :" << query.lastError().text();
+    }
+}
+
 SyncJournalBlacklistRecord SyncJournalDb::blacklistEntry( const QString& file )
 {
     QMutexLocker locker(&_mutex);
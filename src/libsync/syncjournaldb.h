@@ -42,6 +42,11 @@ public:
     bool setFileRecord( const SyncJournalFileRecord& record );
     bool deleteFileRecord( const QString& filename, bool recursively = false );
     int getFileRecordCount();
+
+    /** Whether a file of \a size bytes was synced. Cheap, to know if computing a checksum is worth it */
+    bool hasFileRecordOfSize(quint64 size);
+    /** The synced files that have this size and content checksum */
+    QStringList getFilePathsByContent(quint64 size, const QByteArray &checksum);
     bool exists();
 
     void updateBlacklistEntry( const SyncJournalBlacklistRecord& item );
@@ -66,10 +71,22 @@ public:
         bool _valid;
     };
 
+    /* The SHA1 of each chunk of the version of a file that was last uploaded with chunking.
+     * The chunks that did not change since are not sent again. */
+    struct ChunkHashes {
+        ChunkHashes() : _chunkSize(0), _valid(false) {}
+        QByteArray _etag; // of the uploaded version
+        qint64 _chunkSize;
+        QList<QByteArray> _hashes;
+        bool _valid;
+    };
+
     DownloadInfo getDownloadInfo(const QString &file);
     void setDownloadInfo(const QString &file, const DownloadInfo &i);
     UploadInfo getUploadInfo(const QString &file);
     void setUploadInfo(const QString &file, const UploadInfo &i);
+    ChunkHashes getChunkHashes(const QString &file);
+    void setChunkHashes(const QString &file, const ChunkHashes &h);
     SyncJournalBlacklistRecord blacklistEntry( const QString& );
     void avoidRenamesOnNextSync(const QString &path);
 
@@ -38,6 +38,8 @@ public:
     QByteArray _etag;
     QByteArray _fileId;
     QByteArray _remotePerm;
+    QByteArray _contentChecksum;
+    quint64   _fileSize;
     int       _mode;
 };
 
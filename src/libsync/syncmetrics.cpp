@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncmetrics.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMap>
+#include <QMutex>
+#include <QVector>
+
+#include <string.h>
+
+namespace Mirall {
+
+namespace {
+
+enum MetricType { Counter, Gauge, Histogram };
+
+struct MetricInfo {
+    const char *name;
+    MetricType type;
+    const char *help;
+};
+
+const MetricInfo metricInfos[] = {
+    { "owncloud_sync_runs_total", Counter, "Sync runs that finished" },
+    { "owncloud_sync_errors_total", Counter, "Sync runs that stopped because of an error" },
+    { "owncloud_sync_duration_seconds", Histogram, "Duration of the sync runs" },
+    { "owncloud_discovery_duration_seconds", Histogram, "Time spent in the update detection, per replica" },
+    { "owncloud_reconcile_duration_seconds", Histogram, "Time spent in the reconciliation, per replica" },
+    { "owncloud_propagated_items_total", Counter, "Items propagated, per direction and result" },
+    { "owncloud_propagated_bytes_total", Counter, "Size of the files transferred successfully, per direction" },
+    { "owncloud_propagation_jobs_in_flight", Gauge, "Propagation jobs running" },
+    { "owncloud_sync_items_per_second", Gauge, "Items propagated per second during the last propagation" },
+    { "owncloud_sync_bytes_per_second", Gauge, "Bytes transferred per second during the last propagation" },
+    { "owncloud_network_requests_total", Counter, "Requests to the server, per verb and status code" },
+    { "owncloud_network_requests_in_flight", Gauge, "Requests to the server waiting for their reply" },
+    { "owncloud_network_request_duration_seconds", Histogram, "Time until the end of the reply, per verb" },
+    { "owncloud_network_first_byte_seconds", Histogram, "Time until the headers of the reply, per verb" },
+    { "owncloud_network_bytes_total", Counter, "Bytes sent and received in the body of the requests" },
+    { "owncloud_journal_commit_duration_seconds", Histogram, "Time spent committing the sync journal" },
+};
+const int metricInfoCount = sizeof(metricInfos) / sizeof(metricInfos[0]);
+
+// The buckets of a histogram are log-linear: 8 sub-buckets per power of two
+const int subBucketBits = 3;
+const int subBucketCount = 1 << subBucketBits;
+const int maxExponent = 40; // 2^40 usec is 12 days
+const int bucketCount = (maxExponent - subBucketBits + 1) * subBucketCount;
+// Exported buckets, as powers of two microseconds: about 1ms to 134s
+const int firstExportedExponent = 10;
+const int lastExportedExponent = 27;
+
+struct Series {
+    Series() : value(0), count(0), sum(0) {}
+    qint64 value; // of a counter or a gauge
+    QVector<qint64> buckets;
+    qint64 count;
+    qint64 sum;
+};
+
+typedef QMap<QByteArray, Series> SeriesByLabels;
+
+struct Registry {
+    QMutex mutex;
+    QMap<QByteArray, SeriesByLabels> metrics;
+};
+
+}
+
+static Registry *registry()
+{
+    static Registry r;
+    return &r;
+}
+
+static const MetricInfo *metricInfo(const char *name)
+{
+    for (int i = 0; i < metricInfoCount; ++i) {
+        if (strcmp(metricInfos[i].name, name) == 0) {
+            return &metricInfos[i];
+        }
+    }
+    return 0;
+}
+
+static int bucketIndex(qint64 usec)
+{
+    if (usec < subBucketCount) {
+        return qMax(int(usec), 0);
+    }
+    int exponent = 0;
+    for (quint64 v = usec; v > 1; v >>= 1) {
+        ++exponent;
+    }
+    if (exponent >= maxExponent) {
+        return bucketCount - 1;
+    }
+    const int sub = int(usec >> (exponent - subBucketBits)) & (subBucketCount - 1);
+    return (exponent - subBucketBits + 1) * subBucketCount + sub;
+}
+
+static qint64 bucketLowerBound(int index)
+{
+    if (index < subBucketCount) {
+        return index;
+    }
+    const int shift = index / subBucketCount - 1;
+    return qint64(subBucketCount + index % subBucketCount) << shift;
+}
+
+// Must be called with the mutex locked
+static Series *series(Registry *r, const char *name, MetricType type, const QByteArray &labels)
+{
+    const MetricInfo *info = metricInfo(name);
+    if (!info || info->type != type) {
+        qWarning() << "Unknown metric" << name << type;
+        Q_ASSERT(false);
+        return 0;
+    }
+    return &r->metrics[QByteArray(name)][labels];
+}
+
+void SyncMetrics::increment(const char *name, qint64 value, const QByteArray &labels)
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    if (Series *s = series(r, name, Counter, labels)) {
+        s->value += value;
+    }
+}
+
+void SyncMetrics::addToGauge(const char *name, qint64 delta, const QByteArray &labels)
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    if (Series *s = series(r, name, Gauge, labels)) {
+        s->value += delta;
+    }
+}
+
+void SyncMetrics::setGauge(const char *name, qint64 value, const QByteArray &labels)
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    if (Series *s = series(r, name, Gauge, labels)) {
+        s->value = value;
+    }
+}
+
+void SyncMetrics::observe(const char *name, qint64 usec, const QByteArray &labels)
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    if (Series *s = series(r, name, Histogram, labels)) {
+        if (s->buckets.isEmpty()) {
+            s->buckets.fill(0, bucketCount);
+        }
+        s->buckets[bucketIndex(usec)]++;
+        s->count++;
+        s->sum += qMax(usec, qint64(0));
+    }
+}
+
+qint64 SyncMetrics::value(const char *name, const QByteArray &labels)
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    return r->metrics.value(QByteArray(name)).value(labels).value;
+}
+
+qint64 SyncMetrics::count(const char *name, const QByteArray &labels)
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    return r->metrics.value(QByteArray(name)).value(labels).count;
+}
+
+qint64 SyncMetrics::quantile(const char *name, double q, const QByteArray &labels)
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    const Series s = r->metrics.value(QByteArray(name)).value(labels);
+    if (s.count == 0) {
+        return 0;
+    }
+    const qint64 rank = qBound(qint64(1), qint64(q * s.count + 0.999999), s.count);
+    qint64 seen = 0;
+    for (int i = 0; i < s.buckets.size(); ++i) {
+        seen += s.buckets.at(i);
+        if (seen >= rank) {
+            return bucketLowerBound(i + 1);
+        }
+    }
+    return bucketLowerBound(bucketCount);
+}
+
+static QByteArray withLabels(const QByteArray &name, const QByteArray &labels, const QByteArray &extra = QByteArray())
+{
+    QByteArray all = labels;
+    if (!extra.isEmpty()) {
+        if (!all.isEmpty()) {
+            all += ',';
+        }
+        all += extra;
+    }
+    return all.isEmpty() ? name : name + '{' + all + '}';
+}
+
+static QByteArray seconds(qint64 usec)
+{
+    return QByteArray::number(usec / 1000000.0, 'g', 10);
+}
+
+QByteArray SyncMetrics::prometheusText()
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    QByteArray text;
+    for (int i = 0; i < metricInfoCount; ++i) {
+        const MetricInfo &info = metricInfos[i];
+        const QByteArray name(info.name);
+        QMap<QByteArray, SeriesByLabels>::const_iterator metric = r->metrics.constFind(name);
+        if (metric == r->metrics.constEnd()) {
+            continue;
+        }
+        static const char *typeNames[] = { "counter", "gauge", "histogram" };
+        text += "# HELP " + name + ' ' + info.help + '\n';
+        text += "# TYPE " + name + ' ' + typeNames[info.type] + '\n';
+
+        for (SeriesByLabels::const_iterator it = metric->constBegin(); it != metric->constEnd(); ++it) {
+            const Series &s = it.value();
+            if (info.type != Histogram) {
+                text += withLabels(name, it.key()) + ' ' + QByteArray::number(s.value) + '\n';
+                continue;
+            }
+            const QByteArray bucketName = name + "_bucket";
+            qint64 cumulated = 0;
+            int index = 0;
+            for (int exponent = firstExportedExponent; exponent <= lastExportedExponent; ++exponent) {
+                // the values below 2^exponent are in the buckets before the one starting there
+                const int end = bucketIndex(qint64(1) << exponent);
+                for (; index < end; ++index) {
+                    cumulated += s.buckets.at(index);
+                }
+                text += withLabels(bucketName, it.key(), "le=\"" + seconds(qint64(1) << exponent) + '"')
+                        + ' ' + QByteArray::number(cumulated) + '\n';
+            }
+            text += withLabels(bucketName, it.key(), "le=\"+Inf\"") + ' ' + QByteArray::number(s.count) + '\n';
+            text += withLabels(name + "_sum", it.key()) + ' ' + seconds(s.sum) + '\n';
+            text += withLabels(name + "_count", it.key()) + ' ' + QByteArray::number(s.count) + '\n';
+        }
+    }
+    return text;
+}
+
+void SyncMetrics::reset()
+{
+    Registry *r = registry();
+    QMutexLocker locker(&r->mutex);
+    r->metrics.clear();
+}
+
+/*********************************************************************************************/
+
+MetricsExporter::MetricsExporter(QObject *parent)
+    : QObject(parent)
+    , _server(0)
+{
+    connect(&_fileTimer, SIGNAL(timeout()), SLOT(writeFile()));
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    writeFile();
+}
+
+void MetricsExporter::setFile(const QString &fileName, int intervalMsec)
+{
+    _fileName = fileName;
+    if (_fileName.isEmpty()) {
+        _fileTimer.stop();
+        return;
+    }
+    _fileTimer.start(intervalMsec);
+    writeFile();
+}
+
+void MetricsExporter::writeFile()
+{
+    if (_fileName.isEmpty()) {
+        return;
+    }
+    // Through a temporary file, so that the readers never see half of it
+    const QString tmpFileName = _fileName + QLatin1String(".tmp");
+    QFile file(tmpFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << Q_FUNC_INFO << "Cannot write the metrics to" << tmpFileName << file.errorString();
+        return;
+    }
+    file.write(SyncMetrics::prometheusText());
+    file.close();
+    QFile::remove(_fileName);
+    if (!QFile::rename(tmpFileName, _fileName)) {
+        qDebug() << Q_FUNC_INFO << "Cannot rename" << tmpFileName << "to" << _fileName;
+    }
+}
+
+bool MetricsExporter::listen(const QString &socketName)
+{
+    delete _server;
+    _server = new QLocalServer(this);
+    QLocalServer::removeServer(socketName);
+    if (!_server->listen(socketName)) {
+        qDebug() << Q_FUNC_INFO << "Cannot serve the metrics on" << socketName << _server->errorString();
+        delete _server;
+        _server = 0;
+        return false;
+    }
+#ifndef Q_OS_WIN
+    QFile::setPermissions(_server->fullServerName(), QFile::ReadOwner | QFile::WriteOwner);
+#endif
+    connect(_server, SIGNAL(newConnection()), SLOT(slotNewConnection()));
+    qDebug() << "Serving the metrics on" << _server->fullServerName();
+    return true;
+}
+
+void MetricsExporter::setupFromEnvironment()
+{
+    const QString fileName = QString::fromLocal8Bit(qgetenv("OWNCLOUD_METRICS_FILE"));
+    if (!fileName.isEmpty()) {
+        setFile(fileName);
+    }
+    const QString socketName = QString::fromLocal8Bit(qgetenv("OWNCLOUD_METRICS_SOCKET"));
+    if (!socketName.isEmpty()) {
+        listen(socketName);
+    }
+}
+
+void MetricsExporter::slotNewConnection()
+{
+    while (QLocalSocket *socket = _server->nextPendingConnection()) {
+        connect(socket, SIGNAL(readyRead()), SLOT(slotReadyRead()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void MetricsExporter::slotReadyRead()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    if (!socket) {
+        return;
+    }
+    // Answer once the request headers are there, whatever the request
+    QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+    if (!request.contains("\r\n\r\n") && !request.contains("\n\n")) {
+        socket->setProperty("request", request);
+        return;
+    }
+    const QByteArray body = SyncMetrics::prometheusText();
+    socket->write("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                  + QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+    socket->disconnectFromServer();
+}
+
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include "owncloudlib.h"
+
+class QLocalServer;
+
+namespace Mirall {
+
+/**
+ * @brief Process wide counters, gauges and latency histograms of the syncs
+ *
+ * The metrics are declared in syncmetrics.cpp with their type and help text.
+ * \a labels is what goes between the braces in the Prometheus format, for
+ * example: verb="GET". The histograms record microseconds and keep 8 buckets
+ * per power of two, so that their quantiles are known within 1/8 of the value
+ * at every scale; they are exported in seconds.
+ *
+ * Every call takes a mutex: they are meant for once per request, item or
+ * transaction, not for every byte.
+ */
+class OWNCLOUDSYNC_EXPORT SyncMetrics
+{
+public:
+    static void increment(const char *name, qint64 value = 1, const QByteArray &labels = QByteArray());
+    static void addToGauge(const char *name, qint64 delta, const QByteArray &labels = QByteArray());
+    static void setGauge(const char *name, qint64 value, const QByteArray &labels = QByteArray());
+    static void observe(const char *name, qint64 usec, const QByteArray &labels = QByteArray());
+
+    /** The value of a counter or a gauge */
+    static qint64 value(const char *name, const QByteArray &labels = QByteArray());
+    /** The number of values recorded by a histogram */
+    static qint64 count(const char *name, const QByteArray &labels = QByteArray());
+    /** The value in microseconds below which the fraction \a q of the recorded values are */
+    static qint64 quantile(const char *name, double q, const QByteArray &labels = QByteArray());
+
+    /** All the metrics, in the Prometheus text exposition format */
+    static QByteArray prometheusText();
+
+    static void reset();
+};
+
+/**
+ * @brief Makes the SyncMetrics available to a monitoring system
+ *
+ * The metrics can be written to a file, for the text file collector of the
+ * Prometheus node exporter, and served on a local socket: every HTTP request
+ * received there is answered with them, for example:
+ *   curl --unix-socket /run/user/1000/owncloud-metrics http://localhost/metrics
+ */
+class OWNCLOUDSYNC_EXPORT MetricsExporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MetricsExporter(QObject *parent = 0);
+    ~MetricsExporter();
+
+    /** Rewrite \a fileName every \a intervalMsec and when the exporter is destroyed */
+    void setFile(const QString &fileName, int intervalMsec = 15000);
+    bool listen(const QString &socketName);
+
+    /** Export as OWNCLOUD_METRICS_FILE and OWNCLOUD_METRICS_SOCKET tell */
+    void setupFromEnvironment();
+
+public slots:
+    void writeFile();
+
+private slots:
+    void slotNewConnection();
+    void slotReadyRead();
+
+private:
+    QString _fileName;
+    QTimer _fileTimer;
+    QLocalServer *_server;
+};
+
+}
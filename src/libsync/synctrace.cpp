@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "synctrace.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+
+namespace Mirall {
+
+// Enough for the biggest syncs, without letting a runaway trace fill the disk
+static const int maxEvents = 2000000;
+// The recorded events are handed to the writer by chunks of that size
+static const int chunkSize = 256 * 1024;
+
+namespace {
+// Some events of a trace, to append to its file
+struct TraceChunk
+{
+    QSharedPointer<QFile> file;
+    QByteArray data;
+    bool last; // the file is complete after it
+};
+
+struct TraceState
+{
+    TraceState() : eventCount(0), dropped(0), writerRunning(false) {}
+
+    QAtomicInt runs; // the running syncs, read without the mutex
+    QMutex mutex;
+    QElapsedTimer clock; // started with the first run
+    QByteArray events; // not handed to the writer yet
+    int eventCount;
+    int dropped;
+    QHash<QThread *, int> threadIds;
+    QString lastFile;
+
+    QSharedPointer<QFile> file; // of the running trace, only opened by the writer
+    QList<TraceChunk> pending;
+    bool writerRunning;
+};
+
+/*
+ * Writes the pending chunks on the global thread pool, so that a trace is neither kept in
+ * memory nor written from the thread that records it. There is at most one writer at a time.
+ */
+class TraceWriter : public QRunnable
+{
+public:
+    void run() Q_DECL_OVERRIDE;
+};
+}
+
+static TraceState *state()
+{
+    static TraceState s;
+    return &s;
+}
+
+static QByteArray jsonString(const QString &str)
+{
+    QByteArray result;
+    result.reserve(str.size() + 2);
+    result += '"';
+    foreach (const QChar &c, str) {
+        const ushort u = c.unicode();
+        if (u == '"' || u == '\\') {
+            result += '\\';
+            result += char(u);
+        } else if (u < 0x20) {
+            result += "\\u00";
+            result += QByteArray::number(u, 16).rightJustified(2, '0');
+        } else if (u < 0x80) {
+            result += char(u);
+        } else {
+            result += "\\u" + QByteArray::number(u, 16).rightJustified(4, '0');
+        }
+    }
+    result += '"';
+    return result;
+}
+
+static QByteArray jsonValue(const QVariant &value)
+{
+    switch (value.type()) {
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+        return value.toByteArray();
+    case QVariant::Double:
+        return QByteArray::number(value.toDouble(), 'g', 12);
+    case QVariant::Bool:
+        return value.toBool() ? "true" : "false";
+    default:
+        return jsonString(value.toString());
+    }
+}
+
+static QByteArray jsonId(const void *id)
+{
+    return "\"0x" + QByteArray::number(quintptr(id), 16) + '"';
+}
+
+// Must be called with the mutex locked
+static int threadId(TraceState *s)
+{
+    QThread *thread = QThread::currentThread();
+    QHash<QThread *, int>::const_iterator it = s->threadIds.constFind(thread);
+    if (it != s->threadIds.constEnd()) {
+        return it.value();
+    }
+    const int tid = s->threadIds.size() + 1;
+    s->threadIds.insert(thread, tid);
+    QString name = thread->objectName();
+    if (name.isEmpty()) {
+        name = thread == QCoreApplication::instance()->thread()
+                ? QLatin1String("main") : QString::fromLatin1("thread %1").arg(tid);
+    }
+    s->events += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + QByteArray::number(tid)
+            + ",\"args\":{\"name\":" + jsonString(name) + "}}";
+    return tid;
+}
+
+// Must be called with the mutex locked
+static void queueChunk(TraceState *s, bool last)
+{
+    TraceChunk chunk;
+    chunk.file = s->file;
+    chunk.data.swap(s->events);
+    chunk.last = last;
+    s->pending.append(chunk);
+    if (!s->writerRunning) {
+        s->writerRunning = true;
+        QThreadPool::globalInstance()->start(new TraceWriter);
+    }
+}
+
+void TraceWriter::run()
+{
+    TraceState *s = state();
+    forever {
+        TraceChunk chunk;
+        {
+            QMutexLocker locker(&s->mutex);
+            if (s->pending.isEmpty()) {
+                s->writerRunning = false;
+                return;
+            }
+            chunk = s->pending.takeFirst();
+        }
+
+        QFile *file = chunk.file.data();
+        // (a file that could not be opened has an error set, the rest of the trace is dropped)
+        if (!file->isOpen() && file->error() == QFile::NoError) {
+            QDir dir = QFileInfo(file->fileName()).absoluteDir();
+            if (!dir.exists() && !dir.mkpath(QLatin1String("."))) {
+                qDebug() << Q_FUNC_INFO << "Cannot create" << dir.path();
+            }
+            if (!file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                qDebug() << Q_FUNC_INFO << "Cannot write the trace to" << file->fileName() << file->errorString();
+            }
+        }
+        if (file->isOpen()) {
+            file->write(chunk.data);
+        }
+        if (chunk.last && file->isOpen()) {
+            file->close();
+            qDebug() << "Sync trace written to" << file->fileName();
+            QMutexLocker locker(&s->mutex);
+            s->lastFile = file->fileName();
+        }
+    }
+}
+
+static void addEvent(const char *phase, const char *category, const QString &name, qint64 ts,
+                     const QByteArray &extra, const SyncTrace::Args &args)
+{
+    TraceState *s = state();
+    QByteArray event;
+    event.reserve(160);
+    event += "{\"name\":" + jsonString(name) + ",\"cat\":\"" + category + "\",\"ph\":\"" + phase
+            + "\",\"ts\":" + QByteArray::number(ts) + ",\"pid\":1" + extra;
+    if (!args.isEmpty()) {
+        event += ",\"args\":{";
+        for (int i = 0; i < args.size(); ++i) {
+            if (i > 0) {
+                event += ',';
+            }
+            event += '"' + args.at(i).first + "\":" + jsonValue(args.at(i).second);
+        }
+        event += '}';
+    }
+
+    QMutexLocker locker(&s->mutex);
+    if (s->runs.fetchAndAddRelaxed(0) == 0) {
+        return; // the trace was finished meanwhile
+    }
+    if (s->eventCount >= maxEvents) {
+        s->dropped++;
+        return;
+    }
+    event += ",\"tid\":" + QByteArray::number(threadId(s)) + '}';
+    s->events += ",\n";
+    s->events += event;
+    s->eventCount++;
+    if (s->events.size() >= chunkSize) {
+        queueChunk(s, false);
+    }
+}
+
+QString SyncTrace::directory()
+{
+    static QString dir = QString::fromLocal8Bit(qgetenv("OWNCLOUD_SYNC_TRACE_DIR"));
+    return dir;
+}
+
+bool SyncTrace::isActive()
+{
+    return state()->runs.fetchAndAddRelaxed(0) > 0;
+}
+
+qint64 SyncTrace::now()
+{
+    if (!isActive()) {
+        return 0;
+    }
+    TraceState *s = state();
+    QMutexLocker locker(&s->mutex);
+    return s->clock.isValid() ? s->clock.nsecsElapsed() / 1000 : 0;
+}
+
+void SyncTrace::startRun(const void *id, const QString &name)
+{
+    if (directory().isEmpty()) {
+        return;
+    }
+    TraceState *s = state();
+    {
+        QMutexLocker locker(&s->mutex);
+        if (s->runs.fetchAndAddRelaxed(1) == 0) {
+            s->clock.start();
+            s->eventCount = 0;
+            s->dropped = 0;
+            s->threadIds.clear();
+            s->file = QSharedPointer<QFile>(new QFile(QDir(directory()).absoluteFilePath(QLatin1String("sync-")
+                    + QDateTime::currentDateTime().toString(QLatin1String("yyyyMMdd-hhmmss-zzz"))
+                    + QLatin1String(".json"))));
+            s->events = "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":"
+                    + jsonString(QCoreApplication::applicationName()) + "}}";
+        }
+    }
+    asyncBegin("sync", name, id);
+}
+
+void SyncTrace::finishRun(const void *id, const Args &args)
+{
+    if (!isActive()) {
+        return;
+    }
+    asyncEnd("sync", QLatin1String("sync"), id, args);
+
+    TraceState *s = state();
+    QMutexLocker locker(&s->mutex);
+    if (s->runs.fetchAndAddRelaxed(-1) != 1) {
+        return; // another folder is still syncing
+    }
+    if (s->dropped > 0) {
+        qDebug() << Q_FUNC_INFO << "dropped events:" << s->dropped;
+    }
+    s->events += "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":"
+            + QByteArray::number(s->dropped) + "}}\n";
+    queueChunk(s, true);
+    s->file.clear();
+    s->clock.invalidate();
+}
+
+void SyncTrace::complete(const char *category, const QString &name, qint64 start, const Args &args)
+{
+    if (!isActive()) {
+        return;
+    }
+    const qint64 end = now();
+    addEvent("X", category, name, start, ",\"dur\":" + QByteArray::number(qMax(end - start, qint64(0))), args);
+}
+
+void SyncTrace::asyncBegin(const char *category, const QString &name, const void *id, const Args &args)
+{
+    if (!isActive()) {
+        return;
+    }
+    addEvent("b", category, name, now(), ",\"id\":" + jsonId(id), args);
+}
+
+void SyncTrace::asyncStep(const char *category, const QString &name, const void *id, const Args &args)
+{
+    if (!isActive()) {
+        return;
+    }
+    addEvent("n", category, name, now(), ",\"id\":" + jsonId(id), args);
+}
+
+void SyncTrace::asyncEnd(const char *category, const QString &name, const void *id, const Args &args)
+{
+    if (!isActive()) {
+        return;
+    }
+    addEvent("e", category, name, now(), ",\"id\":" + jsonId(id), args);
+}
+
+QString SyncTrace::lastTraceFile()
+{
+    TraceState *s = state();
+    QMutexLocker locker(&s->mutex);
+    return s->lastFile;
+}
+
+}
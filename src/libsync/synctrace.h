@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) by agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QVariant>
+
+#include "owncloudlib.h"
+
+namespace Mirall {
+
+/**
+ * @brief Timeline of the sync runs, written in the Chrome trace format
+ *
+ * Set OWNCLOUD_SYNC_TRACE_DIR to a directory to enable it. Everything that happens
+ * while a sync runs is then recorded to a sync-<date>.json file in that directory,
+ * which is complete once the last of the running syncs finished. The events are
+ * written as they come, by chunks, from a worker of the global thread pool. The file
+ * can be loaded in chrome://tracing or in any viewer of that format.
+ *
+ * Spans that stay on one thread are "complete" events (see SyncTraceScope), the ones
+ * that are started and finished from different places are async events, matched by
+ * their id. When tracing is off every call returns after reading one atomic int.
+ */
+class OWNCLOUDSYNC_EXPORT SyncTrace
+{
+public:
+    typedef QList<QPair<QByteArray, QVariant> > Args;
+
+    /** Whether a traced sync is running: nothing is recorded otherwise */
+    static bool isActive();
+
+    /** The time of the trace in microseconds, to pass as the start of complete() */
+    static qint64 now();
+
+    /** A sync of the folder \a name starts, \a id identifies it until finishRun() */
+    static void startRun(const void *id, const QString &name);
+    static void finishRun(const void *id, const Args &args = Args());
+
+    /** A span on the current thread, from \a start (see now()) until now */
+    static void complete(const char *category, const QString &name, qint64 start,
+                         const Args &args = Args());
+
+    static void asyncBegin(const char *category, const QString &name, const void *id,
+                           const Args &args = Args());
+    /** A point in time inside of the async span \a id, like the first byte of a reply */
+    static void asyncStep(const char *category, const QString &name, const void *id,
+                          const Args &args = Args());
+    static void asyncEnd(const char *category, const QString &name, const void *id,
+                         const Args &args = Args());
+
+    /** The directory the traces are written to, empty when tracing is disabled */
+    static QString directory();
+    /** The last trace file that was completely written, for the tests */
+    static QString lastTraceFile();
+};
+
+/**
+ * @brief Records a complete event from its construction to its destruction
+ */
+class SyncTraceScope
+{
+public:
+    SyncTraceScope(const char *category, const QString &name)
+        : _category(category), _name(name), _start(SyncTrace::isActive() ? SyncTrace::now() : -1) {}
+    ~SyncTraceScope()
+    {
+        if (_start >= 0) {
+            SyncTrace::complete(_category, _name, _start, _args);
+        }
+    }
+
+    void addArg(const QByteArray &key, const QVariant &value) { _args.append(qMakePair(key, value)); }
+
+private:
+    Q_DISABLE_COPY(SyncTraceScope)
+
+    const char *_category;
+    QString _name;
+    qint64 _start;
+    SyncTrace::Args _args;
+};
+
+}
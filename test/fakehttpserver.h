@@ -0,0 +1,99 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_FAKEHTTPSERVER_H
+#define MIRALL_FAKEHTTPSERVER_H
+
+#include <QHash>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QUrl>
+
+/*
+ * A request received by a FakeHttpServer. The header names are in lower case.
+ */
+struct FakeHttpRequest
+{
+    QByteArray method;
+    QByteArray path; // with the query
+    QHash<QByteArray, QByteArray> headers;
+    QByteArray body;
+};
+
+/*
+ * Local HTTP server for the tests of the network jobs. It reads the requests, and
+ * each test answers them in its handleRequest(), right away or later with reply().
+ */
+class FakeHttpServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    int requestCount;
+
+    FakeHttpServer() : requestCount(0)
+    {
+        connect(this, SIGNAL(newConnection()), SLOT(slotNewConnection()));
+        listen(QHostAddress::LocalHost);
+    }
+
+    QUrl url() const { return QUrl(QString::fromLatin1("http://127.0.0.1:%1/").arg(serverPort())); }
+
+    /* \a headers is empty or ends with "\r\n", the Content-Length is added */
+    static void reply(QTcpSocket *socket, const QByteArray &status, const QByteArray &headers,
+                      const QByteArray &body = QByteArray())
+    {
+        socket->write("HTTP/1.1 " + status + "\r\n" + headers + "Content-Length: "
+                      + QByteArray::number(body.size()) + "\r\n\r\n" + body);
+    }
+
+protected:
+    virtual void handleRequest(QTcpSocket *socket, const FakeHttpRequest &request) = 0;
+
+private slots:
+    void slotNewConnection()
+    {
+        while (QTcpSocket *socket = nextPendingConnection()) {
+            connect(socket, SIGNAL(readyRead()), SLOT(slotReadyRead()));
+        }
+    }
+
+    void slotReadyRead()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+        QByteArray &buffer = _buffers[socket];
+        buffer += socket->readAll();
+
+        forever {
+            const int headerEnd = buffer.indexOf("\r\n\r\n");
+            if (headerEnd < 0) {
+                return;
+            }
+            FakeHttpRequest request;
+            QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+            const QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+            request.method = requestLine.value(0);
+            request.path = requestLine.value(1);
+            foreach (const QByteArray &line, lines) {
+                const int colon = line.indexOf(':');
+                request.headers.insert(line.left(colon).trimmed().toLower(), line.mid(colon + 1).trimmed());
+            }
+            const int length = request.headers.value("content-length").toInt();
+            if (buffer.size() < headerEnd + 4 + length) {
+                return;
+            }
+            request.body = buffer.mid(headerEnd + 4, length);
+            buffer.remove(0, headerEnd + 4 + length);
+
+            ++requestCount;
+            handleRequest(socket, request);
+        }
+    }
+
+private:
+    QHash<QTcpSocket *, QByteArray> _buffers;
+};
+
+#endif
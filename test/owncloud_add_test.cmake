@@ -4,6 +4,7 @@ macro(owncloud_add_test test_class additional_cpp)
                         "${PROJECT_SOURCE_DIR}/src/libsync"
                         "${CMAKE_BINARY_DIR}/src/libsync"
                         "${CMAKE_CURRENT_BINARY_DIR}"
+                        "${CMAKE_CURRENT_SOURCE_DIR}"
                        )
 
     set(OWNCLOUD_TEST_CLASS ${test_class})
@@ -0,0 +1,144 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTACTIVITYLISTMODEL_H
+#define MIRALL_TESTACTIVITYLISTMODEL_H
+
+#include <QtTest>
+
+#include "activitylistmodel.h"
+
+using namespace Mirall;
+
+class TestActivityListModel : public QObject
+{
+    Q_OBJECT
+
+    ActivityListModel::Entry entry(const QString &file, const QString &folder = QLatin1String("A"),
+                                   bool ignored = false)
+    {
+        ActivityListModel::Entry entry;
+        entry.file = file;
+        entry.folder = folder;
+        entry.ignored = ignored;
+        return entry;
+    }
+
+    // the files of the rows, from the top
+    QStringList files(const ActivityListModel &model)
+    {
+        QStringList result;
+        for (int row = 0; row < model.rowCount(); ++row) {
+            result << model.index(row, ActivityListModel::FileColumn).data().toString();
+        }
+        return result;
+    }
+
+    // first and last row of a rowsInserted() or rowsRemoved() signal
+    QPair<int, int> range(const QList<QVariant> &arguments)
+    {
+        return qMakePair(arguments.at(1).toInt(), arguments.at(2).toInt());
+    }
+
+private slots:
+    void testBatchedFlush()
+    {
+        ActivityListModel model;
+        QSignalSpy inserted(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+
+        model.addEntry(entry("a"));
+        model.addEntry(entry("b"));
+        model.addEntry(entry("c"));
+        // nothing shown before the flush
+        QCOMPARE(model.rowCount(), 0);
+        QVERIFY(inserted.isEmpty());
+
+        // the timer inserts them in one go, newest first
+        QTRY_COMPARE(inserted.count(), 1);
+        QCOMPARE(range(inserted.first()), qMakePair(0, 2));
+        QCOMPARE(files(model), QStringList() << "c" << "b" << "a");
+
+        model.addEntry(entry("d"));
+        model.addEntry(entry("e"));
+        model.flush();
+        QCOMPARE(inserted.count(), 2);
+        QCOMPARE(range(inserted.last()), qMakePair(0, 1));
+        QCOMPARE(files(model), QStringList() << "e" << "d" << "c" << "b" << "a");
+
+        // an empty flush does nothing
+        model.flush();
+        QCOMPARE(inserted.count(), 2);
+    }
+
+    void testTrim()
+    {
+        ActivityListModel model;
+        model.setMaxRows(3);
+        QSignalSpy inserted(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+        QSignalSpy removed(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+
+        // only the newest of the pending entries are kept
+        for (int i = 0; i < 5; ++i) {
+            model.addEntry(entry(QString::number(i)));
+        }
+        model.flush();
+        QCOMPARE(files(model), QStringList() << "4" << "3" << "2");
+        QCOMPARE(range(inserted.last()), qMakePair(0, 2));
+        QVERIFY(removed.isEmpty());
+
+        // the oldest rows are removed from the bottom
+        model.addEntry(entry("5"));
+        model.addEntry(entry("6"));
+        model.flush();
+        QCOMPARE(files(model), QStringList() << "6" << "5" << "4");
+        QCOMPARE(removed.count(), 1);
+        QCOMPARE(range(removed.last()), qMakePair(3, 4));
+
+        model.setMaxRows(1);
+        QCOMPARE(files(model), QStringList() << "6");
+        QCOMPARE(range(removed.last()), qMakePair(1, 2));
+
+        // at least one row
+        model.setMaxRows(0);
+        QCOMPARE(model.maxRows(), 1);
+        QCOMPARE(model.rowCount(), 1);
+    }
+
+    void testRemoveIgnoredEntries()
+    {
+        ActivityListModel model;
+        model.addEntry(entry("i1", "A", true));
+        model.addEntry(entry("i2", "A", true));
+        model.addEntry(entry("f1", "A"));
+        model.addEntry(entry("other", "B", true));
+        model.addEntry(entry("i3", "A", true));
+        model.addEntry(entry("i4", "A", true));
+        model.addEntry(entry("i5", "A", true));
+        model.flush();
+        QCOMPARE(files(model), QStringList() << "i5" << "i4" << "i3" << "other" << "f1" << "i2" << "i1");
+
+        // not flushed yet: dropped without touching the rows
+        model.addEntry(entry("pending", "A", true));
+        model.addEntry(entry("f2", "A"));
+
+        QSignalSpy removed(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+        model.removeIgnoredEntries(QLatin1String("A"));
+        // each run of consecutive rows in one signal, from the bottom
+        QCOMPARE(removed.count(), 2);
+        QCOMPARE(range(removed.at(0)), qMakePair(5, 6));
+        QCOMPARE(range(removed.at(1)), qMakePair(0, 2));
+        QCOMPARE(files(model), QStringList() << "other" << "f1");
+
+        model.flush();
+        QCOMPARE(files(model), QStringList() << "f2" << "other" << "f1");
+
+        model.removeIgnoredEntries(QLatin1String("B"));
+        QCOMPARE(files(model), QStringList() << "f2" << "f1");
+        QCOMPARE(range(removed.last()), qMakePair(1, 1));
+    }
+};
+
+#endif
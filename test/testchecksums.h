@@ -0,0 +1,125 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTCHECKSUMS_H
+#define MIRALL_TESTCHECKSUMS_H
+
+#include <QtTest>
+#include <QBuffer>
+#include <QTemporaryFile>
+
+#include "checksums.h"
+#include "syncjournaldb.h"
+#include "syncjournalfilerecord.h"
+
+using namespace Mirall;
+
+class TestChecksums : public QObject
+{
+    Q_OBJECT
+
+private:
+    QString _root;
+
+private slots:
+    void initTestCase()
+    {
+        qsrand(QTime::currentTime().msec());
+        _root = QDir::tempPath() + "/" + "test_" + QString::number(qrand());
+        QVERIFY(QDir().mkpath(_root));
+    }
+
+    void cleanupTestCase()
+    {
+        if( _root.startsWith(QDir::tempPath() )) {
+            system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
+        }
+    }
+
+    void testKnownValues()
+    {
+        ContentChecksum sha1(ContentChecksum::SHA1);
+        sha1.addData(0, "abc", 3);
+        QCOMPARE(sha1.result(), QByteArray("SHA1:a9993e364706816aba3e25717850c26c9cd0d89d"));
+
+        ContentChecksum adler(ContentChecksum::Adler32);
+        adler.addData(0, "Wikipedia", 9);
+        QCOMPARE(adler.result(), QByteArray("Adler32:11e60398"));
+
+        QCOMPARE(ContentChecksum::typeOf(sha1.result()), ContentChecksum::SHA1);
+        QCOMPARE(ContentChecksum::typeOf(adler.result()), ContentChecksum::Adler32);
+        QCOMPARE(ContentChecksum::typeOf("MD5:abc"), ContentChecksum::NoChecksum);
+    }
+
+    void testNonContiguousData()
+    {
+        QByteArray data;
+        for (int i = 0; i < 100000; ++i) {
+            data.append(char(i * 7));
+        }
+        ContentChecksum reference(ContentChecksum::Adler32);
+        reference.addData(0, data.constData(), data.size());
+
+        // Out of order and repeated blocks are ignored, the gaps are read from the device
+        ContentChecksum checksum(ContentChecksum::Adler32);
+        checksum.addData(50000, data.constData() + 50000, 1000);
+        checksum.addData(0, data.constData(), 20000);
+        checksum.addData(0, data.constData(), 10000);
+        checksum.addData(10000, data.constData() + 10000, 30000);
+        QCOMPARE(checksum.bytesHashed(), qint64(40000));
+
+        QBuffer buffer(&data);
+        QVERIFY(buffer.open(QIODevice::ReadOnly));
+        QVERIFY(checksum.hashUpTo(&buffer, data.size()));
+        QCOMPARE(checksum.result(), reference.result());
+    }
+
+    void testComputeChecksum()
+    {
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        file.write("abc");
+        file.close();
+
+        ComputeChecksum compute;
+        QSignalSpy doneSpy(&compute, SIGNAL(done(QByteArray)));
+        compute.start(file.fileName(), ContentChecksum::SHA1);
+        QTRY_COMPARE(doneSpy.count(), 1);
+        QCOMPARE(doneSpy.first().first().toByteArray(), QByteArray("SHA1:a9993e364706816aba3e25717850c26c9cd0d89d"));
+
+        // A file that cannot be read
+        compute.start(file.fileName() + QLatin1String(".missing"), ContentChecksum::SHA1);
+        QTRY_COMPARE(doneSpy.count(), 2);
+        QVERIFY(doneSpy.last().first().toByteArray().isEmpty());
+    }
+
+    void testJournalLookupByContent()
+    {
+        SyncJournalDb journal(_root);
+        QVERIFY(!journal.hasFileRecordOfSize(1000));
+
+        SyncJournalFileRecord record;
+        record._path = QLatin1String("a/big.bin");
+        record._type = 0; // file
+        record._etag = "e1";
+        record._fileSize = 1000;
+        record._contentChecksum = "SHA1:0123";
+        record._modtime = QDateTime::currentDateTime();
+        QVERIFY(journal.setFileRecord(record));
+        record._path = QLatin1String("b/big.bin");
+        record._contentChecksum = "SHA1:4567";
+        QVERIFY(journal.setFileRecord(record));
+
+        QVERIFY(journal.hasFileRecordOfSize(1000));
+        QVERIFY(!journal.hasFileRecordOfSize(1001));
+        QCOMPARE(journal.getFilePathsByContent(1000, "SHA1:0123"), QStringList() << QLatin1String("a/big.bin"));
+        QVERIFY(journal.getFilePathsByContent(1001, "SHA1:0123").isEmpty());
+        QVERIFY(journal.getFilePathsByContent(1000, QByteArray()).isEmpty());
+        QCOMPARE(journal.getFileRecord(QLatin1String("b/big.bin"))._fileSize, quint64(1000));
+    }
+};
+
+#endif
@@ -0,0 +1,241 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTCHUNKREUSE_H
+#define MIRALL_TESTCHUNKREUSE_H
+
+#include <QtTest>
+
+#include "account.h"
+#include "creds/dummycredentials.h"
+#include "fakehttpserver.h"
+#include "propagator_qnam.h"
+#include "syncjournaldb.h"
+#include "utility.h"
+
+using namespace Mirall;
+
+/*
+ * Local stand-in for the chunked upload of the server: the chunks are assembled when they
+ * are all there. A chunk sent with OC-Chunk-Reuse and no data is taken from the current
+ * version of the file, unless `supportsReuse` is false: it is then stored empty, as an
+ * older server would do.
+ */
+class FakeChunkServer : public FakeHttpServer
+{
+public:
+    QByteArray file;
+    QByteArray etag;
+    bool supportsReuse;
+    qint64 bytesReceived;
+    int reusedChunks;
+
+    FakeChunkServer() : etag("0"), supportsReuse(true), bytesReceived(0), reusedChunks(0) {}
+
+protected:
+    void handleRequest(QTcpSocket *socket, const FakeHttpRequest &request) Q_DECL_OVERRIDE
+    {
+        bytesReceived += request.body.size();
+
+        QRegExp chunkName(QLatin1String("-chunking-(\\d+)-(\\d+)-(\\d+)$"));
+        if (chunkName.indexIn(QString::fromLatin1(request.path)) < 0) {
+            file = request.body;
+            reply(socket, "201 Created", newVersion());
+            return;
+        }
+        const int transfer = chunkName.cap(1).toInt();
+        const int count = chunkName.cap(2).toInt();
+        const int index = chunkName.cap(3).toInt();
+
+        QByteArray data = request.body;
+        QByteArray extraHeaders;
+        if (request.headers.contains("oc-chunk-reuse") && supportsReuse) {
+            if (request.headers.value("if-match") != '"' + etag + '"') {
+                reply(socket, "412 Precondition Failed", QByteArray());
+                return;
+            }
+            data = file.mid(request.headers.value("oc-chunk-offset").toLongLong(),
+                            request.headers.value("oc-chunk-length").toInt());
+            if (QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex() != request.headers.value("oc-chunk-reuse")) {
+                reply(socket, "400 Bad Request", QByteArray());
+                return;
+            }
+            ++reusedChunks;
+            extraHeaders = "OC-Chunk-Reused: 1\r\n";
+        }
+
+        QMap<int, QByteArray> &chunks = _chunks[transfer];
+        chunks[index] = data;
+        if (chunks.size() < count) {
+            reply(socket, "201 Created", extraHeaders);
+            return;
+        }
+        file.clear();
+        foreach (const QByteArray &chunk, chunks) {
+            file += chunk;
+        }
+        _chunks.remove(transfer);
+        reply(socket, "201 Created", extraHeaders + newVersion());
+    }
+
+private:
+    QByteArray newVersion()
+    {
+        etag = QByteArray::number(etag.toInt() + 1);
+        return "ETag: \"" + etag + "\"\r\nOC-FileID: 42\r\nX-OC-MTime: accepted\r\n";
+    }
+
+    QHash<int, QMap<int, QByteArray> > _chunks;
+};
+
+class TestChunkReuse : public QObject
+{
+    Q_OBJECT
+
+    QString _root;
+
+    // An empty directory for the current test function
+    QString testDir()
+    {
+        const QString dir = _root + QLatin1Char('/') + QLatin1String(QTest::currentTestFunction());
+        QDir().mkpath(dir);
+        return dir;
+    }
+
+    QByteArray randomData(int size)
+    {
+        QByteArray data(size, Qt::Uninitialized);
+        for (int i = 0; i < size; ++i) {
+            data[i] = char(qrand());
+        }
+        return data;
+    }
+
+    // Upload \a content as the new version of "big.bin" and return the status
+    SyncFileItem::Status upload(FakeChunkServer *server, const QString &dir, SyncJournalDb *journal,
+                                const QByteArray &content, csync_instructions_e instruction)
+    {
+        const QString fileName = dir + QLatin1String("/big.bin");
+        QFile f(fileName);
+        f.open(QIODevice::WriteOnly);
+        f.write(content);
+        f.close();
+
+        SyncFileItem item;
+        item._file = QLatin1String("big.bin");
+        item._instruction = instruction;
+        item._size = content.size();
+        item._modtime = Utility::qDateTimeToTime_t(QFileInfo(fileName).lastModified());
+        item._etag = instruction == CSYNC_INSTRUCTION_NEW ? QByteArray() : server->etag;
+        item.log._other_size = 0;
+
+        OwncloudPropagator propagator(0, dir, QLatin1String("/"), QLatin1String("/"), journal, 0);
+        PropagateUploadFileQNAM job(&propagator, item);
+        QSignalSpy completedSpy(&job, SIGNAL(completed(SyncFileItem)));
+        job.start();
+        for (int i = 0; i < 500 && completedSpy.isEmpty(); ++i) {
+            QTest::qWait(10);
+        }
+        if (completedSpy.isEmpty()) {
+            return SyncFileItem::NoStatus;
+        }
+        return completedSpy.first().first().value<SyncFileItem>()._status;
+    }
+
+private slots:
+    void initTestCase()
+    {
+        qsrand(QTime::currentTime().msec());
+        _root = QDir::tempPath() + "/" + "test_" + QString::number(qrand());
+        qsrand(42);
+        qputenv("OWNCLOUD_CHUNK_SIZE", "1024");
+        qRegisterMetaType<SyncFileItem>("SyncFileItem");
+    }
+
+    void testJournal()
+    {
+        const QString dir = testDir();
+        SyncJournalDb journal(dir);
+        QVERIFY(!journal.getChunkHashes(QLatin1String("a"))._valid);
+
+        SyncJournalDb::ChunkHashes hashes;
+        hashes._etag = "abc";
+        hashes._chunkSize = 1024;
+        hashes._hashes << QByteArray(20, 'x') << QByteArray(20, 'y');
+        hashes._valid = true;
+        journal.setChunkHashes(QLatin1String("a"), hashes);
+
+        SyncJournalDb::ChunkHashes stored = journal.getChunkHashes(QLatin1String("a"));
+        QVERIFY(stored._valid);
+        QCOMPARE(stored._etag, hashes._etag);
+        QCOMPARE(stored._chunkSize, hashes._chunkSize);
+        QCOMPARE(stored._hashes, hashes._hashes);
+
+        journal.setChunkHashes(QLatin1String("a"), SyncJournalDb::ChunkHashes());
+        QVERIFY(!journal.getChunkHashes(QLatin1String("a"))._valid);
+    }
+
+    void testUnchangedChunksAreReused()
+    {
+        FakeChunkServer server;
+        Account *account = new Account;
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+        AccountManager::instance()->setAccount(account);
+        const QString dir = testDir();
+        SyncJournalDb journal(dir);
+
+        // 5 chunks, the last one is 904 bytes
+        QByteArray content = randomData(5000);
+        QCOMPARE(upload(&server, dir, &journal, content, CSYNC_INSTRUCTION_NEW), SyncFileItem::Success);
+        QCOMPARE(server.file, content);
+        QCOMPARE(server.bytesReceived, qint64(5000));
+        QCOMPARE(journal.getChunkHashes(QLatin1String("big.bin"))._hashes.size(), 5);
+
+        // Change the third chunk: only it and the last one are sent
+        content[2100] = ~content[2100];
+        server.bytesReceived = 0;
+        QCOMPARE(upload(&server, dir, &journal, content, CSYNC_INSTRUCTION_SYNC), SyncFileItem::Success);
+        QCOMPARE(server.file, content);
+        QCOMPARE(server.reusedChunks, 3);
+        QCOMPARE(server.bytesReceived, qint64(1024 + 904));
+        QCOMPARE(journal.getChunkHashes(QLatin1String("big.bin"))._etag, server.etag);
+    }
+
+    void testServerWithoutReuse()
+    {
+        FakeChunkServer server;
+        server.supportsReuse = false;
+        Account *account = new Account;
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+        AccountManager::instance()->setAccount(account);
+        const QString dir = testDir();
+        SyncJournalDb journal(dir);
+
+        QByteArray content = randomData(5000);
+        QCOMPARE(upload(&server, dir, &journal, content, CSYNC_INSTRUCTION_NEW), SyncFileItem::Success);
+
+        content[2100] = ~content[2100];
+        server.bytesReceived = 0;
+        server.requestCount = 0;
+        QCOMPARE(upload(&server, dir, &journal, content, CSYNC_INSTRUCTION_SYNC), SyncFileItem::Success);
+        // The empty chunk stored by the server was replaced by the data
+        QCOMPARE(server.file, content);
+        QCOMPARE(server.bytesReceived, qint64(5000));
+        // One request to find out, then all the chunks
+        QCOMPARE(server.requestCount, 6);
+    }
+
+    void cleanupTestCase()
+    {
+        if( _root.startsWith(QDir::tempPath() )) {
+            system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,287 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTDELTADOWNLOAD_H
+#define MIRALL_TESTDELTADOWNLOAD_H
+
+#include <QtTest>
+#include <QBuffer>
+#include <QTemporaryFile>
+
+#include "account.h"
+#include "creds/dummycredentials.h"
+#include "deltadownload.h"
+#include "fakehttpserver.h"
+
+using namespace Mirall;
+
+/*
+ * Local stand-in for a server with block manifests: serves the manifest of `content` when
+ * asked for it, and the ranges of `content` as multipart/byteranges. The byte at
+ * `corruptOffset` is changed in the ranges, as if it was damaged on the way.
+ */
+class FakeBlockServer : public FakeHttpServer
+{
+public:
+    QByteArray content;
+    int blockSize;
+    bool hasManifests;
+    bool hasChecksum; // of the whole file, in the manifest
+    int corruptOffset;
+    qint64 bytesSent;
+
+    FakeBlockServer(const QByteArray &data)
+        : content(data), blockSize(1024), hasManifests(true), hasChecksum(true), corruptOffset(-1), bytesSent(0) {}
+
+protected:
+    void handleRequest(QTcpSocket *socket, const FakeHttpRequest &request) Q_DECL_OVERRIDE
+    {
+        if (request.headers.value("accept").contains("application/x-block-manifest") && hasManifests) {
+            QBuffer device(&content);
+            device.open(QIODevice::ReadOnly);
+            BlockManifest manifest = BlockManifest::compute(&device, blockSize);
+            if (!hasChecksum) {
+                manifest.checksum.clear();
+            }
+            reply(socket, "200 OK", headers("application/x-block-manifest"), manifest.toByteArray());
+            return;
+        }
+
+        QRegExp rangeHeader(QLatin1String("bytes=([0-9,-]+)"));
+        if (rangeHeader.indexIn(QString::fromLatin1(request.headers.value("range"))) < 0) {
+            reply(socket, "200 OK", headers("application/octet-stream"), content);
+            return;
+        }
+        QByteArray served = content;
+        if (corruptOffset >= 0) {
+            served[corruptOffset] = ~served[corruptOffset];
+        }
+        const QByteArray boundary = "THIS_STRING_SEPARATES";
+        QByteArray body;
+        foreach (const QString &range, rangeHeader.cap(1).split(QLatin1Char(','))) {
+            qint64 start = range.section(QLatin1Char('-'), 0, 0).toLongLong();
+            qint64 end = range.section(QLatin1Char('-'), 1, 1).toLongLong();
+            body += "--" + boundary + "\r\nContent-Type: application/octet-stream\r\n"
+                    "Content-Range: bytes " + QByteArray::number(start) + '-' + QByteArray::number(end)
+                    + '/' + QByteArray::number(content.size()) + "\r\n\r\n"
+                    + served.mid(start, end - start + 1) + "\r\n";
+            bytesSent += end - start + 1;
+        }
+        body += "--" + boundary + "--\r\n";
+        reply(socket, "206 Partial Content", headers("multipart/byteranges; boundary=" + boundary), body);
+    }
+
+private:
+    static QByteArray headers(const QByteArray &type)
+    {
+        return "Content-Type: " + type + "\r\nETag: \"1\"\r\n";
+    }
+};
+
+class TestDeltaDownload : public QObject
+{
+    Q_OBJECT
+
+    QByteArray randomData(int size)
+    {
+        QByteArray data(size, Qt::Uninitialized);
+        for (int i = 0; i < size; ++i) {
+            data[i] = char(qrand());
+        }
+        return data;
+    }
+
+    // Some bytes inserted at 5000, and the bytes of the 40th block changed
+    QByteArray modified(const QByteArray &data)
+    {
+        QByteArray result = data;
+        result.insert(5000, randomData(100));
+        for (int i = 40 * 1024; i < 40 * 1024 + 10; ++i) {
+            result[i] = ~result[i];
+        }
+        return result;
+    }
+
+    BlockManifest manifestOf(QByteArray data, int blockSize)
+    {
+        QBuffer device(&data);
+        device.open(QIODevice::ReadOnly);
+        return BlockManifest::compute(&device, blockSize);
+    }
+
+private slots:
+    void initTestCase()
+    {
+        qsrand(42);
+    }
+
+    void testManifestRoundTrip()
+    {
+        const BlockManifest manifest = manifestOf(randomData(10000), 1024);
+        QCOMPARE(manifest.blocks.size(), 10);
+        QVERIFY(manifest.checksum.startsWith("SHA1:"));
+
+        BlockManifest parsed;
+        QVERIFY(BlockManifest::parse(manifest.toByteArray(), &parsed));
+        QCOMPARE(parsed.length, qint64(10000));
+        QCOMPARE(parsed.blockSize, 1024);
+        QCOMPARE(parsed.checksum, manifest.checksum);
+        QCOMPARE(parsed.blocks.size(), 10);
+        QCOMPARE(parsed.blocks.last().weak, manifest.blocks.last().weak);
+        QCOMPARE(parsed.blocks.last().strong, manifest.blocks.last().strong);
+
+        // A block is missing
+        QByteArray truncated = manifest.toByteArray();
+        truncated.truncate(truncated.lastIndexOf('\n', -2) + 1);
+        QVERIFY(!BlockManifest::parse(truncated, &parsed));
+        // Not a manifest at all
+        QVERIFY(!BlockManifest::parse("<html>Hello</html>", &parsed));
+    }
+
+    void testFindBlocks()
+    {
+        QByteArray local = randomData(64 * 1024);
+        QByteArray remote = modified(local);
+        const BlockManifest manifest = manifestOf(remote, 1024);
+
+        QBuffer device(&local);
+        device.open(QIODevice::ReadOnly);
+        const QVector<qint64> found = manifest.findBlocks(&device);
+        QCOMPARE(found.size(), manifest.blocks.size());
+
+        int missing = 0;
+        for (int i = 0; i < found.size(); ++i) {
+            if (found.at(i) < 0) {
+                ++missing;
+            } else {
+                QCOMPARE(local.mid(found.at(i), 1024), remote.mid(i * 1024, 1024));
+            }
+        }
+        // The block with the insertion, the changed one and the short last one.
+        // The blocks after the insertion are found at their shifted offset.
+        QCOMPARE(missing, 3);
+        QCOMPARE(found.at(5), qint64(5 * 1024 - 100));
+
+        const QList<QPair<qint64, qint64> > ranges = manifest.missingRanges(found);
+        QCOMPARE(ranges.size(), 3);
+        QCOMPARE(ranges.first(), qMakePair(qint64(4096), qint64(5120)));
+        QCOMPARE(ranges.last().second, qint64(remote.size()));
+    }
+
+    void testParseRangeReply()
+    {
+        QList<RangeData> parts;
+        QVERIFY(parseRangeReply("multipart/byteranges; boundary=\"xyz\"", QByteArray(),
+                                "--xyz\r\nContent-Range: bytes 0-2/100\r\n\r\nabc\r\n"
+                                "--xyz\r\nContent-Type: text/plain\r\ncontent-range: bytes 50-51/100\r\n\r\nde\r\n"
+                                "--xyz--\r\n", &parts));
+        QCOMPARE(parts.size(), 2);
+        QCOMPARE(parts.at(0).offset, qint64(0));
+        QCOMPARE(parts.at(0).data, QByteArray("abc"));
+        QCOMPARE(parts.at(1).offset, qint64(50));
+        QCOMPARE(parts.at(1).data, QByteArray("de"));
+
+        parts.clear();
+        QVERIFY(parseRangeReply("application/octet-stream", "bytes 10-13/100", "abcd", &parts));
+        QCOMPARE(parts.size(), 1);
+        QCOMPARE(parts.at(0).offset, qint64(10));
+
+        parts.clear();
+        QVERIFY(!parseRangeReply("application/octet-stream", "bytes 10-13/100", "abc", &parts));
+    }
+
+    void testDeltaDownload()
+    {
+        QByteArray local = randomData(64 * 1024);
+        FakeBlockServer server(modified(local));
+        QScopedPointer<Account> account(new Account);
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+
+        QTemporaryFile localFile;
+        QVERIFY(localFile.open());
+        localFile.write(local);
+        localFile.close();
+        QTemporaryFile output;
+        QVERIFY(output.open());
+
+        DeltaDownload delta(account.data(), QLatin1String("file"), "1", localFile.fileName(), &output);
+        QSignalSpy finishedSpy(&delta, SIGNAL(finished(bool)));
+        delta.start();
+        QTRY_COMPARE(finishedSpy.count(), 1);
+        QCOMPARE(finishedSpy.first().first().toBool(), true);
+
+        output.seek(0);
+        QCOMPARE(output.readAll(), server.content);
+        QCOMPARE(delta.bytesDownloaded(), server.bytesSent);
+        QVERIFY(server.bytesSent < 5 * 1024);
+        QCOMPARE(delta.checksum(), manifestOf(server.content, 1024).checksum);
+    }
+
+    void testBlocksAreVerified()
+    {
+        QByteArray local = randomData(64 * 1024);
+        FakeBlockServer server(modified(local));
+        server.hasChecksum = false;
+        QScopedPointer<Account> account(new Account);
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+
+        QTemporaryFile localFile;
+        QVERIFY(localFile.open());
+        localFile.write(local);
+        localFile.close();
+
+        {
+            QTemporaryFile output;
+            QVERIFY(output.open());
+            DeltaDownload delta(account.data(), QLatin1String("file"), "1", localFile.fileName(), &output);
+            QSignalSpy finishedSpy(&delta, SIGNAL(finished(bool)));
+            delta.start();
+            QTRY_COMPARE(finishedSpy.count(), 1);
+            QCOMPARE(finishedSpy.first().first().toBool(), true);
+            output.seek(0);
+            QCOMPARE(output.readAll(), server.content);
+        }
+
+        // A byte of the 40th block is damaged on the way
+        server.corruptOffset = 40 * 1024 + 5;
+        QTemporaryFile output;
+        QVERIFY(output.open());
+        DeltaDownload delta(account.data(), QLatin1String("file"), "1", localFile.fileName(), &output);
+        QSignalSpy finishedSpy(&delta, SIGNAL(finished(bool)));
+        delta.start();
+        QTRY_COMPARE(finishedSpy.count(), 1);
+        QCOMPARE(finishedSpy.first().first().toBool(), false);
+        QVERIFY(output.size() <= qint64(40 * 1024));
+    }
+
+    void testFallbackWithoutManifest()
+    {
+        QByteArray local = randomData(64 * 1024);
+        FakeBlockServer server(modified(local));
+        server.hasManifests = false;
+        QScopedPointer<Account> account(new Account);
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+
+        QTemporaryFile localFile;
+        QVERIFY(localFile.open());
+        localFile.write(local);
+        localFile.close();
+        QTemporaryFile output;
+        QVERIFY(output.open());
+
+        DeltaDownload delta(account.data(), QLatin1String("file"), "1", localFile.fileName(), &output);
+        QSignalSpy finishedSpy(&delta, SIGNAL(finished(bool)));
+        delta.start();
+        QTRY_COMPARE(finishedSpy.count(), 1);
+        QCOMPARE(finishedSpy.first().first().toBool(), false);
+        QCOMPARE(output.size(), qint64(0));
+    }
+};
+
+#endif
@@ -56,9 +56,25 @@ private slots:
 
         _watcher = new FolderWatcher(_root);
         QObject::connect(_watcher, SIGNAL(folderChanged(QString)), this, SLOT(slotFolderChanged(QString)));
+        // the sub directories are registered in the background
+        QVERIFY(!_watcher->isReliable());
+        QTRY_VERIFY(_watcher->isReliable());
         _timer.singleShot(3000, this, SLOT(slotEnd()));
     }
 
+    void testIgnoreMatcher() {
+        IgnoreMatcher matcher;
+        QVERIFY(matcher.isEmpty());
+        matcher.addPattern("*.tmp");
+        matcher.addPattern("build/");
+        matcher.addPattern("/a/b*/c");
+        QVERIFY(matcher.isIgnored("/x/y.tmp/z"));
+        QVERIFY(matcher.isIgnored("/x/build"));
+        QVERIFY(matcher.isIgnored("/a/bz/c"));
+        QVERIFY(!matcher.isIgnored("/x/y"));
+        QVERIFY(!matcher.isIgnored("/x/builder"));
+    }
+
     void testACreate() { // create a new file
         QString cmd;
         _checkMark = _root;
@@ -116,6 +132,50 @@ private slots:
         QVERIFY(_checkMark.isEmpty()); // the slot clears the checkmark.
     }
 
+    void testChangesAreCoalesced() {
+        _watcher->setDebounceInterval(200);
+        QTest::qWait(300); // let the window of the previous changes end
+        QSignalSpy pathsSpy(_watcher, SIGNAL(pathsChanged(QStringList)));
+
+        // one folderChanged for the burst, then one pathsChanged with the files
+        _checkMark = _root+"/a1/b1/c1";
+        QVERIFY(Utility::writeRandomFile(_root+"/a1/b1/c1/f1.bin"));
+        QVERIFY(Utility::writeRandomFile(_root+"/a1/b1/c1/f2.bin"));
+        QVERIFY(Utility::writeRandomFile(_root+"/a1/b1/c1/f1.bin"));
+        QTRY_COMPARE(pathsSpy.count(), 1);
+        QVERIFY(_checkMark.isEmpty()); // the slot clears the checkmark.
+
+        QStringList paths = pathsSpy.first().first().toStringList();
+        QCOMPARE(paths, QStringList() << _root+"/a1/b1/c1/f1.bin" << _root+"/a1/b1/c1/f2.bin");
+    }
+
+    // Beyond the watch limit, the directories that remain are polled
+    void testPollFallback() {
+#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
+        return; // only the inotify backend has a watch limit
+#endif
+        // room for the root and one directory only
+        qputenv("OWNCLOUD_WATCHER_MAX_WATCHES", "2");
+        qputenv("OWNCLOUD_WATCHER_POLL_INTERVAL", "100");
+        FolderWatcher watcher(_root);
+        qputenv("OWNCLOUD_WATCHER_MAX_WATCHES", "");
+        qputenv("OWNCLOUD_WATCHER_POLL_INTERVAL", "");
+        watcher.setDebounceInterval(100);
+        QSignalSpy pathsSpy(&watcher, SIGNAL(pathsChanged(QStringList)));
+
+        // the first scan makes the reference
+        QTRY_VERIFY(watcher.polledDirectoryCount() > 0);
+        QVERIFY(!watcher.isReliable());
+
+        // a2/b3/c3 is below an unwatched directory whichever was registered
+        QTest::qWait(300); // let the window of the previous changes end
+        _checkMark = _root+"/a2/b3/c3";
+        QVERIFY(Utility::writeRandomFile(_root+"/a2/b3/c3/polled.bin"));
+        QTRY_COMPARE(pathsSpy.count(), 1);
+        QCOMPARE(pathsSpy.first().first().toStringList(), QStringList() << _root+"/a2/b3/c3/polled.bin");
+        QVERIFY(_checkMark.isEmpty()); // the slot clears the checkmark.
+    }
+
     void cleanupTestCase() {
         if( _root.startsWith(QDir::tempPath() )) {
             system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
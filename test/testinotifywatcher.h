@@ -14,13 +14,24 @@
 
 using namespace Mirall;
 
-class TestInotifyWatcher: public FolderWatcherPrivate
+class TestInotifyWatcher: public QObject
 {
     Q_OBJECT
 
 private:
     QString _root;
 
+    // the paths of all the pathsChanged() signals so far
+    QSet<QString> changedPaths(const QSignalSpy &spy) {
+        QSet<QString> paths;
+        foreach (const QList<QVariant> &arguments, spy) {
+            foreach (const QString &path, arguments.at(0).toStringList()) {
+                paths.insert(path);
+            }
+        }
+        return paths;
+    }
+
 private slots:
     void initTestCase() {
         qsrand(QTime::currentTime().msec());
@@ -37,32 +48,77 @@ private slots:
 
     }
 
-    // Test the recursive path listing function findFoldersBelow
+    // All the directories below the root are registered with inotify
     void testDirsBelowPath() {
-        QStringList dirs;
-
-        bool ok = findFoldersBelow(QDir(_root), dirs);
-        QVERIFY( dirs.indexOf(_root + "/a1")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b1")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b1/c1")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b1/c2")>-1);
+        FolderWatcher watcher(_root);
+        watcher.setDebounceInterval(100);
+        QSignalSpy spy(&watcher, SIGNAL(pathsChanged(QStringList)));
+        QTRY_VERIFY(watcher.isReliable());
+        QCOMPARE(watcher.polledDirectoryCount(), 0);
 
-        QVERIFY(Utility::writeRandomFile(_root+"/a1/rand1.dat"));
-        QVERIFY(Utility::writeRandomFile(_root+"/a1/b1/rand2.dat"));
-        QVERIFY(Utility::writeRandomFile(_root+"/a1/b1/c1/rand3.dat"));
+        QStringList dirs;
+        dirs << "/a1" << "/a1/b1" << "/a1/b1/c1" << "/a1/b1/c2"
+             << "/a1/b2" << "/a1/b2/c1" << "/a1/b3" << "/a1/b3/c3"
+             << "/a2" << "/a2/b3" << "/a2/b3/c3";
+
+        QSet<QString> expected;
+        foreach (const QString &dir, dirs) {
+            const QString file = _root + dir + "/rand.dat";
+            QVERIFY(Utility::writeRandomFile(file));
+            expected.insert(file);
+        }
+        QTRY_VERIFY(changedPaths(spy).contains(expected));
+    }
 
-        QVERIFY( dirs.indexOf(_root + "/a1/b2")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b2/c1")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b3")>-1);
-        QVERIFY( dirs.indexOf(_root + "/a1/b3/c3")>-1);
+    // The ignore patterns apply to directories, a file is only ignored with its directory
+    void testIgnoredDirectories() {
+        QDir(_root).mkpath(_root + "/i1/build");
+        QFile list(_root + "/exclude.lst");
+        QVERIFY(list.open(QIODevice::WriteOnly));
+        list.write("build/\n");
+        list.close();
+
+        FolderWatcher watcher(_root);
+        watcher.addIgnoreListFile(_root + "/exclude.lst");
+        watcher.setDebounceInterval(100);
+        QSignalSpy spy(&watcher, SIGNAL(pathsChanged(QStringList)));
+        QTRY_VERIFY(watcher.isReliable());
+
+        QVERIFY(Utility::writeRandomFile(_root + "/i1/build/ignored.o"));
+        QVERIFY(QDir(_root).mkdir("a2/build"));
+        QVERIFY(QDir(_root).mkdir("a2/built"));
+        QVERIFY(Utility::writeRandomFile(_root + "/i1/.hidden"));
+        QVERIFY(Utility::writeRandomFile(_root + "/a1/build"));
+
+        QSet<QString> expected;
+        expected << _root + "/a2/built" << _root + "/i1/.hidden" << _root + "/a1/build";
+        QTRY_VERIFY(changedPaths(spy).contains(expected));
+        QVERIFY(!changedPaths(spy).contains(_root + "/a2/build"));
+        QVERIFY(!changedPaths(spy).contains(_root + "/i1/build/ignored.o"));
+    }
 
-        QVERIFY( dirs.indexOf(_root + "/a2"));
-        QVERIFY( dirs.indexOf(_root + "/a2/b3"));
-        QVERIFY( dirs.indexOf(_root + "/a2/b3/c3"));
+    // More events than the inotify queue holds: the changes are lost
+    void testQueueOverflow() {
+        QFile limitFile("/proc/sys/fs/inotify/max_queued_events");
+        const int limit = limitFile.open(QIODevice::ReadOnly) ? limitFile.readAll().trimmed().toInt() : 0;
+        if (limit <= 0 || limit > 100000) {
+            qDebug() << "Not overflowing an inotify queue of" << limit << "events";
+            return;
+        }
 
-        QVERIFY2(dirs.count() == 11, "Directory count wrong.");
+        QDir(_root).mkpath(_root + "/overflow");
+        FolderWatcher watcher(_root);
+        QSignalSpy lostSpy(&watcher, SIGNAL(lostChanges()));
+        QTRY_VERIFY(watcher.isReliable());
 
-        QVERIFY2(ok, "findFoldersBelow failed.");
+        // IN_CREATE and IN_CLOSE_WRITE for each file, nothing is read meanwhile
+        for (int i = 0; i < limit / 2 + 100; ++i) {
+            QFile file(_root + "/overflow/f" + QString::number(i));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.close();
+        }
+        QVERIFY(lostSpy.isEmpty());
+        QTRY_VERIFY(lostSpy.count() > 0);
     }
 
     void cleanupTestCase() {
@@ -0,0 +1,128 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTLOGGER_H
+#define MIRALL_TESTLOGGER_H
+
+#include <QtTest>
+
+#include "logger.h"
+
+using namespace Mirall;
+
+class TestLogger : public QObject
+{
+    Q_OBJECT
+
+    QString _root;
+
+    // An empty directory for the current test function
+    QString testDir()
+    {
+        const QString dir = _root + QLatin1Char('/') + QLatin1String(QTest::currentTestFunction());
+        QDir().mkpath(dir);
+        return dir;
+    }
+
+    QByteArray readFile(const QString &fileName)
+    {
+        QFile f(fileName);
+        f.open(QIODevice::ReadOnly);
+        return f.readAll();
+    }
+
+private slots:
+    void initTestCase()
+    {
+        qsrand(QTime::currentTime().msec());
+        _root = QDir::tempPath() + "/" + "test_" + QString::number(qrand());
+    }
+
+    void cleanupTestCase()
+    {
+        if( _root.startsWith(QDir::tempPath() )) {
+            system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
+        }
+    }
+
+    void testHistoryIsBounded()
+    {
+        Logger *logger = Logger::instance();
+        logger->setHistorySize(10);
+        logger->clearHistory();
+        for (int i = 0; i < 100; ++i) {
+            Logger::mirallLog(QString::fromLatin1("line %1").arg(i));
+        }
+        logger->flush();
+
+        const QStringList history = logger->history();
+        QCOMPARE(history.size(), 10);
+        QVERIFY(history.first().endsWith(QLatin1String("line 90")));
+        QVERIFY(history.last().endsWith(QLatin1String("line 99")));
+    }
+
+    void testConcurrentWriters()
+    {
+        const QString fileName = testDir() + QLatin1String("/log");
+        Logger *logger = Logger::instance();
+        logger->setLogFile(fileName);
+
+        // more lines than the queue holds, from several threads
+        QList<QThread *> threads;
+        for (int t = 0; t < 4; ++t) {
+            QThread *thread = new LogThread(t);
+            threads.append(thread);
+            thread->start();
+        }
+        foreach (QThread *thread, threads) {
+            thread->wait();
+        }
+        logger->flush();
+        qDeleteAll(threads);
+
+        const QByteArray content = readFile(fileName);
+        for (int t = 0; t < 4; ++t) {
+            QVERIFY(content.contains("thread " + QByteArray::number(t) + " line 0\n"));
+            QVERIFY(content.contains("thread " + QByteArray::number(t) + " line 4999\n"));
+        }
+        logger->setLogFile(QString());
+    }
+
+    void testRotation()
+    {
+        const QString dir = testDir();
+        Logger *logger = Logger::instance();
+        logger->setLogDir(dir);
+        logger->enterNextLogFile();
+        Logger::mirallLog(QLatin1String("first"));
+        logger->enterNextLogFile();
+        Logger::mirallLog(QLatin1String("second"));
+        logger->flush();
+
+        QVERIFY(readFile(dir + QLatin1String("/owncloud.log.1")).contains("first"));
+        QVERIFY(readFile(dir + QLatin1String("/owncloud.log.2")).contains("second"));
+        logger->setLogDir(QString());
+        logger->setLogFile(QString());
+    }
+
+private:
+    class LogThread : public QThread
+    {
+    public:
+        explicit LogThread(int number) : _number(number) {}
+    protected:
+        void run()
+        {
+            for (int i = 0; i < 5000; ++i) {
+                Logger::mirallLog(QString::fromLatin1("thread %1 line %2").arg(_number).arg(i));
+            }
+        }
+    private:
+        int _number;
+    };
+};
+
+#endif
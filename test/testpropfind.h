@@ -0,0 +1,215 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTPROPFIND_H
+#define MIRALL_TESTPROPFIND_H
+
+#include <QtTest>
+#include <cerrno>
+
+#include "account.h"
+#include "creds/dummycredentials.h"
+#include "discoveryphase.h"
+#include "networkjobs.h"
+#include "fakehttpserver.h"
+
+using namespace Mirall;
+
+/*
+ * Answers the requests for the paths of `replies` with their status and body,
+ * the other ones with a 404 page. Keeps the last request.
+ */
+class FakeDavServer : public FakeHttpServer
+{
+public:
+    QHash<QByteArray, QPair<QByteArray, QByteArray> > replies;
+    FakeHttpRequest lastRequest;
+
+protected:
+    void handleRequest(QTcpSocket *socket, const FakeHttpRequest &request) Q_DECL_OVERRIDE
+    {
+        lastRequest = request;
+        if (!replies.contains(request.path)) {
+            reply(socket, "404 Not Found", "Content-Type: text/html\r\n", "<html>Not Found</html>");
+            return;
+        }
+        const QPair<QByteArray, QByteArray> &r = replies[request.path];
+        reply(socket, r.first, "Content-Type: application/xml; charset=utf-8\r\n", r.second);
+    }
+};
+
+static QByteArray multistatus(const QByteArray &responses)
+{
+    return "<?xml version=\"1.0\"?>\n"
+           "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n"
+           + responses +
+           "</d:multistatus>\n";
+}
+
+static QByteArray response(const QByteArray &href, const QByteArray &props,
+                           const QByteArray &missingProps = QByteArray())
+{
+    QByteArray xml = "<d:response><d:href>" + href + "</d:href>\n"
+                     "<d:propstat><d:prop>" + props + "</d:prop>"
+                     "<d:status>HTTP/1.1 200 OK</d:status></d:propstat>\n";
+    if (!missingProps.isEmpty()) {
+        xml += "<d:propstat><d:prop>" + missingProps + "</d:prop>"
+               "<d:status>HTTP/1.1 404 Not Found</d:status></d:propstat>\n";
+    }
+    return xml + "</d:response>\n";
+}
+
+class TestPropfind : public QObject
+{
+    Q_OBJECT
+
+    QVector<csync_vio_file_stat_t *> _entries;
+
+public slots:
+    // the job deletes itself once finished: the entries are taken as they come
+    void slotEntriesReceived()
+    {
+        DiscoverySingleDirectoryJob *job = qobject_cast<DiscoverySingleDirectoryJob *>(sender());
+        _entries += job->takeEntries();
+    }
+
+private slots:
+    void cleanup()
+    {
+        foreach (csync_vio_file_stat_t *fs, _entries) {
+            csync_vio_file_stat_destroy(fs);
+        }
+        _entries.clear();
+    }
+
+    void testPropfindMultistatus()
+    {
+        FakeDavServer server;
+        server.replies.insert("/remote.php/webdav/dir", qMakePair(QByteArray("207 Multi-Status"),
+            multistatus(response("/remote.php/webdav/dir/",
+                                 "<d:getetag>\"5a1b\"</d:getetag><oc:id>00000042ocabcdef</oc:id>"))));
+        QScopedPointer<Account> account(new Account);
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+
+        PropfindJob *job = new PropfindJob(account.data(), QLatin1String("dir"));
+        job->setProperties(QList<QByteArray>() << "getetag" << "http://owncloud.org/ns:id");
+        QSignalSpy resultSpy(job, SIGNAL(result(QVariantMap)));
+        QSignalSpy errorSpy(job, SIGNAL(finishedWithError()));
+        job->start();
+        QTRY_COMPARE(resultSpy.count(), 1);
+        QCOMPARE(errorSpy.count(), 0);
+
+        QCOMPARE(server.lastRequest.method, QByteArray("PROPFIND"));
+        QCOMPARE(server.lastRequest.headers.value("depth"), QByteArray("0"));
+        QVERIFY(server.lastRequest.body.contains("<d:getetag />"));
+        QVERIFY(server.lastRequest.body.contains("<id xmlns=\"http://owncloud.org/ns\" />"));
+
+        const QVariantMap values = resultSpy.first().first().toMap();
+        QCOMPARE(values.value("getetag").toString(), QString("\"5a1b\""));
+        QCOMPARE(values.value("id").toString(), QString("00000042ocabcdef"));
+    }
+
+    void testPropfindError_data()
+    {
+        QTest::addColumn<QString>("file");
+        QTest::addColumn<QByteArray>("status");
+        QTest::newRow("not found") << QString("missing") << QByteArray();
+        QTest::newRow("no multistatus") << QString("dir") << QByteArray("200 OK");
+    }
+
+    void testPropfindError()
+    {
+        QFETCH(QString, file);
+        QFETCH(QByteArray, status);
+        const QByteArray path = "/remote.php/webdav/" + file.toUtf8();
+        FakeDavServer server;
+        if (!status.isEmpty()) {
+            server.replies.insert(path, qMakePair(status, QByteArray("<html>Login</html>")));
+        }
+        QScopedPointer<Account> account(new Account);
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+
+        PropfindJob *job = new PropfindJob(account.data(), file);
+        QSignalSpy resultSpy(job, SIGNAL(result(QVariantMap)));
+        QSignalSpy errorSpy(job, SIGNAL(finishedWithError()));
+        job->start();
+        QTRY_COMPARE(errorSpy.count(), 1);
+        QCOMPARE(resultSpy.count(), 0);
+        QCOMPARE(server.lastRequest.path, path);
+    }
+
+    void testDiscoveryListing()
+    {
+        FakeDavServer server;
+        server.replies.insert("/remote.php/webdav/dir", qMakePair(QByteArray("207 Multi-Status"), multistatus(
+            response("/remote.php/webdav/dir/",
+                     "<d:resourcetype><d:collection/></d:resourcetype><d:getetag>\"e0\"</d:getetag>")
+            + response("/remote.php/webdav/dir/a%20b.txt",
+                       "<d:getlastmodified>Wed, 15 Oct 2014 10:00:00 GMT</d:getlastmodified>"
+                       "<d:getcontentlength>123</d:getcontentlength><d:resourcetype/>"
+                       "<d:getetag>\"e1\"</d:getetag><oc:id>00000043oc</oc:id>"
+                       "<oc:permissions>RDNVW</oc:permissions>",
+                       "<oc:dDU/><oc:dDC/>")
+            + response("/remote.php/webdav/dir/sub/",
+                       "<d:resourcetype><d:collection/></d:resourcetype><d:getetag>\"e2\"</d:getetag>"))));
+        QScopedPointer<Account> account(new Account);
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+
+        DiscoverySingleDirectoryJob *job = new DiscoverySingleDirectoryJob(account.data(), QLatin1String("dir"));
+        connect(job, SIGNAL(entriesReceived()), SLOT(slotEntriesReceived()));
+        QSignalSpy startedSpy(job, SIGNAL(listingStarted()));
+        QSignalSpy finishedSpy(job, SIGNAL(finishedListing(int,QString)));
+        job->start();
+        QTRY_COMPARE(finishedSpy.count(), 1);
+        QCOMPARE(finishedSpy.first().at(0).toInt(), 0);
+        QCOMPARE(startedSpy.count(), 1);
+        QCOMPARE(server.lastRequest.method, QByteArray("PROPFIND"));
+        QCOMPARE(server.lastRequest.headers.value("depth"), QByteArray("1"));
+
+        // the directory itself is not an entry
+        QCOMPARE(_entries.count(), 2);
+        csync_vio_file_stat_t *file = _entries.at(0);
+        QCOMPARE(QString::fromUtf8(file->name), QString("a b.txt"));
+        QCOMPARE(file->type, CSYNC_VIO_FILE_TYPE_REGULAR);
+        QCOMPARE(qint64(file->size), qint64(123));
+        QCOMPARE(qint64(file->mtime), qint64(1413367200));
+        QCOMPARE(QByteArray(file->etag), QByteArray("e1"));
+        QCOMPARE(QByteArray(file->file_id), QByteArray("00000043oc"));
+        QCOMPARE(QByteArray(file->remotePerm), QByteArray("RDNVW"));
+        // in the 404 propstat: not known
+        QVERIFY(!(file->fields & CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL));
+
+        csync_vio_file_stat_t *dir = _entries.at(1);
+        QCOMPARE(QString::fromUtf8(dir->name), QString("sub"));
+        QCOMPARE(dir->type, CSYNC_VIO_FILE_TYPE_DIRECTORY);
+        QCOMPARE(QByteArray(dir->etag), QByteArray("e2"));
+    }
+
+    void testDiscoveryError()
+    {
+        FakeDavServer server;
+        QScopedPointer<Account> account(new Account);
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+
+        DiscoverySingleDirectoryJob *job = new DiscoverySingleDirectoryJob(account.data(), QLatin1String("missing"));
+        connect(job, SIGNAL(entriesReceived()), SLOT(slotEntriesReceived()));
+        QSignalSpy startedSpy(job, SIGNAL(listingStarted()));
+        QSignalSpy finishedSpy(job, SIGNAL(finishedListing(int,QString)));
+        job->start();
+        QTRY_COMPARE(finishedSpy.count(), 1);
+        QCOMPARE(finishedSpy.first().at(0).toInt(), ENOENT);
+        QVERIFY(!finishedSpy.first().at(1).toString().isEmpty());
+        // the error page is not parsed
+        QCOMPARE(startedSpy.count(), 0);
+        QVERIFY(_entries.isEmpty());
+    }
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTREMOTECHANGENOTIFIER_H
+#define MIRALL_TESTREMOTECHANGENOTIFIER_H
+
+#include <QtTest>
+
+#include "account.h"
+#include "creds/dummycredentials.h"
+#include "fakehttpserver.h"
+#include "remotechangenotifier.h"
+
+using namespace Mirall;
+
+/*
+ * Local stand-in for the long poll endpoint: GET <path>?etag=X is answered with the
+ * current etag right away if X differs from it, otherwise as soon as setEtag() changes it.
+ */
+class FakeLongPollServer : public FakeHttpServer
+{
+public:
+    QByteArray etag;
+    bool unsupported; // answer 404
+    int failures;     // number of requests to answer with 500
+
+    FakeLongPollServer() : etag("1"), unsupported(false), failures(0) {}
+
+    void setEtag(const QByteArray &newEtag)
+    {
+        etag = newEtag;
+        foreach (QTcpSocket *socket, _waiting) {
+            reply(socket, "200 OK", "Content-Type: text/plain\r\n", etag);
+        }
+        _waiting.clear();
+    }
+
+protected:
+    void handleRequest(QTcpSocket *socket, const FakeHttpRequest &request) Q_DECL_OVERRIDE
+    {
+        QRegExp etagParam(QLatin1String("[?&]etag=([^&]*)"));
+        if (unsupported || etagParam.indexIn(QString::fromLatin1(request.path)) < 0) {
+            reply(socket, "404 Not Found", QByteArray());
+        } else if (failures > 0) {
+            --failures;
+            reply(socket, "500 Internal Server Error", QByteArray());
+        } else if (etagParam.cap(1).toLatin1() != etag) {
+            reply(socket, "200 OK", "Content-Type: text/plain\r\n", etag);
+        } else {
+            _waiting.append(socket);
+        }
+    }
+
+private:
+    QList<QTcpSocket *> _waiting;
+};
+
+class TestRemoteChangeNotifier : public QObject
+{
+    Q_OBJECT
+
+    Account *createAccount(const QUrl &url)
+    {
+        Account *account = new Account;
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(url);
+        return account;
+    }
+
+private slots:
+    void testNotifiesChanges()
+    {
+        FakeLongPollServer server;
+        QScopedPointer<Account> account(createAccount(server.url()));
+        RemoteChangeNotifier notifier;
+        notifier.setPath(QLatin1String("longpoll"));
+        QSignalSpy changedSpy(&notifier, SIGNAL(remoteChanged()));
+
+        notifier.start(account.data());
+        QTRY_VERIFY(notifier.isActive());
+        // The first answer only tells the current etag
+        QCOMPARE(changedSpy.count(), 0);
+
+        server.setEtag("2");
+        QTRY_COMPARE(changedSpy.count(), 1);
+        server.setEtag("3");
+        QTRY_COMPARE(changedSpy.count(), 2);
+
+        // One request per change, nothing in between
+        QTest::qWait(200);
+        QCOMPARE(server.requestCount, 4);
+        QCOMPARE(changedSpy.count(), 2);
+
+        notifier.stop();
+        QVERIFY(!notifier.isActive());
+    }
+
+    void testFallsBackWhenUnsupported()
+    {
+        FakeLongPollServer server;
+        server.unsupported = true;
+        QScopedPointer<Account> account(createAccount(server.url()));
+        RemoteChangeNotifier notifier;
+        notifier.setPath(QLatin1String("longpoll"));
+        notifier.setRetryInterval(50);
+
+        notifier.start(account.data());
+        QTRY_COMPARE(server.requestCount, 1);
+        QVERIFY(!notifier.isActive());
+        // Not asked again any time soon
+        QTest::qWait(300);
+        QCOMPARE(server.requestCount, 1);
+    }
+
+    void testRetriesAfterFailure()
+    {
+        FakeLongPollServer server;
+        server.failures = 2;
+        QScopedPointer<Account> account(createAccount(server.url()));
+        RemoteChangeNotifier notifier;
+        notifier.setPath(QLatin1String("longpoll"));
+        notifier.setRetryInterval(50);
+        QSignalSpy activeSpy(&notifier, SIGNAL(activeChanged(bool)));
+
+        notifier.start(account.data());
+        // two failures, the current etag, then the one that waits
+        QTRY_COMPARE(server.requestCount, 4);
+        QVERIFY(notifier.isActive());
+        QCOMPARE(activeSpy.count(), 1);
+    }
+};
+
+#endif
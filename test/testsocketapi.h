@@ -0,0 +1,133 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSOCKETAPI_H
+#define MIRALL_TESTSOCKETAPI_H
+
+#include <QtTest>
+#include <QLocalSocket>
+
+#include "socketapiserver.h"
+
+using namespace Mirall;
+
+// Answers with the statuses of the table, NOP for the other paths
+class FakeSocketApi : public SocketApiServer
+{
+public:
+    FakeSocketApi() : SocketApiServer(0) {}
+
+    QHash<QString, QString> statuses;
+
+    void changeStatus(const QString &folderPath, const QString &path, const QString &status) {
+        queueStatusChange(folderPath, path, status);
+    }
+
+protected:
+    QString fileStatus(const QString &path) Q_DECL_OVERRIDE {
+        return statuses.value(path, QLatin1String("NOP"));
+    }
+};
+
+class TestSocketApi : public QObject
+{
+    Q_OBJECT
+
+    QString _root;
+    QString _socketPath;
+    QStringList _lines;
+
+    // the lines received so far
+    QStringList receivedLines(QLocalSocket &client) {
+        while (client.canReadLine()) {
+            QByteArray line = client.readLine();
+            line.chop(1);
+            _lines.append(QString::fromUtf8(line));
+        }
+        return _lines;
+    }
+
+    // once the server answered, it knows the client and pushes to it
+    void connectClient(QLocalSocket &client) {
+        client.connectToServer(_socketPath);
+        QVERIFY(client.waitForConnected(1000));
+        client.write("VERSION:\n");
+        QTRY_COMPARE(receivedLines(client).count(), 1);
+        QVERIFY(_lines.first().startsWith("VERSION:"));
+        _lines.clear();
+    }
+
+private slots:
+    void initTestCase() {
+        qsrand(QTime::currentTime().msec());
+        _root = QDir::tempPath() + "/" + "test_" + QString::number(qrand());
+        _socketPath = _root + "/socket";
+    }
+
+    void init() {
+        _lines.clear();
+    }
+
+    void testStatusBatch() {
+        FakeSocketApi server;
+        server.statuses.insert("/f/a", "OK");
+        server.statuses.insert("/f/b", "SYNC");
+        server.listen(0, _socketPath);
+        QLocalSocket client;
+        connectClient(client);
+
+        // the paths are separated by 0x1f, one line each comes back in the same order
+        client.write("RETRIEVE_STATUS_BATCH:/f/b\x1f/f/x\x1f/f/a\n");
+        QTRY_COMPARE(receivedLines(client).count(), 3);
+        QCOMPARE(_lines, QStringList() << "STATUS:SYNC:/f/b" << "STATUS:NOP:/f/x" << "STATUS:OK:/f/a");
+
+        // an empty batch gets no answer
+        client.write("RETRIEVE_STATUS_BATCH:\n");
+        client.write("RETRIEVE_FILE_STATUS:/f/a\n");
+        QTRY_COMPARE(receivedLines(client).count(), 4);
+        QCOMPARE(_lines.last(), QString("STATUS:OK:/f/a"));
+    }
+
+    void testCoalescedPush() {
+        FakeSocketApi server;
+        server.listen(0, _socketPath);
+        QLocalSocket client;
+        connectClient(client);
+
+        // only the latest status of a path is pushed, all of them at once
+        server.changeStatus("/f", "/f/a", "SYNC");
+        server.changeStatus("/f", "/f/b", "SYNC");
+        server.changeStatus("/f", "/f/a", "OK");
+        QVERIFY(receivedLines(client).isEmpty());
+        QTRY_COMPARE(receivedLines(client).count(), 2);
+        QStringList lines = _lines;
+        qSort(lines);
+        QCOMPARE(lines, QStringList() << "STATUS:OK:/f/a" << "STATUS:SYNC:/f/b");
+        QTest::qWait(500);
+        QCOMPARE(receivedLines(client).count(), 2);
+
+        // a folder with too many changes gets one UPDATE_VIEW instead
+        _lines.clear();
+        for (int i = 0; i < 1000; ++i) {
+            server.changeStatus("/g", "/g/" + QString::number(i), "SYNC");
+        }
+        server.changeStatus("/f", "/f/c", "OK");
+        QTRY_COMPARE(receivedLines(client).count(), 2);
+        lines = _lines;
+        qSort(lines);
+        QCOMPARE(lines, QStringList() << "STATUS:OK:/f/c" << "UPDATE_VIEW:/g");
+        QTest::qWait(500);
+        QCOMPARE(receivedLines(client).count(), 2);
+    }
+
+    void cleanupTestCase() {
+        if( _root.startsWith(QDir::tempPath() )) {
+           system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSYNCMETRICS_H
+#define MIRALL_TESTSYNCMETRICS_H
+
+#include <QtTest>
+#include <QLocalSocket>
+
+#include "account.h"
+#include "creds/dummycredentials.h"
+#include "propagator_qnam.h"
+#include "syncmetrics.h"
+#include "fakehttpserver.h"
+
+using namespace Mirall;
+
+/*
+ * Serves `content` to every GET, with an ETag
+ */
+class FakeFileServer : public FakeHttpServer
+{
+public:
+    QByteArray content;
+
+protected:
+    void handleRequest(QTcpSocket *socket, const FakeHttpRequest &) Q_DECL_OVERRIDE
+    {
+        reply(socket, "200 OK", "Content-Type: application/octet-stream\r\nETag: \"1\"\r\n", content);
+    }
+};
+
+class TestSyncMetrics : public QObject
+{
+    Q_OBJECT
+
+    QString _root;
+
+private slots:
+    void initTestCase()
+    {
+        qsrand(QTime::currentTime().msec());
+        _root = QDir::tempPath() + "/" + "test_" + QString::number(qrand());
+        QVERIFY(QDir().mkpath(_root));
+    }
+
+    void cleanupTestCase()
+    {
+        if( _root.startsWith(QDir::tempPath() )) {
+            system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
+        }
+    }
+
+    void init()
+    {
+        SyncMetrics::reset();
+    }
+
+    void testCountersAndGauges()
+    {
+        SyncMetrics::increment("owncloud_sync_runs_total");
+        SyncMetrics::increment("owncloud_sync_runs_total", 2);
+        QCOMPARE(SyncMetrics::value("owncloud_sync_runs_total"), qint64(3));
+
+        SyncMetrics::increment("owncloud_network_bytes_total", 100, "direction=\"sent\"");
+        SyncMetrics::increment("owncloud_network_bytes_total", 5, "direction=\"received\"");
+        QCOMPARE(SyncMetrics::value("owncloud_network_bytes_total", "direction=\"sent\""), qint64(100));
+
+        SyncMetrics::addToGauge("owncloud_network_requests_in_flight", 2);
+        SyncMetrics::addToGauge("owncloud_network_requests_in_flight", -1);
+        QCOMPARE(SyncMetrics::value("owncloud_network_requests_in_flight"), qint64(1));
+        SyncMetrics::setGauge("owncloud_network_requests_in_flight", 7);
+        QCOMPARE(SyncMetrics::value("owncloud_network_requests_in_flight"), qint64(7));
+    }
+
+    void testHistogramPrecision()
+    {
+        // 1ms to 1000s: every quantile is known within 1/8
+        for (qint64 usec = 1000; usec <= 1000000000; usec *= 10) {
+            for (int i = 0; i < 100; ++i) {
+                SyncMetrics::observe("owncloud_journal_commit_duration_seconds", usec);
+            }
+        }
+        QCOMPARE(SyncMetrics::count("owncloud_journal_commit_duration_seconds"), qint64(700));
+        const qint64 expected[] = { 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+        for (int i = 0; i < 7; ++i) {
+            const qint64 q = SyncMetrics::quantile("owncloud_journal_commit_duration_seconds", (i + 0.5) / 7);
+            QVERIFY2(q > expected[i] && q <= expected[i] + expected[i] / 8, QByteArray::number(q));
+        }
+    }
+
+    // GETFileJob has its own slotMetaDataChanged(): the request must still be measured
+    void testGetFileJob()
+    {
+        FakeFileServer server;
+        server.content = QByteArray(10000, 'x');
+        QScopedPointer<Account> account(new Account);
+        account->setCredentials(new DummyCredentials);
+        account->setUrl(server.url());
+
+        QFile file(_root + QLatin1String("/download"));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        GETFileJob *job = new GETFileJob(account.data(), QLatin1String("file"), &file,
+                                         QMap<QByteArray, QByteArray>(), QByteArray(), 0);
+        QSignalSpy finishedSpy(job, SIGNAL(finishedSignal()));
+        job->start();
+        QTRY_COMPARE(finishedSpy.count(), 1); // the job deletes itself
+        file.close();
+
+        QCOMPARE(SyncMetrics::count("owncloud_network_first_byte_seconds", "verb=\"GET\""), qint64(1));
+        QCOMPARE(SyncMetrics::count("owncloud_network_request_duration_seconds", "verb=\"GET\""), qint64(1));
+        QCOMPARE(SyncMetrics::value("owncloud_network_requests_total", "verb=\"GET\",code=\"200\""), qint64(1));
+        QCOMPARE(SyncMetrics::value("owncloud_network_bytes_total", "direction=\"received\""), qint64(10000));
+        QCOMPARE(SyncMetrics::value("owncloud_network_requests_in_flight"), qint64(0));
+        QCOMPARE(QFileInfo(file.fileName()).size(), qint64(10000));
+    }
+
+    void testPrometheusText()
+    {
+        SyncMetrics::increment("owncloud_network_requests_total", 1, "verb=\"GET\",code=\"200\"");
+        SyncMetrics::observe("owncloud_network_request_duration_seconds", 1500, "verb=\"GET\"");
+        SyncMetrics::observe("owncloud_network_request_duration_seconds", 500000, "verb=\"GET\"");
+
+        const QByteArray text = SyncMetrics::prometheusText();
+        QVERIFY(text.contains("# TYPE owncloud_network_requests_total counter\n"));
+        QVERIFY(text.contains("owncloud_network_requests_total{verb=\"GET\",code=\"200\"} 1\n"));
+        QVERIFY(text.contains("# TYPE owncloud_network_request_duration_seconds histogram\n"));
+        // 1.5ms is above 1.024ms, below 2.048ms
+        QVERIFY(text.contains("owncloud_network_request_duration_seconds_bucket{verb=\"GET\",le=\"0.001024\"} 0\n"));
+        QVERIFY(text.contains("owncloud_network_request_duration_seconds_bucket{verb=\"GET\",le=\"0.002048\"} 1\n"));
+        QVERIFY(text.contains("owncloud_network_request_duration_seconds_bucket{verb=\"GET\",le=\"+Inf\"} 2\n"));
+        QVERIFY(text.contains("owncloud_network_request_duration_seconds_sum{verb=\"GET\"} 0.5015\n"));
+        QVERIFY(text.contains("owncloud_network_request_duration_seconds_count{verb=\"GET\"} 2\n"));
+        // nothing recorded
+        QVERIFY(!text.contains("owncloud_sync_runs_total"));
+    }
+
+    void testExportToFile()
+    {
+        const QString fileName = _root + QLatin1String("/owncloud.prom");
+        SyncMetrics::increment("owncloud_sync_runs_total");
+        {
+            MetricsExporter exporter;
+            exporter.setFile(fileName);
+            QFile f(fileName);
+            QVERIFY(f.open(QIODevice::ReadOnly));
+            QVERIFY(f.readAll().contains("owncloud_sync_runs_total 1\n"));
+            SyncMetrics::increment("owncloud_sync_runs_total");
+        }
+        // written again when the exporter goes away
+        QFile f(fileName);
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        QVERIFY(f.readAll().contains("owncloud_sync_runs_total 2\n"));
+        QVERIFY(!QFile::exists(fileName + QLatin1String(".tmp")));
+    }
+
+    void testExportOnSocket()
+    {
+        const QString socketName = _root + QLatin1String("/metrics");
+        SyncMetrics::increment("owncloud_sync_errors_total");
+        MetricsExporter exporter;
+        QVERIFY(exporter.listen(socketName));
+
+        QLocalSocket socket;
+        socket.connectToServer(socketName);
+        QVERIFY(socket.waitForConnected(1000));
+        socket.write("GET /metrics HTTP/1.0\r\n\r\n");
+        QByteArray reply;
+        for (int i = 0; i < 100 && socket.state() == QLocalSocket::ConnectedState; ++i) {
+            QTest::qWait(10);
+            reply += socket.readAll();
+        }
+        reply += socket.readAll();
+        QVERIFY(reply.startsWith("HTTP/1.0 200 OK\r\n"));
+        QVERIFY(reply.endsWith("owncloud_sync_errors_total 1\n"));
+    }
+};
+
+#endif
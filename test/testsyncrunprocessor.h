@@ -0,0 +1,130 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSYNCRUNPROCESSOR_H
+#define MIRALL_TESTSYNCRUNPROCESSOR_H
+
+#include <QtTest>
+
+#include "syncrunprocessor.h"
+
+using namespace Mirall;
+
+class TestSyncRunProcessor : public QObject
+{
+    Q_OBJECT
+
+    QString _root;
+
+    // An empty directory for the current test function, with a trailing slash
+    QString testDir()
+    {
+        const QString dir = _root + QLatin1Char('/') + QLatin1String(QTest::currentTestFunction()) + QLatin1Char('/');
+        QDir().mkpath(dir);
+        return dir;
+    }
+
+    SyncFileItem item(const QString &file, csync_instructions_e instruction, SyncFileItem::Direction direction,
+                      SyncFileItem::Status status = SyncFileItem::Success)
+    {
+        SyncFileItem item;
+        item._file = file;
+        item._instruction = instruction;
+        item._direction = direction;
+        item._status = status;
+        return item;
+    }
+
+    QByteArray readLog(const QString &dir)
+    {
+        QFile f(dir + QLatin1String(".owncloudsync.log"));
+        f.open(QIODevice::ReadOnly);
+        return f.readAll();
+    }
+
+private slots:
+    void initTestCase()
+    {
+        qsrand(QTime::currentTime().msec());
+        _root = QDir::tempPath() + "/" + "test_" + QString::number(qrand());
+    }
+
+    void cleanupTestCase()
+    {
+        if( _root.startsWith(QDir::tempPath() )) {
+            system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
+        }
+    }
+
+    void testSummaryAndLog()
+    {
+        const QString dir = testDir();
+        SyncRunProcessor processor(dir);
+        QSignalSpy spy(&processor, SIGNAL(finished()));
+
+        processor.addItem(item("new1", CSYNC_INSTRUCTION_NEW, SyncFileItem::Down));
+        processor.addItem(item("new2", CSYNC_INSTRUCTION_NEW, SyncFileItem::Down));
+        processor.addItem(item("up", CSYNC_INSTRUCTION_NEW, SyncFileItem::Up));
+        processor.addItem(item("gone", CSYNC_INSTRUCTION_REMOVE, SyncFileItem::Down));
+        processor.addItem(item("changed", CSYNC_INSTRUCTION_SYNC, SyncFileItem::Down));
+        processor.addItem(item("ignored", CSYNC_INSTRUCTION_IGNORE, SyncFileItem::None, SyncFileItem::FileIgnored));
+        for (int i = 0; i < SyncRunProcessor::maxSummaryErrors + 5; ++i) {
+            processor.addItem(item(QString::fromLatin1("broken%1").arg(i), CSYNC_INSTRUCTION_NEW,
+                                   SyncFileItem::Down, SyncFileItem::NormalError));
+        }
+        // streamed: the items are in the log before the end of the sync
+        for (int i = 0; i < 100 && !readLog(dir).contains("broken54"); ++i) {
+            QTest::qWait(10);
+        }
+        QVERIFY(readLog(dir).contains("|new1|"));
+        QVERIFY(!readLog(dir).contains("Syncrun finished"));
+
+        processor.finish();
+        QVERIFY(spy.isEmpty());
+        for (int i = 0; i < 100 && spy.isEmpty(); ++i) {
+            QTest::qWait(10);
+        }
+        QCOMPARE(spy.count(), 1);
+
+        const SyncRunSummary summary = processor.summary();
+        QCOMPARE(summary.newItems, 2);
+        QCOMPARE(summary.firstItemNew._file, QString("new1"));
+        QCOMPARE(summary.removedItems, 1);
+        QCOMPARE(summary.updatedItems, 1);
+        QCOMPARE(summary.renamedItems, 0);
+        QCOMPARE(summary.ignoredItems, 1);
+        QCOMPARE(summary.errorCount, SyncRunProcessor::maxSummaryErrors + 5);
+        QCOMPARE(summary.errors.size(), SyncRunProcessor::maxSummaryErrors);
+        QCOMPARE(summary.errors.first().first, QString("broken0"));
+
+        const QByteArray log = readLog(dir);
+        QVERIFY(log.contains("#=#=#=# Syncrun started "));
+        QVERIFY(log.trimmed().endsWith("msec)"));
+        // the items with no direction are not logged
+        QVERIFY(!log.contains("|ignored|"));
+        QVERIFY(log.indexOf("|new1|") < log.indexOf("|broken0|"));
+    }
+
+    void testDestroyedWhileRunning()
+    {
+        const QString dir = testDir();
+        {
+            SyncRunProcessor processor(dir);
+            for (int i = 0; i < 1000; ++i) {
+                processor.addItem(item(QString::fromLatin1("file%1").arg(i), CSYNC_INSTRUCTION_NEW, SyncFileItem::Up));
+            }
+        }
+        // the destructor does not wait, the worker closes the log on its own
+        for (int i = 0; i < 100 && !readLog(dir).trimmed().endsWith("msec)"); ++i) {
+            QTest::qWait(10);
+        }
+        const QByteArray log = readLog(dir);
+        QVERIFY(log.contains("|file999|"));
+        QVERIFY(log.trimmed().endsWith("msec)"));
+    }
+};
+
+#endif
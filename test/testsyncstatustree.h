@@ -0,0 +1,79 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSYNCSTATUSTREE_H
+#define MIRALL_TESTSYNCSTATUSTREE_H
+
+#include <QtTest>
+
+#include "syncstatustree.h"
+
+using namespace Mirall;
+
+class TestSyncStatusTree : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testAggregation()
+    {
+        SyncStatusTree tree;
+        QCOMPARE(tree.status(QLatin1String("")), SyncFileStatus::STATUS_NONE);
+
+        tree.setStatus(QLatin1String("a/b/c.txt"), SyncFileStatus::STATUS_EVAL);
+        tree.setStatus(QLatin1String("a/d.txt"), SyncFileStatus::STATUS_NEW);
+        QCOMPARE(tree.count(), 2);
+        QCOMPARE(tree.status(QLatin1String("a/b/c.txt")), SyncFileStatus::STATUS_EVAL);
+        QCOMPARE(tree.status(QLatin1String("a/d.txt")), SyncFileStatus::STATUS_NEW);
+        QCOMPARE(tree.status(QLatin1String("a/b")), SyncFileStatus::STATUS_EVAL);
+        QCOMPARE(tree.status(QLatin1String("a/")), SyncFileStatus::STATUS_EVAL);
+        QCOMPARE(tree.status(QLatin1String("/")), SyncFileStatus::STATUS_EVAL);
+        QCOMPARE(tree.status(QLatin1String("a/e")), SyncFileStatus::STATUS_NONE);
+
+        // An error wins over the pending entries
+        tree.setStatus(QLatin1String("a/b/f.txt"), SyncFileStatus::STATUS_STAT_ERROR);
+        QCOMPARE(tree.status(QLatin1String("a/b/f.txt")), SyncFileStatus::STATUS_ERROR);
+        QCOMPARE(tree.status(QLatin1String("a/b")), SyncFileStatus::STATUS_ERROR);
+        QCOMPARE(tree.status(QLatin1String("a")), SyncFileStatus::STATUS_ERROR);
+
+        // The same entry changing its status is counted once
+        tree.setStatus(QLatin1String("a/b/f.txt"), SyncFileStatus::STATUS_EVAL);
+        QCOMPARE(tree.count(), 3);
+        QCOMPARE(tree.status(QLatin1String("a")), SyncFileStatus::STATUS_EVAL);
+
+        tree.setStatus(QLatin1String("a/b/c.txt"), SyncFileStatus::STATUS_SYNC);
+        tree.setStatus(QLatin1String("a/b/f.txt"), SyncFileStatus::STATUS_SYNC);
+        QCOMPARE(tree.status(QLatin1String("a/b")), SyncFileStatus::STATUS_NONE);
+        QCOMPARE(tree.status(QLatin1String("a")), SyncFileStatus::STATUS_EVAL);
+
+        tree.setStatus(QLatin1String("a/d.txt"), SyncFileStatus::STATUS_SYNC);
+        QCOMPARE(tree.count(), 0);
+        QCOMPARE(tree.status(QLatin1String("a")), SyncFileStatus::STATUS_NONE);
+    }
+
+    void testDirectoryWithOwnStatus()
+    {
+        SyncStatusTree tree;
+        tree.setStatus(QLatin1String("dir"), SyncFileStatus::STATUS_NEW);
+        tree.setStatus(QLatin1String("dir/file"), SyncFileStatus::STATUS_NEW);
+        QCOMPARE(tree.status(QLatin1String("dir")), SyncFileStatus::STATUS_NEW);
+
+        // Removing the directory entry keeps the entries below it
+        tree.setStatus(QLatin1String("dir"), SyncFileStatus::STATUS_SYNC);
+        QCOMPARE(tree.status(QLatin1String("dir")), SyncFileStatus::STATUS_EVAL);
+        QCOMPARE(tree.status(QLatin1String("dir/file")), SyncFileStatus::STATUS_NEW);
+
+        // Removing an entry that is not there changes nothing
+        tree.setStatus(QLatin1String("other/file"), SyncFileStatus::STATUS_SYNC);
+        QCOMPARE(tree.count(), 1);
+
+        tree.clear();
+        QCOMPARE(tree.count(), 0);
+        QCOMPARE(tree.status(QLatin1String("dir/file")), SyncFileStatus::STATUS_NONE);
+    }
+};
+
+#endif
@@ -0,0 +1,117 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSYNCTRACE_H
+#define MIRALL_TESTSYNCTRACE_H
+
+#include <QtTest>
+
+#include "synctrace.h"
+
+using namespace Mirall;
+
+class TestSyncTrace : public QObject
+{
+    Q_OBJECT
+
+    QString _root;
+
+    QByteArray readFile(const QString &fileName)
+    {
+        QFile f(fileName);
+        f.open(QIODevice::ReadOnly);
+        return f.readAll();
+    }
+
+private slots:
+    void initTestCase()
+    {
+        qsrand(QTime::currentTime().msec());
+        _root = QDir::tempPath() + "/" + "test_" + QString::number(qrand());
+        QVERIFY(QDir().mkpath(_root));
+
+        // read once, before the first trace
+        qputenv("OWNCLOUD_SYNC_TRACE_DIR", _root.toLocal8Bit());
+        QCOMPARE(SyncTrace::directory(), _root);
+    }
+
+    void cleanupTestCase()
+    {
+        if( _root.startsWith(QDir::tempPath() )) {
+            system( QString("rm -rf %1").arg(_root).toLocal8Bit() );
+        }
+    }
+
+    void testNothingRecordedOutsideOfARun()
+    {
+        QVERIFY(!SyncTrace::isActive());
+        SyncTrace::asyncBegin("network", QLatin1String("GET a"), this);
+        QVERIFY(!SyncTrace::isActive());
+    }
+
+    void testRunIsWritten()
+    {
+        int a, b;
+        SyncTrace::startRun(&a, QLatin1String("folder a"));
+        SyncTrace::startRun(&b, QLatin1String("folder b"));
+        QVERIFY(SyncTrace::isActive());
+        {
+            SyncTraceScope scope("discovery", QLatin1String("dir \"quoted\""));
+            scope.addArg("entries", 12);
+        }
+        SyncTrace::asyncBegin("network", QLatin1String("PROPFIND /"), this);
+        SyncTrace::asyncStep("network", QLatin1String("first byte"), this);
+        SyncTrace::asyncEnd("network", QLatin1String("PROPFIND /"), this,
+                            SyncTrace::Args() << qMakePair(QByteArray("bytes_received"), QVariant(qint64(1234))));
+
+        // Complete when the last of the runs finished, and the writer caught up
+        const QString previous = SyncTrace::lastTraceFile();
+        SyncTrace::finishRun(&a);
+        QTest::qWait(100);
+        QCOMPARE(SyncTrace::lastTraceFile(), previous);
+        SyncTrace::finishRun(&b);
+        QVERIFY(!SyncTrace::isActive());
+        QTRY_VERIFY(SyncTrace::lastTraceFile() != previous);
+
+        const QString fileName = SyncTrace::lastTraceFile();
+        QVERIFY(fileName.startsWith(_root));
+        const QByteArray trace = readFile(fileName);
+        QVERIFY(trace.startsWith("{\"traceEvents\":["));
+        QVERIFY(trace.trimmed().endsWith("}}"));
+        QVERIFY(trace.contains("\"name\":\"folder a\",\"cat\":\"sync\",\"ph\":\"b\""));
+        QVERIFY(trace.contains("\"name\":\"dir \\\"quoted\\\"\",\"cat\":\"discovery\",\"ph\":\"X\""));
+        QVERIFY(trace.contains("\"args\":{\"entries\":12}"));
+        QVERIFY(trace.contains("\"ph\":\"n\""));
+        QVERIFY(trace.contains("\"bytes_received\":1234"));
+        QVERIFY(trace.contains("\"thread_name\""));
+        QVERIFY(!trace.contains("GET a"));
+    }
+
+    void testEventsAreStreamed()
+    {
+        int a;
+        const QString previous = SyncTrace::lastTraceFile();
+        SyncTrace::startRun(&a, QLatin1String("folder a"));
+        // several chunks of events
+        for (int i = 0; i < 10000; ++i) {
+            SyncTrace::asyncBegin("network", QString::fromLatin1("GET file%1").arg(i), this);
+        }
+        SyncTrace::finishRun(&a);
+        QTRY_VERIFY(SyncTrace::lastTraceFile() != previous);
+
+        const QByteArray trace = readFile(SyncTrace::lastTraceFile());
+        QVERIFY(trace.startsWith("{\"traceEvents\":["));
+        QVERIFY(trace.trimmed().endsWith("\"droppedEvents\":0}}"));
+        QVERIFY(trace.contains("\"GET file0\""));
+        QVERIFY(trace.indexOf("\"GET file5000\"") < trace.indexOf("\"GET file9999\""));
+        QCOMPARE(trace.count("\"ph\":\"b\""), 10001);
+        // no event is lost between two chunks
+        QVERIFY(!trace.contains(",\n,"));
+        QVERIFY(!trace.contains("}{"));
+    }
+};
+
+#endif